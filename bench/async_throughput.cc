@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../test_utils/test_utils.h"
+#include "bench_utils.h"
+
+// Compares the sync and the async (completion queue) shardkv server under
+// many concurrent clients. The server under test owns IDs [0, 500]. The rest
+// belong to a peer that takes PEER_DELAY_MS to answer an Append, like a slow
+// or overloaded server would. CLIENTS threads each send requests back to
+// back: 90% Gets of users on the server, and 10% Puts of posts whose user is
+// on the peer, so the Put has to forward an Append there. We report
+// throughput, Get and Put latency, and how many threads the server needed.
+// The async server runs with POLLERS threads on one completion queue. The
+// sync server runs twice: with as many threads as grpc gives it, and with
+// grpc's thread pool capped at POLLERS threads (grpc then fails the calls it
+// has no thread for).
+//
+// usage: ./async_throughput [CLIENTS] [PEER_DELAY_MS] [POLLERS] [SECONDS]
+
+using Clock = std::chrono::steady_clock;
+using Empty = google::protobuf::Empty;
+
+// stands in for the server that owns the posts' users
+class SlowPeer : public Shardkv::Service {
+ public:
+  explicit SlowPeer(int delay_ms) : delay(delay_ms) {}
+
+  ::grpc::Status Append(::grpc::ServerContext* context,
+                        const ::AppendRequest* request,
+                        Empty* response) override {
+    std::this_thread::sleep_for(delay);
+    return ::grpc::Status::OK;
+  }
+
+ private:
+  std::chrono::milliseconds delay;
+};
+
+static int thread_count() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("Threads:", 0) == 0) {
+      return atoi(line.c_str() + 8);
+    }
+  }
+  return 0;
+}
+
+// serves a sync shardkv whose thread pool grpc caps at max_threads
+static void start_capped_shardkv(const std::string& addr,
+                                 const std::string& shardmaster_addr,
+                                 int max_threads) {
+  std::thread thr([=]() {
+    ::grpc::ServerBuilder builder;
+    builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
+    ::grpc::ResourceQuota quota;
+    quota.SetMaxThreads(max_threads);
+    builder.SetResourceQuota(quota);
+    ShardkvServer shardkv(addr, shardmaster_addr);
+    builder.RegisterService(&shardkv);
+    builder.BuildAndStart()->Wait();
+  });
+  thr.detach();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+static double percentile(std::vector<double>& latencies, double p) {
+  if (latencies.empty()) {
+    return 0;
+  }
+  return latencies[(size_t)((latencies.size() - 1) * p)];
+}
+
+enum Mode { SYNC, SYNC_CAPPED, ASYNC };
+
+static void run(const char* name, int base_port, Mode mode, int pollers,
+                int clients, int seconds) {
+  std::string shardmaster_addr = "127.0.0.1:" + std::to_string(base_port);
+  std::string server = "127.0.0.1:" + std::to_string(base_port + 1);
+  std::string peer = "127.0.0.1:" + std::to_string(base_port + 2);
+  start_shardmaster(shardmaster_addr);
+  if (mode == ASYNC) {
+    start_async_shardkv(server, shardmaster_addr, 1, pollers);
+  } else if (mode == SYNC_CAPPED) {
+    start_capped_shardkv(server, shardmaster_addr, pollers);
+  } else {
+    start_shardkv(server, shardmaster_addr);
+  }
+
+  auto shardmaster = Shardmaster::NewStub(grpc::CreateChannel(
+      shardmaster_addr, grpc::InsecureChannelCredentials()));
+  join(shardmaster.get(), server);
+  join(shardmaster.get(), peer);
+
+  KeyValues users;
+  for (unsigned int id = MIN_KEY; id <= MAX_KEY / 2; id++) {
+    users.emplace_back("user_" + std::to_string(id), "some user");
+  }
+  load(server, users);
+  // sleep to allow the server to get the config with the peer in it
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  std::atomic<bool> stop(false);
+  std::atomic<int> peak_threads(thread_count());
+  // threads of the server that aren't there when it's idle (the clients'
+  // threads are subtracted too)
+  int idle_threads = peak_threads.load();
+  std::thread sampler([&]() {
+    while (!stop.load()) {
+      int n = thread_count();
+      if (n > peak_threads.load()) {
+        peak_threads.store(n);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  });
+
+  std::vector<std::vector<double>> gets(clients), puts(clients);
+  std::atomic<int> failed(0);
+  std::vector<std::thread> threads;
+  auto channel =
+      grpc::CreateChannel(server, grpc::InsecureChannelCredentials());
+  auto start = Clock::now();
+  for (int t = 0; t < clients; t++) {
+    threads.emplace_back([&, t]() {
+      auto stub = Shardkv::NewStub(channel);
+      std::mt19937 rng(t);
+      std::uniform_int_distribution<int> local(MIN_KEY, MAX_KEY / 2);
+      std::uniform_int_distribution<int> remote(MAX_KEY / 2 + 1, MAX_KEY);
+      // each client puts its own posts, so no two clients race on one
+      unsigned int next_post = t;
+      for (int i = 0; !stop.load(); i++) {
+        ::grpc::ClientContext cc;
+        ::grpc::Status status;
+        bool is_put = i % 10 == t % 10;
+        std::string post = "post_" + std::to_string(next_post);
+        if (is_put) {
+          // only a new post is appended to its user's list, so delete it
+          // first (untimed)
+          ::grpc::ClientContext delete_cc;
+          DeleteRequest req;
+          Empty res;
+          req.set_key(post);
+          stub->Delete(&delete_cc, req, &res);
+          next_post += clients;
+          if (next_post > MAX_KEY / 2) {
+            next_post = t;
+          }
+        }
+        auto op_start = Clock::now();
+        if (is_put) {
+          PutRequest req;
+          Empty res;
+          req.set_key(post);
+          req.set_data("a post");
+          req.set_user("user_" + std::to_string(remote(rng)));
+          status = stub->Put(&cc, req, &res);
+        } else {
+          GetRequest req;
+          GetResponse res;
+          req.set_key("user_" + std::to_string(local(rng)));
+          status = stub->Get(&cc, req, &res);
+        }
+        std::chrono::duration<double, std::micro> elapsed =
+            Clock::now() - op_start;
+        if (!status.ok()) {
+          failed++;
+        } else if (is_put) {
+          puts[t].push_back(elapsed.count());
+        } else {
+          gets[t].push_back(elapsed.count());
+        }
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop.store(true);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double secs = seconds_since(start);
+  sampler.join();
+
+  std::vector<double> get_latencies, put_latencies;
+  for (int t = 0; t < clients; t++) {
+    get_latencies.insert(get_latencies.end(), gets[t].begin(), gets[t].end());
+    put_latencies.insert(put_latencies.end(), puts[t].begin(), puts[t].end());
+  }
+  std::sort(get_latencies.begin(), get_latencies.end());
+  std::sort(put_latencies.begin(), put_latencies.end());
+  printf("%-8s %10.0f %6d %10.0f %10.0f %10.0f %10.0f %8d\n", name,
+         (get_latencies.size() + put_latencies.size()) / secs, failed.load(),
+         percentile(get_latencies, 0.5), percentile(get_latencies, 0.99),
+         percentile(put_latencies, 0.5), percentile(put_latencies, 0.99),
+         peak_threads.load() - idle_threads - clients);
+}
+
+int main(int argc, char** argv) {
+  int clients = argc > 1 ? atoi(argv[1]) : 64;
+  int delay_ms = argc > 2 ? atoi(argv[2]) : 20;
+  int pollers = argc > 3 ? atoi(argv[3]) : 2;
+  int seconds = argc > 4 ? atoi(argv[4]) : 3;
+
+  // the peers run in their own processes, so their threads aren't counted.
+  // they're forked before this process starts using grpc
+  std::vector<pid_t> peers;
+  for (int base_port : {9270, 9280, 9290}) {
+    std::string peer = "127.0.0.1:" + std::to_string(base_port + 2);
+    peers.push_back(
+        spawn_service_in_proc<SlowPeer, const int&>(peer, delay_ms));
+  }
+
+  printf("%d clients, 10%% puts forwarding an append that takes %d ms, "
+         "%d s per run\n",
+         clients, delay_ms, seconds);
+  printf("%-8s %10s %6s %10s %10s %10s %10s %8s\n", "server", "ops/s",
+         "failed", "get p50", "get p99", "put p50", "put p99", "threads");
+  // each run gets its own cluster, since servers can't be stopped
+  run("sync", 9270, SYNC, pollers, clients, seconds);
+  run("sync-cap", 9280, SYNC_CAPPED, pollers, clients, seconds);
+  run("async", 9290, ASYNC, pollers, clients, seconds);
+  for (pid_t pid : peers) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include "bench_utils.h"
+
+#include <cassert>
+#include <thread>
+
+using Empty = google::protobuf::Empty;
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+KeyValues make_pairs(size_t post_bytes) {
+  KeyValues pairs;
+  std::string post(post_bytes, 'x');
+  for (unsigned int id = MIN_KEY; id <= MAX_KEY; id++) {
+    std::string user = "user_" + std::to_string(id);
+    pairs.emplace_back(user, "user " + std::to_string(id));
+    pairs.emplace_back("post_" + std::to_string(id), post);
+    pairs.emplace_back(user + "_posts", "post_" + std::to_string(id) + ",");
+  }
+  return pairs;
+}
+
+void join(Shardmaster::Stub* shardmaster, const std::string& server) {
+  ::grpc::ClientContext cc;
+  JoinRequest req;
+  Empty res;
+  req.set_server(server);
+  auto status = shardmaster->Join(&cc, req, &res);
+  assert(status.ok());
+}
+
+void load(const std::string& addr, const KeyValues& pairs) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  while (true) {
+    ::grpc::ClientContext cc;
+    auto stream = stub->TransferShard(&cc);
+    // the acknowledgements are read as they come, so the server never waits
+    // on us to take one
+    size_t acked = 0;
+    std::thread reader([&stream, &acked]() {
+      TransferResponse res;
+      while (stream->Read(&res)) {
+        acked = res.keys();
+      }
+    });
+    TransferBatch batch;
+    size_t batch_bytes = 0;
+    for (size_t i = 0; i < pairs.size(); i++) {
+      KeyValue* kv = batch.add_pairs();
+      kv->set_key(pairs[i].first);
+      kv->set_data(pairs[i].second);
+      batch_bytes += pairs[i].first.size() + pairs[i].second.size();
+      if (batch.pairs_size() == TRANSFER_BATCH_KEYS ||
+          batch_bytes >= TRANSFER_BATCH_BYTES || i + 1 == pairs.size()) {
+        if (!stream->Write(batch)) {
+          break;
+        }
+        batch.Clear();
+        batch_bytes = 0;
+      }
+    }
+    stream->WritesDone();
+    reader.join();
+    if (stream->Finish().ok() && acked == pairs.size()) {
+      return;
+    }
+    // the server doesn't have its config yet
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
+bool has_key(Shardkv::Stub* stub, const std::string& key) {
+  ::grpc::ClientContext cc;
+  GetRequest req;
+  GetResponse res;
+  req.set_key(key);
+  return stub->Get(&cc, req, &res).ok();
+}
+
+KeyValues pairs_on(Shardmaster::Stub* shardmaster, const std::string& server,
+                   const KeyValues& pairs) {
+  ::grpc::ClientContext cc;
+  QueryResponse config;
+  auto status = shardmaster->Query(&cc, Empty(), &config);
+  assert(status.ok());
+  std::vector<shard_t> shards;
+  for (auto& entry : config.config()) {
+    if (entry.server() == server) {
+      for (auto& s : entry.shards()) {
+        shards.push_back({s.lower(), s.upper()});
+      }
+    }
+  }
+  KeyValues on_server;
+  for (auto& kv : pairs) {
+    if (CheckInShard(extractID(kv.first), shards)) {
+      on_server.push_back(kv);
+    }
+  }
+  return on_server;
+}
+
+void wait_for_handoff(const std::string& addr, const KeyValues& moved) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  // keys are handed off in ID order and each batch is applied atomically, so
+  // once every key of the last ID is there the whole transfer is done
+  std::string last = std::to_string(extractID(moved.back().first));
+  while (!has_key(stub.get(), "user_" + last) ||
+         !has_key(stub.get(), "post_" + last) ||
+         !has_key(stub.get(), "user_" + last + "_posts")) {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  for (auto& kv : moved) {
+    assert(has_key(stub.get(), kv.first));
+  }
+}
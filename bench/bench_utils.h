@@ -0,0 +1,35 @@
+#ifndef SHARDING_BENCH_UTILS_H
+#define SHARDING_BENCH_UTILS_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../shardkv/shardkv.h"
+
+// helpers shared by the benchmarks that run a whole cluster in one process.
+// they use loopback addresses, so creating a channel doesn't wait on name
+// lookups
+
+double seconds_since(std::chrono::steady_clock::time_point start);
+
+// a user, a post of post_bytes bytes and a post list for every ID
+KeyValues make_pairs(size_t post_bytes);
+
+// joins server, asserting the shardmaster accepts it
+void join(Shardmaster::Stub* shardmaster, const std::string& server);
+
+// streams pairs to the shardkv at addr until it accepts all of them
+void load(const std::string& addr, const KeyValues& pairs);
+
+bool has_key(Shardkv::Stub* stub, const std::string& key);
+
+// returns the pairs whose IDs the shardmaster currently assigns to server
+KeyValues pairs_on(Shardmaster::Stub* shardmaster, const std::string& server,
+                   const KeyValues& pairs);
+
+// waits until the shardkv at addr serves every pair in moved, which must be
+// in ID order (as make_pairs returns them)
+void wait_for_handoff(const std::string& addr, const KeyValues& moved);
+
+#endif  // SHARDING_BENCH_UTILS_H
@@ -0,0 +1,148 @@
+#include <malloc.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../shardkv/kvstore.h"
+
+// Memory and lookup cost of the storage layouts the social schema's keys have
+// been kept in. NUM_USERS users each get a user_<id>, a post_<id> and a
+// user_<id>_posts key with a VALUE_BYTES value, which are loaded into
+//   - map:     one std::map, how ShardkvServer first stored keys
+//   - striped: KV_STRIPES hash-striped string-keyed hash maps, how KvStore
+//              stored keys before they were packed
+//   - packed:  KvStore
+// one at a time. For each we report the heap bytes per key (counted by the
+// global operator new below) and single-threaded random Gets per second. IDs
+// go past MAX_KEY, so KvStore keeps almost all of them in its overflow
+// stripes rather than one bucket per ID.
+//
+// usage: ./key_layout [NUM_USERS] [VALUE_BYTES] [GETS]
+
+static std::atomic<size_t> heap_bytes(0);
+
+void* operator new(size_t size) {
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  heap_bytes += malloc_usable_size(p);
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  if (p != nullptr) {
+    heap_bytes -= malloc_usable_size(p);
+    free(p);
+  }
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+class MapStore {
+ public:
+  void Put(const std::string& key, const std::string& value) {
+    map[key] = value;
+  }
+
+  bool Get(const std::string& key, std::string* value) {
+    auto it = map.find(key);
+    if (it == map.end()) {
+      return false;
+    }
+    *value = it->second;
+    return true;
+  }
+
+ private:
+  std::map<std::string, std::string> map;
+};
+
+class StripedStore {
+ public:
+  void Put(const std::string& key, const std::string& value) {
+    Stripe& s = stripes[std::hash<std::string>{}(key) & (KV_STRIPES - 1)];
+    std::unique_lock<std::shared_mutex> lock(s.mtx);
+    s.map[key] = value;
+  }
+
+  bool Get(const std::string& key, std::string* value) {
+    Stripe& s = stripes[std::hash<std::string>{}(key) & (KV_STRIPES - 1)];
+    std::shared_lock<std::shared_mutex> lock(s.mtx);
+    auto it = s.map.find(key);
+    if (it == s.map.end()) {
+      return false;
+    }
+    *value = it->second;
+    return true;
+  }
+
+ private:
+  struct alignas(64) Stripe {
+    std::shared_mutex mtx;
+    std::unordered_map<std::string, std::string> map;
+  };
+  Stripe stripes[KV_STRIPES];
+};
+
+template <typename Store>
+static void run(const char* name, const std::vector<std::string>& keys,
+                const std::string& value, const std::vector<size_t>& gets) {
+  size_t before = heap_bytes.load();
+  Store* store = new Store();
+  for (const std::string& key : keys) {
+    store->Put(key, value);
+  }
+  double bytes = (double)(heap_bytes.load() - before) / keys.size();
+
+  std::string got;
+  size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i : gets) {
+    found += store->Get(keys[i], &got);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  delete store;
+
+  if (found != gets.size()) {
+    printf("%s lost keys\n", name);
+  }
+  printf("%-10s %14.1f %14.0f\n", name, bytes, gets.size() / elapsed.count());
+}
+
+int main(int argc, char** argv) {
+  int users = argc > 1 ? atoi(argv[1]) : 1000000;
+  size_t value_bytes = argc > 2 ? atoi(argv[2]) : 8;
+  int num_gets = argc > 3 ? atoi(argv[3]) : 1000000;
+
+  std::vector<std::string> keys;
+  for (int id = 0; id < users; id++) {
+    keys.push_back("user_" + std::to_string(id));
+    keys.push_back("post_" + std::to_string(id));
+    keys.push_back("user_" + std::to_string(id) + "_posts");
+  }
+  std::string value(value_bytes, 'x');
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+  std::vector<size_t> gets(num_gets);
+  for (size_t& i : gets) {
+    i = pick(rng);
+  }
+
+  printf("%d users (%zu keys), %zu byte values\n", users, keys.size(),
+         value_bytes);
+  printf("%-10s %14s %14s\n", "layout", "bytes/key", "gets/s");
+  run<MapStore>("map", keys, value, gets);
+  run<StripedStore>("striped", keys, value, gets);
+  run<KvStore>("packed", keys, value, gets);
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../common/common.h"
+#include "../common/keys.h"
+
+// Microbenchmark of the key parsing every shardkv request does before it can
+// route the key: "what kind of key is this?" and "what's its ID?". Each key of
+// a mix of user_<id>, post_<id> and user_<id>_posts keys is parsed the way the
+// servers used to (parse_value on '_' to classify it, then extractID for the
+// ID, each splitting the key into new strings) and with ParseKey.
+//
+// usage: ./key_parse [KEYS]
+
+// returns the ns per key of parse over keys. the results are summed so the
+// calls can't be optimized away
+template <typename Parse>
+static double time(const std::vector<std::string>& keys, Parse parse) {
+  size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (const std::string& key : keys) {
+    sink += parse(key);
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (sink == (size_t)-1) {
+    printf("unreachable\n");
+  }
+  return elapsed.count() / keys.size();
+}
+
+int main(int argc, char** argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> pick(MIN_KEY, MAX_KEY);
+  std::vector<std::string> keys(n);
+  for (int i = 0; i < n; i++) {
+    std::string id = std::to_string(pick(rng));
+    switch (i % 3) {
+      case 0:
+        keys[i] = "user_" + id;
+        break;
+      case 1:
+        keys[i] = "post_" + id;
+        break;
+      default:
+        keys[i] = "user_" + id + "_posts";
+    }
+  }
+
+  double split = time(keys, [](const std::string& key) {
+    std::vector<std::string> parsed = parse_value(key, "_");
+    bool is_user = parsed.size() == 2 && parsed[0] == "user";
+    return (size_t)extractID(key) + is_user;
+  });
+  double parse_key = time(keys, [](const std::string& key) {
+    ParsedKey parsed = ParseKey(key);
+    return (size_t)parsed.id + (parsed.type == KeyType::USER);
+  });
+
+  printf("%d keys, ns per key\n", n);
+  printf("%12s %12s\n", "split", "ParseKey");
+  printf("%12.1f %12.1f\n", split, parse_key);
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../shardkv/kvstore.h"
+
+// Thread-count scaling benchmark for the shardkv storage engine. Each thread
+// runs a 90% Get / 10% Put mix over a shared key set, first against the old
+// layout (one std::map behind one mutex) and then against KvStore.
+//
+// usage: ./kvstore_scaling [NUM_KEYS] [OPS_PER_THREAD]
+
+// the storage layout ShardkvServer used before KvStore
+class MutexMap {
+ public:
+  bool Get(const std::string& key, std::string* value) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = map.find(key);
+    if (it == map.end()) {
+      return false;
+    }
+    *value = it->second;
+    return true;
+  }
+
+  bool Put(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return map.insert_or_assign(key, value).second;
+  }
+
+ private:
+  std::map<std::string, std::string> map;
+  std::mutex mtx;
+};
+
+template <typename Store>
+double run(Store& store, const std::vector<std::string>& keys, int threads,
+           int ops) {
+  std::atomic<bool> go(false);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+      std::string value;
+      while (!go.load()) {
+      }
+      for (int i = 0; i < ops; i++) {
+        const std::string& key = keys[pick(rng)];
+        if (i % 10 == 0) {
+          store.Put(key, "updated post text");
+        } else {
+          store.Get(key, &value);
+        }
+      }
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  go.store(true);
+  for (auto& w : workers) {
+    w.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return (double)threads * ops / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+  int num_keys = argc > 1 ? atoi(argv[1]) : 100000;
+  int ops = argc > 2 ? atoi(argv[2]) : 1000000;
+
+  std::vector<std::string> keys;
+  for (int i = 0; i < num_keys; i++) {
+    keys.push_back((i % 2 ? "post_" : "user_") + std::to_string(i));
+  }
+
+  MutexMap mutex_map;
+  KvStore kv_store(0, num_keys);
+  for (auto& key : keys) {
+    mutex_map.Put(key, "some post text");
+    kv_store.Put(key, "some post text");
+  }
+
+  int max_threads = std::thread::hardware_concurrency();
+  printf("%d keys, %d ops/thread, 90%% gets\n", num_keys, ops);
+  printf("%8s %18s %18s %8s\n", "threads", "map+mutex ops/s", "KvStore ops/s",
+         "speedup");
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    double base = run(mutex_map, keys, threads, ops);
+    double striped = run(kv_store, keys, threads, ops);
+    printf("%8d %18.0f %18.0f %7.2fx\n", threads, base, striped,
+           striped / base);
+  }
+  return 0;
+}
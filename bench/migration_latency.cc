@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../test_utils/test_utils.h"
+#include "bench_utils.h"
+
+// Measures Get latency on a server while a Join moves half of its keys away.
+// Reader threads issue Gets for users that stay on the old owner, each on a
+// fixed schedule (one every INTERVAL_US), and latency is counted from when a
+// Get was scheduled, so a Get that is stuck holds up the ones behind it the
+// way it would for real clients. We report latency percentiles for the Gets
+// scheduled between the Join and the moment the new owner serves every key it
+// took over. This runs once with keys handed off by the background migrator,
+// and once with keys handed off inline while shard_mutex is held (how servers
+// used to do it).
+//
+// usage: ./migration_latency [POST_BYTES] [READERS] [INTERVAL_US]
+
+using Clock = std::chrono::steady_clock;
+
+struct Sample {
+  Clock::time_point scheduled;
+  double micros;
+  bool ok;
+};
+
+static void run(const char* name, int base_port, bool background,
+                size_t post_bytes, int readers, int interval_us) {
+  std::string shardmaster_addr = "127.0.0.1:" + std::to_string(base_port);
+  std::string skv_1 = "127.0.0.1:" + std::to_string(base_port + 1);
+  std::string skv_2 = "127.0.0.1:" + std::to_string(base_port + 2);
+  start_shardmaster(shardmaster_addr);
+  for (const std::string& addr : {skv_1, skv_2}) {
+    spawn_service_in_thread<ShardkvServer, const std::string&,
+                            const std::string&, const bool&>(
+        addr, addr, shardmaster_addr, background);
+  }
+  auto shardmaster = Shardmaster::NewStub(grpc::CreateChannel(
+      shardmaster_addr, grpc::InsecureChannelCredentials()));
+
+  KeyValues pairs = make_pairs(post_bytes);
+  join(shardmaster.get(), skv_1);
+  load(skv_1, pairs);
+
+  // skv_1 keeps the lower half of the IDs when skv_2 joins
+  std::atomic<bool> stop(false);
+  std::vector<std::vector<Sample>> samples(readers);
+  std::vector<std::thread> threads;
+  auto channel = grpc::CreateChannel(skv_1, grpc::InsecureChannelCredentials());
+  for (int t = 0; t < readers; t++) {
+    threads.emplace_back([&, t]() {
+      auto stub = Shardkv::NewStub(channel);
+      std::mt19937 rng(t);
+      std::uniform_int_distribution<int> pick(MIN_KEY, MAX_KEY / 2 - 1);
+      auto scheduled = Clock::now();
+      while (!stop.load()) {
+        scheduled += std::chrono::microseconds(interval_us);
+        std::this_thread::sleep_until(scheduled);
+        ::grpc::ClientContext cc;
+        GetRequest req;
+        GetResponse res;
+        req.set_key("user_" + std::to_string(pick(rng)));
+        bool ok = stub->Get(&cc, req, &res).ok();
+        std::chrono::duration<double, std::micro> elapsed =
+            Clock::now() - scheduled;
+        samples[t].push_back({scheduled, elapsed.count(), ok});
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto join_start = Clock::now();
+  join(shardmaster.get(), skv_2);
+  wait_for_handoff(skv_2, pairs_on(shardmaster.get(), skv_2, pairs));
+  auto join_end = Clock::now();
+  stop.store(true);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<double> latencies;
+  int failed = 0;
+  for (auto& thread_samples : samples) {
+    for (auto& s : thread_samples) {
+      if (s.scheduled >= join_start && s.scheduled <= join_end) {
+        latencies.push_back(s.micros);
+        failed += !s.ok;
+      }
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    if (latencies.empty()) {
+      return 0.0;
+    }
+    return latencies[(size_t)((latencies.size() - 1) * p)];
+  };
+  std::chrono::duration<double> handoff = join_end - join_start;
+  printf("%-12s %10.3f %8zu %6d %10.0f %10.0f %10.0f\n", name,
+         handoff.count(), latencies.size(), failed, percentile(0.5),
+         percentile(0.99), percentile(1));
+}
+
+int main(int argc, char** argv) {
+  size_t post_bytes = argc > 1 ? atoi(argv[1]) : 65536;
+  int readers = argc > 2 ? atoi(argv[2]) : 4;
+  int interval_us = argc > 3 ? atoi(argv[3]) : 1000;
+
+  printf("%zu byte posts, %d readers each getting a key that stays put every "
+         "%d us\n",
+         post_bytes, readers, interval_us);
+  printf("%-12s %10s %8s %6s %10s %10s %10s\n", "handoff", "join s", "gets",
+         "failed", "p50 us", "p99 us", "max us");
+  // each run gets its own cluster, since servers can't be stopped
+  run("background", 9180, true, post_bytes, readers, interval_us);
+  run("inline", 9190, false, post_bytes, readers, interval_us);
+  return 0;
+}
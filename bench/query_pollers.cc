@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../shardmaster/shardmaster.h"
+
+// Query throughput and latency of the shardmaster with POLLERS threads
+// calling Query in process (each serializing the response, as gRPC would).
+// The config starts out fragmented by 200 Moves over 5 servers. First every
+// poller calls Query back to back for SECONDS, and we report Queries per
+// second. Then, for SECONDS more, every poller calls it every 100 ms (like a
+// shardkv does), while another thread Moves a random range every millisecond,
+// and we report the average and 99th percentile latency of both.
+//
+// usage: ./query_pollers [POLLERS] [SECONDS]
+
+using Empty = google::protobuf::Empty;
+
+static MoveRequest randomMove(std::mt19937& rng) {
+  std::uniform_int_distribution<unsigned int> lower(MIN_KEY, MAX_KEY);
+  std::uniform_int_distribution<unsigned int> length(1, 50);
+  std::uniform_int_distribution<int> server(0, 4);
+  unsigned int l = lower(rng);
+  MoveRequest req;
+  req.set_server("server_" + std::to_string(server(rng)));
+  req.mutable_shard()->set_lower(l);
+  req.mutable_shard()->set_upper(std::min(MAX_KEY, l + length(rng) - 1));
+  return req;
+}
+
+// average and 99th percentile of samples, in us
+static std::pair<double, double> summary(std::vector<double>& samples) {
+  if (samples.empty()) {
+    return {0, 0};
+  }
+  std::sort(samples.begin(), samples.end());
+  double total = 0;
+  for (double sample : samples) {
+    total += sample;
+  }
+  return {total / samples.size(), samples[samples.size() * 99 / 100]};
+}
+
+static double since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+int main(int argc, char** argv) {
+  int pollers = argc > 1 ? atoi(argv[1]) : 1000;
+  int seconds = argc > 2 ? atoi(argv[2]) : 5;
+  if (pollers < 1 || seconds < 1) {
+    fprintf(stderr, "usage: ./query_pollers [POLLERS] [SECONDS]\n");
+    return 1;
+  }
+
+  StaticShardmaster sm;
+  Empty empty;
+  for (int i = 0; i < 5; i++) {
+    JoinRequest req;
+    req.set_server("server_" + std::to_string(i));
+    sm.Join(nullptr, &req, &empty);
+  }
+  std::mt19937 rng(0);
+  for (int i = 0; i < 200; i++) {
+    MoveRequest req = randomMove(rng);
+    sm.Move(nullptr, &req, &empty);
+  }
+  QueryResponse config;
+  sm.Query(nullptr, &empty, &config);
+  printf("%d pollers, config of %zu bytes\n", pollers, config.ByteSizeLong());
+
+  // back to back
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> queries{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < pollers; i++) {
+    threads.emplace_back([&]() {
+      uint64_t mine = 0;
+      std::string bytes;
+      while (!done.load(std::memory_order_relaxed)) {
+        QueryResponse config;
+        sm.Query(nullptr, &empty, &config);
+        config.SerializeToString(&bytes);
+        mine++;
+      }
+      queries += mine;
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  done = true;
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  printf("saturated   %10.0f queries/s\n",
+         queries.load() / since(start) * 1e6);
+
+  // every 100 ms, with Moves
+  done = false;
+  threads.clear();
+  std::vector<std::vector<double>> latencies(pollers);
+  for (int i = 0; i < pollers; i++) {
+    threads.emplace_back([&, i]() {
+      std::string bytes;
+      // spread the pollers over the interval
+      auto next = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(100000LL * i / pollers);
+      while (!done.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_until(next);
+        next += std::chrono::milliseconds(100);
+        auto before = std::chrono::steady_clock::now();
+        QueryResponse config;
+        sm.Query(nullptr, &empty, &config);
+        config.SerializeToString(&bytes);
+        latencies[i].push_back(since(before));
+      }
+    });
+  }
+  std::vector<double> moves;
+  start = std::chrono::steady_clock::now();
+  while (since(start) < seconds * 1e6) {
+    MoveRequest req = randomMove(rng);
+    auto before = std::chrono::steady_clock::now();
+    sm.Move(nullptr, &req, &empty);
+    moves.push_back(since(before));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  done = true;
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  double elapsed = since(start);
+  std::vector<double> all;
+  for (std::vector<double>& mine : latencies) {
+    all.insert(all.end(), mine.begin(), mine.end());
+  }
+  auto [query_avg, query_p99] = summary(all);
+  auto [move_avg, move_p99] = summary(moves);
+  printf("polling     %10.0f queries/s, %.1f us average, %.1f us p99\n",
+         all.size() / elapsed * 1e6, query_avg, query_p99);
+  printf("moves       %10.0f /s, %.1f us average, %.1f us p99\n",
+         moves.size() / elapsed * 1e6, move_avg, move_p99);
+  return 0;
+}
@@ -0,0 +1,188 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <grpcpp/grpcpp.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../build/shardmaster.grpc.pb.h"
+#include "../shardmaster/raft.h"
+
+// What replicating the shardmaster with Raft costs a client. For a plain
+// ./shardmaster and then for 3 and 5 replicas (./shardmaster -r, each its
+// own process on this machine, with its Raft state in /tmp), five servers
+// Join, then we time OPS Moves and OPS Queries, one at a time, sent to the
+// leader and then to a follower (which forwards them), and report the
+// average and 99th percentile latency of each. Run it from build/.
+//
+// usage: ./raft_commit [OPS]
+
+using Empty = google::protobuf::Empty;
+using Clock = std::chrono::steady_clock;
+
+constexpr int FIRST_PORT = 8100;
+
+// starts ./shardmaster on port, with args before it
+static pid_t spawn(const std::vector<std::string>& args, int port) {
+  // or the child prints whatever we haven't yet
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<std::string> all = {"./shardmaster"};
+    all.insert(all.end(), args.begin(), args.end());
+    all.push_back(std::to_string(port));
+    std::vector<char*> argv;
+    for (std::string& arg : all) {
+      argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    freopen("/dev/null", "w", stdout);
+    execv(argv[0], argv.data());
+    perror("./shardmaster");
+    exit(1);
+  }
+  return pid;
+}
+
+static double since(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+// prints the average and 99th percentile of samples, in us
+static void report(const char* name, std::vector<double>& samples) {
+  std::sort(samples.begin(), samples.end());
+  double total = 0;
+  for (double sample : samples) {
+    total += sample;
+  }
+  printf("  %-16s %10.1f us average, %10.1f us p99\n", name,
+         total / samples.size(), samples[samples.size() * 99 / 100]);
+}
+
+// times ops Moves, then ops Queries, sent to stub
+static void measure(Shardmaster::Stub* stub, const char* to, int ops) {
+  std::vector<double> moves, queries;
+  for (int i = 0; i < ops; i++) {
+    grpc::ClientContext cc;
+    MoveRequest req;
+    req.set_server("server_" + std::to_string(i % 5));
+    req.mutable_shard()->set_lower(i % 1000);
+    req.mutable_shard()->set_upper(i % 1000);
+    Empty empty;
+    auto start = Clock::now();
+    if (!stub->Move(&cc, req, &empty).ok()) {
+      fprintf(stderr, "Move failed\n");
+      exit(1);
+    }
+    moves.push_back(since(start));
+  }
+  for (int i = 0; i < ops; i++) {
+    grpc::ClientContext cc;
+    Empty req;
+    QueryResponse config;
+    auto start = Clock::now();
+    if (!stub->Query(&cc, req, &config).ok()) {
+      fprintf(stderr, "Query failed\n");
+      exit(1);
+    }
+    queries.push_back(since(start));
+  }
+  printf("%s\n", to);
+  report("move", moves);
+  report("query", queries);
+}
+
+int main(int argc, char** argv) {
+  int ops = argc > 1 ? atoi(argv[1]) : 500;
+  if (ops < 1) {
+    fprintf(stderr, "usage: ./raft_commit [OPS]\n");
+    return 1;
+  }
+  // resolve names with getaddrinfo (so /etc/hosts) rather than c-ares,
+  // whose DNS queries stall for seconds on every reconnect on hosts without
+  // a working nameserver, and would swamp what we're timing. the replicas
+  // inherit it
+  setenv("GRPC_DNS_RESOLVER", "native", 0);
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  std::string hostname(hostnamebuf);
+
+  for (int replicas : {1, 3, 5}) {
+    std::vector<std::string> addrs;
+    std::string list;
+    for (int i = 0; i < replicas; i++) {
+      addrs.push_back(hostname + ":" + std::to_string(FIRST_PORT + i));
+      list += (i ? "," : "") + addrs.back();
+    }
+    std::vector<pid_t> pids;
+    for (int i = 0; i < replicas; i++) {
+      std::vector<std::string> args;
+      if (replicas > 1) {
+        std::string state = "/tmp/raft_commit_" + std::to_string(i);
+        unlink(state.c_str());
+        args = {"-r", list, "-s", state};
+      }
+      pids.push_back(spawn(args, FIRST_PORT + i));
+    }
+
+    std::vector<std::unique_ptr<Shardmaster::Stub>> stubs;
+    std::vector<std::unique_ptr<Raft::Stub>> rafts;
+    for (const std::string& addr : addrs) {
+      auto channel = PeerChannel(addr);
+      stubs.push_back(Shardmaster::NewStub(channel));
+      rafts.push_back(Raft::NewStub(channel));
+    }
+    // the first replica that says it leads (the plain one always does)
+    int leader = -1;
+    while (leader < 0 && replicas > 1) {
+      for (int i = 0; i < replicas && leader < 0; i++) {
+        grpc::ClientContext cc;
+        cc.set_wait_for_ready(true);
+        Empty req;
+        RaftStatus status;
+        if (rafts[i]->Status(&cc, req, &status).ok() && status.is_leader()) {
+          leader = i;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    leader = std::max(leader, 0);
+    for (int i = 0; i < 5; i++) {
+      grpc::ClientContext cc;
+      cc.set_wait_for_ready(true);
+      JoinRequest req;
+      req.set_server("server_" + std::to_string(i));
+      Empty empty;
+      stubs[leader]->Join(&cc, req, &empty);
+    }
+    // so every channel is connected before anything is timed
+    for (auto& stub : stubs) {
+      grpc::ClientContext cc;
+      cc.set_wait_for_ready(true);
+      Empty req;
+      QueryResponse config;
+      stub->Query(&cc, req, &config);
+    }
+
+    if (replicas == 1) {
+      measure(stubs[0].get(), "plain shardmaster", ops);
+    } else {
+      std::string name = std::to_string(replicas) + " replicas, ";
+      measure(stubs[leader].get(), (name + "at the leader").c_str(), ops);
+      measure(stubs[(leader + 1) % replicas].get(),
+              (name + "at a follower").c_str(), ops);
+    }
+    for (pid_t pid : pids) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,176 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <grpcpp/grpcpp.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../build/shardmaster.grpc.pb.h"
+#include "../shardmaster/raft.h"
+
+// How long a replicated shardmaster is unavailable when its leader dies.
+// REPLICAS replicas (./shardmaster -r, each its own process on this machine,
+// with its Raft state in /tmp) start, and a server Joins. Then, ROUNDS
+// times, we SIGKILL the leader and time how long until a survivor says it
+// leads, and until a Move sent to a survivor commits. The killed replica is
+// then restarted from its state file, and we time how long until it has
+// applied everything the leader has committed. Run it from build/.
+//
+// usage: ./raft_failover [REPLICAS] [ROUNDS]
+
+using Empty = google::protobuf::Empty;
+using Clock = std::chrono::steady_clock;
+
+constexpr int FIRST_PORT = 8110;
+
+static double since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+int main(int argc, char** argv) {
+  int replicas = argc > 1 ? atoi(argv[1]) : 3;
+  int rounds = argc > 2 ? atoi(argv[2]) : 10;
+  if (replicas < 3 || rounds < 1) {
+    fprintf(stderr, "usage: ./raft_failover [REPLICAS (at least 3)] "
+                    "[ROUNDS]\n");
+    return 1;
+  }
+  // resolve names with getaddrinfo (so /etc/hosts) rather than c-ares,
+  // whose DNS queries stall for seconds on every reconnect on hosts without
+  // a working nameserver, and would swamp what we're timing. the replicas
+  // inherit it
+  setenv("GRPC_DNS_RESOLVER", "native", 0);
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  std::string hostname(hostnamebuf);
+
+  std::vector<std::string> addrs;
+  std::string list;
+  for (int i = 0; i < replicas; i++) {
+    addrs.push_back(hostname + ":" + std::to_string(FIRST_PORT + i));
+    list += (i ? "," : "") + addrs.back();
+  }
+  // starts (or restarts) replica i
+  auto spawn = [&](int i) {
+    std::string state = "/tmp/raft_failover_" + std::to_string(i);
+    // or the child prints whatever we haven't yet
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      freopen("/dev/null", "w", stdout);
+      execl("./shardmaster", "./shardmaster", "-r", list.c_str(), "-s",
+            state.c_str(), std::to_string(FIRST_PORT + i).c_str(), nullptr);
+      perror("./shardmaster");
+      exit(1);
+    }
+    return pid;
+  };
+  std::vector<pid_t> pids;
+  for (int i = 0; i < replicas; i++) {
+    unlink(("/tmp/raft_failover_" + std::to_string(i)).c_str());
+    pids.push_back(spawn(i));
+  }
+
+  std::vector<std::unique_ptr<Shardmaster::Stub>> stubs;
+  std::vector<std::unique_ptr<Raft::Stub>> rafts;
+  for (const std::string& addr : addrs) {
+    auto channel = PeerChannel(addr);
+    stubs.push_back(Shardmaster::NewStub(channel));
+    rafts.push_back(Raft::NewStub(channel));
+  }
+  // replica i's status, false if it doesn't answer within timeout
+  auto status = [&](int i, RaftStatus* status,
+                    std::chrono::milliseconds timeout) {
+    grpc::ClientContext cc;
+    cc.set_wait_for_ready(true);
+    cc.set_deadline(std::chrono::system_clock::now() + timeout);
+    Empty req;
+    return rafts[i]->Status(&cc, req, status).ok();
+  };
+  // the replica other than dead that leads, waiting for there to be one
+  auto leader = [&](int dead) {
+    while (true) {
+      for (int i = 0; i < replicas; i++) {
+        RaftStatus s;
+        if (i != dead && status(i, &s, std::chrono::seconds(10)) &&
+            s.is_leader()) {
+          return i;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+
+  int current = leader(-1);
+  {
+    grpc::ClientContext cc;
+    cc.set_wait_for_ready(true);
+    JoinRequest req;
+    req.set_server("server_0");
+    Empty empty;
+    stubs[current]->Join(&cc, req, &empty);
+  }
+  // so every channel is connected before anything is timed
+  for (int i = 0; i < replicas; i++) {
+    RaftStatus s;
+    status(i, &s, std::chrono::seconds(10));
+  }
+
+  printf("%d replicas\n", replicas);
+  printf("%-6s %12s %12s %12s\n", "round", "elected", "committed",
+         "caught up");
+  double elected_total = 0, committed_total = 0, caught_up_total = 0;
+  for (int round = 0; round < rounds; round++) {
+    int dead = current;
+    int survivor = (dead + 1) % replicas;
+    auto start = Clock::now();
+    kill(pids[dead], SIGKILL);
+    waitpid(pids[dead], nullptr, 0);
+
+    current = leader(dead);
+    double elected = since(start);
+    grpc::ClientContext cc;
+    MoveRequest req;
+    req.set_server("server_0");
+    req.mutable_shard()->set_lower(round);
+    req.mutable_shard()->set_upper(round);
+    Empty empty;
+    if (!stubs[survivor]->Move(&cc, req, &empty).ok()) {
+      fprintf(stderr, "Move failed\n");
+      return 1;
+    }
+    double committed = since(start);
+
+    RaftStatus s;
+    status(current, &s, std::chrono::seconds(10));
+    uint64_t target = s.commit_index();
+    pids[dead] = spawn(dead);
+    start = Clock::now();
+    while (!status(dead, &s, std::chrono::seconds(10)) ||
+           s.applied_index() < target) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double caught_up = since(start);
+
+    printf("%-6d %9.1f ms %9.1f ms %9.1f ms\n", round, elected, committed,
+           caught_up);
+    elected_total += elected;
+    committed_total += committed;
+    caught_up_total += caught_up;
+  }
+  printf("%-6s %9.1f ms %9.1f ms %9.1f ms\n", "avg", elected_total / rounds,
+         committed_total / rounds, caught_up_total / rounds);
+
+  for (pid_t pid : pids) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+  return 0;
+}
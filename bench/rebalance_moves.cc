@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../shardmaster/shardmaster.h"
+
+// How much of the key space changes owner on each Join and Leave, with the
+// shardmaster's default placement (an even interval per server, recomputed
+// in join order) and with Placement::BALANCED. Both shardmasters are driven
+// in-process through the same membership changes; after each one we compare
+// the owner of every ID in [MIN_KEY, MAX_KEY] before and after. "least" is
+// the least any even placement has to move: the new server's share on a
+// Join, what the leaving servers held on a Leave. For BALANCED we also
+// report the spread of the servers' loads and how many ranges the config
+// holds.
+//
+// usage: ./rebalance_moves [SERVERS]
+//   with SERVERS (at most 5, the most partition() handles) joining one at a
+//   time, then leaving and coming back
+
+using Empty = google::protobuf::Empty;
+using Owners = std::vector<std::string>;
+
+static Owners owners(StaticShardmaster& sm, size_t* ranges, size_t* min_load,
+                     size_t* max_load) {
+  Empty empty;
+  QueryResponse config;
+  sm.Query(nullptr, &empty, &config);
+  Owners owner(MAX_KEY - MIN_KEY + 1);
+  *ranges = 0;
+  *min_load = owner.size();
+  *max_load = 0;
+  for (const ConfigEntry& entry : config.config()) {
+    size_t load = 0;
+    for (const Shard& s : entry.shards()) {
+      for (unsigned int id = s.lower(); id <= s.upper(); id++) {
+        owner[id - MIN_KEY] = entry.server();
+      }
+      load += s.upper() - s.lower() + 1;
+      (*ranges)++;
+    }
+    *min_load = std::min(*min_load, load);
+    *max_load = std::max(*max_load, load);
+  }
+  return owner;
+}
+
+static double movedPercent(const Owners& before, const Owners& after) {
+  size_t moved = 0;
+  for (size_t i = 0; i < before.size(); i++) {
+    // IDs nobody owned before have nothing to move
+    moved += before[i] != "" && before[i] != after[i];
+  }
+  return 100.0 * moved / before.size();
+}
+
+int main(int argc, char** argv) {
+  int servers = argc > 1 ? atoi(argv[1]) : 5;
+  if (servers < 2 || servers > 5) {
+    fprintf(stderr, "usage: ./rebalance_moves [SERVERS (2-5)]\n");
+    return 1;
+  }
+  auto name = [](int i) { return "server_" + std::to_string(i); };
+  // (server, joining)
+  std::vector<std::pair<int, bool>> steps;
+  for (int i = 0; i < servers; i++) {
+    steps.emplace_back(i, true);
+  }
+  for (int i = 1; i < servers; i += 2) {
+    steps.emplace_back(i, false);
+  }
+  for (int i = 1; i < servers; i += 2) {
+    steps.emplace_back(servers + i, true);
+  }
+  steps.emplace_back(0, false);
+
+  StaticShardmaster partitioned;
+  StaticShardmaster balanced(Placement::BALANCED);
+  size_t ranges, min_load, max_load;
+  Owners before_p = owners(partitioned, &ranges, &min_load, &max_load);
+  Owners before_b = before_p;
+  std::map<std::string, size_t> load;
+  double total_p = 0, total_b = 0, total_least = 0;
+
+  printf("%-18s %10s %10s %10s %12s %8s\n", "change", "partition",
+         "balanced", "least", "loads", "ranges");
+  for (auto [server, joining] : steps) {
+    Empty empty;
+    double least;
+    if (joining) {
+      JoinRequest req;
+      req.set_server(name(server));
+      partitioned.Join(nullptr, &req, &empty);
+      balanced.Join(nullptr, &req, &empty);
+      size_t members = load.size() + 1;
+      least = members == 1 ? 0
+                           : 100.0 * ((MAX_KEY - MIN_KEY + 1) / members) /
+                                 (MAX_KEY - MIN_KEY + 1);
+    } else {
+      LeaveRequest req;
+      req.add_servers(name(server));
+      partitioned.Leave(nullptr, &req, &empty);
+      balanced.Leave(nullptr, &req, &empty);
+      least = 100.0 * load[name(server)] / (MAX_KEY - MIN_KEY + 1);
+    }
+    Owners after_p = owners(partitioned, &ranges, &min_load, &max_load);
+    Owners after_b = owners(balanced, &ranges, &min_load, &max_load);
+    double moved_p = movedPercent(before_p, after_p);
+    double moved_b = movedPercent(before_b, after_b);
+    total_p += moved_p;
+    total_b += moved_b;
+    total_least += least;
+    printf("%-18s %9.1f%% %9.1f%% %9.1f%% %5zu..%-5zu %8zu\n",
+           ((joining ? "join " : "leave ") + name(server)).c_str(), moved_p,
+           moved_b, least, min_load, max_load, ranges);
+    load.clear();
+    for (size_t i = 0; i < after_b.size(); i++) {
+      if (after_b[i] != "") {
+        load[after_b[i]]++;
+      }
+    }
+    before_p = after_p;
+    before_b = after_b;
+  }
+  printf("%-18s %9.1f%% %9.1f%% %9.1f%%\n", "total", total_p, total_b,
+         total_least);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "../shardkv/kvstore.h"
+#include "../shardkv/wal.h"
+
+// How long a KvStore of KEYS keys takes to come back after a restart: from
+// its log alone, and from a snapshot plus the TAIL_WRITES logged after it.
+// For each we report the time until Recover returns (the server could start
+// serving), until the first Get is answered, and until every stripe is back
+// in memory. The files go in the current directory and are still in the page
+// cache when they're read, so this measures our work, not the disk.
+//
+// usage: ./restart_time [KEYS] [TAIL_WRITES]
+
+static const char* LOG_PATH = "./restart_time.log";
+static const char* SNAPSHOT_PATH = "./restart_time.snap";
+
+static double since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// restarts from the log (and the snapshot, if snapshot_path isn't "") and
+// prints how long it took
+static void restart(const char* name, const char* snapshot_path, int keys) {
+  WriteAheadLog log(LOG_PATH, SyncMode::ASYNC);
+  if (!log.Open()) {
+    perror(LOG_PATH);
+    exit(1);
+  }
+  KvStore store;
+  auto start = std::chrono::steady_clock::now();
+  size_t records = store.Recover(&log, snapshot_path);
+  double recovered = since(start);
+  std::string value;
+  if (!store.Get("post_" + std::to_string(keys / 2), &value)) {
+    fprintf(stderr, "lost a key\n");
+    exit(1);
+  }
+  double first_get = since(start);
+  store.Hydrate();
+  printf("%-20s %10zu %10.3f %10.3f %10.3f\n", name, records, recovered,
+         first_get, since(start));
+}
+
+int main(int argc, char** argv) {
+  int keys = argc > 1 ? atoi(argv[1]) : 1000000;
+  int tail = argc > 2 ? atoi(argv[2]) : keys / 100;
+  unlink(LOG_PATH);
+  unlink(SNAPSHOT_PATH);
+
+  std::string value(100, 'x');
+  {
+    WriteAheadLog log(LOG_PATH, SyncMode::ASYNC);
+    KvStore store;
+    if (!log.Open()) {
+      perror(LOG_PATH);
+      return 1;
+    }
+    store.Recover(&log);
+    for (int i = 0; i < keys; i++) {
+      store.Put("post_" + std::to_string(i), value);
+    }
+  }
+
+  printf("%d keys, 100 byte values, %d writes after the snapshot\n", keys,
+         tail);
+  printf("%-20s %10s %10s %10s %10s\n", "restart from", "records",
+         "serving s", "1st get s", "in mem s");
+  restart("log", "", keys);
+
+  {
+    WriteAheadLog log(LOG_PATH, SyncMode::ASYNC);
+    KvStore store;
+    if (!log.Open()) {
+      perror(LOG_PATH);
+      return 1;
+    }
+    store.Recover(&log);
+    auto start = std::chrono::steady_clock::now();
+    if (!store.Checkpoint(SNAPSHOT_PATH)) {
+      perror(SNAPSHOT_PATH);
+      return 1;
+    }
+    printf("(checkpoint took %.3f s)\n", since(start));
+    for (int i = 0; i < tail; i++) {
+      store.Put("post_" + std::to_string(i), value);
+    }
+  }
+  restart("snapshot + log tail", SNAPSHOT_PATH, keys);
+
+  unlink(LOG_PATH);
+  unlink(SNAPSHOT_PATH);
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../shardmaster/shardmaster.h"
+
+// How evenly each placement spreads the key space, and how much of it moves
+// on each Join and Leave: range partitioning (the default), BALANCED, and
+// the hash ring with a few numbers of virtual nodes per server. Every
+// shardmaster is driven in-process through the same membership changes as
+// in rebalance_moves. After each one we compare the owner of every ID in
+// [MIN_KEY, MAX_KEY] before and after, and the servers' loads: their
+// standard deviation as a percentage of the mean (averaged over the changes)
+// and the worst max / mean.
+//
+// usage: ./ring_placement [SERVERS]
+//   with SERVERS (at most 5, the most partition() handles) joining one at a
+//   time, then leaving and coming back
+
+using Empty = google::protobuf::Empty;
+using Owners = std::vector<std::string>;
+
+static Owners owners(StaticShardmaster& sm, std::vector<size_t>* loads,
+                     size_t* ranges) {
+  Empty empty;
+  QueryResponse config;
+  sm.Query(nullptr, &empty, &config);
+  Owners owner(MAX_KEY - MIN_KEY + 1);
+  loads->clear();
+  *ranges = 0;
+  for (const ConfigEntry& entry : config.config()) {
+    size_t load = 0;
+    for (const Shard& s : entry.shards()) {
+      for (unsigned int id = s.lower(); id <= s.upper(); id++) {
+        owner[id - MIN_KEY] = entry.server();
+      }
+      load += s.upper() - s.lower() + 1;
+      (*ranges)++;
+    }
+    loads->push_back(load);
+  }
+  return owner;
+}
+
+static double movedPercent(const Owners& before, const Owners& after) {
+  size_t moved = 0;
+  for (size_t i = 0; i < before.size(); i++) {
+    // IDs nobody owned before have nothing to move
+    moved += before[i] != "" && before[i] != after[i];
+  }
+  return 100.0 * moved / before.size();
+}
+
+int main(int argc, char** argv) {
+  int servers = argc > 1 ? atoi(argv[1]) : 5;
+  if (servers < 2 || servers > 5) {
+    fprintf(stderr, "usage: ./ring_placement [SERVERS (2-5)]\n");
+    return 1;
+  }
+  auto name = [](int i) { return "server_" + std::to_string(i); };
+  // (server, joining)
+  std::vector<std::pair<int, bool>> steps;
+  for (int i = 0; i < servers; i++) {
+    steps.emplace_back(i, true);
+  }
+  for (int i = 1; i < servers; i += 2) {
+    steps.emplace_back(i, false);
+  }
+  for (int i = 1; i < servers; i += 2) {
+    steps.emplace_back(servers + i, true);
+  }
+  steps.emplace_back(0, false);
+
+  struct Mode {
+    std::string name;
+    Placement placement;
+    unsigned int vnodes;
+  };
+  std::vector<Mode> modes = {{"partition", Placement::PARTITION, 0},
+                             {"balanced", Placement::BALANCED, 0}};
+  for (unsigned int vnodes : {1, 4, 16, 64, 128}) {
+    modes.push_back(
+        {"ring x" + std::to_string(vnodes), Placement::RING, vnodes});
+  }
+
+  printf("%-12s %10s %10s %10s %10s\n", "placement", "moved", "stddev",
+         "max/mean", "ranges");
+  for (const Mode& mode : modes) {
+    StaticShardmaster sm(mode.placement, mode.vnodes);
+    std::vector<size_t> loads;
+    size_t ranges, max_ranges = 0;
+    Owners before = owners(sm, &loads, &ranges);
+    double moved = 0, deviation = 0, worst = 0;
+    int measured = 0;
+    for (auto [server, joining] : steps) {
+      Empty empty;
+      if (joining) {
+        JoinRequest req;
+        req.set_server(name(server));
+        sm.Join(nullptr, &req, &empty);
+      } else {
+        LeaveRequest req;
+        req.add_servers(name(server));
+        sm.Leave(nullptr, &req, &empty);
+      }
+      Owners after = owners(sm, &loads, &ranges);
+      moved += movedPercent(before, after);
+      before = after;
+      max_ranges = std::max(max_ranges, ranges);
+      if (loads.size() < 2) {
+        continue;
+      }
+      double mean = (double)(MAX_KEY - MIN_KEY + 1) / loads.size();
+      double variance = 0;
+      size_t max_load = 0;
+      for (size_t load : loads) {
+        variance += (load - mean) * (load - mean);
+        max_load = std::max(max_load, load);
+      }
+      deviation += 100.0 * std::sqrt(variance / loads.size()) / mean;
+      worst = std::max(worst, max_load / mean);
+      measured++;
+    }
+    printf("%-12s %9.1f%% %9.1f%% %10.2f %10zu\n", mode.name.c_str(), moved,
+           deviation / measured, worst, max_ranges);
+  }
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../common/common.h"
+#include "../common/shardindex.h"
+
+// Microbenchmark of the shard ownership lookups every shardkv request makes:
+// "is this ID ours?" and "which server owns this ID?". The key space is cut
+// into SERVERS * SHARDS_PER_SERVER shards, dealt out round robin so every
+// server holds scattered ranges (like after a series of Moves). Each lookup is
+// timed with the helper servers used to call (CheckInShard taking the shard
+// vector by value), with CheckInShard taking it by reference, and with
+// ShardIndex.
+//
+// usage: ./shard_lookup [LOOKUPS] [SHARDS_PER_SERVER]
+
+using Config = std::map<std::string, std::vector<shard_t>>;
+
+// CheckInShard as it was: the vector is copied on every call
+static bool checkInShardByValue(unsigned int key, std::vector<shard> shards) {
+  int shard_intervals = shards.size();
+  for (int i = 0; i < shard_intervals; i++) {
+    shard s = shards.at(i);
+    if (key >= s.lower && key <= s.upper) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static Config makeConfig(int servers, int shards_per_server) {
+  Config config;
+  unsigned int n = servers * shards_per_server;
+  unsigned int keys = MAX_KEY - MIN_KEY + 1;
+  for (unsigned int i = 0; i < n; i++) {
+    shard_t s = {MIN_KEY + i * keys / n, MIN_KEY + (i + 1) * keys / n - 1};
+    config["server_" + std::to_string(i % servers)].push_back(s);
+  }
+  return config;
+}
+
+// runs lookup on every ID and returns the ns per call. the results are summed
+// so the calls can't be optimized away
+template <typename Lookup>
+static double time(const std::vector<int>& ids, Lookup lookup) {
+  size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int id : ids) {
+    sink += lookup(id);
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (sink == (size_t)-1) {
+    printf("unreachable\n");
+  }
+  return elapsed.count() / ids.size();
+}
+
+int main(int argc, char** argv) {
+  int lookups = argc > 1 ? atoi(argv[1]) : 2000000;
+  int shards_per_server = argc > 2 ? atoi(argv[2]) : 4;
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> pick(MIN_KEY, MAX_KEY);
+  std::vector<int> ids(lookups);
+  for (int& id : ids) {
+    id = pick(rng);
+  }
+
+  printf("%d lookups, %d shards per server, ns per lookup\n", lookups,
+         shards_per_server);
+  printf("%8s | %10s %10s %10s | %10s %10s %10s\n", "servers",
+         "local/val", "local/ref", "local/idx", "owner/val", "owner/ref",
+         "owner/idx");
+  for (int servers : {1, 4, 16, 64}) {
+    if (servers * shards_per_server > (int)(MAX_KEY - MIN_KEY + 1)) {
+      break;
+    }
+    Config config = makeConfig(servers, shards_per_server);
+    const std::string self = "server_0";
+    const std::vector<shard_t>& local = config[self];
+    ShardIndex index(config, self);
+
+    double local_val = time(
+        ids, [&](int id) { return checkInShardByValue(id, local) ? 1 : 0; });
+    double local_ref =
+        time(ids, [&](int id) { return CheckInShard(id, local) ? 1 : 0; });
+    double local_idx =
+        time(ids, [&](int id) { return index.Local(id) ? 1 : 0; });
+    // how serverFor used to find the owner: try every server in turn
+    double owner_val = time(ids, [&](int id) {
+      for (auto& server : config) {
+        if (checkInShardByValue(id, server.second)) {
+          return server.first.size();
+        }
+      }
+      return (size_t)0;
+    });
+    double owner_ref = time(ids, [&](int id) {
+      for (auto& server : config) {
+        if (CheckInShard(id, server.second)) {
+          return server.first.size();
+        }
+      }
+      return (size_t)0;
+    });
+    double owner_idx =
+        time(ids, [&](int id) { return index.Owner(id).size(); });
+
+    printf("%8d | %10.1f %10.1f %10.1f | %10.1f %10.1f %10.1f\n", servers,
+           local_val, local_ref, local_idx, owner_val, owner_ref, owner_idx);
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../shardmaster/shardmaster.h"
+
+// Cost of the shardmaster's Move, and what a long run of them does to the
+// config. SERVERS servers join, then MOVES random ranges (up to 50 IDs long,
+// anywhere in [MIN_KEY, MAX_KEY]) are each moved to a random server, in
+// process. We report the time per Move, how many ranges the config ends up
+// with (and the most it had along the way), and what a Query then costs:
+// the time to fill the response and its serialized size.
+//
+// usage: ./shard_moves [MOVES] [SERVERS]
+
+using Empty = google::protobuf::Empty;
+
+static size_t ranges(StaticShardmaster& sm, size_t* bytes) {
+  Empty empty;
+  QueryResponse config;
+  sm.Query(nullptr, &empty, &config);
+  size_t n = 0;
+  for (const ConfigEntry& entry : config.config()) {
+    n += entry.shards_size();
+  }
+  *bytes = config.ByteSizeLong();
+  return n;
+}
+
+int main(int argc, char** argv) {
+  int moves = argc > 1 ? atoi(argv[1]) : 100000;
+  int servers = argc > 2 ? atoi(argv[2]) : 5;
+  if (moves < 1 || servers < 1 || servers > 5) {
+    fprintf(stderr, "usage: ./shard_moves [MOVES] [SERVERS (1-5)]\n");
+    return 1;
+  }
+
+  StaticShardmaster sm;
+  Empty empty;
+  for (int i = 0; i < servers; i++) {
+    JoinRequest req;
+    req.set_server("server_" + std::to_string(i));
+    sm.Join(nullptr, &req, &empty);
+  }
+
+  // generated up front so only the Moves are timed
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<unsigned int> lower(MIN_KEY, MAX_KEY);
+  std::uniform_int_distribution<unsigned int> length(1, 50);
+  std::uniform_int_distribution<int> server(0, servers - 1);
+  std::vector<MoveRequest> requests(moves);
+  for (MoveRequest& req : requests) {
+    unsigned int l = lower(rng);
+    req.set_server("server_" + std::to_string(server(rng)));
+    req.mutable_shard()->set_lower(l);
+    req.mutable_shard()->set_upper(std::min(MAX_KEY, l + length(rng) - 1));
+  }
+
+  size_t bytes, most = 0;
+  double moving = 0;
+  // time the Moves in batches, checking the config's size between them
+  int batch = std::max(1, moves / 100);
+  for (int i = 0; i < moves; i += batch) {
+    auto start = std::chrono::steady_clock::now();
+    for (int j = i; j < std::min(moves, i + batch); j++) {
+      sm.Move(nullptr, &requests[j], &empty);
+    }
+    moving += std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    most = std::max(most, ranges(sm, &bytes));
+  }
+
+  int queries = 10000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < queries; i++) {
+    QueryResponse config;
+    sm.Query(nullptr, &empty, &config);
+  }
+  double querying = std::chrono::duration<double, std::micro>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+  size_t final_ranges = ranges(sm, &bytes);
+  printf("%d moves over %d servers\n", moves, servers);
+  printf("move        %10.2f us\n", moving / moves);
+  printf("ranges      %10zu (at most %zu)\n", final_ranges, most);
+  printf("query       %10.2f us\n", querying / queries);
+  printf("query size  %10zu bytes\n", bytes);
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "../test_utils/test_utils.h"
+#include "bench_utils.h"
+
+// Measures how fast a Join moves data. One server is loaded with a user, a
+// post and a post list for every ID, then a second server joins and we time
+// how long it takes until it can serve every key it took over. For
+// comparison, the same keys are then pushed again the way servers used to
+// hand them off: one unary Put per key, each on a freshly created channel.
+//
+// usage: ./shard_transfer [POST_BYTES]
+
+using Empty = google::protobuf::Empty;
+
+static void report(const char* method, const KeyValues& pairs, double secs) {
+  double bytes = 0;
+  for (auto& kv : pairs) {
+    bytes += kv.first.size() + kv.second.size();
+  }
+  printf("%-26s %8zu keys %8.2f MB %8.3f s %10.0f keys/s %8.2f MB/s\n", method,
+         pairs.size(), bytes / 1e6, secs, pairs.size() / secs,
+         bytes / 1e6 / secs);
+}
+
+int main(int argc, char** argv) {
+  size_t post_bytes = argc > 1 ? atoi(argv[1]) : 16384;
+
+  std::string shardmaster_addr = "127.0.0.1:9080";
+  std::string skv_1 = "127.0.0.1:9081";
+  std::string skv_2 = "127.0.0.1:9082";
+  start_shardmaster(shardmaster_addr);
+  start_shardkvs({skv_1, skv_2}, shardmaster_addr);
+  auto shardmaster = Shardmaster::NewStub(grpc::CreateChannel(
+      shardmaster_addr, grpc::InsecureChannelCredentials()));
+
+  KeyValues pairs = make_pairs(post_bytes);
+  join(shardmaster.get(), skv_1);
+  load(skv_1, pairs);
+
+  // skv_2 takes over the upper half of the IDs when it joins
+  auto start = std::chrono::steady_clock::now();
+  join(shardmaster.get(), skv_2);
+  KeyValues moved = pairs_on(shardmaster.get(), skv_2, pairs);
+  wait_for_handoff(skv_2, moved);
+  double join_secs = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  for (auto& kv : moved) {
+    auto channel =
+        grpc::CreateChannel(skv_2, grpc::InsecureChannelCredentials());
+    auto stub = Shardkv::NewStub(channel);
+    ::grpc::ClientContext cc;
+    PutRequest req;
+    Empty res;
+    req.set_key(kv.first);
+    req.set_data(kv.second);
+    req.set_user("");
+    auto status = stub->Put(&cc, req, &res);
+    assert(status.ok());
+  }
+  double put_secs = seconds_since(start);
+
+  printf("%zu byte posts, batches of %d keys / %zu bytes\n", post_bytes,
+         TRANSFER_BATCH_KEYS, TRANSFER_BATCH_BYTES);
+  report("Join (TransferShard)", moved, join_secs);
+  report("per-key Put, new channel", moved, put_secs);
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../shardkv/kvstore.h"
+
+// A KvStore holding a user, a VALUE_KB post and a post list for every ID,
+// with and without a memory budget of BUDGET_MB. After loading, READS Gets
+// go 90% to a hot tenth of the IDs and 10% to any ID -- most shards idle,
+// a few busy. We report what the budget keeps in memory and on disk, the
+// latency of Gets, and how long reading a spilled stripe back in took.
+//
+// usage: ./spill_faults [VALUE_KB] [BUDGET_MB] [READS]
+
+static const char* SPILL_PATH = "./spill_faults.spill";
+
+using Clock = std::chrono::steady_clock;
+
+static void run(const char* name, size_t budget, int value_kb, int reads) {
+  KvStore store;
+  if (budget != 0 && !store.SetMemoryBudget(budget, SPILL_PATH)) {
+    perror(SPILL_PATH);
+    exit(1);
+  }
+  std::string post(value_kb << 10, 'x');
+  for (unsigned int id = MIN_KEY; id <= MAX_KEY; id++) {
+    std::string suffix = std::to_string(id);
+    store.Put("user_" + suffix, "name " + suffix);
+    store.Put("post_" + suffix, post);
+    store.ListAppend("user_" + suffix + "_posts", {"post_" + suffix});
+  }
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> any(MIN_KEY, MAX_KEY);
+  std::uniform_int_distribution<int> hot(MIN_KEY, MAX_KEY / 10);
+  std::uniform_int_distribution<int> percent(0, 99);
+  std::vector<double> micros;
+  std::string value;
+  for (int i = 0; i < reads; i++) {
+    int id = percent(rng) < 90 ? hot(rng) : any(rng);
+    std::string key = "post_" + std::to_string(id);
+    auto start = Clock::now();
+    store.Get(key, &value);
+    micros.push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() - start)
+            .count());
+  }
+  double total = 0;
+  for (double us : micros) {
+    total += us;
+  }
+  std::sort(micros.begin(), micros.end());
+
+  KvMemoryStats m = store.MemoryStats();
+  printf("%-10s %9.1f %9.1f %10.2f %10.2f %10.2f %8llu %9.1f %9llu\n", name,
+         m.resident_bytes / 1048576.0, m.spilled_bytes / 1048576.0,
+         total / micros.size(), micros[micros.size() / 2],
+         micros[micros.size() * 99 / 100], (unsigned long long)m.faults,
+         m.faults > 0 ? (double)m.fault_micros_total / m.faults : 0.0,
+         (unsigned long long)m.fault_micros_max);
+}
+
+int main(int argc, char** argv) {
+  int value_kb = argc > 1 ? atoi(argv[1]) : 16;
+  size_t budget_mb = argc > 2 ? atoi(argv[2]) : 4;
+  int reads = argc > 3 ? atoi(argv[3]) : 200000;
+
+  printf("%d IDs, %d KB posts, %d gets (90%% to a tenth of the IDs)\n",
+         MAX_KEY - MIN_KEY + 1, value_kb, reads);
+  printf("%-10s %9s %9s %10s %10s %10s %8s %9s %9s\n", "budget", "res MB",
+         "spill MB", "get avg us", "p50 us", "p99 us", "faults",
+         "fault avg", "fault max");
+  run("none", 0, value_kb, reads);
+  std::string name = std::to_string(budget_mb) + " MB";
+  run(name.c_str(), budget_mb << 20, value_kb, reads);
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../shardkv/kvstore.h"
+#include "../shardkv/lsmstore.h"
+#include "../shardkv/wal.h"
+
+// KvStore against LsmStore on the same workload: KEYS keys with 100 byte
+// values are loaded, then READS Gets of random keys (one in ten missing) are
+// timed, then KEYS more Puts of random keys. Both log their writes (ASYNC,
+// so the disk's fsync latency doesn't drown out the engines). For the
+// LsmStore we also report
+//
+//   write amplification  bytes of runs written by flushes and compactions per
+//                        byte written by callers (the log adds one more)
+//   read amplification   blocks read from disk per lookup that missed the
+//                        memtables
+//
+// The runs are in the page cache, so reads cost a pread and a block decode,
+// not a disk seek.
+//
+// usage: ./storage_engines [KEYS] [READS]
+
+static const char* LOG_PATH = "./storage_engines.log";
+static const char* LSM_DIR = "./storage_engines.lsm";
+
+using Clock = std::chrono::steady_clock;
+
+static void report(const char* name, std::vector<double>& micros) {
+  double total = 0;
+  for (double us : micros) {
+    total += us;
+  }
+  std::sort(micros.begin(), micros.end());
+  printf("%-10s %-6s %10.2f %10.2f\n", "", name, total / micros.size(),
+         micros[micros.size() * 99 / 100]);
+}
+
+static double elapsedMicros(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+// loads keys, then times reads and writes. flush (if set) is called between
+// the load and the reads
+static void run(const char* name, StorageEngine* store, int keys, int reads,
+                const std::function<void()>& flush) {
+  std::string value(100, 'x');
+  for (int i = 0; i < keys; i++) {
+    store->Put("post_" + std::to_string(i), value);
+  }
+  if (flush) {
+    flush();
+  }
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> key(0, keys + keys / 9);
+  printf("%-10s\n", name);
+
+  std::vector<double> micros;
+  std::string out;
+  for (int i = 0; i < reads; i++) {
+    std::string k = "post_" + std::to_string(key(rng));
+    auto start = Clock::now();
+    store->Get(k, &out);
+    micros.push_back(elapsedMicros(start));
+  }
+  report("get", micros);
+
+  micros.clear();
+  for (int i = 0; i < keys; i++) {
+    std::string k = "post_" + std::to_string(key(rng));
+    auto start = Clock::now();
+    store->Put(k, value);
+    micros.push_back(elapsedMicros(start));
+  }
+  report("put", micros);
+}
+
+int main(int argc, char** argv) {
+  int keys = argc > 1 ? atoi(argv[1]) : 1000000;
+  int reads = argc > 2 ? atoi(argv[2]) : 200000;
+  unlink(LOG_PATH);
+  system((std::string("rm -rf ") + LSM_DIR).c_str());
+
+  printf("%d keys, 100 byte values, %d gets then %d puts\n", keys, reads,
+         keys);
+  printf("%-10s %-6s %10s %10s\n", "engine", "op", "avg us", "p99 us");
+  {
+    WriteAheadLog log(LOG_PATH, SyncMode::ASYNC);
+    if (!log.Open()) {
+      perror(LOG_PATH);
+      return 1;
+    }
+    KvStore store;
+    store.Recover(&log);
+    run("KvStore", &store, keys, reads, nullptr);
+  }
+
+  LsmStore store(LSM_DIR, SyncMode::ASYNC);
+  if (!store.Open()) {
+    perror(LSM_DIR);
+    return 1;
+  }
+  run("LsmStore", &store, keys, reads, [&store]() { store.Flush(); });
+  store.Flush();
+  LsmStats stats = store.Stats();
+  printf("LsmStore: %llu flushes, %llu compactions, %zu runs, %llu stalls\n",
+         (unsigned long long)stats.flushes,
+         (unsigned long long)stats.compactions, stats.runs,
+         (unsigned long long)stats.stalls);
+  printf("write amplification %.2f (+1 for the log)\n",
+         (double)(stats.flushed_bytes + stats.compacted_bytes) /
+             stats.user_bytes);
+  printf("read amplification  %.2f blocks per lookup\n",
+         stats.lookups > 0 ? (double)stats.blocks_read / stats.lookups : 0);
+
+  unlink(LOG_PATH);
+  system((std::string("rm -rf ") + LSM_DIR).c_str());
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../shardkv/kvstore.h"
+
+// What a KvStore's values cost: IDS users with 4-20 byte names and posts of
+// 20-280 bytes (a fifth of them appended to a few times, 10-30 bytes at a
+// time), loaded into a KvStore with a bucket per ID. We count the heap
+// allocations the load makes and the memory it takes (RSS), then hand every
+// shard of SHARD_IDS IDs off with ReadRange and EraseBatch and drop the
+// pairs, counting the frees the store makes and those dropping the pairs
+// takes.
+//
+// usage: ./value_memory [IDS] [SHARD_IDS]
+
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> allocated_bytes{0};
+static std::atomic<uint64_t> frees{0};
+
+void* operator new(size_t size) {
+  allocations++;
+  allocated_bytes += size;
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  if (p != nullptr) {
+    frees++;
+  }
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+static double rssMB() {
+  long pages = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f != nullptr) {
+    if (fscanf(f, "%*s %ld", &pages) != 1) {
+      pages = 0;
+    }
+    fclose(f);
+  }
+  return pages * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+static double since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+int main(int argc, char** argv) {
+  unsigned int ids = argc > 1 ? atoi(argv[1]) : 200000;
+  unsigned int shard_ids = argc > 2 ? atoi(argv[2]) : 1000;
+
+  // the workload is made up front, so only the store's allocations count
+  struct User {
+    std::string user, post, name, text;
+    std::vector<std::string> edits;
+  };
+  std::vector<User> users(ids);
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> name_len(4, 20);
+  std::uniform_int_distribution<int> post_len(20, 280);
+  std::uniform_int_distribution<int> edit_len(10, 30);
+  std::uniform_int_distribution<int> edits(1, 5);
+  std::uniform_int_distribution<int> percent(0, 99);
+  size_t value_bytes = 0;
+  for (unsigned int id = 0; id < ids; id++) {
+    User& u = users[id];
+    u.user = "user_" + std::to_string(id);
+    u.post = "post_" + std::to_string(id);
+    u.name.assign(name_len(rng), 'n');
+    u.text.assign(post_len(rng), 'p');
+    value_bytes += u.name.size() + u.text.size();
+    if (percent(rng) < 20) {
+      for (int e = edits(rng); e > 0; e--) {
+        u.edits.emplace_back(edit_len(rng), 'e');
+        value_bytes += u.edits.back().size();
+      }
+    }
+  }
+
+  KvStore store(0, ids - 1);
+  double rss_before = rssMB();
+  uint64_t allocations_before = allocations;
+  uint64_t bytes_before = allocated_bytes;
+  auto start = std::chrono::steady_clock::now();
+  for (const User& u : users) {
+    store.Put(u.user, u.name);
+    store.Put(u.post, u.text);
+    for (const std::string& edit : u.edits) {
+      store.Append(u.post, edit);
+    }
+  }
+  double load = since(start);
+  printf("%u IDs, %.1f MB of values\n", ids, value_bytes / 1048576.0);
+  printf("load:    %.3f s, %llu allocations (%.1f MB), RSS +%.1f MB\n", load,
+         (unsigned long long)(allocations - allocations_before),
+         (allocated_bytes - bytes_before) / 1048576.0, rssMB() - rss_before);
+
+  // the store's side of a handoff is ReadRange, then EraseBatch once the new
+  // owner has the keys; the pairs read are the transfer's payload, dropped
+  // once sent
+  uint64_t store_frees = 0;
+  uint64_t payload_frees = 0;
+  allocations_before = allocations;
+  size_t pairs = 0;
+  start = std::chrono::steady_clock::now();
+  for (unsigned int lower = 0; lower < ids; lower += shard_ids) {
+    uint64_t frees_before;
+    {
+      auto moving = store.ReadRange({lower, lower + shard_ids - 1});
+      std::vector<std::string> keys;
+      keys.reserve(moving.size());
+      for (const auto& kv : moving) {
+        keys.push_back(kv.first);
+      }
+      frees_before = frees;
+      store.EraseBatch(keys);
+      store_frees += frees - frees_before;
+      pairs += moving.size();
+      frees_before = frees;
+    }
+    payload_frees += frees - frees_before;
+  }
+  printf("handoff: %.3f s for %zu keys in shards of %u IDs, %llu allocations\n",
+         since(start), pairs, shard_ids,
+         (unsigned long long)(allocations - allocations_before));
+  printf("         %llu frees by the store, %llu dropping the pairs, RSS +%.1f "
+         "MB left\n",
+         (unsigned long long)store_frees, (unsigned long long)payload_frees,
+         rssMB() - rss_before);
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../shardkv/kvstore.h"
+#include "../shardkv/wal.h"
+
+// Write throughput of KvStore with a write-ahead log in each SyncMode. Every
+// thread Puts its own keys as fast as it can, and each Put returns only once
+// the log says it's durable. For each mode we report writes per second and
+// how many writes shared an fsync, for a growing number of threads. The log
+// goes in the current directory, so run this on the disk a server would log
+// to.
+//
+// usage: ./wal_throughput [WRITES_PER_THREAD] [MAX_THREADS]
+
+static const char* LOG_PATH = "./wal_throughput.log";
+
+// returns writes per second. *per_fsync is set to the writes per fsync
+static double run(const SyncMode* mode, int threads, int writes,
+                  double* per_fsync) {
+  unlink(LOG_PATH);
+  WriteAheadLog log(LOG_PATH, mode != nullptr ? *mode : SyncMode::ASYNC);
+  KvStore store;
+  if (mode != nullptr) {
+    if (!log.Open()) {
+      perror(LOG_PATH);
+      exit(1);
+    }
+    store.Recover(&log);
+  }
+
+  std::atomic<bool> go(false);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() {
+      std::string value(100, 'x');
+      while (!go.load()) {
+      }
+      for (int i = 0; i < writes; i++) {
+        store.Put("post_" + std::to_string(t * writes + i), value);
+      }
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  go.store(true);
+  for (auto& w : workers) {
+    w.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  uint64_t fsyncs = mode != nullptr ? log.Fsyncs() : 0;
+  *per_fsync = fsyncs > 0 ? (double)threads * writes / fsyncs : 0;
+  return threads * writes / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+  int writes = argc > 1 ? atoi(argv[1]) : 2000;
+  int max_threads = argc > 2 ? atoi(argv[2]) : 32;
+
+  const SyncMode modes[] = {SyncMode::PER_WRITE, SyncMode::BATCHED,
+                            SyncMode::ASYNC};
+  const char* names[] = {"per-write", "batched", "async"};
+
+  printf("%d writes/thread, 100 byte values\n", writes);
+  printf("%8s %10s %14s %14s\n", "threads", "mode", "writes/s",
+         "writes/fsync");
+  for (int threads = 1; threads <= max_threads; threads *= 4) {
+    double per_fsync;
+    printf("%8d %10s %14.0f %14s\n", threads, "no log",
+           run(nullptr, threads, writes, &per_fsync), "-");
+    for (int m = 0; m < 3; m++) {
+      double rate = run(&modes[m], threads, writes, &per_fsync);
+      // an async run can finish before its first background fsync
+      char batching[32] = "-";
+      if (per_fsync > 0) {
+        snprintf(batching, sizeof(batching), "%.1f", per_fsync);
+      }
+      printf("%8d %10s %14.0f %14s\n", threads, names[m], rate, batching);
+    }
+  }
+  unlink(LOG_PATH);
+  return 0;
+}
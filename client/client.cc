@@ -17,32 +17,96 @@ void logError(const std::string& method, Status& error) {
 void Client::Query() {
     Empty query;
     QueryResponse response;
-    ClientContext cc;
 
-    Status status = stub->Query(&cc, query, &response);
+    Status status = shardmasters.Call([&](Shardmaster::Stub* stub) {
+        ClientContext cc;
+        return stub->Query(&cc, query, &response);
+    });
     if(status.ok()) {
+        installConfig(response);
+    } else {
+        logError("Query", status);
+    }
+}
+
+Client::~Client() {
+    {
+        std::lock_guard<std::mutex> lock(watch_mtx);
+        stopping = true;
+        if(watch_cc != nullptr) {
+            watch_cc->TryCancel();
+        }
+    }
+    watcher.join();
+}
+
+void Client::installConfig(const QueryResponse& response) {
+    std::set<std::string> servers;
+    {
+        std::lock_guard<std::mutex> lock(config_mtx);
         // start by resetting config
         configuration.Clear();
         for(const auto& config : response.config()) {
+            servers.insert(config.server());
             // now set up shards
             for(const auto& shard : config.shards()) {
                 configuration.Insert(config.server(), {shard.lower(), shard.upper()});
             }
         }
-    } else {
-        logError("Query", status);
+        config_num = response.config_num();
+    }
+    peers.Retain(servers);
+}
+
+void Client::watchConfig() {
+    while(true) {
+        ClientContext cc;
+        QueryIfNewerRequest req;
+        QueryResponse response;
+        {
+            std::lock_guard<std::mutex> lock(watch_mtx);
+            if(stopping) {
+                return;
+            }
+            watch_cc = &cc;
+        }
+        {
+            std::lock_guard<std::mutex> lock(config_mtx);
+            req.set_config_num(config_num);
+        }
+
+        Shardmaster::Stub* stub = shardmasters.Current();
+        auto reader = stub->Watch(&cc, req);
+        while(reader->Read(&response)) {
+            installConfig(response);
+        }
+        reader->Finish();
+        shardmasters.Rotate(stub);
+
+        {
+            std::lock_guard<std::mutex> lock(watch_mtx);
+            watch_cc = nullptr;
+            if(stopping) {
+                return;
+            }
+        }
+        // the shardmaster (replica) is unreachable (commands still fall back to Query when a key
+        // has no server), so back off a little before subscribing again
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 }
 
 void Client::Move(const std::string& server, const shard_t &shard) {
     MoveRequest req;
     Empty response;
-    ClientContext cc;
 
     req.set_server(server);
     req.mutable_shard()->set_upper(shard.upper);
     req.mutable_shard()->set_lower(shard.lower);
-    Status status = stub->Move(&cc, req, &response);
+    Status status = shardmasters.Call([&](Shardmaster::Stub* stub) {
+        ClientContext cc;
+        return stub->Move(&cc, req, &response);
+    });
     if(!status.ok()) {
         logError("Move", status);
     }
@@ -51,10 +115,12 @@ void Client::Move(const std::string& server, const shard_t &shard) {
 void Client::Join(const std::string& server) {
     JoinRequest req;
     Empty response;
-    ClientContext cc;
 
     req.set_server(server);
-    Status status = stub->Join(&cc, req, &response);
+    Status status = shardmasters.Call([&](Shardmaster::Stub* stub) {
+        ClientContext cc;
+        return stub->Join(&cc, req, &response);
+    });
     if(!status.ok()) {
         logError("Join", status);
     }
@@ -63,28 +129,34 @@ void Client::Join(const std::string& server) {
 void Client::Leave(const std::vector<std::string>& servers) {
     LeaveRequest req;
     Empty response;
-    ClientContext cc;
 
     for (const std::string& server : servers) {
         req.add_servers(server);
     }
 
-    Status status = stub->Leave(&cc, req, &response);
+    Status status = shardmasters.Call([&](Shardmaster::Stub* stub) {
+        ClientContext cc;
+        return stub->Leave(&cc, req, &response);
+    });
     if(!status.ok()) {
         logError("Leave", status);
     }
 }
 
 void Client::PrintConfig() {
+    std::lock_guard<std::mutex> lock(config_mtx);
     configuration.Print();
 }
 
 void Client::Get(const std::string& key) {
     if (key == "all_users") {
-        std::vector<std::string> servers = configuration.AllServers();
+        std::vector<std::string> servers;
+        {
+            std::lock_guard<std::mutex> lock(config_mtx);
+            servers = configuration.AllServers();
+        }
         for (std::string server : servers) {
-            auto channel = grpc::CreateChannel(server, grpc::InsecureChannelCredentials());
-            auto kvStub = Shardkv::NewStub(channel);
+            auto kvStub = peers.Get(server);
             std::cout << "Get server: " << server << "\n";
 
             ::grpc::ClientContext cc;
@@ -100,13 +172,13 @@ void Client::Get(const std::string& key) {
             }
         }
     } else {
-        auto kvStub = getKVStub(key);
+        std::string server;
+        auto kvStub = getKVStub(key, &server);
         if(kvStub == nullptr) {
             return;
         }
 
-        unsigned int key_id = (unsigned int)extractID(key);
-        std::cout << "Get server: " << configuration.GetServer(key_id).value() << "\n";
+        std::cout << "Get server: " << server << "\n";
 
         ::grpc::ClientContext cc;
         GetRequest req;
@@ -122,19 +194,20 @@ void Client::Get(const std::string& key) {
     }
 }
 
-void Client::Delete(const std::string& key) {
-    auto kvStub = getKVStub(key);
+void Client::Delete(const std::string& key, const std::string& user_id) {
+    std::string server;
+    auto kvStub = getKVStub(key, &server);
     if(kvStub == nullptr) {
         return;
     }
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Delete server: " << configuration.GetServer(key_id).value() << "\n";
+    std::cout << "Delete server: " << server << "\n";
 
     ::grpc::ClientContext cc;
     DeleteRequest req;
     Empty res;
     req.set_key(key);
+    req.set_user(user_id);
 
     auto status = kvStub->Delete(&cc, req, &res);
     if(status.ok()) {
@@ -145,13 +218,13 @@ void Client::Delete(const std::string& key) {
 }
 
 void Client::Put(const std::string &key, const std::string &value, const std::string &user_id) {
-    auto kvStub = getKVStub(key);
+    std::string server;
+    auto kvStub = getKVStub(key, &server);
     if(kvStub == nullptr) {
         return;
     }
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Put server: " << configuration.GetServer(key_id).value() << "\n";
+    std::cout << "Put server: " << server << "\n";
 
     ::grpc::ClientContext cc;
     PutRequest req;
@@ -167,13 +240,13 @@ void Client::Put(const std::string &key, const std::string &value, const std::st
 }
 
 void Client::Append(const std::string &key, const std::string &value) {
-    auto kvStub = getKVStub(key);
+    std::string server;
+    auto kvStub = getKVStub(key, &server);
     if(kvStub == nullptr) {
         return;
     }
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Append server: " << configuration.GetServer(key_id).value() << "\n";
+    std::cout << "Append server: " << server << "\n";
 
     ::grpc::ClientContext cc;
     AppendRequest req;
@@ -187,11 +260,144 @@ void Client::Append(const std::string &key, const std::string &value) {
     }
 }
 
+void Client::MultiGet(const std::vector<std::string>& keys) {
+    std::map<std::string, MultiGetRequest> requests;
+    std::vector<std::pair<std::string, int>> where(keys.size(), {"", 0});
+    bool unrouted = false;
+    {
+        std::lock_guard<std::mutex> lock(config_mtx);
+        for(size_t i = 0; i < keys.size(); i++) {
+            ParsedKey parsed = ParseKey(keys[i]);
+            if(!parsed.HasID()) {
+                // every server has its own all_users, so it has no single owner
+                // (and neither does a key without an ID)
+                continue;
+            }
+            std::optional<std::string> addr = configuration.GetServer(parsed.id);
+            if(!addr.has_value()) {
+                unrouted = true;
+                continue;
+            }
+            MultiGetRequest& req = requests[addr.value()];
+            where[i] = {addr.value(), req.keys_size()};
+            req.add_keys(keys[i]);
+        }
+    }
+    if(unrouted) {
+        // same as getKVStub: we probably haven't gotten a config yet
+        Query();
+    }
+    printResults("MultiGet", keys, where,
+                 sendBatches(requests, &Shardkv::Stub::PrepareAsyncMultiGet));
+}
+
+void Client::MultiPut(const std::vector<PutRequest>& puts) {
+    std::map<std::string, MultiPutRequest> requests;
+    std::vector<std::string> keys;
+    std::vector<std::pair<std::string, int>> where(puts.size(), {"", 0});
+    bool unrouted = false;
+    {
+        std::lock_guard<std::mutex> lock(config_mtx);
+        for(size_t i = 0; i < puts.size(); i++) {
+            keys.push_back(puts[i].key());
+            ParsedKey parsed = ParseKey(puts[i].key());
+            if(!parsed.HasID()) {
+                continue;
+            }
+            std::optional<std::string> addr = configuration.GetServer(parsed.id);
+            if(!addr.has_value()) {
+                unrouted = true;
+                continue;
+            }
+            MultiPutRequest& req = requests[addr.value()];
+            where[i] = {addr.value(), req.puts_size()};
+            *req.add_puts() = puts[i];
+        }
+    }
+    if(unrouted) {
+        Query();
+    }
+    printResults("MultiPut", keys, where,
+                 sendBatches(requests, &Shardkv::Stub::PrepareAsyncMultiPut));
+}
+
+template <typename Request>
+std::map<std::string, MultiResponse> Client::sendBatches(
+    const std::map<std::string, Request>& requests,
+    std::unique_ptr<grpc::ClientAsyncResponseReader<MultiResponse>> (Shardkv::Stub::*prepare)(
+        ClientContext*, const Request&, grpc::CompletionQueue*)) {
+    struct Batch {
+        std::string server;
+        ClientContext cc;
+        MultiResponse response;
+        Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<MultiResponse>> reader;
+    };
+    grpc::CompletionQueue cq;
+    std::vector<std::unique_ptr<Batch>> batches;
+    for(const auto& [server, req] : requests) {
+        auto batch = std::make_unique<Batch>();
+        batch->server = server;
+        auto kvStub = peers.Get(server);
+        batch->reader = ((*kvStub).*prepare)(&batch->cc, req, &cq);
+        batch->reader->StartCall();
+        batch->reader->Finish(&batch->response, &batch->status, batch.get());
+        batches.push_back(std::move(batch));
+    }
+
+    std::map<std::string, MultiResponse> responses;
+    for(size_t i = 0; i < batches.size(); i++) {
+        void* tag;
+        bool ok;
+        cq.Next(&tag, &ok);
+        auto batch = static_cast<Batch*>(tag);
+        if(batch->status.ok()) {
+            responses[batch->server] = std::move(batch->response);
+        } else {
+            logError("batch to " + batch->server, batch->status);
+        }
+    }
+    return responses;
+}
+
+void Client::printResults(const std::string& method, const std::vector<std::string>& keys,
+                          const std::vector<std::pair<std::string, int>>& where,
+                          const std::map<std::string, MultiResponse>& responses) {
+    for(size_t i = 0; i < keys.size(); i++) {
+        const std::string& server = where[i].first;
+        std::cout << method << " " << keys[i] << ": ";
+        auto it = responses.find(server);
+        if(server == "") {
+            std::cout << "no server owns this key\n";
+        } else if(it == responses.end()) {
+            std::cout << "server " << server << " failed\n";
+        } else {
+            const KeyStatus& result = it->second.results(where[i].second);
+            if(result.code() != grpc::StatusCode::OK) {
+                std::cout << "failed on " << server << ": " << result.error() << "\n";
+            } else if(method == "MultiGet") {
+                std::cout << result.data() << " (" << server << ")\n";
+            } else {
+                std::cout << "ok (" << server << ")\n";
+            }
+        }
+    }
+}
+
 // helper for getting key-value server stubs given a key. returns nullptr on error
-std::unique_ptr<Shardkv::Stub> Client::getKVStub(const std::string key) {
+std::shared_ptr<Shardkv::Stub> Client::getKVStub(const std::string key, std::string* server) {
     // get servername
-    unsigned int key_id = (unsigned int)extractID(key);
-    auto addr = configuration.GetServer(key_id);
+    ParsedKey parsed = ParseKey(key);
+    if(!parsed.HasID()) {
+        std::cout << "ERR: " << key << " has no ID, so no server owns it\n";
+        return nullptr;
+    }
+    unsigned int key_id = parsed.id;
+    std::optional<std::string> addr;
+    {
+        std::lock_guard<std::mutex> lock(config_mtx);
+        addr = configuration.GetServer(key_id);
+    }
     if(!addr.has_value()) {
         // not sure how we could get this case UNLESS we have just never run query, so we'll just do that I guess
         // oh I guess this could happen if the key is out of range too... think more about this - can we assume it
@@ -199,6 +405,6 @@ std::unique_ptr<Shardkv::Stub> Client::getKVStub(const std::string key) {
         Query();
         return nullptr;
     }
-    auto channel = grpc::CreateChannel(addr.value(), grpc::InsecureChannelCredentials());
-    return Shardkv::NewStub(channel);
+    *server = addr.value();
+    return peers.Get(addr.value());
 }
@@ -7,11 +7,17 @@
 
 #include <grpcpp/grpcpp.h>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <vector>
 
 #include "../build/shardmaster.grpc.pb.h"
 #include "../build/shardkv.grpc.pb.h"
 #include "../common/common.h"
+#include "../common/keys.h"
+#include "../common/peerpool.h"
+#include "../common/shardmasters.h"
 #include "../config/config.h"
 
 using grpc::Channel;
@@ -21,8 +27,14 @@ using grpc::ClientContext;
 class Client {
     using Empty = google::protobuf::Empty;
 public:
-    explicit Client(const std::string& addr) :
-        stub(Shardmaster::NewStub(grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()))) {}
+    // addr is the shardmaster's address, or its replicas' (comma-separated)
+    explicit Client(const std::string& addr) : shardmasters(addr) {
+        // keep the config up to date in the background, so commands route by the shardmaster's
+        // latest config without having to run query first
+        watcher = std::thread(&Client::watchConfig, this);
+    }
+
+    ~Client();
 
     void Query();
 
@@ -40,16 +52,59 @@ public:
 
     void Append(const std::string& key, const std::string& value);
 
-    void Delete(const std::string& key);
+    // user_id (optional, for a post) takes the post off that user's posts too
+    void Delete(const std::string& key, const std::string& user_id = "");
 
-private:
-    // helper for getting stubs to shardkv servers given a key
-    std::unique_ptr<Shardkv::Stub> getKVStub(const std::string key);
+    // gets every key with one MultiGet per server that owns some of them, sent in parallel
+    void MultiGet(const std::vector<std::string>& keys);
 
-    // grpc stub
-    std::unique_ptr<Shardmaster::Stub> stub;
+    // puts every (key, value, user) with one MultiPut per server that owns some of the keys, sent in
+    // parallel
+    void MultiPut(const std::vector<PutRequest>& puts);
 
+private:
+    // helper for getting stubs to shardkv servers given a key. stores the server's address in server
+    std::shared_ptr<Shardkv::Stub> getKVStub(const std::string key, std::string* server);
+
+    // sends requests[server] to each server in parallel and waits for all of them. returns the
+    // responses of the servers that answered
+    template <typename Request>
+    std::map<std::string, MultiResponse> sendBatches(
+        const std::map<std::string, Request>& requests,
+        std::unique_ptr<grpc::ClientAsyncResponseReader<MultiResponse>> (Shardkv::Stub::*prepare)(
+            ClientContext*, const Request&, grpc::CompletionQueue*));
+
+    // prints the results of a MultiGet or MultiPut. where[i] is the server keys[i] was sent to and
+    // its index in that server's batch (or "" if no server owns it)
+    void printResults(const std::string& method, const std::vector<std::string>& keys,
+                      const std::vector<std::pair<std::string, int>>& where,
+                      const std::map<std::string, MultiResponse>& responses);
+
+    // replaces configuration with the config in response
+    void installConfig(const QueryResponse& response);
+
+    // runs in watcher: installs every config the shardmaster pushes, re-subscribing (to the next
+    // replica, if there are several) if the stream breaks, until the client is destroyed
+    void watchConfig();
+
+    // grpc stubs, one per shardmaster replica
+    ShardmasterList shardmasters;
+
+    // configuration and config_num are shared between the repl and watcher
+    std::mutex config_mtx;
     Config configuration;
+    uint64_t config_num = 0;
+
+    // one long-lived channel per shardkv server, so commands reuse warm connections. installConfig
+    // drops the channels to servers that are no longer in the config
+    PeerPool peers;
+
+    std::thread watcher;
+    // guards stopping and watch_cc, the context of the open Watch stream (if any), so the
+    // destructor can cancel it
+    std::mutex watch_mtx;
+    bool stopping = false;
+    ClientContext* watch_cc = nullptr;
 };
 
 
@@ -9,11 +9,11 @@ using namespace std;
 
 void DeleteCommand::Handle(const std::string &line) {
     vector<string> tokens = split(line);
-    assert(tokens.size() == 2);
+    assert(tokens.size() == 2 || tokens.size() == 3);
     string key = tokens[1];
-    client.Delete(key);
+    client.Delete(key, tokens.size() == 3 ? tokens[2] : "");
 }
 
 void DeleteCommand::PrintHelpMessage() {
-    std::cout << "del <key>\ndeletes <key> and the associated value, prints an error if the key is not found\n";
+    std::cout << "del <key> [<user>]\ndeletes <key> and the associated value, prints an error if the key is not found. if <key> is a post of <user>, it is also removed from <user>'s posts\n";
 }
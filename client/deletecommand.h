@@ -7,7 +7,7 @@
 
 class DeleteCommand : public RegexCommand {
 public:
-    // matches: del <key>
+    // matches: del <key> [<user>]
     explicit DeleteCommand(Client& cl) : RegexCommand("del .+"), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override ;
@@ -15,17 +15,19 @@
 #include "appendcommand.h"
 #include "putcommand.h"
 #include "deletecommand.h"
+#include "multigetcommand.h"
+#include "multiputcommand.h"
 
 using namespace std;
 
 int main(int argc, char **argv) {
-    // usage is ./client <hostname> <port>
-    if(argc != 3) {
-        std::cerr << "usage: ./client <hostname> <port>\n";
+    // usage is ./client <hostname> <port>, where a replicated shardmaster is given as a list of
+    // hostnames and/or ports
+    const string addr = argc == 3 ? ShardmasterAddrs(argv[1], argv[2]) : "";
+    if(addr == "") {
+        std::cerr << "usage: ./client <hostname>[,<hostname>...] <port>[,<port>...]\n";
         return 1;
     }
-
-    const string addr = string(argv[1]) + ":" + string(argv[2]);
     // construct client
     Client client(addr);
 
@@ -47,6 +49,10 @@ int main(int argc, char **argv) {
     repl.AddCommand(ac);
     DeleteCommand dc(client);
     repl.AddCommand(dc);
+    MultiGetCommand mgc(client);
+    repl.AddCommand(mgc);
+    MultiPutCommand mpc(client);
+    repl.AddCommand(mpc);
 
     // now start repl
     repl.Start();
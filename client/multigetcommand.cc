@@ -0,0 +1,15 @@
+#include "multigetcommand.h"
+#include "../common/common.h"
+
+using namespace std;
+
+void MultiGetCommand::Handle(const std::string &line) {
+    vector<string> tokens = split(line);
+    assert(tokens.size() >= 2);
+    client.MultiGet(vector<string>(tokens.begin() + 1, tokens.end()));
+}
+
+void MultiGetCommand::PrintHelpMessage() {
+    std::cout << "multiget <key> [<key> ...]\nretrieves the values associated with every <key>, asking each "
+                 "server for all of its keys at once\n";
+}
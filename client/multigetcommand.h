@@ -0,0 +1,19 @@
+#ifndef SHARDING_MULTIGETCOMMAND_H
+#define SHARDING_MULTIGETCOMMAND_H
+
+
+#include "../repl/regexcommand.h"
+#include "client.h"
+
+class MultiGetCommand : public RegexCommand {
+public:
+    // matches: multiget <key> [<key> ...]
+    explicit MultiGetCommand(Client& cl) : RegexCommand("multiget .+"), client(cl) {}
+    void Handle(const std::string& line) override;
+    void PrintHelpMessage() override;
+private:
+    Client& client;
+};
+
+
+#endif //SHARDING_MULTIGETCOMMAND_H
@@ -0,0 +1,27 @@
+#include "multiputcommand.h"
+#include "../common/common.h"
+
+using namespace std;
+
+void MultiPutCommand::Handle(const std::string &line) {
+    vector<string> tokens = split(line);
+    if(tokens.size() < 4 || (tokens.size() - 1) % 3 != 0) {
+        PrintHelpMessage();
+        return;
+    }
+    vector<PutRequest> puts;
+    for(size_t i = 1; i < tokens.size(); i += 3) {
+        PutRequest req;
+        req.set_key(tokens[i]);
+        req.set_data(tokens[i + 1]);
+        req.set_user(tokens[i + 2]);
+        puts.push_back(req);
+    }
+    client.MultiPut(puts);
+}
+
+void MultiPutCommand::PrintHelpMessage() {
+    std::cout << "multiput <key> <value> <user> [<key> <value> <user> ...]\nputs every <key> <value> pair "
+                 "(values can't contain spaces), sending each server all of its pairs at once. <user> is "
+                 "the user a post belongs to, for a user key pass the key itself\n";
+}
@@ -0,0 +1,19 @@
+#ifndef SHARDING_MULTIPUTCOMMAND_H
+#define SHARDING_MULTIPUTCOMMAND_H
+
+
+#include "../repl/regexcommand.h"
+#include "client.h"
+
+class MultiPutCommand : public RegexCommand {
+public:
+    // matches: multiput <key> <value> <user> [<key> <value> <user> ...]
+    explicit MultiPutCommand(Client& cl) : RegexCommand("multiput .+"), client(cl) {}
+    void Handle(const std::string& line) override;
+    void PrintHelpMessage() override;
+private:
+    Client& client;
+};
+
+
+#endif //SHARDING_MULTIPUTCOMMAND_H
@@ -1,10 +1,13 @@
 #include "common.h"
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <regex>
 #include <math.h>
 
+#include "records.h"
+
 void sortAscendingInterval(std::vector<shard_t> &shards) {
   std::sort(
       shards.begin(), shards.end(),
@@ -104,7 +107,7 @@ void sortDescendingSize(std::vector<shard_t> &shards) {
 size_t shardRangeSize(const std::vector<shard_t> &vec) {
   size_t tot = 0;
   for (const shard_t &s : vec) {
-    tot += size(vec);
+    tot += size(s);
   }
   return tot;
 }
@@ -146,6 +149,179 @@ OverlapStatus get_overlap(const shard_t &a, const shard_t &b) {
   }
 }
 
+std::vector<shard_t> shard_difference(const std::vector<shard_t> &a,
+                                      const std::vector<shard_t> &b) {
+  std::vector<shard_t> pieces = a;
+  for (const shard_t &cut : b) {
+    std::vector<shard_t> remaining;
+    for (const shard_t &p : pieces) {
+      switch (get_overlap(p, cut)) {
+      case OverlapStatus::NO_OVERLAP:
+        remaining.push_back(p);
+        break;
+      case OverlapStatus::OVERLAP_START:
+        remaining.push_back({cut.upper + 1, p.upper});
+        break;
+      case OverlapStatus::OVERLAP_END:
+        remaining.push_back({p.lower, cut.lower - 1});
+        break;
+      case OverlapStatus::COMPLETELY_CONTAINS:
+        remaining.push_back({p.lower, cut.lower - 1});
+        remaining.push_back({cut.upper + 1, p.upper});
+        break;
+      case OverlapStatus::COMPLETELY_CONTAINED:
+        break;
+      }
+    }
+    pieces = remaining;
+  }
+  sortAscendingInterval(pieces);
+  return pieces;
+}
+
+// sorts shards and merges the ones that touch
+static void mergeAdjacent(std::vector<shard_t> &shards) {
+  sortAscendingInterval(shards);
+  std::vector<shard_t> merged;
+  for (const shard_t &s : shards) {
+    if (!merged.empty() && merged.back().upper + 1 == s.lower) {
+      merged.back().upper = s.upper;
+    } else {
+      merged.push_back(s);
+    }
+  }
+  shards = merged;
+}
+
+std::map<std::string, std::vector<shard_t>>
+rebalance(const std::map<std::string, std::vector<shard_t>> &assignment,
+          const std::vector<std::string> &servers, unsigned int min,
+          unsigned int max) {
+  std::map<std::string, std::vector<shard_t>> result;
+  if (servers.empty()) {
+    return result;
+  }
+  std::map<std::string, size_t> load;
+  for (const std::string &server : servers) {
+    auto it = assignment.find(server);
+    load[server] = it == assignment.end() ? 0 : shardRangeSize(it->second);
+  }
+  // everyone gets total / n, and the remainder goes to the servers that
+  // already hold the most, so they give up as little as possible
+  size_t total = max - min + 1;
+  std::vector<std::string> by_load = servers;
+  std::stable_sort(by_load.begin(), by_load.end(),
+                   [&load](const std::string &a, const std::string &b) {
+                     return load[a] > load[b];
+                   });
+  std::map<std::string, size_t> target;
+  for (size_t i = 0; i < by_load.size(); i++) {
+    target[by_load[i]] = total / servers.size() + (i < total % servers.size());
+  }
+
+  // a server keeps its lowest IDs up to its target
+  std::vector<shard_t> kept;
+  for (const std::string &server : servers) {
+    auto it = assignment.find(server);
+    if (it == assignment.end()) {
+      continue;
+    }
+    std::vector<shard_t> shards = it->second;
+    sortAscendingInterval(shards);
+    size_t room = target[server];
+    for (const shard_t &s : shards) {
+      if (room == 0) {
+        break;
+      }
+      shard_t keep = {s.lower, s.upper};
+      if (size(keep) > room) {
+        keep.upper = keep.lower + room - 1;
+      }
+      room -= size(keep);
+      result[server].push_back(keep);
+      kept.push_back(keep);
+    }
+  }
+
+  // and the rest, including whatever nobody held, fills up the others in
+  // order
+  std::vector<shard_t> pool = shard_difference({{min, max}}, kept);
+  size_t next = 0;
+  for (const std::string &server : servers) {
+    size_t room = target[server] - shardRangeSize(result[server]);
+    while (room > 0 && next < pool.size()) {
+      shard_t &s = pool[next];
+      shard_t take = {s.lower, s.upper};
+      if (size(take) > room) {
+        take.upper = take.lower + room - 1;
+        s.lower = take.upper + 1;
+      } else {
+        next++;
+      }
+      room -= size(take);
+      result[server].push_back(take);
+    }
+  }
+
+  for (auto &[server, shards] : result) {
+    mergeAdjacent(shards);
+  }
+  return result;
+}
+
+// FNV-1a, then splitmix64's finalizer so that names differing only in their
+// last character land far apart on the ring
+static uint64_t hashName(const std::string &name) {
+  uint64_t hash = Fnv1a64(name);
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+  return hash ^ (hash >> 31);
+}
+
+std::map<std::string, std::vector<shard_t>>
+hash_ring(const std::vector<std::string> &servers, unsigned int vnodes,
+          unsigned int min, unsigned int max) {
+  struct Point {
+    unsigned int position;
+    uint64_t hash;
+    const std::string *server;
+  };
+  std::map<std::string, std::vector<shard_t>> result;
+  std::vector<Point> points;
+  for (const std::string &server : servers) {
+    result[server];
+    for (unsigned int v = 0; v < vnodes; v++) {
+      uint64_t hash = hashName(server + "#" + std::to_string(v));
+      points.push_back({min + (unsigned int)(hash % (max - min + 1)), hash,
+                        &server});
+    }
+  }
+  if (points.empty()) {
+    return result;
+  }
+  // of points at the same position, the one with the lower hash wins
+  std::sort(points.begin(), points.end(), [](const Point &a, const Point &b) {
+    return a.position != b.position ? a.position < b.position
+                                    : a.hash < b.hash;
+  });
+  // a point owns the IDs after the point before it, up to its own position
+  unsigned int lower = min;
+  for (const Point &p : points) {
+    if (p.position >= lower) {
+      result[*p.server].push_back({lower, p.position});
+      lower = p.position + 1;
+    }
+  }
+  // and the first point also owns the ones after the last, around the ring
+  if (lower <= max) {
+    result[*points.front().server].push_back({lower, max});
+  }
+  for (auto &[server, shards] : result) {
+    mergeAdjacent(shards);
+  }
+  return result;
+}
+
 std::vector<std::string> split(const std::string &s) {
   std::vector<std::string> v;
   std::regex ws_re("\\s+"); // whitespace
@@ -183,11 +359,8 @@ int extractID(std::string key) {
 }
 
 // helper that checks if key is in this list of shards
-bool CheckInShard(int key, std::vector<shard> shards) {
-  int shard_intervals = shards.size();
-
-  for (int i = 0; i < shard_intervals; i++) {
-    shard s = shards.at(i);
+bool CheckInShard(int key, const std::vector<shard> &shards) {
+  for (const shard &s : shards) {
     if (key >= s.lower && key <= s.upper) {
       return true;
     }
@@ -1,6 +1,7 @@
 #ifndef SHARDING_COMMON_H
 #define SHARDING_COMMON_H
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -41,7 +42,7 @@ enum class OverlapStatus {
 };
 
 std::vector<shard_t> partition(int n, unsigned int min, unsigned int max);
-bool CheckInShard(int key, std::vector<shard> shards);
+bool CheckInShard(int key, const std::vector<shard>& shards);
 /* ========================= */
 /* === Helper functions ==== */
 /* ========================= */
@@ -71,6 +72,33 @@ std::pair<shard_t, shard_t> split_shard(const shard_t& s);
 // RPC!
 OverlapStatus get_overlap(const shard_t& a, const shard_t& b);
 
+// returns the parts of the shards in a that aren't covered by any shard in b,
+// sorted by lower bound. e.g. {[0, 500]} minus {[0, 250], [400, 1000]} is
+// {[251, 399]}
+std::vector<shard_t> shard_difference(const std::vector<shard_t>& a,
+                                      const std::vector<shard_t>& b);
+
+// reassigns [min, max] evenly among servers, moving as few IDs as possible:
+// servers over their share give up their highest IDs, and those (plus any
+// nobody held) go to the servers under their share, in the order given.
+// assignment may hold servers that aren't in servers (they're dropped) and
+// miss some that are (they start empty). every server gets an entry, with
+// its shards sorted and adjacent ones merged
+std::map<std::string, std::vector<shard_t>>
+rebalance(const std::map<std::string, std::vector<shard_t>>& assignment,
+          const std::vector<std::string>& servers, unsigned int min,
+          unsigned int max);
+
+// places each server at vnodes points of a hash ring over [min, max] (by
+// hashing "<server>#<i>"), and gives each point the IDs after the point
+// before it, up to its own. a server joining or leaving only takes IDs from,
+// or gives them to, its neighbours on the ring, and the more points per
+// server the more even their shares. every server gets an entry, with its
+// shards sorted and adjacent ones merged
+std::map<std::string, std::vector<shard_t>>
+hash_ring(const std::vector<std::string>& servers, unsigned int vnodes,
+          unsigned int min, unsigned int max);
+
 // utility function for splitting strings on whitespace
 std::vector<std::string> split(const std::string& s);
 
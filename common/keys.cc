@@ -0,0 +1,82 @@
+#include "keys.h"
+
+#include <climits>
+
+ParsedKey ParseKey(std::string_view key) {
+  ParsedKey parsed;
+  if (key == "all_users") {
+    parsed.type = KeyType::ALL_USERS;
+    return parsed;
+  }
+  size_t sep = key.find('_');
+  if (sep == std::string_view::npos) {
+    return parsed;
+  }
+  std::string_view word = key.substr(0, sep);
+  size_t i = sep + 1;
+  long id = 0;
+  for (; i < key.size() && key[i] != '_'; i++) {
+    if (key[i] < '0' || key[i] > '9') {
+      return parsed;
+    }
+    id = id * 10 + (key[i] - '0');
+    if (id > INT_MAX) {
+      return parsed;
+    }
+  }
+  if (i == sep + 1) {
+    return parsed;
+  }
+  std::string_view rest = key.substr(i);  // "" or "_<word>"
+  parsed.id = id;
+  if (word == "user" && rest.empty()) {
+    parsed.type = KeyType::USER;
+  } else if (word == "post" && rest.empty()) {
+    parsed.type = KeyType::POST;
+  } else if (word == "user" && rest == "_posts") {
+    parsed.type = KeyType::USER_POSTS;
+  } else {
+    parsed.type = KeyType::OTHER;
+  }
+  return parsed;
+}
+
+// the type tags of packed keys. they start at 1 so no packed key is 0
+enum : uint64_t { PACKED_USER = 1, PACKED_POST = 2, PACKED_USER_POSTS = 3 };
+
+PackedKey PackKey(std::string_view key, const ParsedKey& parsed) {
+  uint64_t tag;
+  switch (parsed.type) {
+    case KeyType::USER:
+      tag = PACKED_USER;
+      break;
+    case KeyType::POST:
+      tag = PACKED_POST;
+      break;
+    case KeyType::USER_POSTS:
+      tag = PACKED_USER_POSTS;
+      break;
+    default:
+      return 0;
+  }
+  // user_ and post_ are both 5 characters, so the ID starts at key[5]. a
+  // leading zero is followed by another digit, not by '_' or the end
+  if (key[5] == '0' && key.size() > 6 && key[6] != '_') {
+    return 0;
+  }
+  return tag << 32 | (uint64_t)parsed.id;
+}
+
+PackedKey PackKey(std::string_view key) { return PackKey(key, ParseKey(key)); }
+
+std::string UnpackKey(PackedKey packed) {
+  std::string id = std::to_string(PackedID(packed));
+  switch (packed >> 32) {
+    case PACKED_USER:
+      return "user_" + id;
+    case PACKED_POST:
+      return "post_" + id;
+    default:
+      return "user_" + id + "_posts";
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef SHARDING_KEYS_H
+#define SHARDING_KEYS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// the shapes of key the servers know about
+enum class KeyType {
+  USER,        // user_<id>
+  POST,        // post_<id>
+  USER_POSTS,  // user_<id>_posts
+  ALL_USERS,   // all_users
+  OTHER,       // <word>_<id>[_<word>] that isn't one of the above
+  INVALID      // no ID: not something any server stores
+};
+
+struct ParsedKey {
+  KeyType type = KeyType::INVALID;
+  // the ID that decides which shard the key belongs to, or -1 if it has none
+  int id = -1;
+
+  bool HasID() const { return id >= 0; }
+};
+
+// classifies key and parses its ID in one pass over it, without allocating.
+// unlike extractID this never asserts: a key without a (non-negative, int
+// sized) ID after its first '_' comes back INVALID, except all_users
+ParsedKey ParseKey(std::string_view key);
+
+// A user_<id>, post_<id> or user_<id>_posts key packed into 8 bytes: the type
+// in the high 32 bits and the ID in the low ones. 0 is never a packed key.
+using PackedKey = uint64_t;
+
+// packs key, already parsed into parsed. only those three shapes with the ID
+// spelled canonically (no leading zeros) are packed, so UnpackKey gives back
+// exactly key. returns 0 for any other key
+PackedKey PackKey(std::string_view key, const ParsedKey& parsed);
+
+PackedKey PackKey(std::string_view key);
+
+// the ID of a packed key
+inline int PackedID(PackedKey packed) { return (int)(packed & 0xffffffff); }
+
+// the key packed into packed, which must not be 0
+std::string UnpackKey(PackedKey packed);
+
+#endif  // SHARDING_KEYS_H
@@ -0,0 +1,33 @@
+#include "peerpool.h"
+
+std::shared_ptr<Shardkv::Stub> PeerPool::Get(const std::string& addr) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = stubs.find(addr);
+  if (it != stubs.end()) {
+    reused++;
+    return it->second;
+  }
+  // a cached channel that loses its connection reconnects on its own, backing
+  // off between attempts. cap the backoff so a peer that restarts is picked up
+  // again within a second, like a fresh channel would
+  grpc::ChannelArguments args;
+  args.SetInt(GRPC_ARG_INITIAL_RECONNECT_BACKOFF_MS, 100);
+  args.SetInt(GRPC_ARG_MAX_RECONNECT_BACKOFF_MS, 1000);
+  std::shared_ptr<Shardkv::Stub> stub =
+      Shardkv::NewStub(grpc::CreateCustomChannel(
+          addr, grpc::InsecureChannelCredentials(), args));
+  stubs.emplace(addr, stub);
+  created++;
+  return stub;
+}
+
+void PeerPool::Retain(const std::set<std::string>& addrs) {
+  std::lock_guard<std::mutex> lock(mtx);
+  for (auto it = stubs.begin(); it != stubs.end();) {
+    if (addrs.count(it->first) == 0) {
+      it = stubs.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
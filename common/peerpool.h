@@ -0,0 +1,37 @@
+#ifndef SHARDING_PEERPOOL_H
+#define SHARDING_PEERPOOL_H
+
+#include <grpcpp/grpcpp.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "../build/shardkv.grpc.pb.h"
+
+// Keeps one channel (and stub) per shardkv address, so repeated RPCs to the
+// same server reuse its HTTP/2 connection instead of setting up a new one
+// every time. Stubs are thread safe, so callers share them.
+class PeerPool {
+ public:
+  // returns the stub for addr, opening a channel to it on first use
+  std::shared_ptr<Shardkv::Stub> Get(const std::string& addr);
+
+  // closes the channels to every address not in addrs (e.g. servers that left
+  // the config). stubs handed out earlier stay usable
+  void Retain(const std::set<std::string>& addrs);
+
+  // number of channels opened, and of Gets served by an open one
+  uint64_t Created() const { return created.load(); }
+  uint64_t Reused() const { return reused.load(); }
+
+ private:
+  std::mutex mtx;
+  std::unordered_map<std::string, std::shared_ptr<Shardkv::Stub>> stubs;
+  std::atomic<uint64_t> created{0};
+  std::atomic<uint64_t> reused{0};
+};
+
+#endif  // SHARDING_PEERPOOL_H
@@ -0,0 +1,62 @@
+#include "records.h"
+
+#include <unistd.h>
+
+uint32_t Fnv1a32(std::string_view data) {
+  uint32_t hash = 2166136261u;
+  for (char c : data) {
+    hash = (hash ^ (uint8_t)c) * 16777619u;
+  }
+  return hash;
+}
+
+uint64_t Fnv1a64(std::string_view data) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : data) {
+    hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+  }
+  return hash;
+}
+
+size_t StartRecord(std::string* out) {
+  size_t start = out->size();
+  out->append(RECORD_HEADER, '\0');
+  return start;
+}
+
+void FinishRecord(std::string* out, size_t start) {
+  std::string_view payload(out->data() + start + RECORD_HEADER,
+                           out->size() - start - RECORD_HEADER);
+  uint32_t len = payload.size();
+  uint32_t sum = Fnv1a32(payload);
+  memcpy(&(*out)[start], &len, sizeof(len));
+  memcpy(&(*out)[start + sizeof(len)], &sum, sizeof(sum));
+}
+
+bool NextRecord(std::string_view data, size_t* pos, std::string_view* payload) {
+  if (data.size() - *pos < RECORD_HEADER) {
+    return false;
+  }
+  const char* header = data.data() + *pos;
+  uint32_t len = GetRaw<uint32_t>(header);
+  if (data.size() - *pos - RECORD_HEADER < len) {
+    return false;
+  }
+  std::string_view body(header + RECORD_HEADER, len);
+  if (Fnv1a32(body) != GetRaw<uint32_t>(header + sizeof(uint32_t))) {
+    return false;
+  }
+  *payload = body;
+  *pos += RECORD_HEADER + len;
+  return true;
+}
+
+std::string ReadFile(int fd) {
+  std::string contents;
+  char chunk[1 << 16];
+  ssize_t n;
+  while ((n = pread(fd, chunk, sizeof(chunk), contents.size())) > 0) {
+    contents.append(chunk, n);
+  }
+  return contents;
+}
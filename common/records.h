@@ -0,0 +1,58 @@
+#ifndef SHARDING_RECORDS_H
+#define SHARDING_RECORDS_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// FNV-1a, so anything hashed with it reads the same in any build
+uint32_t Fnv1a32(std::string_view data);
+uint64_t Fnv1a64(std::string_view data);
+
+// appends v to out as its bytes in memory
+template <typename T>
+void PutRaw(std::string* out, T v) {
+  out->append((const char*)&v, sizeof(v));
+}
+
+// the T whose bytes start at p, which needn't be aligned
+template <typename T>
+T GetRaw(const char* p) {
+  T v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Checksummed records, for files appended to in place (the shardkv write-ahead
+// log, the shardmaster's Raft state), where a crash can leave the last one
+// torn. A record is RECORD_HEADER bytes (the payload's length and its
+// Fnv1a32) followed by the payload, so a torn or garbled one is told apart
+// from a complete one and everything from it on is dropped.
+//
+// usage:
+//   size_t start = StartRecord(&out);
+//   out.append(...);  // the payload
+//   FinishRecord(&out, start);
+//
+//   size_t pos = 0;
+//   std::string_view payload;
+//   while (NextRecord(contents, &pos, &payload)) ...
+constexpr size_t RECORD_HEADER = 2 * sizeof(uint32_t);
+
+// starts a record at the end of out, returning where it starts
+size_t StartRecord(std::string* out);
+
+// fills in the header of the record that starts at start, whose payload is
+// everything appended to out since
+void FinishRecord(std::string* out, size_t start);
+
+// if a complete record starts at data[*pos], sets *payload to its payload,
+// moves *pos past it and returns true. otherwise (a torn or garbled record,
+// or the end of data) returns false and leaves *pos where it is
+bool NextRecord(std::string_view data, size_t* pos, std::string_view* payload);
+
+// all of the file fd, from the start
+std::string ReadFile(int fd);
+
+#endif  // SHARDING_RECORDS_H
@@ -0,0 +1,41 @@
+#include "shardindex.h"
+
+#include <algorithm>
+
+ShardIndex::ShardIndex(
+    const std::map<std::string, std::vector<shard_t>>& config,
+    const std::string& self, unsigned int min_id, unsigned int max_id)
+    : min_id(min_id), owners(max_id - min_id + 1, NONE) {
+  for (auto& [server, shards] : config) {
+    if (server == self) {
+      local = servers.size();
+    }
+    for (const shard_t& s : shards) {
+      if (s.upper < min_id || s.lower > max_id) {
+        continue;
+      }
+      std::fill(owners.begin() + (std::max(s.lower, min_id) - min_id),
+                owners.begin() + (std::min(s.upper, max_id) - min_id + 1),
+                servers.size());
+    }
+    servers.push_back(server);
+  }
+}
+
+uint32_t ShardIndex::find(int id) const {
+  if (id < (long)min_id || id - (long)min_id >= (long)owners.size()) {
+    return NONE;
+  }
+  return owners[id - min_id];
+}
+
+const std::string& ShardIndex::Owner(int id) const {
+  static const std::string none;
+  uint32_t server = find(id);
+  return server == NONE ? none : servers[server];
+}
+
+bool ShardIndex::Local(int id) const {
+  uint32_t server = find(id);
+  return server != NONE && server == local;
+}
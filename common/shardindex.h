@@ -0,0 +1,48 @@
+#ifndef SHARDING_SHARDINDEX_H
+#define SHARDING_SHARDINDEX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Answers which server owns an ID under one config. The config is flattened
+// into a table with one entry per ID in [min_id, max_id] holding the index of
+// its server, so a lookup is one array read: no scan over the shards, no
+// copies, no allocation. Build one when a config is installed (O(key space)),
+// then share it read-only.
+class ShardIndex {
+ public:
+  ShardIndex() = default;
+
+  // indexes the shards of every server in config. Local answers for self.
+  // the parts of shards outside [min_id, max_id] are left out
+  explicit ShardIndex(
+      const std::map<std::string, std::vector<shard_t>>& config,
+      const std::string& self = "", unsigned int min_id = MIN_KEY,
+      unsigned int max_id = MAX_KEY);
+
+  // returns the server that owns id, or "" if nobody does
+  const std::string& Owner(int id) const;
+
+  // returns whether self owns id
+  bool Local(int id) const;
+
+ private:
+  // marks IDs nobody owns
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  // returns the index in servers of id's owner, or NONE
+  uint32_t find(int id) const;
+
+  unsigned int min_id = MIN_KEY;
+  // owners[id - min_id] is the index of id's server in servers
+  std::vector<uint32_t> owners;
+  std::vector<std::string> servers;
+  // index of self in servers, or NONE if self isn't in the config
+  uint32_t local = NONE;
+};
+
+#endif  // SHARDING_SHARDINDEX_H
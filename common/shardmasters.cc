@@ -0,0 +1,65 @@
+#include "shardmasters.h"
+
+#include <algorithm>
+#include <sstream>
+
+static std::vector<std::string> splitList(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    items.push_back(item);
+  }
+  return items;
+}
+
+ShardmasterList::ShardmasterList(const std::string& addrs) {
+  for (const std::string& addr : splitList(addrs)) {
+    stubs.push_back(Shardmaster::NewStub(
+        grpc::CreateChannel(addr, grpc::InsecureChannelCredentials())));
+  }
+}
+
+Shardmaster::Stub* ShardmasterList::Current() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return stubs[current].get();
+}
+
+void ShardmasterList::Rotate(Shardmaster::Stub* stub) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (stubs[current].get() == stub) {
+    current = (current + 1) % stubs.size();
+  }
+}
+
+grpc::Status ShardmasterList::Call(
+    const std::function<grpc::Status(Shardmaster::Stub*)>& call) {
+  grpc::Status status;
+  for (size_t tried = 0; tried < stubs.size(); tried++) {
+    Shardmaster::Stub* stub = Current();
+    status = call(stub);
+    if (status.error_code() != grpc::StatusCode::UNAVAILABLE) {
+      break;
+    }
+    Rotate(stub);
+  }
+  return status;
+}
+
+std::string ShardmasterAddrs(const std::string& hosts,
+                             const std::string& ports) {
+  std::vector<std::string> host_list = splitList(hosts);
+  std::vector<std::string> port_list = splitList(ports);
+  size_t n = std::max(host_list.size(), port_list.size());
+  if (host_list.empty() || port_list.empty() ||
+      (host_list.size() != n && host_list.size() != 1) ||
+      (port_list.size() != n && port_list.size() != 1)) {
+    return "";
+  }
+  std::string addrs;
+  for (size_t i = 0; i < n; i++) {
+    addrs += (i ? "," : "") + host_list[host_list.size() == 1 ? 0 : i] + ":" +
+             port_list[port_list.size() == 1 ? 0 : i];
+  }
+  return addrs;
+}
@@ -0,0 +1,56 @@
+#ifndef SHARDING_SHARDMASTERS_H
+#define SHARDING_SHARDMASTERS_H
+
+#include <grpcpp/grpcpp.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../build/shardmaster.grpc.pb.h"
+
+// The shardmaster as its clients see it: a single address, or the replicas
+// of a replicated shardmaster (./shardmaster -r), any of which serves every
+// call. Calls go to one replica until it can't be reached; Rotate then moves
+// them on to the next, so a dead replica costs a failed call rather than an
+// outage. Stubs are thread safe, so callers share them.
+//
+// usage:
+//   ShardmasterList shardmasters("host:9095,host:9096,host:9097");
+//   grpc::Status status = shardmasters.Call([&](Shardmaster::Stub* stub) {
+//     grpc::ClientContext cc;
+//     return stub->Join(&cc, req, &res);
+//   });
+class ShardmasterList {
+ public:
+  // addrs is an address, or a comma-separated list of them
+  explicit ShardmasterList(const std::string& addrs);
+
+  // the stub of the replica calls go to now
+  Shardmaster::Stub* Current();
+
+  // moves calls on from stub's replica to the next one, unless another
+  // caller already has
+  void Rotate(Shardmaster::Stub* stub);
+
+  // runs call on the current replica, moving on to the next one each time
+  // it's unreachable (UNAVAILABLE), until one answers or every replica has
+  // been tried. returns the last status
+  grpc::Status Call(
+      const std::function<grpc::Status(Shardmaster::Stub*)>& call);
+
+ private:
+  std::vector<std::unique_ptr<Shardmaster::Stub>> stubs;
+  std::mutex mtx;
+  size_t current = 0;
+};
+
+// the shardmaster addresses for a hostname and port given on the command
+// line, either of which may be a comma-separated list: one host with several
+// ports, several hosts with one port, or as many hosts as ports (paired up in
+// order). returns them comma-separated, or "" if the lists don't match up
+std::string ShardmasterAddrs(const std::string& hosts,
+                             const std::string& ports);
+
+#endif  // SHARDING_SHARDMASTERS_H
@@ -0,0 +1,71 @@
+#include "shardtable.h"
+
+#include <climits>
+
+void ShardTable::split(unsigned int id) {
+  auto it = ranges.upper_bound(id);
+  if (it == ranges.begin()) {
+    return;
+  }
+  --it;
+  if (it->first == id || it->second.upper < id) {
+    return;
+  }
+  ranges.emplace_hint(std::next(it), id,
+                      Range{it->second.upper, it->second.owner});
+  it->second.upper = id - 1;
+}
+
+void ShardTable::Assign(const shard_t& s, const std::string& server) {
+  split(s.lower);
+  if (s.upper != UINT_MAX) {
+    split(s.upper + 1);
+  }
+  auto it = ranges.lower_bound(s.lower);
+  while (it != ranges.end() && it->first <= s.upper) {
+    it = ranges.erase(it);
+  }
+  it = ranges.emplace_hint(it, s.lower, Range{s.upper, server});
+  // merge with the ranges on either side if server owns them too
+  auto next = std::next(it);
+  if (next != ranges.end() && next->first == s.upper + 1 &&
+      next->second.owner == server) {
+    it->second.upper = next->second.upper;
+    ranges.erase(next);
+  }
+  if (it != ranges.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second.upper + 1 == s.lower && prev->second.owner == server) {
+      prev->second.upper = it->second.upper;
+      ranges.erase(it);
+    }
+  }
+}
+
+void ShardTable::Reset(
+    const std::map<std::string, std::vector<shard_t>>& config) {
+  ranges.clear();
+  for (const auto& [server, shards] : config) {
+    for (const shard_t& s : shards) {
+      Assign(s, server);
+    }
+  }
+}
+
+const std::string& ShardTable::Owner(unsigned int id) const {
+  static const std::string none;
+  auto it = ranges.upper_bound(id);
+  if (it == ranges.begin()) {
+    return none;
+  }
+  --it;
+  return it->second.upper < id ? none : it->second.owner;
+}
+
+std::map<std::string, std::vector<shard_t>> ShardTable::ByServer() const {
+  std::map<std::string, std::vector<shard_t>> config;
+  ForEach([&config](const shard_t& s, const std::string& server) {
+    config[server].push_back(s);
+  });
+  return config;
+}
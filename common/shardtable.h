@@ -0,0 +1,53 @@
+#ifndef SHARDING_SHARDTABLE_H
+#define SHARDING_SHARDTABLE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Which server owns each range of IDs: one ordered map from the lower bound
+// of a range to its upper bound and owner. Ranges never overlap, and two that
+// touch always have different owners (Assign merges them), so however many
+// Moves the table has seen it holds no more ranges than the config needs.
+// IDs in no range are owned by nobody. Not thread safe.
+class ShardTable {
+ public:
+  // gives s to server, taking it from whoever owned any of it. O(log n) plus
+  // the ranges s covers, each of which was added by an earlier Assign
+  void Assign(const shard_t& s, const std::string& server);
+
+  // replaces the table with the shards of every server in config
+  void Reset(const std::map<std::string, std::vector<shard_t>>& config);
+
+  // returns the server that owns id, or "" if nobody does. O(log n)
+  const std::string& Owner(unsigned int id) const;
+
+  // returns the shards of every server that has any, sorted
+  std::map<std::string, std::vector<shard_t>> ByServer() const;
+
+  // calls fn(shard, server) for every range, in order
+  template <typename Fn>
+  void ForEach(Fn fn) const {
+    for (const auto& [lower, range] : ranges) {
+      fn(shard_t{lower, range.upper}, range.owner);
+    }
+  }
+
+  // returns the number of ranges
+  size_t Size() const { return ranges.size(); }
+
+ private:
+  struct Range {
+    unsigned int upper;
+    std::string owner;
+  };
+
+  // splits the range holding id, if it starts before id, so one starts at id
+  void split(unsigned int id);
+
+  std::map<unsigned int, Range> ranges;
+};
+
+#endif  // SHARDING_SHARDTABLE_H
@@ -26,9 +26,13 @@ std::optional<std::string> Config::GetServer(unsigned int key) {
 
 std::vector<std::string> Config::AllServers() {
     std::vector<std::string> servers;
+    std::set<std::string> seen;
     auto it = shardToServer.begin();
     while (it != shardToServer.end()) {
-        servers.push_back(it->second.server);
+        // a server with several shards is still listed once
+        if(seen.insert(it->second.server).second) {
+            servers.push_back(it->second.server);
+        }
         it++;
     }
     return servers;
@@ -9,6 +9,7 @@
 #include <map>
 #include <vector>
 #include <optional>
+#include <set>
 #include "../common/common.h"
 
 typedef struct {
@@ -24,7 +25,7 @@ public:
     // retrieves the server currently responsible for the given key. returns none if no such server exists
     std::optional<std::string> GetServer(unsigned int key);
 
-    // returns list of all servers
+    // returns list of all servers, each listed once
     std::vector<std::string> AllServers();
 
     // deletes all entries from the config
@@ -9,7 +9,8 @@ from flask_cors import CORS  # comment this on deployment
 from google.protobuf.empty_pb2 import Empty
 
 from shard_config import ShardConfig
-from shardkv_pb2 import AppendRequest, DeleteRequest, GetRequest, PutRequest
+from shardkv_pb2 import (AppendRequest, DeleteRequest, GetRequest,
+                         MultiGetRequest, PutRequest)
 from shardkv_pb2_grpc import ShardkvStub
 from shardmaster_pb2 import GDPRDeleteRequest
 from shardmaster_pb2_grpc import ShardmasterStub
@@ -69,6 +70,32 @@ def shardkvGet(server, key):
     return response.data
 
 
+def shardkvMultiGet(keys_by_server):
+    """
+    Helper function to get many keys with one MultiGet per server. The
+    requests are sent to all servers at once.
+
+    Inputs:
+    - keys_by_server: a dict from each shardkv server to the keys it owns
+
+    Returns:
+    - a dict from each key to its data, for the keys that were found
+
+    Raises:
+    - grpc.RpcError: if a whole MultiGet fails
+    """
+    futures = []
+    for server, keys in keys_by_server.items():
+        stub = ShardkvStub(grpc.insecure_channel(server))
+        futures.append(stub.MultiGet.future(MultiGetRequest(keys=keys)))
+    data = {}
+    for future in futures:
+        for result in future.result().results:
+            if result.code == grpc.StatusCode.OK.value[0]:
+                data[result.key] = result.data
+    return data
+
+
 def shardkvPut(server, key, data, user=None):
     """
     Helper function to make a put request to a shardkv server.
@@ -108,13 +135,14 @@ def shardkvAppend(server, key, data):
     stub.Append(AppendRequest(key=key, data=data))
 
 
-def shardkvDelete(server, key):
+def shardkvDelete(server, key, user=""):
     """
     Helper function to make a delete request to a shardkv server.
 
     Inputs:
     - server: the shardkv server
     - key: the Delete request's key
+    - user: for a post, its user (the post is taken off the user's posts too)
 
     Raises:
     - grpc.RpcError: if the status is not grpc.StatusCode.OK
@@ -123,7 +151,7 @@ def shardkvDelete(server, key):
     channel = grpc.insecure_channel(server)
     stub = ShardkvStub(channel)
     # Send Delete request
-    stub.Delete(DeleteRequest(key=key))
+    stub.Delete(DeleteRequest(key=key, user=user))
 
 
 ### FLASK SERVER
@@ -245,30 +273,44 @@ def allUserPosts():
     post_keys = filter(None, data.split(","))
     post_ids = list(set([extractId(key) for key in post_keys]))
 
-    # for each post, get its content and server
+    # get the content of every post with one MultiGet per server, repeating
+    # the request for the posts we didn't get until all of them are retrieved
     posts = []
     err = None
-    for post_id in post_ids:
-        # repeatedly send a Get request until post content is retrieved
-        for _ in range(TRIES):
-            try:
+    remaining = post_ids
+    for _ in range(TRIES):
+        try:
+            servers = {}
+            keys_by_server = {}
+            for post_id in remaining:
                 server = sc.getShardServer(post_id)
+                servers[post_id] = server
+                keys_by_server.setdefault(server, []).append(f"post_{post_id}")
+            data = shardkvMultiGet(keys_by_server)
+            missing = []
+            for post_id in remaining:
                 post_key = f"post_{post_id}"
-                post_content = shardkvGet(server, post_key)
-                posts.append(
-                    {"postId": post_key, "postContent": post_content, "shard": server}
-                )
+                if post_key in data:
+                    posts.append(
+                        {"postId": post_key, "postContent": data[post_key],
+                         "shard": servers[post_id]}
+                    )
+                else:
+                    missing.append(post_id)
+            remaining = missing
+            if not remaining:
                 err = None
                 break
-            except (IndexError, grpc.RpcError) as e:
-                err = e
-                print("Error encountered in allUserPosts 2! Updating cache...")
-                updateShardConfig(sc, app.config.get("shardmaster_location"))
-            # Sleep for 100ms between queries
-            sleep(0.1)
-        if err:
-            print("Error encountered: ", err)
-            return "", 500
+            err = f"posts not found: {remaining}"
+        except (IndexError, grpc.RpcError) as e:
+            err = e
+        print("Error encountered in allUserPosts 2! Updating cache...")
+        updateShardConfig(sc, app.config.get("shardmaster_location"))
+        # Sleep for 100ms between queries
+        sleep(0.1)
+    if err:
+        print("Error encountered: ", err)
+        return "", 500
 
     return jsonify({"posts": posts})
 
@@ -348,12 +390,9 @@ def deletePost():
     for _ in range(TRIES):
         try:
             post_server = sc.getShardServer(extractId(post_id))
-            shardkvDelete(post_server, post_id)
+            # the post's server also takes it off the user's posts
+            shardkvDelete(post_server, post_id, user_id)
             user_server = sc.getShardServer(extractId(user_id))
-            posts = shardkvGet(user_server, user_id + "_posts")
-            new_posts = filter(None, [s.strip() for s in posts.split(",")])
-            new_posts = ",".join(list(filter(lambda x: x != post_id and x != extractId(post_id), new_posts))) + ","
-            shardkvPut(user_server, user_id + "_posts", new_posts)
 
             return jsonify({"postServer": post_server, "userServer": user_server})
         except (IndexError, grpc.RpcError) as e:
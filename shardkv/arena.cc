@@ -0,0 +1,137 @@
+#include "arena.h"
+
+#include <algorithm>
+
+// the smallest class holds the link of a free block
+constexpr size_t MIN_BLOCK = 16;
+
+int Arena::classOf(size_t size) {
+  if (size <= 128) {
+    return (std::max(size, MIN_BLOCK) + 15) / 16 - 1;
+  }
+  // 2^k < size <= 2^(k+1), split in four steps
+  int k = 63 - __builtin_clzll(size - 1);
+  size_t step = (size_t)1 << (k - 2);
+  return 8 + (k - 7) * 4 + (int)((size - ((size_t)1 << k) + step - 1) / step) -
+         1;
+}
+
+size_t Arena::classSize(int c) {
+  if (c < 8) {
+    return 16 * (c + 1);
+  }
+  int k = 7 + (c - 8) / 4;
+  return ((size_t)1 << k) + ((c - 8) % 4 + 1) * ((size_t)1 << (k - 2));
+}
+
+Arena::~Arena() { release(); }
+
+char* Arena::Allocate(size_t size, size_t* capacity) {
+  std::lock_guard<std::mutex> lock(mtx);
+  blocks++;
+  if (size > ARENA_MAX_BLOCK) {
+    *capacity = (size + 15) / 16 * 16;
+    char* data = new char[sizeof(Header) + *capacity];
+    Header* h = reinterpret_cast<Header*>(data);
+    h->prev = nullptr;
+    h->next = big;
+    if (big != nullptr) {
+      big->prev = h;
+    }
+    big = h;
+    bytes += sizeof(Header) + *capacity;
+    return data + sizeof(Header);
+  }
+  int c = classOf(size);
+  *capacity = classSize(c);
+  if (free_lists[c] != nullptr) {
+    char* block = free_lists[c];
+    free_lists[c] = *reinterpret_cast<char**>(block);
+    return block;
+  }
+  if ((size_t)(end - next) < *capacity) {
+    // what's left of the chunk goes to the free lists, biggest blocks first
+    while ((size_t)(end - next) >= MIN_BLOCK) {
+      int fit = classOf(end - next);
+      if (classSize(fit) > (size_t)(end - next)) {
+        fit--;
+      }
+      *reinterpret_cast<char**>(next) = free_lists[fit];
+      free_lists[fit] = next;
+      next += classSize(fit);
+    }
+    chunk_size = chunk_size == 0 ? ARENA_MIN_CHUNK
+                                 : std::min(chunk_size * 2, ARENA_MAX_CHUNK);
+    char* data = new char[sizeof(Header) + chunk_size];
+    Header* h = reinterpret_cast<Header*>(data);
+    h->prev = nullptr;
+    h->next = chunks;
+    chunks = h;
+    bytes += sizeof(Header) + chunk_size;
+    next = data + sizeof(Header);
+    end = next + chunk_size;
+  }
+  char* block = next;
+  next += *capacity;
+  return block;
+}
+
+void Arena::Free(char* block, size_t capacity) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (capacity > ARENA_MAX_BLOCK) {
+    Header* h = reinterpret_cast<Header*>(block - sizeof(Header));
+    if (h->prev != nullptr) {
+      h->prev->next = h->next;
+    } else {
+      big = h->next;
+    }
+    if (h->next != nullptr) {
+      h->next->prev = h->prev;
+    }
+    bytes -= sizeof(Header) + capacity;
+    delete[] reinterpret_cast<char*>(h);
+  } else {
+    int c = classOf(capacity);
+    *reinterpret_cast<char**>(block) = free_lists[c];
+    free_lists[c] = block;
+  }
+  if (--blocks == 0) {
+    release();
+  }
+}
+
+bool Arena::Grow(char* block, size_t size, size_t* capacity) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (size > ARENA_MAX_BLOCK || block + *capacity != next) {
+    return false;
+  }
+  size_t grown = classSize(classOf(size));
+  if ((size_t)(end - block) < grown) {
+    return false;
+  }
+  next = block + grown;
+  *capacity = grown;
+  return true;
+}
+
+size_t Arena::Bytes() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return bytes;
+}
+
+void Arena::release() {
+  for (Header* list : {chunks, big}) {
+    while (list != nullptr) {
+      Header* next_header = list->next;
+      delete[] reinterpret_cast<char*>(list);
+      list = next_header;
+    }
+  }
+  chunks = nullptr;
+  big = nullptr;
+  std::fill(free_lists, free_lists + NUM_CLASSES, nullptr);
+  next = nullptr;
+  end = nullptr;
+  chunk_size = 0;
+  bytes = 0;
+}
@@ -0,0 +1,85 @@
+#ifndef SHARDING_ARENA_H
+#define SHARDING_ARENA_H
+
+#include <cstddef>
+#include <mutex>
+
+// blocks up to this size come from the arena's size classes; bigger ones are
+// allocated on their own
+constexpr size_t ARENA_MAX_BLOCK = 4096;
+
+// an arena's first chunk, and the most any chunk grows to
+constexpr size_t ARENA_MIN_CHUNK = 4096;
+constexpr size_t ARENA_MAX_CHUNK = 64 << 10;
+
+// A slab allocator for the values (and slot arrays) of a few FlatTables.
+//
+// A request is rounded up to one of 28 size classes: multiples of 16 bytes
+// up to 128, then four per doubling up to ARENA_MAX_BLOCK, so a block over
+// 128 bytes is at most a fifth slack. Blocks are carved out of chunks of
+// ARENA_MIN_CHUNK to ARENA_MAX_CHUNK bytes, and a freed block goes on its
+// class's free list for the next request of that class, so the heap sees one
+// allocation per chunk instead of one per value, and a block costs no malloc
+// header. Bigger blocks are allocated on their own, but still owned by the
+// arena.
+//
+// Once every block has been freed -- all the keys it held were erased,
+// handed off or spilled -- the arena gives all of its chunks back at once,
+// and the next request starts from a fresh ARENA_MIN_CHUNK one.
+//
+// Thread-safe: the tables sharing an arena are locked separately.
+class Arena {
+ public:
+  Arena() = default;
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // returns a block of at least size bytes (size > 0), 8-byte aligned.
+  // *capacity is set to the size it really has, what Free takes back
+  char* Allocate(size_t size, size_t* capacity);
+
+  // returns a block from Allocate, with the capacity it came with
+  void Free(char* block, size_t capacity);
+
+  // grows block, of *capacity bytes, to hold size bytes without moving it,
+  // if it's the last block carved from the newest chunk and the chunk has
+  // room. returns whether it did, setting *capacity to its new size. a
+  // value appended to right after it was written grows this way
+  bool Grow(char* block, size_t size, size_t* capacity);
+
+  // bytes taken from the heap, chunks and big blocks
+  size_t Bytes();
+
+ private:
+  static constexpr int NUM_CLASSES = 28;
+
+  // a chunk or a big block, followed by its data
+  struct Header {
+    Header* prev;
+    Header* next;
+  };
+
+  // the class of a block of size bytes, and the size of a class
+  static int classOf(size_t size);
+  static size_t classSize(int c);
+
+  // gives every chunk and big block back. caller must hold mtx
+  void release();
+
+  std::mutex mtx;
+  // freed blocks of each class, linked through their first 8 bytes
+  char* free_lists[NUM_CLASSES] = {};
+  // every chunk, and every big block, newest first
+  Header* chunks = nullptr;
+  Header* big = nullptr;
+  // the unused part of the newest chunk
+  char* next = nullptr;
+  char* end = nullptr;
+  size_t chunk_size = 0;
+  size_t blocks = 0;
+  size_t bytes = 0;
+};
+
+#endif  // SHARDING_ARENA_H
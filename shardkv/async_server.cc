@@ -0,0 +1,334 @@
+#include "async_server.h"
+
+#include <grpcpp/alarm.h>
+#include <chrono>
+#include <functional>
+
+using Empty = google::protobuf::Empty;
+
+// how long a forwarded Append or Delete waits before it is retried, like the
+// sync handlers' retry loops
+constexpr std::chrono::milliseconds FORWARD_RETRY(50);
+
+namespace {
+
+// every tag we hand to a completion queue is a Call. the poller that gets the
+// tag back calls Proceed with the ok flag the queue returned
+class Call {
+ public:
+  virtual ~Call() = default;
+  virtual void Proceed(bool ok) = 0;
+};
+
+std::unique_ptr<::grpc::ClientAsyncResponseReader<Empty>> prepareForward(
+    Shardkv::Stub* stub, ::grpc::ClientContext* cc, const AppendRequest& req,
+    ::grpc::CompletionQueue* cq) {
+  return stub->PrepareAsyncAppend(cc, req, cq);
+}
+
+std::unique_ptr<::grpc::ClientAsyncResponseReader<Empty>> prepareForward(
+    Shardkv::Stub* stub, ::grpc::ClientContext* cc, const DeleteRequest& req,
+    ::grpc::CompletionQueue* cq) {
+  return stub->PrepareAsyncDelete(cc, req, cq);
+}
+
+// A unary RPC. handle runs the local part of the request on the poller that
+// received it. The forwards it leaves are then sent to their servers one at a
+// time, each retried every FORWARD_RETRY until it succeeds, and only then is
+// the response sent -- the same order the sync handlers use, but nothing
+// blocks while a forward is in flight or waiting to be retried.
+template <typename Request, typename Response, typename Forward>
+class UnaryCall : public Call {
+ public:
+  using RequestFn = void (Shardkv::AsyncService::*)(
+      ::grpc::ServerContext*, Request*,
+      ::grpc::ServerAsyncResponseWriter<Response>*, ::grpc::CompletionQueue*,
+      ::grpc::ServerCompletionQueue*, void*);
+  using HandleFn = std::function<::grpc::Status(
+      ::grpc::ServerContext*, const Request*, Response*, Forwards<Forward>*)>;
+
+  struct Method {
+    Shardkv::AsyncService* service;
+    RequestFn request;
+    HandleFn handle;
+    PeerPool* peers;
+  };
+
+  // waits for the next call of method on cq. the call deletes itself once
+  // it's done
+  static void Accept(const Method& method, ::grpc::ServerCompletionQueue* cq) {
+    new UnaryCall(method, cq);
+  }
+
+  void Proceed(bool ok) override {
+    switch (state) {
+      case REQUESTED:
+        if (!ok) {  // the queue is shutting down
+          delete this;
+          return;
+        }
+        Accept(method, cq);
+        status = method.handle(&ctx, &request, &response, &forwards);
+        sendNext();
+        break;
+      case FORWARDING:
+        if (!forward_status.ok()) {
+          state = BACKING_OFF;
+          alarm = std::make_unique<::grpc::Alarm>();
+          alarm->Set(cq, std::chrono::system_clock::now() + FORWARD_RETRY,
+                     this);
+          break;
+        }
+        next++;
+        sendNext();
+        break;
+      case BACKING_OFF:
+        send();
+        break;
+      case FINISHED:
+        delete this;
+        break;
+    }
+  }
+
+ private:
+  enum State { REQUESTED, FORWARDING, BACKING_OFF, FINISHED };
+
+  UnaryCall(const Method& method, ::grpc::ServerCompletionQueue* cq)
+      : method(method), cq(cq), responder(&ctx) {
+    (method.service->*method.request)(&ctx, &request, &responder, cq, cq,
+                                      this);
+  }
+
+  // sends forwards[next], or the response once every forward went through
+  void sendNext() {
+    if (next == forwards.size()) {
+      state = FINISHED;
+      responder.Finish(response, status, this);
+      return;
+    }
+    stub = method.peers->Get(forwards[next].first);
+    send();
+  }
+
+  void send() {
+    state = FORWARDING;
+    // a ClientContext can't be reused, so every attempt gets a new one
+    forward_cc = std::make_unique<::grpc::ClientContext>();
+    forward_reader =
+        prepareForward(stub.get(), forward_cc.get(), forwards[next].second, cq);
+    forward_reader->StartCall();
+    forward_reader->Finish(&forward_response, &forward_status, this);
+  }
+
+  const Method method;
+  ::grpc::ServerCompletionQueue* cq;
+  State state = REQUESTED;
+
+  ::grpc::ServerContext ctx;
+  Request request;
+  Response response;
+  ::grpc::Status status;
+  ::grpc::ServerAsyncResponseWriter<Response> responder;
+
+  Forwards<Forward> forwards;
+  size_t next = 0;
+  std::shared_ptr<Shardkv::Stub> stub;
+  std::unique_ptr<::grpc::ClientContext> forward_cc;
+  std::unique_ptr<::grpc::ClientAsyncResponseReader<Empty>> forward_reader;
+  Empty forward_response;
+  ::grpc::Status forward_status;
+  std::unique_ptr<::grpc::Alarm> alarm;
+};
+
+// A TransferShard stream. Each batch is applied as it arrives and then
+// acknowledged, and the first one we reject ends the call with that error.
+class TransferCall : public Call {
+ public:
+  static void Accept(Shardkv::AsyncService* service, ShardkvServer* shardkv,
+                     ::grpc::ServerCompletionQueue* cq) {
+    new TransferCall(service, shardkv, cq);
+  }
+
+  void Proceed(bool ok) override {
+    switch (state) {
+      case REQUESTED:
+        if (!ok) {  // the queue is shutting down
+          delete this;
+          return;
+        }
+        Accept(service, shardkv, cq);
+        state = READING;
+        stream.Read(&batch, this);
+        break;
+      case READING: {
+        if (!ok) {  // the sender is done
+          state = FINISHED;
+          stream.Finish(::grpc::Status::OK, this);
+          break;
+        }
+        ::grpc::Status status = shardkv->ApplyBatch(&batch, &response);
+        if (!status.ok()) {
+          state = FINISHED;
+          stream.Finish(status, this);
+          break;
+        }
+        state = ACKING;
+        stream.Write(response, this);
+        break;
+      }
+      case ACKING:
+        if (!ok) {  // the sender went away
+          state = FINISHED;
+          stream.Finish(::grpc::Status::OK, this);
+          break;
+        }
+        state = READING;
+        batch.Clear();
+        stream.Read(&batch, this);
+        break;
+      case FINISHED:
+        delete this;
+        break;
+    }
+  }
+
+ private:
+  enum State { REQUESTED, READING, ACKING, FINISHED };
+
+  TransferCall(Shardkv::AsyncService* service, ShardkvServer* shardkv,
+               ::grpc::ServerCompletionQueue* cq)
+      : service(service), shardkv(shardkv), cq(cq), stream(&ctx) {
+    service->RequestTransferShard(&ctx, &stream, cq, cq, this);
+  }
+
+  Shardkv::AsyncService* service;
+  ShardkvServer* shardkv;
+  ::grpc::ServerCompletionQueue* cq;
+  State state = REQUESTED;
+
+  ::grpc::ServerContext ctx;
+  ::grpc::ServerAsyncReaderWriter<TransferResponse, TransferBatch> stream;
+  TransferBatch batch;
+  TransferResponse response;
+};
+
+using GetCall = UnaryCall<GetRequest, GetResponse, AppendRequest>;
+using PutCall = UnaryCall<PutRequest, Empty, AppendRequest>;
+using AppendCall = UnaryCall<AppendRequest, Empty, AppendRequest>;
+using DeleteCall = UnaryCall<DeleteRequest, Empty, DeleteRequest>;
+using MultiGetCall = UnaryCall<MultiGetRequest, MultiResponse, AppendRequest>;
+using MultiPutCall = UnaryCall<MultiPutRequest, MultiResponse, AppendRequest>;
+using ListUsersCall =
+    UnaryCall<ListUsersRequest, ListUsersResponse, AppendRequest>;
+using ListPostsCall =
+    UnaryCall<ListPostsRequest, ListPostsResponse, AppendRequest>;
+
+}  // namespace
+
+AsyncShardkvServer::AsyncShardkvServer(ShardkvServer* shardkv,
+                                       ::grpc::ServerBuilder* builder,
+                                       int num_cqs, int pollers_per_cq)
+    : shardkv(shardkv), pollers_per_cq(pollers_per_cq) {
+  builder->RegisterService(&service);
+  for (int i = 0; i < num_cqs; i++) {
+    cqs.push_back(builder->AddCompletionQueue());
+  }
+}
+
+AsyncShardkvServer::~AsyncShardkvServer() {
+  for (auto& cq : cqs) {
+    cq->Shutdown();
+  }
+  Wait();
+}
+
+void AsyncShardkvServer::Start() {
+  ShardkvServer* kv = shardkv;
+  PeerPool* peers = &shardkv->Peers();
+  GetCall::Method get{
+      &service, &Shardkv::AsyncService::RequestGet,
+      [kv](::grpc::ServerContext* ctx, const GetRequest* req, GetResponse* res,
+           Forwards<AppendRequest>*) { return kv->Get(ctx, req, res); },
+      peers};
+  PutCall::Method put{
+      &service, &Shardkv::AsyncService::RequestPut,
+      [kv](::grpc::ServerContext*, const PutRequest* req, Empty*,
+           Forwards<AppendRequest>* appends) {
+        return kv->PutLocal(req, appends);
+      },
+      peers};
+  AppendCall::Method append{
+      &service, &Shardkv::AsyncService::RequestAppend,
+      [kv](::grpc::ServerContext* ctx, const AppendRequest* req, Empty* res,
+           Forwards<AppendRequest>*) { return kv->Append(ctx, req, res); },
+      peers};
+  DeleteCall::Method del{
+      &service, &Shardkv::AsyncService::RequestDelete,
+      [kv](::grpc::ServerContext*, const DeleteRequest* req, Empty*,
+           Forwards<DeleteRequest>* deletes) {
+        return kv->DeleteLocal(req, deletes);
+      },
+      peers};
+  MultiGetCall::Method multi_get{
+      &service, &Shardkv::AsyncService::RequestMultiGet,
+      [kv](::grpc::ServerContext* ctx, const MultiGetRequest* req,
+           MultiResponse* res, Forwards<AppendRequest>*) {
+        return kv->MultiGet(ctx, req, res);
+      },
+      peers};
+  MultiPutCall::Method multi_put{
+      &service, &Shardkv::AsyncService::RequestMultiPut,
+      [kv](::grpc::ServerContext*, const MultiPutRequest* req,
+           MultiResponse* res, Forwards<AppendRequest>* appends) {
+        return kv->MultiPutLocal(req, res, appends);
+      },
+      peers};
+  ListUsersCall::Method list_users{
+      &service, &Shardkv::AsyncService::RequestListUsers,
+      [kv](::grpc::ServerContext* ctx, const ListUsersRequest* req,
+           ListUsersResponse* res, Forwards<AppendRequest>*) {
+        return kv->ListUsers(ctx, req, res);
+      },
+      peers};
+  ListPostsCall::Method list_posts{
+      &service, &Shardkv::AsyncService::RequestListPosts,
+      [kv](::grpc::ServerContext* ctx, const ListPostsRequest* req,
+           ListPostsResponse* res, Forwards<AppendRequest>*) {
+        return kv->ListPosts(ctx, req, res);
+      },
+      peers};
+
+  for (auto& cq : cqs) {
+    // one outstanding accept per method and poller, so a burst of new calls
+    // doesn't wait on each accepted call to post the next accept
+    for (int i = 0; i < pollers_per_cq; i++) {
+      GetCall::Accept(get, cq.get());
+      PutCall::Accept(put, cq.get());
+      AppendCall::Accept(append, cq.get());
+      DeleteCall::Accept(del, cq.get());
+      MultiGetCall::Accept(multi_get, cq.get());
+      MultiPutCall::Accept(multi_put, cq.get());
+      ListUsersCall::Accept(list_users, cq.get());
+      ListPostsCall::Accept(list_posts, cq.get());
+      TransferCall::Accept(&service, shardkv, cq.get());
+    }
+    for (int i = 0; i < pollers_per_cq; i++) {
+      pollers.emplace_back([cq = cq.get()]() {
+        void* tag;
+        bool ok;
+        while (cq->Next(&tag, &ok)) {
+          static_cast<Call*>(tag)->Proceed(ok);
+        }
+      });
+    }
+  }
+}
+
+void AsyncShardkvServer::Wait() {
+  for (auto& poller : pollers) {
+    if (poller.joinable()) {
+      poller.join();
+    }
+  }
+}
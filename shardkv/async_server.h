@@ -0,0 +1,49 @@
+#ifndef SHARDING_ASYNC_SERVER_H
+#define SHARDING_ASYNC_SERVER_H
+
+#include <grpcpp/grpcpp.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "shardkv.h"
+
+// Serves a ShardkvServer through Shardkv::AsyncService instead of the sync
+// API. Requests are driven by num_cqs completion queues, each polled by
+// pollers_per_cq threads. The RPCs Put and Delete make to other servers are
+// sent asynchronously on the same queues and retried with an alarm, so a slow
+// or unavailable peer suspends the request waiting on it instead of holding a
+// server thread for the whole retry loop.
+//
+// usage:
+//   ::grpc::ServerBuilder builder;
+//   builder.AddListeningPort(addr, ...);
+//   AsyncShardkvServer async(&shardkv, &builder, num_cqs, pollers_per_cq);
+//   auto server = builder.BuildAndStart();
+//   async.Start();
+class AsyncShardkvServer {
+ public:
+  // registers the async service and its completion queues with builder, which
+  // must not be built yet
+  AsyncShardkvServer(ShardkvServer* shardkv, ::grpc::ServerBuilder* builder,
+                     int num_cqs, int pollers_per_cq);
+
+  // shuts the completion queues down and joins the pollers. the server must be
+  // shut down first
+  ~AsyncShardkvServer();
+
+  // starts accepting calls and the poller threads. call after BuildAndStart
+  void Start();
+
+  // blocks until the pollers exit (i.e. forever, unless the server shuts down)
+  void Wait();
+
+ private:
+  ShardkvServer* shardkv;
+  Shardkv::AsyncService service;
+  const int pollers_per_cq;
+  std::vector<std::unique_ptr<::grpc::ServerCompletionQueue>> cqs;
+  std::vector<std::thread> pollers;
+};
+
+#endif  // SHARDING_ASYNC_SERVER_H
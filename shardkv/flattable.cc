@@ -0,0 +1,253 @@
+#include "flattable.h"
+
+#include <algorithm>
+#include <cstring>
+
+// the smallest slot array, and the biggest that may fill up. a bucket of
+// KvStore holds the two or three keys of one ID, which fit in one of them
+// without probing past a cache line
+constexpr size_t MIN_SLOTS = 2;
+constexpr size_t FULL_SLOTS = 4;
+
+// whether a table of capacity slots has room for count entries
+static bool fits(size_t count, size_t capacity) {
+  return capacity <= FULL_SLOTS ? count <= capacity
+                                : count * 4 <= capacity * 3;
+}
+
+FlatTable::Heap FlatTable::heap(const Slot& slot) {
+  Heap h;
+  memcpy(&h, slot.value, sizeof(h));
+  return h;
+}
+
+std::string_view FlatTable::view(const Slot& slot) {
+  if (onHeap(slot)) {
+    Heap h = heap(slot);
+    return std::string_view(h.data, h.size);
+  }
+  return std::string_view(slot.value, (unsigned char)slot.value[FLAT_INLINE]);
+}
+
+void FlatTable::assign(Slot& slot, std::string_view value) {
+  if (onHeap(slot)) {
+    Heap h = heap(slot);
+    // keep a block the value still fills most of
+    if (value.size() > FLAT_INLINE && value.size() <= h.capacity &&
+        value.size() * 2 >= h.capacity) {
+      memmove(h.data, value.data(), value.size());
+      h.size = value.size();
+      memcpy(slot.value, &h, sizeof(h));
+      return;
+    }
+    if (value.size() > FLAT_INLINE) {
+      size_t capacity;
+      char* data = arena->Allocate(value.size(), &capacity);
+      memcpy(data, value.data(), value.size());
+      arena->Free(h.data, h.capacity);
+      h = Heap{data, (uint32_t)value.size(), (uint32_t)capacity};
+      memcpy(slot.value, &h, sizeof(h));
+      return;
+    }
+    // value may be in the block being freed
+    char copy[FLAT_INLINE];
+    memcpy(copy, value.data(), value.size());
+    arena->Free(h.data, h.capacity);
+    memcpy(slot.value, copy, value.size());
+    slot.value[FLAT_INLINE] = (char)value.size();
+    return;
+  }
+  if (value.size() <= FLAT_INLINE) {
+    memmove(slot.value, value.data(), value.size());
+    slot.value[FLAT_INLINE] = (char)value.size();
+    return;
+  }
+  size_t capacity;
+  char* data = arena->Allocate(value.size(), &capacity);
+  memcpy(data, value.data(), value.size());
+  Heap h{data, (uint32_t)value.size(), (uint32_t)capacity};
+  memcpy(slot.value, &h, sizeof(h));
+  slot.value[FLAT_INLINE] = HEAP_TAG;
+}
+
+void FlatTable::freeValue(Slot& slot) {
+  if (onHeap(slot)) {
+    Heap h = heap(slot);
+    arena->Free(h.data, h.capacity);
+    slot.value[FLAT_INLINE] = 0;
+  }
+}
+
+FlatTable::Slot* FlatTable::allocateSlots(size_t n) {
+  size_t bytes;
+  char* block = arena->Allocate(n * sizeof(Slot), &bytes);
+  memset(block, 0, n * sizeof(Slot));
+  return reinterpret_cast<Slot*>(block);
+}
+
+size_t FlatTable::home(PackedKey key) const {
+  // Fibonacci hashing: the top bits of the product are well mixed even for
+  // keys that only differ in the low bits of their ID
+  return (key * 0x9E3779B97F4A7C15ULL) >> shift;
+}
+
+size_t FlatTable::probe(PackedKey key) const {
+  size_t mask = capacity - 1;
+  size_t i = home(key);
+  // a small table may be full
+  for (size_t n = 0; n < capacity; n++, i = (i + 1) & mask) {
+    if (slots[i].key == key || slots[i].key == 0) {
+      return i;
+    }
+  }
+  return capacity;
+}
+
+void FlatTable::rehash(size_t n) {
+  Slot* old = slots;
+  size_t old_capacity = capacity;
+  slots = allocateSlots(n);
+  capacity = n;
+  shift = 64 - __builtin_ctzll(n);
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old[i].key != 0) {
+      place(old[i]);
+    }
+  }
+  if (old != nullptr) {
+    arena->Free(reinterpret_cast<char*>(old), old_capacity * sizeof(Slot));
+  }
+}
+
+FlatTable::Slot& FlatTable::place(const Slot& slot) {
+  Slot& to = slots[probe(slot.key)];
+  to = slot;
+  return to;
+}
+
+FlatTable::Slot& FlatTable::insert(PackedKey key, bool* inserted) {
+  if (count > 0) {
+    size_t i = probe(key);
+    if (i < capacity && slots[i].key == key) {
+      *inserted = false;
+      return slots[i];
+    }
+  }
+  // keep a bigger table at most 3/4 full so probe runs stay short
+  if (!fits(count + 1, capacity)) {
+    rehash(std::max(MIN_SLOTS, capacity * 2));
+  }
+  count++;
+  *inserted = true;
+  Slot empty = {};
+  empty.key = key;
+  return place(empty);
+}
+
+bool FlatTable::Find(PackedKey key, std::string_view* value) const {
+  if (count == 0) {
+    return false;
+  }
+  size_t i = probe(key);
+  if (i == capacity || slots[i].key == 0) {
+    return false;
+  }
+  *value = view(slots[i]);
+  return true;
+}
+
+bool FlatTable::Set(PackedKey key, std::string_view value) {
+  bool inserted;
+  assign(insert(key, &inserted), value);
+  return inserted;
+}
+
+bool FlatTable::Append(PackedKey key, std::string_view data) {
+  bool inserted;
+  Slot& slot = insert(key, &inserted);
+  std::string_view old = view(slot);
+  size_t size = old.size() + data.size();
+  if (!onHeap(slot) && size <= FLAT_INLINE) {
+    memcpy(slot.value + old.size(), data.data(), data.size());
+    slot.value[FLAT_INLINE] = (char)size;
+    return inserted;
+  }
+  Heap h = onHeap(slot) ? heap(slot) : Heap{nullptr, 0, 0};
+  size_t grown = h.capacity;
+  if (size > h.capacity && h.data != nullptr &&
+      arena->Grow(h.data, size, &grown)) {
+    h.capacity = grown;
+  }
+  if (size > h.capacity) {
+    // at least double, so a value built up by appends is copied O(1) times
+    // per byte
+    size_t capacity;
+    char* data = arena->Allocate(std::max(size, old.size() * 2), &capacity);
+    memcpy(data, old.data(), old.size());
+    if (h.data != nullptr) {
+      arena->Free(h.data, h.capacity);
+    }
+    h = Heap{data, (uint32_t)old.size(), (uint32_t)capacity};
+  }
+  memcpy(h.data + h.size, data.data(), data.size());
+  h.size = size;
+  memcpy(slot.value, &h, sizeof(h));
+  slot.value[FLAT_INLINE] = HEAP_TAG;
+  return inserted;
+}
+
+void FlatTable::Reserve(size_t n) {
+  size_t target = std::max(MIN_SLOTS, capacity);
+  while (!fits(n, target)) {
+    target *= 2;
+  }
+  if (target > capacity) {
+    rehash(target);
+  }
+}
+
+bool FlatTable::Erase(PackedKey key, std::string* value) {
+  if (count == 0) {
+    return false;
+  }
+  size_t mask = capacity - 1;
+  size_t i = probe(key);
+  if (i == capacity || slots[i].key == 0) {
+    return false;
+  }
+  if (value != nullptr) {
+    value->assign(view(slots[i]));
+  }
+  freeValue(slots[i]);
+  // move back every later entry of the run that may move into the hole at i
+  // (its home isn't between i and it), so no lookup stops at the hole before
+  // reaching its key. in a full table the run ends at the hole itself
+  for (size_t j = (i + 1) & mask; j != i && slots[j].key != 0;
+       j = (j + 1) & mask) {
+    size_t h = home(slots[j].key);
+    if (((j - h) & mask) >= ((j - i) & mask)) {
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+  slots[i] = Slot{};
+  if (--count == 0) {
+    Clear();
+  }
+  return true;
+}
+
+void FlatTable::Clear() {
+  for (size_t i = 0; i < capacity; i++) {
+    if (slots[i].key != 0) {
+      freeValue(slots[i]);
+    }
+  }
+  if (slots != nullptr) {
+    arena->Free(reinterpret_cast<char*>(slots), capacity * sizeof(Slot));
+  }
+  slots = nullptr;
+  capacity = 0;
+  count = 0;
+  shift = 64;
+}
@@ -0,0 +1,161 @@
+#ifndef SHARDING_FLATTABLE_H
+#define SHARDING_FLATTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "../common/keys.h"
+#include "arena.h"
+
+// values up to this many bytes are stored in the table's slot itself
+constexpr size_t FLAT_INLINE = 23;
+
+// An open-addressing hash table from PackedKey to a string value, used by
+// KvStore for the keys of the social schema.
+//
+// Every entry is a 32 byte slot (the 8 byte key and the value) in one flat
+// array, probed linearly from the key's hash, so a lookup touches one or two
+// cache lines and there is no per-key node or key string on the heap. Values
+// of up to FLAT_INLINE bytes (user names, short posts) are stored inline in
+// the slot; a longer one is a block of the table's Arena, as are the slot
+// arrays, so filling the table doesn't allocate from the heap per value.
+// Appending to a value grows its block geometrically, in place when the
+// block has room. Erasing shifts the following entries of the probe run back
+// instead of leaving tombstones, so lookups never get slower as keys come and
+// go. Not thread-safe: KvStore locks the stripe that owns the table.
+class FlatTable {
+ public:
+  FlatTable() = default;
+
+  // slots point into the arena, and only the table may free them
+  FlatTable(const FlatTable&) = delete;
+  FlatTable& operator=(const FlatTable&) = delete;
+
+  // the arena the table allocates from, which may be shared with other
+  // tables and must outlive this one's entries. set it while the table is
+  // empty
+  void SetArena(Arena* arena) { this->arena = arena; }
+
+  // points value at the value of key. returns false if it's missing. value
+  // is valid until the next change to the table
+  bool Find(PackedKey key, std::string_view* value) const;
+
+  // sets the value of key, inserting it if it's missing. returns whether it
+  // was
+  bool Set(PackedKey key, std::string_view value);
+
+  // appends data to the value of key, inserting it if it's missing. returns
+  // whether it was
+  bool Append(PackedKey key, std::string_view data);
+
+  // removes key, copying its old value into value (if non-null). returns
+  // false if key was not present
+  bool Erase(PackedKey key, std::string* value = nullptr);
+
+  // calls fn(key, value) on every entry, in no particular order
+  template <typename Fn>
+  void ForEach(Fn fn) const {
+    for (size_t i = 0; i < capacity; i++) {
+      if (slots[i].key != 0) {
+        fn(slots[i].key, view(slots[i]));
+      }
+    }
+  }
+
+  // removes every entry whose key pred returns true for, calling
+  // fn(key, value) on each before it goes
+  template <typename Pred, typename Fn>
+  void EraseIf(Pred pred, Fn fn) {
+    if (count == 0) {
+      return;
+    }
+    Slot* old = slots;
+    slots = allocateSlots(capacity);
+    count = 0;
+    for (size_t i = 0; i < capacity; i++) {
+      if (old[i].key == 0) {
+        continue;
+      }
+      if (pred(old[i].key)) {
+        fn(old[i].key, view(old[i]));
+        freeValue(old[i]);
+      } else {
+        place(old[i]);
+        count++;
+      }
+    }
+    arena->Free(reinterpret_cast<char*>(old), capacity * sizeof(Slot));
+    if (count == 0) {
+      Clear();
+    }
+  }
+
+  // removes every entry, giving their blocks back to the arena
+  void Clear();
+
+  // makes room for n entries in all, so inserting up to that many doesn't
+  // rehash. filling a table from another's slots in order would otherwise
+  // pack them into long probe runs while it grows
+  void Reserve(size_t n);
+
+  size_t Size() const { return count; }
+
+ private:
+  // the last byte of value is the length of an inline value, or HEAP_TAG
+  // if value holds a Heap instead
+  struct Slot {
+    PackedKey key;  // 0 marks an empty slot
+    char value[FLAT_INLINE + 1];
+  };
+  struct Heap {
+    char* data;
+    uint32_t size;
+    uint32_t capacity;
+  };
+  static constexpr char HEAP_TAG = (char)0xff;
+
+  static bool onHeap(const Slot& slot) {
+    return slot.value[FLAT_INLINE] == HEAP_TAG;
+  }
+  static Heap heap(const Slot& slot);
+  static std::string_view view(const Slot& slot);
+
+  // sets the value of slot to value, which may point into it
+  void assign(Slot& slot, std::string_view value);
+
+  // gives slot's value block back, if it has one
+  void freeValue(Slot& slot);
+
+  // a zeroed slot array of n (a power of two) slots from the arena. n slots
+  // of 32 bytes are always a whole size class
+  Slot* allocateSlots(size_t n);
+
+  // the home slot of key
+  size_t home(PackedKey key) const;
+
+  // the index of key's slot, or of the empty slot ending its probe run
+  size_t probe(PackedKey key) const;
+
+  // resizes the slot array to n slots (a power of two) and reinserts every
+  // entry
+  void rehash(size_t n);
+
+  // copies slot, whose key must not be in the table, to the first free slot
+  // of its probe run. the table must have room for it. doesn't update count
+  Slot& place(const Slot& slot);
+
+  // returns key's slot, inserting an empty value if it's missing. *inserted
+  // is set to whether it was
+  Slot& insert(PackedKey key, bool* inserted);
+
+  Arena* arena = nullptr;
+  Slot* slots = nullptr;
+  size_t capacity = 0;
+  size_t count = 0;
+  // 64 - log2(capacity), the shift that maps a hash to a slot
+  int shift = 64;
+};
+
+#endif  // SHARDING_FLATTABLE_H
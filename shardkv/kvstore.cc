@@ -0,0 +1,1070 @@
+#include "kvstore.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// a spilled stripe is its entries back to back: key length, value length,
+// whether it's a list, key, value
+constexpr size_t SPILL_ENTRY_HEADER = 2 * sizeof(uint32_t) + 1;
+
+// the ID of keys shaped like <word>_<ID>[_<word>]. returns false for keys
+// like all_users that have no ID
+static bool keyID(const std::string& key, unsigned int* id) {
+  ParsedKey parsed = ParseKey(key);
+  *id = parsed.id;
+  return parsed.HasID();
+}
+
+// the list a snapshot or spill file entry holds, as PostList::Encode left it
+static PostList decodeList(std::string_view value) {
+  PostList list;
+  if (!PostList::Decode(value, &list)) {
+    // both files are only ever written by us
+    fprintf(stderr, "kvstore: garbled post list\n");
+    abort();
+  }
+  return list;
+}
+
+static int64_t now() {
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+KvStore::KvStore(unsigned int min_id, unsigned int max_id)
+    : min_id(min_id),
+      max_id(max_id),
+      arenas((max_id - min_id) / KV_ARENA_IDS + 1 + KV_STRIPES),
+      buckets(max_id - min_id + 1) {
+  for (size_t i = 0; i < buckets.size(); i++) {
+    buckets[i].table.SetArena(&arenas[i / KV_ARENA_IDS]);
+  }
+  for (size_t i = 0; i < KV_STRIPES; i++) {
+    overflow[i].table.SetArena(&arenas[arenas.size() - KV_STRIPES + i]);
+  }
+}
+
+KvStore::~KvStore() {
+  if (spill_fd >= 0) {
+    close(spill_fd);
+  }
+}
+
+KvStore::Stripe& KvStore::stripeFor(const std::string& key,
+                                    PackedKey* packed) {
+  ParsedKey parsed = ParseKey(key);
+  *packed = PackKey(key, parsed);
+  unsigned int id = parsed.id;
+  if (parsed.HasID() && id >= min_id && id <= max_id) {
+    return buckets[id - min_id];
+  }
+  return overflow[std::hash<std::string>{}(key) & (KV_STRIPES - 1)];
+}
+
+size_t KvStore::indexOf(const Stripe& s) const {
+  if (&s >= overflow && &s < overflow + KV_STRIPES) {
+    return buckets.size() + (&s - overflow);
+  }
+  return &s - buckets.data();
+}
+
+KvStore::Stripe& KvStore::stripeAt(size_t index) {
+  if (index < buckets.size()) {
+    return buckets[index];
+  }
+  return overflow[index - buckets.size()];
+}
+
+bool KvStore::findCold(const Stripe& s, const std::string& key,
+                       MappedSnapshot::Entry* entry) const {
+  return base->Find(indexOf(s), key, entry);
+}
+
+void KvStore::warm(Stripe& s) {
+  s.last_access.store(now(), std::memory_order_relaxed);
+  if (!s.cold && !s.spilled) {
+    return;
+  }
+  size_t bytes = 0;
+  auto load = [&s, &bytes](std::string_view k, std::string_view value,
+                           bool is_list) {
+    std::string key(k);
+    if (is_list) {
+      auto list = s.lists.emplace(key, decodeList(value)).first;
+      bytes += listBytes(key, list->second);
+      return;
+    }
+    setPlain(s, key, PackKey(key, ParseKey(key)), value);
+    bytes += plainBytes(key, value);
+  };
+  if (s.spilled) {
+    auto start = std::chrono::steady_clock::now();
+    s.table.Reserve(s.spill_count);
+    readSpilled(s, load);
+    // its part of the file is garbage now. the disk blocks are given back
+    // later, a batch at a time
+    {
+      std::lock_guard<std::mutex> lock(freed_mutex);
+      freed.emplace_back(s.spill_offset, s.spill_length);
+      freed_bytes += s.spill_length;
+    }
+    s.spilled = false;
+    spilled_bytes -= s.spill_length;
+    spilled_stripes--;
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    faults++;
+    fault_micros_total += micros;
+    uint64_t max = fault_micros_max;
+    while (micros > max && !fault_micros_max.compare_exchange_weak(max, micros)) {
+    }
+  } else {
+    s.table.Reserve(base->Count(indexOf(s)));
+    base->ForEach(indexOf(s), [&load](const MappedSnapshot::Entry& entry) {
+      load(entry.key, entry.value, entry.is_list);
+    });
+    s.cold = false;
+    // nothing reads the mapping once no stripe is cold
+    if (--cold_stripes == 0) {
+      base.reset();
+    }
+  }
+  resize(s, 0, bytes);
+}
+
+std::shared_lock<std::shared_mutex> KvStore::readLock(Stripe& s) {
+  s.last_access.store(now(), std::memory_order_relaxed);
+  while (true) {
+    std::shared_lock<std::shared_mutex> lock(s.mtx);
+    if (!s.spilled) {
+      return lock;
+    }
+    lock.unlock();
+    {
+      std::unique_lock<std::shared_mutex> write_lock(s.mtx);
+      warm(s);
+    }
+    // s may be spilled again meanwhile by someone else, so check again
+    enforceBudget(&s);
+  }
+}
+
+void KvStore::readSpilled(
+    const Stripe& s,
+    const std::function<void(std::string_view, std::string_view, bool)>& fn) {
+  std::string data(s.spill_length, '\0');
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = pread(spill_fd, &data[done], data.size() - done,
+                      s.spill_offset + done);
+    if (n <= 0) {
+      // the stripe's keys are nowhere else
+      perror("kvstore: reading spill file");
+      abort();
+    }
+    done += n;
+  }
+  for (size_t pos = 0; pos + SPILL_ENTRY_HEADER <= data.size();) {
+    uint32_t key_len, value_len;
+    memcpy(&key_len, &data[pos], sizeof(key_len));
+    memcpy(&value_len, &data[pos + sizeof(key_len)], sizeof(value_len));
+    bool is_list = data[pos + 2 * sizeof(uint32_t)] != 0;
+    pos += SPILL_ENTRY_HEADER;
+    std::string_view all(data);
+    fn(all.substr(pos, key_len), all.substr(pos + key_len, value_len),
+       is_list);
+    pos += key_len + value_len;
+  }
+}
+
+void KvStore::spill(Stripe& s) {
+  std::string data;
+  size_t count = 0;
+  auto add = [&data, &count](std::string_view key, std::string_view value,
+                             bool is_list) {
+    uint32_t key_len = key.size();
+    uint32_t value_len = value.size();
+    data.append((const char*)&key_len, sizeof(key_len));
+    data.append((const char*)&value_len, sizeof(value_len));
+    data.push_back(is_list ? 1 : 0);
+    data.append(key);
+    data.append(value);
+    count++;
+  };
+  s.table.ForEach([&add](PackedKey key, std::string_view value) {
+    add(UnpackKey(key), value, false);
+  });
+  for (auto& kv : s.map) {
+    add(kv.first, kv.second, false);
+  }
+  for (auto& kv : s.lists) {
+    add(kv.first, kv.second.Encode(), true);
+  }
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = pwrite(spill_fd, data.data() + done, data.size() - done,
+                       spill_end + done);
+    if (n < 0) {
+      // the disk is full or failing: keep the stripe in memory instead
+      perror("kvstore: writing spill file");
+      return;
+    }
+    done += n;
+  }
+  s.spill_offset = spill_end;
+  s.spill_length = data.size();
+  s.spill_count = count;
+  spill_end += data.size();
+  // swapped out rather than cleared, so their buckets are freed too
+  s.table.Clear();
+  std::unordered_map<std::string, std::string>().swap(s.map);
+  std::unordered_map<std::string, PostList>().swap(s.lists);
+  resize(s, s.bytes, 0);
+  s.spilled = true;
+  spilled_bytes += data.size();
+  spilled_stripes++;
+  spills++;
+}
+
+void KvStore::enforceBudget(const Stripe* keep) {
+  if (budget == 0 || resident_bytes <= budget) {
+    return;
+  }
+  // whoever holds it is spilling already
+  std::unique_lock<std::mutex> lock(spill_mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> freed_lock(freed_mutex);
+    if (spilled_stripes == 0) {
+      // nothing points into the file, so start it over
+      if (ftruncate(spill_fd, 0) == 0) {
+        spill_end = 0;
+      }
+      freed.clear();
+      freed_bytes = 0;
+    } else if (freed_bytes > spilled_bytes) {
+      // most of the file is garbage
+      for (auto& [offset, length] : freed) {
+        fallocate(spill_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  offset, length);
+      }
+      freed.clear();
+      freed_bytes = 0;
+    }
+  }
+  std::vector<std::pair<int64_t, size_t>> oldest;
+  for (size_t i = 0; i < buckets.size() + KV_STRIPES; i++) {
+    oldest.emplace_back(
+        stripeAt(i).last_access.load(std::memory_order_relaxed), i);
+  }
+  std::sort(oldest.begin(), oldest.end());
+  size_t target = budget / 10 * KV_SPILL_TARGET_TENTHS;
+  for (auto& [access, i] : oldest) {
+    if (resident_bytes <= target) {
+      break;
+    }
+    Stripe& s = stripeAt(i);
+    if (&s == keep) {
+      continue;
+    }
+    // only tried, as we may be called by a reader waiting for a stripe;
+    // a stripe someone has locked is in use anyway
+    std::unique_lock<std::shared_mutex> stripe_lock(s.mtx, std::try_to_lock);
+    if (stripe_lock.owns_lock() && !s.spilled && !s.cold && s.bytes > 0) {
+      spill(s);
+    }
+  }
+}
+
+size_t KvStore::plainBytes(std::string_view key, std::string_view value) {
+  return KV_ENTRY_OVERHEAD + key.size() + value.size();
+}
+
+size_t KvStore::listBytes(std::string_view key, const PostList& list) {
+  return KV_ENTRY_OVERHEAD + key.size() + list.Bytes();
+}
+
+size_t KvStore::entryBytes(Stripe& s, const std::string& key,
+                           PackedKey packed) {
+  std::string_view plain;
+  if (findPlain(s, key, packed, &plain)) {
+    return plainBytes(key, plain);
+  }
+  auto list = s.lists.find(key);
+  return list != s.lists.end() ? listBytes(key, list->second) : 0;
+}
+
+void KvStore::resize(Stripe& s, size_t before, size_t after) {
+  s.bytes = s.bytes - before + after;
+  resident_bytes += after - before;
+}
+
+bool KvStore::SetMemoryBudget(size_t budget, const std::string& path) {
+  spill_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (spill_fd < 0) {
+    return false;
+  }
+  unlink(path.c_str());
+  this->budget = budget;
+  return true;
+}
+
+KvMemoryStats KvStore::MemoryStats() {
+  KvMemoryStats stats;
+  stats.resident_bytes = resident_bytes;
+  stats.spilled_bytes = spilled_bytes;
+  stats.spilled_stripes = spilled_stripes;
+  stats.spills = spills;
+  stats.faults = faults;
+  stats.fault_micros_total = fault_micros_total;
+  stats.fault_micros_max = fault_micros_max;
+  return stats;
+}
+
+void KvStore::RangeBytes(const shard_t& s, size_t* resident,
+                         size_t* spilled) {
+  *resident = 0;
+  *spilled = 0;
+  unsigned int lower = std::max(s.lower, min_id);
+  unsigned int upper = std::min(s.upper, max_id);
+  for (unsigned long id = lower; id <= upper; id++) {
+    Stripe& b = buckets[id - min_id];
+    std::shared_lock<std::shared_mutex> lock(b.mtx);
+    *resident += b.bytes;
+    *spilled += b.spilled ? b.spill_length : 0;
+  }
+}
+
+bool KvStore::findPlain(Stripe& s, const std::string& key, PackedKey packed,
+                        std::string_view* value) {
+  if (packed != 0) {
+    return s.table.Find(packed, value);
+  }
+  auto it = s.map.find(key);
+  if (it == s.map.end()) {
+    return false;
+  }
+  *value = it->second;
+  return true;
+}
+
+bool KvStore::setPlain(Stripe& s, const std::string& key, PackedKey packed,
+                       std::string_view value) {
+  if (packed != 0) {
+    return s.table.Set(packed, value);
+  }
+  auto [it, inserted] = s.map.try_emplace(key);
+  it->second.assign(value);
+  return inserted;
+}
+
+bool KvStore::appendPlain(Stripe& s, const std::string& key, PackedKey packed,
+                          std::string_view data) {
+  if (packed != 0) {
+    return s.table.Append(packed, data);
+  }
+  auto [it, inserted] = s.map.try_emplace(key);
+  it->second.append(data);
+  return inserted;
+}
+
+bool KvStore::erasePlain(Stripe& s, const std::string& key, PackedKey packed,
+                         std::string* value) {
+  if (packed != 0) {
+    return s.table.Erase(packed, value);
+  }
+  auto it = s.map.find(key);
+  if (it == s.map.end()) {
+    return false;
+  }
+  if (value != nullptr) {
+    *value = std::move(it->second);
+  }
+  s.map.erase(it);
+  return true;
+}
+
+PostList* KvStore::listFor(Stripe& s, const std::string& key,
+                           PackedKey packed, bool create, bool* created) {
+  if (created != nullptr) {
+    *created = false;
+  }
+  auto it = s.lists.find(key);
+  if (it != s.lists.end()) {
+    return &it->second;
+  }
+  std::string_view plain;
+  if (findPlain(s, key, packed, &plain)) {
+    auto list = s.lists.emplace(key, PostList(std::string(plain))).first;
+    erasePlain(s, key, packed, nullptr);
+    return &list->second;
+  }
+  if (!create) {
+    return nullptr;
+  }
+  if (created != nullptr) {
+    *created = true;
+  }
+  return &s.lists[key];
+}
+
+bool KvStore::Get(const std::string& key, std::string* value) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::shared_lock<std::shared_mutex> lock = readLock(s);
+  if (s.cold) {
+    MappedSnapshot::Entry entry;
+    if (!findCold(s, key, &entry)) {
+      return false;
+    }
+    if (entry.is_list) {
+      *value = decodeList(entry.value).Joined();
+    } else {
+      value->assign(entry.value);
+    }
+    return true;
+  }
+  std::string_view plain;
+  if (findPlain(s, key, packed, &plain)) {
+    value->assign(plain);
+    return true;
+  }
+  auto list = s.lists.find(key);
+  if (list != s.lists.end()) {
+    *value = list->second.Joined();
+    return true;
+  }
+  return false;
+}
+
+bool KvStore::Contains(const std::string& key) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::shared_lock<std::shared_mutex> lock = readLock(s);
+  if (s.cold) {
+    MappedSnapshot::Entry entry;
+    return findCold(s, key, &entry);
+  }
+  std::string_view plain;
+  return findPlain(s, key, packed, &plain) || s.lists.count(key) > 0;
+}
+
+void KvStore::GetBatch(const std::vector<std::string>& keys,
+                       std::vector<std::string>* values,
+                       std::vector<bool>* found) {
+  // visit the keys grouped by stripe, so each stripe is locked once
+  std::vector<std::pair<Stripe*, size_t>> order;
+  std::vector<PackedKey> packed(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    order.emplace_back(&stripeFor(keys[i], &packed[i]), i);
+  }
+  std::sort(order.begin(), order.end());
+
+  values->assign(keys.size(), "");
+  found->assign(keys.size(), false);
+  for (size_t i = 0; i < order.size();) {
+    Stripe* s = order[i].first;
+    std::shared_lock<std::shared_mutex> lock = readLock(*s);
+    for (; i < order.size() && order[i].first == s; i++) {
+      size_t k = order[i].second;
+      if (s->cold) {
+        MappedSnapshot::Entry entry;
+        if (findCold(*s, keys[k], &entry)) {
+          if (entry.is_list) {
+            (*values)[k] = decodeList(entry.value).Joined();
+          } else {
+            (*values)[k].assign(entry.value);
+          }
+          (*found)[k] = true;
+        }
+        continue;
+      }
+      std::string_view plain;
+      if (findPlain(*s, keys[k], packed[k], &plain)) {
+        (*values)[k].assign(plain);
+        (*found)[k] = true;
+        continue;
+      }
+      auto list = s->lists.find(keys[k]);
+      if (list != s->lists.end()) {
+        (*values)[k] = list->second.Joined();
+        (*found)[k] = true;
+      }
+    }
+  }
+}
+
+bool KvStore::Put(const std::string& key, const std::string& value) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  size_t before = entryBytes(s, key, packed);
+  // a plain value replaces a list
+  bool was_list = s.lists.erase(key) > 0;
+  bool inserted = setPlain(s, key, packed, value);
+  resize(s, before, plainBytes(key, value));
+  uint64_t lsn = logWrite(WriteAheadLog::PUT, key, value);
+  lock.unlock();
+  sync(lsn);
+  enforceBudget();
+  return inserted && !was_list;
+}
+
+bool KvStore::PutIfAbsent(const std::string& key, const std::string& value) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  std::string_view plain;
+  if (s.lists.count(key) > 0 || findPlain(s, key, packed, &plain)) {
+    return false;
+  }
+  setPlain(s, key, packed, value);
+  resize(s, 0, plainBytes(key, value));
+  uint64_t lsn = logWrite(WriteAheadLog::PUT, key, value);
+  lock.unlock();
+  sync(lsn);
+  enforceBudget();
+  return true;
+}
+
+bool KvStore::Append(const std::string& key, const std::string& data) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  size_t before = entryBytes(s, key, packed);
+  bool inserted = false;
+  auto list = s.lists.find(key);
+  if (list != s.lists.end()) {
+    for (const std::string& post : parse_value(data, ",")) {
+      list->second.Append(post);
+    }
+  } else {
+    inserted = appendPlain(s, key, packed, data);
+  }
+  resize(s, before, entryBytes(s, key, packed));
+  uint64_t lsn = logWrite(WriteAheadLog::APPEND, key, data);
+  lock.unlock();
+  sync(lsn);
+  enforceBudget();
+  return inserted;
+}
+
+bool KvStore::ListAppend(const std::string& key,
+                         const std::vector<std::string>& posts) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  size_t before = entryBytes(s, key, packed);
+  bool created;
+  PostList* list = listFor(s, key, packed, true, &created);
+  std::string joined;
+  for (const std::string& post : posts) {
+    list->Append(post);
+    joined += post + ",";
+  }
+  resize(s, before, listBytes(key, *list));
+  uint64_t lsn = logWrite(WriteAheadLog::LIST_APPEND, key, joined);
+  lock.unlock();
+  sync(lsn);
+  enforceBudget();
+  return created;
+}
+
+bool KvStore::PutList(const std::string& key, PostList list, bool if_absent) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  size_t before = entryBytes(s, key, packed);
+  std::string_view plain;
+  if (if_absent &&
+      (s.lists.count(key) > 0 || findPlain(s, key, packed, &plain))) {
+    return false;
+  }
+  erasePlain(s, key, packed, nullptr);
+  size_t after = listBytes(key, list);
+  std::string encoded = list.Encode();
+  s.lists.insert_or_assign(key, std::move(list));
+  resize(s, before, after);
+  uint64_t lsn = logWrite(WriteAheadLog::PUT_LIST, key, encoded);
+  lock.unlock();
+  sync(lsn);
+  enforceBudget();
+  return true;
+}
+
+bool KvStore::ListRemove(const std::string& key, const std::string& post) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  size_t before = entryBytes(s, key, packed);
+  PostList* list = listFor(s, key, packed, false);
+  if (list == nullptr || !list->Remove(post)) {
+    // listFor may have turned a plain value into a list
+    resize(s, before, entryBytes(s, key, packed));
+    return false;
+  }
+  resize(s, before, listBytes(key, *list));
+  uint64_t lsn = logWrite(WriteAheadLog::LIST_REMOVE, key, post);
+  lock.unlock();
+  sync(lsn);
+  enforceBudget();
+  return true;
+}
+
+bool KvStore::ListRange(const std::string& key, uint64_t cursor, size_t limit,
+                        std::vector<std::string>* posts, uint64_t* next,
+                        bool* more) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::shared_lock<std::shared_mutex> lock = readLock(s);
+  if (s.cold) {
+    MappedSnapshot::Entry entry;
+    if (!findCold(s, key, &entry)) {
+      return false;
+    }
+    PostList list = entry.is_list ? decodeList(entry.value)
+                                  : PostList(std::string(entry.value));
+    list.Range(cursor, limit, posts, next, more);
+    return true;
+  }
+  auto list = s.lists.find(key);
+  if (list != s.lists.end()) {
+    list->second.Range(cursor, limit, posts, next, more);
+    return true;
+  }
+  // a plain value isn't turned into a list under a shared lock, so read it
+  // the way it would be
+  std::string_view plain;
+  if (findPlain(s, key, packed, &plain)) {
+    PostList(std::string(plain)).Range(cursor, limit, posts, next, more);
+    return true;
+  }
+  return false;
+}
+
+void KvStore::PutBatch(std::vector<std::pair<std::string, std::string>>& pairs,
+                       std::vector<bool>* created) {
+  std::vector<Stripe*> stripes;
+  std::vector<PackedKey> packed(pairs.size());
+  for (size_t i = 0; i < pairs.size(); i++) {
+    stripes.push_back(&stripeFor(pairs[i].first, &packed[i]));
+  }
+  // lock each stripe once, in address order, so two batches can't deadlock
+  std::vector<Stripe*> order = stripes;
+  std::sort(order.begin(), order.end());
+  order.erase(std::unique(order.begin(), order.end()), order.end());
+  std::vector<std::unique_lock<std::shared_mutex>> locks;
+  for (Stripe* s : order) {
+    locks.emplace_back(s->mtx);
+    warm(*s);
+  }
+
+  created->assign(pairs.size(), false);
+  uint64_t lsn = 0;
+  for (size_t i = 0; i < pairs.size(); i++) {
+    size_t before = entryBytes(*stripes[i], pairs[i].first, packed[i]);
+    bool was_list = stripes[i]->lists.erase(pairs[i].first) > 0;
+    bool inserted =
+        setPlain(*stripes[i], pairs[i].first, packed[i], pairs[i].second);
+    resize(*stripes[i], before, plainBytes(pairs[i].first, pairs[i].second));
+    (*created)[i] = inserted && !was_list;
+    lsn = logWrite(WriteAheadLog::PUT, pairs[i].first, pairs[i].second);
+  }
+  locks.clear();
+  sync(lsn);
+  enforceBudget();
+}
+
+bool KvStore::Erase(const std::string& key, std::string* value) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  resize(s, entryBytes(s, key, packed), 0);
+  if (!erasePlain(s, key, packed, value)) {
+    auto list = s.lists.find(key);
+    if (list == s.lists.end()) {
+      return false;
+    }
+    if (value != nullptr) {
+      *value = list->second.Joined();
+    }
+    s.lists.erase(list);
+  }
+  uint64_t lsn = logWrite(WriteAheadLog::ERASE, key, "");
+  lock.unlock();
+  sync(lsn);
+  // warm may have read s back in
+  enforceBudget();
+  return true;
+}
+
+bool KvStore::Update(const std::string& key,
+                     const std::function<void(std::string&)>& fn) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  std::string_view plain;
+  if (!findPlain(s, key, packed, &plain)) {
+    return false;
+  }
+  std::string value(plain);
+  size_t before = plainBytes(key, value);
+  fn(value);
+  setPlain(s, key, packed, value);
+  resize(s, before, plainBytes(key, value));
+  // the log can't replay fn, so it records the value fn left
+  uint64_t lsn = logWrite(WriteAheadLog::PUT, key, value);
+  lock.unlock();
+  sync(lsn);
+  enforceBudget();
+  return true;
+}
+
+bool KvStore::AppendIfPresent(const std::string& key,
+                              const std::string& data) {
+  PackedKey packed;
+  Stripe& s = stripeFor(key, &packed);
+  std::unique_lock<std::shared_mutex> lock(s.mtx);
+  warm(s);
+  std::string_view plain;
+  if (!findPlain(s, key, packed, &plain)) {
+    return false;
+  }
+  size_t before = plainBytes(key, plain);
+  appendPlain(s, key, packed, data);
+  resize(s, before, before + data.size());
+  uint64_t lsn = logWrite(WriteAheadLog::APPEND, key, data);
+  lock.unlock();
+  sync(lsn);
+  enforceBudget();
+  return true;
+}
+
+size_t KvStore::EraseBatch(const std::vector<std::string>& keys) {
+  size_t erased = 0;
+  uint64_t lsn = 0;
+  for (const std::string& key : keys) {
+    PackedKey packed;
+    Stripe& s = stripeFor(key, &packed);
+    std::unique_lock<std::shared_mutex> lock(s.mtx);
+    warm(s);
+    size_t before = entryBytes(s, key, packed);
+    if (!erasePlain(s, key, packed, nullptr) && s.lists.erase(key) == 0) {
+      continue;
+    }
+    resize(s, before, 0);
+    lsn = logWrite(WriteAheadLog::ERASE, key, "");
+    erased++;
+  }
+  // one sync for the whole batch
+  sync(lsn);
+  enforceBudget();
+  return erased;
+}
+
+std::vector<std::pair<std::string, std::string>> KvStore::ReadRange(
+    const shard_t& s, std::vector<std::pair<std::string, std::string>>* lists) {
+  std::vector<std::pair<std::string, std::string>> pairs;
+  unsigned int lower = std::max(s.lower, min_id);
+  unsigned int upper = std::min(s.upper, max_id);
+  for (unsigned long id = lower; id <= upper; id++) {
+    copyStripe(buckets[id - min_id], nullptr, &pairs, lists);
+  }
+  // IDs outside the bucket range can only be found by scanning the overflow
+  if (s.lower < min_id || s.upper > max_id) {
+    for (Stripe& o : overflow) {
+      copyStripe(o, &s, &pairs, lists);
+    }
+  }
+  return pairs;
+}
+
+std::vector<std::pair<std::string, std::string>> KvStore::Snapshot() {
+  std::vector<std::pair<std::string, std::string>> pairs;
+  for (Stripe& b : buckets) {
+    copyStripe(b, nullptr, &pairs, nullptr);
+  }
+  for (Stripe& o : overflow) {
+    copyStripe(o, nullptr, &pairs, nullptr);
+  }
+  return pairs;
+}
+
+void KvStore::copyStripe(
+    Stripe& s, const shard_t* range,
+    std::vector<std::pair<std::string, std::string>>* pairs,
+    std::vector<std::pair<std::string, std::string>>* lists) {
+  auto wanted = [range](std::string_view key) {
+    unsigned int id;
+    return range == nullptr || (keyID(std::string(key), &id) &&
+                                id >= range->lower && id <= range->upper);
+  };
+  auto add = [&wanted, pairs](std::string_view key, std::string_view value) {
+    if (wanted(key)) {
+      pairs->emplace_back(key, value);
+    }
+  };
+  // encoded is a list as PostList::Encode left it
+  auto add_list = [&wanted, pairs, lists](std::string_view key,
+                                          std::string_view encoded) {
+    if (!wanted(key)) {
+      return;
+    }
+    if (lists != nullptr) {
+      lists->emplace_back(key, encoded);
+    } else {
+      pairs->emplace_back(key, decodeList(encoded).Joined());
+    }
+  };
+  // copied where it is, so cold and spilled stripes stay that way
+  std::shared_lock<std::shared_mutex> lock(s.mtx);
+  if (s.cold) {
+    base->ForEach(indexOf(s), [&](const MappedSnapshot::Entry& entry) {
+      if (entry.is_list) {
+        add_list(entry.key, entry.value);
+      } else {
+        add(entry.key, entry.value);
+      }
+    });
+    return;
+  }
+  if (s.spilled) {
+    readSpilled(s, [&](std::string_view key, std::string_view value,
+                       bool is_list) {
+      if (is_list) {
+        add_list(key, value);
+      } else {
+        add(key, value);
+      }
+    });
+    return;
+  }
+  s.table.ForEach([&add](PackedKey key, std::string_view value) {
+    add(UnpackKey(key), value);
+  });
+  for (auto& kv : s.map) {
+    add(kv.first, kv.second);
+  }
+  for (auto& kv : s.lists) {
+    if (!wanted(kv.first)) {
+      continue;
+    }
+    if (lists != nullptr) {
+      lists->emplace_back(kv.first, kv.second.Encode());
+    } else {
+      pairs->emplace_back(kv.first, kv.second.Joined());
+    }
+  }
+}
+
+size_t KvStore::Size() {
+  size_t total = 0;
+  auto count = [this, &total](Stripe& s) {
+    std::shared_lock<std::shared_mutex> lock(s.mtx);
+    total += s.cold      ? base->Count(indexOf(s))
+             : s.spilled ? s.spill_count
+                         : s.table.Size() + s.map.size() + s.lists.size();
+  };
+  for (Stripe& b : buckets) {
+    count(b);
+  }
+  for (Stripe& o : overflow) {
+    count(o);
+  }
+  return total;
+}
+
+void KvStore::ForEachKey(const std::function<void(std::string_view)>& fn) {
+  auto visit = [this, &fn](Stripe& s) {
+    std::shared_lock<std::shared_mutex> lock(s.mtx);
+    if (s.cold) {
+      base->ForEach(indexOf(s), [&fn](const MappedSnapshot::Entry& entry) {
+        fn(entry.key);
+      });
+      return;
+    }
+    if (s.spilled) {
+      readSpilled(s, [&fn](std::string_view key, std::string_view, bool) {
+        fn(key);
+      });
+      return;
+    }
+    s.table.ForEach(
+        [&fn](PackedKey key, std::string_view) { fn(UnpackKey(key)); });
+    for (auto& kv : s.map) {
+      fn(kv.first);
+    }
+    for (auto& kv : s.lists) {
+      fn(kv.first);
+    }
+  };
+  for (Stripe& b : buckets) {
+    visit(b);
+  }
+  for (Stripe& o : overflow) {
+    visit(o);
+  }
+}
+
+size_t KvStore::Recover(WriteAheadLog* wal, const std::string& snapshot_path) {
+  size_t num_stripes = buckets.size() + KV_STRIPES;
+  covered.assign(num_stripes, 0);
+  uint64_t snapshot_lsn = 0;
+  if (snapshot_path != "") {
+    base = MappedSnapshot::Open(snapshot_path, min_id, max_id, num_stripes);
+    // the log may have dropped what the snapshot holds, so going on without
+    // it would lose data
+    if (base == nullptr && access(snapshot_path.c_str(), F_OK) == 0) {
+      fprintf(stderr, "%s: not a snapshot of this store\n",
+              snapshot_path.c_str());
+      abort();
+    }
+  }
+  if (base != nullptr) {
+    for (size_t i = 0; i < num_stripes; i++) {
+      covered[i] = base->Lsn(i);
+      snapshot_lsn = std::max(snapshot_lsn, covered[i]);
+      if (base->Count(i) > 0) {
+        stripeAt(i).cold = true;
+        cold_stripes++;
+      }
+    }
+    if (cold_stripes == 0) {
+      base.reset();
+    }
+  }
+
+  size_t records = wal->Replay([this](const WriteAheadLog::Record& r) {
+    PackedKey packed;
+    if (r.lsn <= covered[indexOf(stripeFor(r.key, &packed))]) {
+      return;
+    }
+    switch (r.op) {
+      case WriteAheadLog::PUT:
+        Put(r.key, r.data);
+        break;
+      case WriteAheadLog::APPEND:
+        Append(r.key, r.data);
+        break;
+      case WriteAheadLog::LIST_APPEND:
+        ListAppend(r.key, parse_value(r.data, ","));
+        break;
+      case WriteAheadLog::LIST_REMOVE:
+        ListRemove(r.key, r.data);
+        break;
+      case WriteAheadLog::ERASE:
+        Erase(r.key);
+        break;
+      case WriteAheadLog::PUT_LIST:
+        PutList(r.key, decodeList(r.data), false);
+        break;
+    }
+  });
+  // the records the snapshot holds may be gone from the log, and new ones
+  // must not look like they're in the snapshot
+  wal->AdvanceTo(snapshot_lsn);
+  covered.clear();
+  log = wal;
+  return records;
+}
+
+bool KvStore::Checkpoint(const std::string& path) {
+  std::lock_guard<std::mutex> checkpoint_lock(checkpoint_mutex);
+  SnapshotWriter writer(path, min_id, max_id, buckets.size() + KV_STRIPES);
+  if (!writer.Open()) {
+    return false;
+  }
+  // every record from here on goes to a new segment, and every stripe
+  // below is written after this point, so the snapshot holds everything in
+  // the old segment
+  if (log != nullptr) {
+    log->Rotate();
+  }
+  auto write = [this, &writer](Stripe& s) {
+    std::shared_lock<std::shared_mutex> lock(s.mtx);
+    // changes to s are logged with s locked exclusively, so s holds exactly
+    // the ones logged up to now
+    writer.BeginStripe(log != nullptr ? log->LastLsn() : 0);
+    if (s.cold) {
+      base->ForEach(indexOf(s), [&writer](const MappedSnapshot::Entry& entry) {
+        writer.Add(entry.key, entry.value, entry.is_list);
+      });
+      return;
+    }
+    if (s.spilled) {
+      readSpilled(s, [&writer](std::string_view key, std::string_view value,
+                               bool is_list) {
+        writer.Add(key, value, is_list);
+      });
+      return;
+    }
+    s.table.ForEach([&writer](PackedKey key, std::string_view value) {
+      writer.Add(UnpackKey(key), value, false);
+    });
+    for (auto& kv : s.map) {
+      writer.Add(kv.first, kv.second, false);
+    }
+    for (auto& kv : s.lists) {
+      writer.Add(kv.first, kv.second.Encode(), true);
+    }
+  };
+  for (Stripe& b : buckets) {
+    write(b);
+  }
+  for (Stripe& o : overflow) {
+    write(o);
+  }
+  if (!writer.Finish()) {
+    return false;
+  }
+  if (log != nullptr) {
+    log->DropRotated();
+  }
+  return true;
+}
+
+void KvStore::Hydrate() {
+  auto hydrate = [this](Stripe& s) {
+    {
+      std::unique_lock<std::shared_mutex> lock(s.mtx);
+      // a spilled stripe stays where it is
+      if (s.cold) {
+        warm(s);
+      }
+    }
+    enforceBudget();
+  };
+  for (Stripe& b : buckets) {
+    hydrate(b);
+  }
+  for (Stripe& o : overflow) {
+    hydrate(o);
+  }
+}
+
+uint64_t KvStore::logWrite(WriteAheadLog::Op op, const std::string& key,
+                           std::string_view data) {
+  return log != nullptr ? log->Add(op, key, data) : 0;
+}
+
+void KvStore::sync(uint64_t lsn) {
+  if (log != nullptr) {
+    log->Sync(lsn);
+  }
+}
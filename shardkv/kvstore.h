@@ -0,0 +1,368 @@
+#ifndef SHARDING_KVSTORE_H
+#define SHARDING_KVSTORE_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../common/common.h"
+#include "../common/keys.h"
+#include "arena.h"
+#include "flattable.h"
+#include "postlist.h"
+#include "snapshot.h"
+#include "storage.h"
+#include "wal.h"
+
+// number of lock stripes for keys that don't fall in a bucket -- must be a
+// power of two
+constexpr size_t KV_STRIPES = 64;
+
+// bytes a key costs in memory besides its key and value (a table slot or a
+// hash node)
+constexpr size_t KV_ENTRY_OVERHEAD = 48;
+
+// the buckets of this many consecutive IDs share an Arena
+constexpr size_t KV_ARENA_IDS = 64;
+
+// once over its memory budget, a store spills stripes until it's this many
+// tenths of the budget, so it doesn't spill on every write past it
+constexpr size_t KV_SPILL_TARGET_TENTHS = 9;
+
+// what a KvStore with a memory budget keeps where (see SetMemoryBudget)
+struct KvMemoryStats {
+  // bytes of keys and values in memory, and in the spill file
+  size_t resident_bytes = 0;
+  size_t spilled_bytes = 0;
+  size_t spilled_stripes = 0;
+  uint64_t spills = 0;
+  // stripes read back from the spill file, and how long that took
+  uint64_t faults = 0;
+  uint64_t fault_micros_total = 0;
+  uint64_t fault_micros_max = 0;
+};
+
+// A concurrent hash table: the in-memory StorageEngine of ShardkvServer.
+//
+// Keys are grouped by the numeric ID that decides which shard they belong to
+// (user_5, post_5 and user_5_posts all have ID 5): every ID in
+// [min_id, max_id] gets its own bucket, a small hash map behind its own
+// reader/writer lock, and the buckets are laid out in ID order. Point lookups
+// are O(1), requests on unrelated IDs run in parallel, and handing off or
+// dropping a shard only visits the buckets of that shard's range. Keys
+// without an ID in range (all_users, ...) live in KV_STRIPES hash-striped
+// overflow maps.
+//
+// Within a stripe, user_<id>, post_<id> and user_<id>_posts keys are stored
+// as a PackedKey in a FlatTable, so they cost a 32 byte slot instead of a
+// hash node with its own key string, and a value of up to FLAT_INLINE bytes
+// is kept in the slot. Longer values and the slot arrays come from an Arena
+// shared by the buckets of KV_ARENA_IDS consecutive IDs (each overflow
+// stripe has its own), so filling a bucket doesn't allocate from the heap,
+// and once a range of IDs has been handed off or spilled its arenas give
+// their chunks back a chunk at a time rather than a value at a time. Any
+// other key goes in a string-keyed map.
+//
+// A list is held as a PostList; a plain string is split into one the first
+// time it's written as a list, e.g. a post list that arrived in a transfer.
+//
+// With a WriteAheadLog attached (see Recover), every change is logged while
+// its stripe is locked, so the log holds each key's changes in the order they
+// were made. The write is then synced (per the log's SyncMode) after the lock
+// is released, before the method returns.
+//
+// Checkpoint writes the store to a snapshot file (see snapshot.h) and lets
+// the log drop what the snapshot holds. Recovering from a snapshot maps it
+// instead of loading it: each stripe it has entries for starts out cold and
+// serves reads straight from the mapping, and is only copied into memory the
+// first time it's written to (or by Hydrate). So a restart costs mapping the
+// file plus replaying the records logged since the snapshot.
+//
+// With a memory budget (SetMemoryBudget), each stripe keeps count of the
+// bytes it holds and when it was last accessed. Once the store holds more
+// than the budget, the stripes accessed longest ago -- the IDs of shards
+// nobody is reading -- are written to a spill file and dropped from memory,
+// and read back in the first time they're accessed again. Snapshot, Size,
+// ForEachKey and Checkpoint read spilled stripes without bringing them back.
+// The spill file is scratch space: what's durable is the log and snapshot.
+class KvStore : public StorageEngine {
+ public:
+  explicit KvStore(unsigned int min_id = MIN_KEY,
+                   unsigned int max_id = MAX_KEY);
+
+  ~KvStore();
+
+  // copies the value of key into value. returns false if key is missing
+  bool Get(const std::string& key, std::string* value) override;
+
+  bool Contains(const std::string& key);
+
+  // looks up every key, locking each stripe once. found[i] is set to whether
+  // keys[i] is present, and values[i] to its value if so
+  void GetBatch(const std::vector<std::string>& keys,
+                std::vector<std::string>* values,
+                std::vector<bool>* found) override;
+
+  // inserts or overwrites key. returns true if the key was newly created
+  bool Put(const std::string& key, const std::string& value) override;
+
+  // inserts key only if it doesn't exist yet. returns true if it was inserted
+  bool PutIfAbsent(const std::string& key,
+                   const std::string& value) override;
+
+  // appends data to the value of key, creating it if it doesn't exist yet.
+  // if key is a list, data is split on commas and each post appended to it.
+  // returns true if the key was newly created
+  bool Append(const std::string& key, const std::string& data) override;
+
+  // appends each post in posts to the list at key (unless it's on it
+  // already), creating the list if key doesn't exist yet. returns true if the
+  // key was newly created
+  bool ListAppend(const std::string& key,
+                  const std::vector<std::string>& posts) override;
+
+  // makes list the value of key, unless if_absent is set and key exists.
+  // returns whether it was written
+  bool PutList(const std::string& key, PostList list, bool if_absent) override;
+
+  // removes post from the list at key. returns false if it wasn't on it
+  bool ListRemove(const std::string& key, const std::string& post) override;
+
+  // reads up to limit posts of the list at key, starting at cursor (see
+  // PostList::Range). returns false if key is missing
+  bool ListRange(const std::string& key, uint64_t cursor, size_t limit,
+                 std::vector<std::string>* posts, uint64_t* next,
+                 bool* more) override;
+
+  // inserts or overwrites every pair, possibly moving the values out of
+  // pairs. all of the pairs' stripes are locked together, so readers see
+  // either none or all of the batch. created[i] is set to whether pairs[i]
+  // was a new key
+  void PutBatch(std::vector<std::pair<std::string, std::string>>& pairs,
+                std::vector<bool>* created) override;
+
+  // removes key, storing its old value in value (if non-null). returns false
+  // if key was not present
+  bool Erase(const std::string& key, std::string* value = nullptr) override;
+
+  // runs fn on the value of key with its stripe locked exclusively, so a
+  // read-modify-write can't interleave with other writers. returns false
+  // (without calling fn) if key is missing or a list
+  bool Update(const std::string& key,
+              const std::function<void(std::string&)>& fn) override;
+
+  // appends data to the value of key in place, only if it exists. returns
+  // false (changing nothing) if key is missing or a list
+  bool AppendIfPresent(const std::string& key,
+                       const std::string& data) override;
+
+  // removes every key in keys that is present, logging all of them before a
+  // single sync. returns the number of keys removed
+  size_t EraseBatch(const std::vector<std::string>& keys) override;
+
+  // returns a copy of every pair whose key ID is in [s.lower, s.upper], in
+  // ID order. only the buckets of that range are read, so the cost depends
+  // on the size of the range and the data in it, not on the whole store. if
+  // lists is set, the post lists go there instead, encoded
+  std::vector<std::pair<std::string, std::string>> ReadRange(
+      const shard_t& s,
+      std::vector<std::pair<std::string, std::string>>* lists =
+          nullptr) override;
+
+  // returns a copy of every key-value pair. stripes are copied one at a time,
+  // so this is not an atomic snapshot of the whole table
+  std::vector<std::pair<std::string, std::string>> Snapshot() override;
+
+  size_t Size() override;
+
+  // calls fn on every key, e.g. to rebuild an index without copying values.
+  // like Snapshot, stripes are visited one at a time
+  void ForEachKey(const std::function<void(std::string_view)>& fn) override;
+
+  // replays wal into the store (which should be empty), then logs every
+  // change made from now on to it. with a snapshot_path, the snapshot there
+  // (if any) is mapped first and only the records it doesn't hold are
+  // replayed. wal must be open and outlive the store. returns the number of
+  // records read from wal
+  size_t Recover(WriteAheadLog* wal, const std::string& snapshot_path = "");
+
+  // writes a snapshot of the store to path, replacing the one there, and
+  // drops the part of the log it makes redundant. stripes are written one at
+  // a time, each with the LSN it's up to date with, so writers are only held
+  // up by the stripe being copied. returns false (with errno set) if the
+  // snapshot couldn't be written
+  bool Checkpoint(const std::string& path);
+
+  // copies every stripe still served from the recovered snapshot into
+  // memory, one at a time, and unmaps the snapshot once they're all done
+  void Hydrate();
+
+  // keeps the store within budget bytes of keys and values, spilling to a
+  // file created at path. the file is unlinked as soon as it's open, so it
+  // goes away with the store. call before the store is used. returns false
+  // (with errno set) if the file can't be created
+  bool SetMemoryBudget(size_t budget, const std::string& path);
+
+  KvMemoryStats MemoryStats();
+
+  // bytes of the keys with an ID in s in memory and spilled, e.g. to see
+  // how much of a shard is resident. keys without an ID count toward none
+  void RangeBytes(const shard_t& s, size_t* resident, size_t* spilled);
+
+ private:
+  // padded to a cache line so neighbouring stripe locks don't false-share
+  struct alignas(64) Stripe {
+    std::shared_mutex mtx;
+    // plain values of the keys PackKey packs
+    FlatTable table;
+    // plain values of every other key
+    std::unordered_map<std::string, std::string> map;
+    // keys that hold a list. a key is in table, map or lists, never two
+    std::unordered_map<std::string, PostList> lists;
+    // whether the stripe's keys are still only in the snapshot (base). a
+    // cold stripe's table, map and lists are empty
+    bool cold = false;
+    // roughly the bytes of the keys and values in table, map and lists
+    size_t bytes = 0;
+    // when the stripe was last read or written (steady_clock ticks)
+    std::atomic<int64_t> last_access{0};
+    // whether the stripe's keys are in the spill file instead, as
+    // spill_length bytes at spill_offset. a spilled stripe is never cold
+    bool spilled = false;
+    uint64_t spill_offset = 0;
+    uint64_t spill_length = 0;
+    size_t spill_count = 0;
+  };
+
+  // the stripe of key. *packed is set to PackKey(key)
+  Stripe& stripeFor(const std::string& key, PackedKey* packed);
+
+  // the position of s in a snapshot: buckets first, then overflow
+  size_t indexOf(const Stripe& s) const;
+  Stripe& stripeAt(size_t index);
+
+  // looks key up in the snapshot the cold stripe s is served from. caller
+  // must hold s.mtx
+  bool findCold(const Stripe& s, const std::string& key,
+                MappedSnapshot::Entry* entry) const;
+
+  // brings s's keys into memory: copies s out of the snapshot if it's cold,
+  // and reads it back from the spill file if it's spilled. caller must hold
+  // s.mtx exclusively
+  void warm(Stripe& s);
+
+  // locks s shared once it's not spilled, and marks it accessed
+  std::shared_lock<std::shared_mutex> readLock(Stripe& s);
+
+  // calls fn(key, value, is_list) on every key of the spilled stripe s.
+  // caller must hold s.mtx
+  void readSpilled(const Stripe& s,
+                   const std::function<void(std::string_view,
+                                            std::string_view, bool)>& fn);
+
+  // writes s to the spill file and frees its keys. caller must hold s.mtx
+  // exclusively and spill_mutex
+  void spill(Stripe& s);
+
+  // spills the stripes accessed longest ago (except keep) until we're back
+  // under the budget, if we're over it. caller must hold no stripe lock
+  void enforceBudget(const Stripe* keep = nullptr);
+
+  // roughly the bytes a plain value or a list takes in memory
+  static size_t plainBytes(std::string_view key, std::string_view value);
+  static size_t listBytes(std::string_view key, const PostList& list);
+
+  // the bytes key takes in s, or 0 if s doesn't hold it
+  static size_t entryBytes(Stripe& s, const std::string& key,
+                           PackedKey packed);
+
+  // records that the keys of s went from before to after bytes. caller must
+  // hold s.mtx exclusively
+  void resize(Stripe& s, size_t before, size_t after);
+
+  // points value at the plain value of key in s. returns false if it has
+  // none. packed is PackKey(key). value is valid until s changes
+  static bool findPlain(Stripe& s, const std::string& key, PackedKey packed,
+                        std::string_view* value);
+
+  // sets the plain value of key in s, inserting it if it has none. returns
+  // whether it was
+  static bool setPlain(Stripe& s, const std::string& key, PackedKey packed,
+                       std::string_view value);
+
+  // appends data to the plain value of key in s, inserting it if it has
+  // none. returns whether it was
+  static bool appendPlain(Stripe& s, const std::string& key, PackedKey packed,
+                          std::string_view data);
+
+  // removes the plain value of key from s, moving it into value (if
+  // non-null). returns false if it had none
+  static bool erasePlain(Stripe& s, const std::string& key, PackedKey packed,
+                         std::string* value);
+
+  // returns the list at key, turning a plain value into one (or creating an
+  // empty one if key is missing and create is set). returns nullptr if there
+  // is no list. caller must hold s.mtx exclusively
+  PostList* listFor(Stripe& s, const std::string& key, PackedKey packed,
+                    bool create, bool* created = nullptr);
+
+  // appends a copy of every pair in s to pairs (only those whose key ID is
+  // in range, if range is set), reading cold and spilled stripes where they
+  // are
+  void copyStripe(Stripe& s, const shard_t* range,
+                  std::vector<std::pair<std::string, std::string>>* pairs,
+                  std::vector<std::pair<std::string, std::string>>* lists);
+
+  // logs a change to key, returning its LSN (0 without a log). caller must
+  // hold the key's stripe exclusively
+  uint64_t logWrite(WriteAheadLog::Op op, const std::string& key,
+                    std::string_view data);
+
+  // waits until the change logged as lsn is durable
+  void sync(uint64_t lsn);
+
+  const unsigned int min_id;
+  const unsigned int max_id;
+  // the arenas of the buckets, KV_ARENA_IDS at a time, then one per overflow
+  // stripe. declared first, so the tables' blocks are still there when the
+  // stripes go
+  std::vector<Arena> arenas;
+  // buckets[i] holds the keys with ID min_id + i
+  std::vector<Stripe> buckets;
+  Stripe overflow[KV_STRIPES];
+  WriteAheadLog* log = nullptr;
+  // the snapshot recovered from, while any stripe is cold
+  std::unique_ptr<MappedSnapshot> base;
+  std::atomic<size_t> cold_stripes{0};
+  // while recovering: the LSN each stripe's snapshot is up to date with
+  std::vector<uint64_t> covered;
+  // one checkpoint at a time
+  std::mutex checkpoint_mutex;
+
+  // see SetMemoryBudget. budget = 0 means no budget
+  size_t budget = 0;
+  int spill_fd = -1;
+  // one spiller at a time. guards spill_end, where the next stripe goes
+  std::mutex spill_mutex;
+  uint64_t spill_end = 0;
+  // (offset, length) of the stripes read back in since the file's disk
+  // blocks were last given back
+  std::mutex freed_mutex;
+  std::vector<std::pair<uint64_t, uint64_t>> freed;
+  uint64_t freed_bytes = 0;
+  std::atomic<size_t> resident_bytes{0};
+  std::atomic<size_t> spilled_bytes{0};
+  std::atomic<size_t> spilled_stripes{0};
+  std::atomic<uint64_t> spills{0};
+  std::atomic<uint64_t> faults{0};
+  std::atomic<uint64_t> fault_micros_total{0};
+  std::atomic<uint64_t> fault_micros_max{0};
+};
+
+#endif  // SHARDING_KVSTORE_H
@@ -0,0 +1,766 @@
+#include "lsmstore.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+
+#include "../common/keys.h"
+#include "postlist.h"
+
+// bytes a memtable entry costs besides its key and value (map node, entry)
+constexpr size_t MEMTABLE_OVERHEAD = 64;
+
+// encoded keys start with a byte that sorts keys without an ID last and the
+// ID, big-endian so IDs sort numerically
+constexpr size_t KEY_PREFIX = 5;
+
+static std::string idPrefix(bool has_id, uint32_t id) {
+  std::string prefix(KEY_PREFIX, '\0');
+  prefix[0] = has_id ? 0 : 1;
+  for (int i = 0; i < 4; i++) {
+    prefix[1 + i] = (char)(id >> (24 - 8 * i));
+  }
+  return prefix;
+}
+
+// the key key is stored under
+static std::string lsmKey(const std::string& key) {
+  ParsedKey parsed = ParseKey(key);
+  return idPrefix(parsed.HasID(), parsed.HasID() ? parsed.id : 0) + key;
+}
+
+static std::string_view userKey(std::string_view k) {
+  return k.substr(KEY_PREFIX);
+}
+
+// the post list entry holds. a plain value is split on commas, as in KvStore
+static PostList listOf(const LsmEntry& entry) {
+  if (entry.kind != LsmEntry::LIST) {
+    return PostList(entry.value);
+  }
+  PostList list;
+  if (!PostList::Decode(entry.value, &list)) {
+    // entries are checksummed on disk, so this is a bug
+    fprintf(stderr, "lsm: garbled post list\n");
+    abort();
+  }
+  return list;
+}
+
+// entry's value as everything but the List* methods reads it
+static std::string valueOf(LsmEntry& entry) {
+  if (entry.kind == LsmEntry::LIST) {
+    return listOf(entry).Joined();
+  }
+  return std::move(entry.value);
+}
+
+// one of the sorted streams of entries scan and compact merge
+class Source {
+ public:
+  virtual ~Source() = default;
+  virtual bool Valid() const = 0;
+  virtual std::string_view Key() const = 0;
+  virtual const LsmEntry& Entry() const = 0;
+  virtual void Next() = 0;
+};
+
+template <typename Memtable>
+class MemtableSource : public Source {
+ public:
+  MemtableSource(std::shared_ptr<const Memtable> table, std::string_view from)
+      : table(std::move(table)), it(this->table->lower_bound(from)) {}
+  bool Valid() const override { return it != table->end(); }
+  std::string_view Key() const override { return it->first; }
+  const LsmEntry& Entry() const override { return it->second; }
+  void Next() override { it++; }
+
+ private:
+  std::shared_ptr<const Memtable> table;
+  typename Memtable::const_iterator it;
+};
+
+class RunSource : public Source {
+ public:
+  RunSource(std::shared_ptr<SortedRun> run, std::string_view from)
+      : it(std::move(run)) {
+    it.Seek(from);
+  }
+  bool Valid() const override { return it.Valid(); }
+  std::string_view Key() const override { return it.Key(); }
+  const LsmEntry& Entry() const override { return it.Entry(); }
+  void Next() override { it.Next(); }
+
+ private:
+  SortedRun::Iterator it;
+};
+
+// calls fn(k, entry) on the newest entry of each key k below to (or every
+// key, if to is "") in sources, in key order. sources are ordered newest
+// first
+static void merge(
+    std::vector<std::unique_ptr<Source>>& sources, std::string_view to,
+    const std::function<void(std::string_view, const LsmEntry&)>& fn) {
+  std::string key;
+  while (true) {
+    // a handful of sources, so a linear pass beats a heap
+    Source* newest = nullptr;
+    for (auto& source : sources) {
+      if (source->Valid() && (to.empty() || source->Key() < to) &&
+          (newest == nullptr || source->Key() < newest->Key())) {
+        newest = source.get();
+      }
+    }
+    if (newest == nullptr) {
+      return;
+    }
+    key.assign(newest->Key());
+    fn(key, newest->Entry());
+    for (auto& source : sources) {
+      if (source->Valid() && source->Key() == key) {
+        source->Next();
+      }
+    }
+  }
+}
+
+// makes the renames and removals in dir durable
+static void syncDir(const std::string& dir) {
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+LsmStore::LsmStore(std::string dir, SyncMode mode, size_t memtable_bytes)
+    : dir(dir), memtable_bytes(memtable_bytes), log(dir + "/wal", mode) {}
+
+LsmStore::~LsmStore() {
+  {
+    std::lock_guard<std::mutex> lock(background_mutex);
+    stopping = true;
+  }
+  background_cv.notify_all();
+  if (background_thread.joinable()) {
+    background_thread.join();
+  }
+}
+
+std::string LsmStore::runPath(uint64_t number) const {
+  return dir + "/run-" + std::to_string(number);
+}
+
+bool LsmStore::Open() {
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    return false;
+  }
+  std::set<uint64_t> live;
+  std::ifstream manifest(dir + "/MANIFEST");
+  std::string word;
+  if (manifest >> word && word == "next") {
+    manifest >> next_run;
+    uint64_t number;
+    while (manifest >> number) {
+      std::shared_ptr<SortedRun> run = SortedRun::Open(runPath(number), number);
+      if (run == nullptr) {
+        return false;
+      }
+      runs.push_back(run);
+      live.insert(number);
+    }
+  }
+  // runs a flush or compaction didn't get to install, and temporary files
+  DIR* d = opendir(dir.c_str());
+  if (d != nullptr) {
+    while (struct dirent* e = readdir(d)) {
+      std::string name = e->d_name;
+      if (name.rfind("run-", 0) == 0 &&
+          (name.find(".tmp") != std::string::npos ||
+           live.count(strtoull(name.c_str() + 4, nullptr, 10)) == 0)) {
+        unlink((dir + "/" + name).c_str());
+      }
+    }
+    closedir(d);
+  }
+
+  if (!log.Open()) {
+    return false;
+  }
+  // the log only holds whole values and erasures, so records that already
+  // made it into a run can be replayed over it
+  recovering = true;
+  log.Replay([this](const WriteAheadLog::Record& r) {
+    switch (r.op) {
+      case WriteAheadLog::PUT:
+        apply(lsmKey(r.key), {LsmEntry::PLAIN, r.data});
+        break;
+      case WriteAheadLog::PUT_LIST:
+        apply(lsmKey(r.key), {LsmEntry::LIST, r.data});
+        break;
+      case WriteAheadLog::ERASE:
+        apply(lsmKey(r.key), {LsmEntry::DELETED, ""});
+        break;
+      default:
+        // only KvStore logs the other ops
+        break;
+    }
+  });
+  recovering = false;
+  // write out what was replayed, so the rotated log (if any) can go
+  if (!memtable.empty()) {
+    imm = std::make_shared<const Memtable>(std::move(memtable));
+    memtable.clear();
+    memtable_size = 0;
+    flushFrozen();
+  }
+  log.DropRotated();
+
+  background_thread = std::thread([this]() { this->background(); });
+  return true;
+}
+
+bool LsmStore::read(const std::string& k, LsmEntry* entry) {
+  std::vector<std::shared_ptr<SortedRun>> current;
+  {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    const Memtable* tables[] = {&memtable, imm.get()};
+    for (const Memtable* table : tables) {
+      if (table == nullptr) {
+        continue;
+      }
+      auto it = table->find(k);
+      if (it != table->end()) {
+        *entry = it->second;
+        return entry->kind != LsmEntry::DELETED;
+      }
+    }
+    current = runs;
+  }
+  // runs never change, so they're read without the lock
+  lookups++;
+  uint64_t blocks = 0;
+  bool found = false;
+  for (auto& run : current) {
+    if (run->Get(k, entry, &blocks)) {
+      found = true;
+      break;
+    }
+  }
+  blocks_read += blocks;
+  return found && entry->kind != LsmEntry::DELETED;
+}
+
+void LsmStore::apply(const std::string& k, LsmEntry entry) {
+  user_bytes += k.size() - KEY_PREFIX + entry.value.size();
+  {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    memtable_size += k.size() + entry.value.size() + MEMTABLE_OVERHEAD;
+    memtable[k] = std::move(entry);
+  }
+  if (!recovering && memtable_size >= memtable_bytes) {
+    freeze();
+  }
+}
+
+uint64_t LsmStore::write(const std::string& k, LsmEntry entry,
+                         WriteAheadLog::Op op, const std::string& key,
+                         std::string_view data) {
+  uint64_t lsn = log.Add(op, key, data);
+  apply(k, std::move(entry));
+  return lsn;
+}
+
+void LsmStore::freeze() {
+  std::unique_lock<std::mutex> lock(background_mutex);
+  if (frozen) {
+    // the memtable filled up before the last one was written out
+    stalls++;
+    background_cv.wait(lock, [this]() { return !frozen; });
+  }
+  // the rotated segment holds exactly the frozen memtable's records, and
+  // goes once its run is installed
+  log.Rotate();
+  {
+    std::unique_lock<std::shared_mutex> table_lock(mtx);
+    imm = std::make_shared<const Memtable>(std::move(memtable));
+    memtable.clear();
+    memtable_size = 0;
+  }
+  frozen = true;
+  background_cv.notify_all();
+}
+
+void LsmStore::background() {
+  std::unique_lock<std::mutex> lock(background_mutex);
+  while (true) {
+    background_cv.wait(lock, [this]() { return stopping || frozen; });
+    // a frozen memtable left behind is still in the rotated log
+    if (stopping) {
+      return;
+    }
+    busy = true;
+    lock.unlock();
+    flushFrozen();
+    lock.lock();
+    frozen = false;
+    background_cv.notify_all();
+    lock.unlock();
+
+    while (true) {
+      {
+        std::shared_lock<std::shared_mutex> table_lock(mtx);
+        if (runs.size() <= LSM_MAX_RUNS) {
+          break;
+        }
+      }
+      compact();
+    }
+    lock.lock();
+    busy = false;
+    background_cv.notify_all();
+  }
+}
+
+void LsmStore::flushFrozen() {
+  std::shared_ptr<const Memtable> table;
+  uint64_t number;
+  {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    table = imm;
+    number = next_run++;
+  }
+  SortedRunWriter writer(runPath(number));
+  bool ok = writer.Open();
+  for (auto& kv : *table) {
+    writer.Add(kv.first, kv.second);
+  }
+  std::shared_ptr<SortedRun> run;
+  // until the run is written, its data is only in the rotated log, which we
+  // can't drop -- and can't keep growing either
+  if (!ok || !writer.Finish() ||
+      (run = SortedRun::Open(runPath(number), number)) == nullptr) {
+    perror(("lsm: writing " + runPath(number)).c_str());
+    abort();
+  }
+  flushed_bytes += run->Bytes();
+  flushes++;
+
+  std::vector<std::shared_ptr<SortedRun>> live;
+  uint64_t next;
+  {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    runs.insert(runs.begin(), run);
+    imm = nullptr;
+    live = runs;
+    next = next_run;
+  }
+  writeManifest(live, next);
+  log.DropRotated();
+}
+
+void LsmStore::compact() {
+  std::vector<std::shared_ptr<SortedRun>> inputs;
+  uint64_t number;
+  bool oldest;
+  {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    // the newest runs, up to where the next older one is bigger than all of
+    // them together: runs grow geometrically with age, so each entry is
+    // rewritten about once per size tier rather than once per compaction
+    uint64_t bytes = runs[0]->Bytes();
+    size_t count = 1;
+    while (count < runs.size() && (count < 2 || runs[count]->Bytes() < bytes)) {
+      bytes += runs[count++]->Bytes();
+    }
+    inputs.assign(runs.begin(), runs.begin() + count);
+    oldest = count == runs.size();
+    number = next_run++;
+  }
+  std::vector<std::unique_ptr<Source>> sources;
+  for (auto& run : inputs) {
+    sources.push_back(std::make_unique<RunSource>(run, ""));
+  }
+  SortedRunWriter writer(runPath(number));
+  bool ok = writer.Open();
+  merge(sources, "", [&writer, oldest](std::string_view k,
+                                       const LsmEntry& entry) {
+    // a tombstone can only go once nothing older is left for it to hide
+    if (!oldest || entry.kind != LsmEntry::DELETED) {
+      writer.Add(k, entry);
+    }
+  });
+  std::shared_ptr<SortedRun> run;
+  if (!ok || !writer.Finish() ||
+      (run = SortedRun::Open(runPath(number), number)) == nullptr) {
+    // the inputs are all still there, so we can go on without it
+    perror(("lsm: compacting into " + runPath(number)).c_str());
+    unlink(runPath(number).c_str());
+    return;
+  }
+  compacted_bytes += run->Bytes();
+  compactions++;
+
+  std::vector<std::shared_ptr<SortedRun>> live;
+  uint64_t next;
+  {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    // runs flushed meanwhile stay in front of it
+    auto first = std::find(runs.begin(), runs.end(), inputs[0]);
+    first = runs.erase(first, first + inputs.size());
+    runs.insert(first, run);
+    live = runs;
+    next = next_run;
+  }
+  writeManifest(live, next);
+  // readers still holding them keep the files until they're done
+  for (auto& input : inputs) {
+    input->MarkObsolete();
+  }
+}
+
+void LsmStore::writeManifest(
+    const std::vector<std::shared_ptr<SortedRun>>& live, uint64_t next) {
+  std::string contents = "next " + std::to_string(next) + "\n";
+  for (auto& run : live) {
+    contents += std::to_string(run->Number()) + "\n";
+  }
+  std::string path = dir + "/MANIFEST";
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 ||
+      ::write(fd, contents.data(), contents.size()) != (ssize_t)contents.size() ||
+      fsync(fd) != 0 || close(fd) != 0 ||
+      rename(tmp_path.c_str(), path.c_str()) != 0) {
+    perror("lsm: writing MANIFEST");
+    abort();
+  }
+  // the runs it lists were renamed into place in this directory too
+  syncDir(dir);
+}
+
+void LsmStore::scan(
+    std::string_view from, std::string_view to,
+    const std::function<void(std::string_view, const LsmEntry&)>& fn) {
+  std::vector<std::unique_ptr<Source>> sources;
+  {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    // the memtable keeps changing, so the range is copied out of it
+    auto copy = std::make_shared<Memtable>(
+        memtable.lower_bound(from),
+        to.empty() ? memtable.end() : memtable.lower_bound(to));
+    sources.push_back(std::make_unique<MemtableSource<Memtable>>(
+        std::move(copy), from));
+    if (imm != nullptr) {
+      sources.push_back(std::make_unique<MemtableSource<Memtable>>(imm, from));
+    }
+    for (auto& run : runs) {
+      sources.push_back(std::make_unique<RunSource>(run, from));
+    }
+  }
+  merge(sources, to, [&fn](std::string_view k, const LsmEntry& entry) {
+    if (entry.kind != LsmEntry::DELETED) {
+      fn(k, entry);
+    }
+  });
+}
+
+bool LsmStore::Get(const std::string& key, std::string* value) {
+  LsmEntry entry;
+  if (!read(lsmKey(key), &entry)) {
+    return false;
+  }
+  *value = valueOf(entry);
+  return true;
+}
+
+void LsmStore::GetBatch(const std::vector<std::string>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<bool>* found) {
+  values->assign(keys.size(), "");
+  found->assign(keys.size(), false);
+  for (size_t i = 0; i < keys.size(); i++) {
+    (*found)[i] = Get(keys[i], &(*values)[i]);
+  }
+}
+
+bool LsmStore::Put(const std::string& key, const std::string& value) {
+  std::string k = lsmKey(key);
+  std::unique_lock<std::mutex> lock(write_mutex);
+  LsmEntry old;
+  bool existed = read(k, &old);
+  uint64_t lsn =
+      write(k, {LsmEntry::PLAIN, value}, WriteAheadLog::PUT, key, value);
+  lock.unlock();
+  log.Sync(lsn);
+  return !existed;
+}
+
+bool LsmStore::PutIfAbsent(const std::string& key, const std::string& value) {
+  std::string k = lsmKey(key);
+  std::unique_lock<std::mutex> lock(write_mutex);
+  LsmEntry old;
+  if (read(k, &old)) {
+    return false;
+  }
+  uint64_t lsn =
+      write(k, {LsmEntry::PLAIN, value}, WriteAheadLog::PUT, key, value);
+  lock.unlock();
+  log.Sync(lsn);
+  return true;
+}
+
+bool LsmStore::Append(const std::string& key, const std::string& data) {
+  std::string k = lsmKey(key);
+  std::unique_lock<std::mutex> lock(write_mutex);
+  LsmEntry entry;
+  bool existed = read(k, &entry);
+  uint64_t lsn;
+  if (existed && entry.kind == LsmEntry::LIST) {
+    PostList list = listOf(entry);
+    for (const std::string& post : parse_value(data, ",")) {
+      list.Append(post);
+    }
+    entry.value = list.Encode();
+    lsn = write(k, entry, WriteAheadLog::PUT_LIST, key, entry.value);
+  } else {
+    entry.value += data;
+    lsn = write(k, {LsmEntry::PLAIN, entry.value}, WriteAheadLog::PUT, key,
+                entry.value);
+  }
+  lock.unlock();
+  log.Sync(lsn);
+  return !existed;
+}
+
+bool LsmStore::ListAppend(const std::string& key,
+                          const std::vector<std::string>& posts) {
+  std::string k = lsmKey(key);
+  std::unique_lock<std::mutex> lock(write_mutex);
+  LsmEntry entry;
+  bool existed = read(k, &entry);
+  // a plain value becomes a list, as in KvStore
+  PostList list = existed ? listOf(entry) : PostList();
+  for (const std::string& post : posts) {
+    list.Append(post);
+  }
+  std::string encoded = list.Encode();
+  uint64_t lsn = write(k, {LsmEntry::LIST, encoded}, WriteAheadLog::PUT_LIST,
+                       key, encoded);
+  lock.unlock();
+  log.Sync(lsn);
+  return !existed;
+}
+
+bool LsmStore::PutList(const std::string& key, PostList list, bool if_absent) {
+  std::string k = lsmKey(key);
+  std::unique_lock<std::mutex> lock(write_mutex);
+  LsmEntry old;
+  if (if_absent && read(k, &old)) {
+    return false;
+  }
+  std::string encoded = list.Encode();
+  uint64_t lsn = write(k, {LsmEntry::LIST, encoded}, WriteAheadLog::PUT_LIST,
+                       key, encoded);
+  lock.unlock();
+  log.Sync(lsn);
+  return true;
+}
+
+bool LsmStore::ListRemove(const std::string& key, const std::string& post) {
+  std::string k = lsmKey(key);
+  std::unique_lock<std::mutex> lock(write_mutex);
+  LsmEntry entry;
+  if (!read(k, &entry)) {
+    return false;
+  }
+  PostList list = listOf(entry);
+  if (!list.Remove(post)) {
+    return false;
+  }
+  std::string encoded = list.Encode();
+  uint64_t lsn = write(k, {LsmEntry::LIST, encoded}, WriteAheadLog::PUT_LIST,
+                       key, encoded);
+  lock.unlock();
+  log.Sync(lsn);
+  return true;
+}
+
+bool LsmStore::ListRange(const std::string& key, uint64_t cursor,
+                         size_t limit, std::vector<std::string>* posts,
+                         uint64_t* next, bool* more) {
+  LsmEntry entry;
+  if (!read(lsmKey(key), &entry)) {
+    return false;
+  }
+  listOf(entry).Range(cursor, limit, posts, next, more);
+  return true;
+}
+
+void LsmStore::PutBatch(std::vector<std::pair<std::string, std::string>>& pairs,
+                        std::vector<bool>* created) {
+  std::vector<std::string> keys;
+  for (auto& kv : pairs) {
+    keys.push_back(lsmKey(kv.first));
+  }
+  std::unique_lock<std::mutex> lock(write_mutex);
+  created->assign(pairs.size(), false);
+  uint64_t lsn = 0;
+  for (size_t i = 0; i < pairs.size(); i++) {
+    LsmEntry old;
+    (*created)[i] = !read(keys[i], &old);
+    lsn = log.Add(WriteAheadLog::PUT, pairs[i].first, pairs[i].second);
+    user_bytes += pairs[i].first.size() + pairs[i].second.size();
+  }
+  // all of the batch goes in the memtable at once
+  {
+    std::unique_lock<std::shared_mutex> table_lock(mtx);
+    for (size_t i = 0; i < pairs.size(); i++) {
+      memtable_size +=
+          keys[i].size() + pairs[i].second.size() + MEMTABLE_OVERHEAD;
+      memtable[keys[i]] = {LsmEntry::PLAIN, std::move(pairs[i].second)};
+    }
+  }
+  if (memtable_size >= memtable_bytes) {
+    freeze();
+  }
+  lock.unlock();
+  log.Sync(lsn);
+}
+
+bool LsmStore::Erase(const std::string& key, std::string* value) {
+  std::string k = lsmKey(key);
+  std::unique_lock<std::mutex> lock(write_mutex);
+  LsmEntry old;
+  if (!read(k, &old)) {
+    return false;
+  }
+  if (value != nullptr) {
+    *value = valueOf(old);
+  }
+  uint64_t lsn = write(k, {LsmEntry::DELETED, ""}, WriteAheadLog::ERASE, key,
+                       "");
+  lock.unlock();
+  log.Sync(lsn);
+  return true;
+}
+
+bool LsmStore::Update(const std::string& key,
+                      const std::function<void(std::string&)>& fn) {
+  std::string k = lsmKey(key);
+  std::unique_lock<std::mutex> lock(write_mutex);
+  LsmEntry entry;
+  if (!read(k, &entry) || entry.kind == LsmEntry::LIST) {
+    return false;
+  }
+  fn(entry.value);
+  uint64_t lsn =
+      write(k, entry, WriteAheadLog::PUT, key, entry.value);
+  lock.unlock();
+  log.Sync(lsn);
+  return true;
+}
+
+bool LsmStore::AppendIfPresent(const std::string& key,
+                               const std::string& data) {
+  return Update(key, [&data](std::string& value) { value += data; });
+}
+
+size_t LsmStore::EraseBatch(const std::vector<std::string>& keys) {
+  std::unique_lock<std::mutex> lock(write_mutex);
+  size_t erased = 0;
+  uint64_t lsn = 0;
+  for (const std::string& key : keys) {
+    std::string k = lsmKey(key);
+    LsmEntry old;
+    if (!read(k, &old)) {
+      continue;
+    }
+    lsn = write(k, {LsmEntry::DELETED, ""}, WriteAheadLog::ERASE, key, "");
+    erased++;
+  }
+  lock.unlock();
+  if (lsn != 0) {
+    log.Sync(lsn);
+  }
+  return erased;
+}
+
+std::vector<std::pair<std::string, std::string>> LsmStore::ReadRange(
+    const shard_t& s, std::vector<std::pair<std::string, std::string>>* lists) {
+  std::string from = idPrefix(true, s.lower);
+  // past the last ID, keys without one start
+  std::string to = s.upper == UINT32_MAX ? idPrefix(false, 0)
+                                         : idPrefix(true, s.upper + 1);
+  std::vector<std::pair<std::string, std::string>> pairs;
+  scan(from, to, [&pairs, lists](std::string_view k, const LsmEntry& entry) {
+    if (entry.kind != LsmEntry::LIST) {
+      pairs.emplace_back(userKey(k), entry.value);
+    } else if (lists != nullptr) {
+      lists->emplace_back(userKey(k), entry.value);
+    } else {
+      pairs.emplace_back(userKey(k), listOf(entry).Joined());
+    }
+  });
+  return pairs;
+}
+
+std::vector<std::pair<std::string, std::string>> LsmStore::Snapshot() {
+  std::vector<std::pair<std::string, std::string>> pairs;
+  scan("", "", [&pairs](std::string_view k, const LsmEntry& entry) {
+    pairs.emplace_back(userKey(k), entry.kind == LsmEntry::LIST
+                                       ? listOf(entry).Joined()
+                                       : entry.value);
+  });
+  return pairs;
+}
+
+size_t LsmStore::Size() {
+  size_t total = 0;
+  scan("", "", [&total](std::string_view, const LsmEntry&) { total++; });
+  return total;
+}
+
+void LsmStore::ForEachKey(const std::function<void(std::string_view)>& fn) {
+  scan("", "",
+       [&fn](std::string_view k, const LsmEntry&) { fn(userKey(k)); });
+}
+
+void LsmStore::Flush() {
+  {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    bool empty;
+    {
+      std::shared_lock<std::shared_mutex> table_lock(mtx);
+      empty = memtable.empty();
+    }
+    if (!empty) {
+      freeze();
+    }
+  }
+  std::unique_lock<std::mutex> lock(background_mutex);
+  background_cv.wait(lock, [this]() { return !frozen && !busy; });
+}
+
+LsmStats LsmStore::Stats() {
+  LsmStats s;
+  s.user_bytes = user_bytes;
+  s.flushed_bytes = flushed_bytes;
+  s.compacted_bytes = compacted_bytes;
+  s.flushes = flushes;
+  s.compactions = compactions;
+  s.lookups = lookups;
+  s.blocks_read = blocks_read;
+  s.stalls = stalls;
+  std::shared_lock<std::shared_mutex> lock(mtx);
+  s.runs = runs.size();
+  return s;
+}
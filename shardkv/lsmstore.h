@@ -0,0 +1,199 @@
+#ifndef SHARDING_LSMSTORE_H
+#define SHARDING_LSMSTORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sortedrun.h"
+#include "storage.h"
+#include "wal.h"
+
+// the memtable is flushed to a new run once it holds about this many bytes
+constexpr size_t LSM_MEMTABLE_BYTES = 4 << 20;
+
+// once there are more runs than this, the newest ones are merged
+constexpr size_t LSM_MAX_RUNS = 4;
+
+// what an LsmStore has done so far, to see what reads and writes cost
+struct LsmStats {
+  // bytes of keys and values written by callers
+  uint64_t user_bytes = 0;
+  // bytes of runs written by flushes and by compactions
+  uint64_t flushed_bytes = 0;
+  uint64_t compacted_bytes = 0;
+  uint64_t flushes = 0;
+  uint64_t compactions = 0;
+  // point lookups, and the run blocks they read from disk
+  uint64_t lookups = 0;
+  uint64_t blocks_read = 0;
+  // writers that waited for a flush because the memtable filled up first
+  uint64_t stalls = 0;
+  size_t runs = 0;
+};
+
+// A log-structured merge tree on disk: the StorageEngine for data that
+// doesn't fit in memory.
+//
+// Writes go to a WriteAheadLog and an in-memory sorted memtable. When the
+// memtable fills up it's frozen, the log is rotated, and a background thread
+// writes the frozen memtable out as an immutable SortedRun (with a block
+// index and Bloom filter) and drops the rotated log. When there are more than
+// LSM_MAX_RUNS runs, the thread merges the newest ones (size-tiered: runs
+// grow with age, so an entry is rewritten about once per size tier), dropping
+// values that were overwritten, and keys that were erased once the merge
+// reaches the oldest run. A lookup checks the memtable, the frozen memtable
+// and then the runs from newest to oldest; the Bloom filters let it skip
+// nearly every run that doesn't hold the key, so it reads about one block
+// from disk.
+//
+// Keys are ordered by their ID first (keys without one go last), so the keys
+// of a shard are one contiguous range and ReadRange scans only that range.
+//
+// Writers are serialized by one mutex, which also makes read-modify-writes
+// (Append, Update, the List* methods) atomic; each write is synced after the
+// mutex is released, so writers waiting together share an fsync (in BATCHED
+// mode). Readers don't take it. A post list is stored as its comma-joined
+// string and rebuilt as a PostList when it's changed or paged through.
+//
+// The directory holds the log ("wal"), the runs ("run-<n>") and a MANIFEST
+// listing the live runs, newest first. Open recovers from all three.
+class LsmStore : public StorageEngine {
+ public:
+  LsmStore(std::string dir, SyncMode mode,
+           size_t memtable_bytes = LSM_MEMTABLE_BYTES);
+
+  // stops the background thread. whatever is still in the memtable is in
+  // the log
+  ~LsmStore();
+
+  // opens the store in dir, creating it if it doesn't exist: loads the runs
+  // in the manifest and replays the log. returns false (with errno set) if
+  // any of them can't be read
+  bool Open();
+
+  bool Get(const std::string& key, std::string* value) override;
+  void GetBatch(const std::vector<std::string>& keys,
+                std::vector<std::string>* values,
+                std::vector<bool>* found) override;
+  bool Put(const std::string& key, const std::string& value) override;
+  bool PutIfAbsent(const std::string& key, const std::string& value) override;
+  bool Append(const std::string& key, const std::string& data) override;
+  bool ListAppend(const std::string& key,
+                  const std::vector<std::string>& posts) override;
+  bool PutList(const std::string& key, PostList list, bool if_absent) override;
+  bool ListRemove(const std::string& key, const std::string& post) override;
+  bool ListRange(const std::string& key, uint64_t cursor, size_t limit,
+                 std::vector<std::string>* posts, uint64_t* next,
+                 bool* more) override;
+  void PutBatch(std::vector<std::pair<std::string, std::string>>& pairs,
+                std::vector<bool>* created) override;
+  bool Erase(const std::string& key, std::string* value = nullptr) override;
+  bool AppendIfPresent(const std::string& key,
+                       const std::string& data) override;
+  bool Update(const std::string& key,
+              const std::function<void(std::string&)>& fn) override;
+  size_t EraseBatch(const std::vector<std::string>& keys) override;
+  std::vector<std::pair<std::string, std::string>> ReadRange(
+      const shard_t& s,
+      std::vector<std::pair<std::string, std::string>>* lists =
+          nullptr) override;
+  std::vector<std::pair<std::string, std::string>> Snapshot() override;
+  size_t Size() override;
+  void ForEachKey(const std::function<void(std::string_view)>& fn) override;
+
+  // writes the memtable out as a run and waits until the background thread
+  // has nothing left to do, e.g. before measuring reads
+  void Flush();
+
+  LsmStats Stats();
+
+ private:
+  // sorted by the encoded key (see lsmKey)
+  using Memtable = std::map<std::string, LsmEntry, std::less<>>;
+
+  // looks up the encoded key k. returns false if it's missing or erased
+  bool read(const std::string& k, LsmEntry* entry);
+
+  // puts entry in the memtable under the encoded key k, and logs the change
+  // to key as op with data. caller must hold write_mutex. returns the LSN to
+  // sync once write_mutex is released
+  uint64_t write(const std::string& k, LsmEntry entry, WriteAheadLog::Op op,
+                 const std::string& key, std::string_view data);
+
+  // what write does, without logging. caller must hold write_mutex
+  void apply(const std::string& k, LsmEntry entry);
+
+  // calls fn(k, entry) on the newest entry of each encoded key k in
+  // [from, to) (to = "" for no end), skipping erased keys, in key order
+  void scan(std::string_view from, std::string_view to,
+            const std::function<void(std::string_view, const LsmEntry&)>& fn);
+
+  // freezes the memtable and rotates the log, once the last frozen memtable
+  // is written out. caller must hold write_mutex
+  void freeze();
+
+  // runs in a separate thread: flushes frozen memtables and compacts
+  void background();
+
+  // writes imm out as a new run and drops the rotated log
+  void flushFrozen();
+
+  // merges the newest runs into one (see the .cc for which)
+  void compact();
+
+  // makes live (newest first) the runs in the manifest
+  void writeManifest(const std::vector<std::shared_ptr<SortedRun>>& live,
+                     uint64_t next);
+
+  std::string runPath(uint64_t number) const;
+
+  const std::string dir;
+  const size_t memtable_bytes;
+  WriteAheadLog log;
+
+  // serializes writers
+  std::mutex write_mutex;
+
+  // guards memtable, imm and runs. readers take it shared just long enough
+  // to look in the memtables and copy runs
+  std::shared_mutex mtx;
+  Memtable memtable;
+  size_t memtable_size = 0;
+  // the frozen memtable being written out, or null
+  std::shared_ptr<const Memtable> imm;
+  // newest first
+  std::vector<std::shared_ptr<SortedRun>> runs;
+  uint64_t next_run = 1;
+
+  // wakes the background thread, and writers waiting for it. frozen is set
+  // while there's a frozen memtable to write out, busy while the thread is
+  // working
+  std::mutex background_mutex;
+  std::condition_variable background_cv;
+  bool frozen = false;
+  bool busy = false;
+  bool stopping = false;
+  std::thread background_thread;
+
+  // set while Open replays the log, which mustn't be rotated meanwhile
+  bool recovering = false;
+
+  // counters for Stats
+  std::atomic<uint64_t> user_bytes{0};
+  std::atomic<uint64_t> flushed_bytes{0};
+  std::atomic<uint64_t> compacted_bytes{0};
+  std::atomic<uint64_t> flushes{0};
+  std::atomic<uint64_t> compactions{0};
+  std::atomic<uint64_t> lookups{0};
+  std::atomic<uint64_t> blocks_read{0};
+  std::atomic<uint64_t> stalls{0};
+};
+
+#endif  // SHARDING_LSMSTORE_H
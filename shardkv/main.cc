@@ -1,15 +1,76 @@
 #include <grpcpp/grpcpp.h>
 #include <unistd.h>
 #include <cstdio>
+#include <cstdlib>
 
+#include "async_server.h"
+#include "lsmstore.h"
 #include "shardkv.h"
 
+// how often a server with a snapshot file checkpoints its store by default
+constexpr std::chrono::seconds SNAPSHOT_INTERVAL(60);
+
+// how often a server with a memory budget reports what it keeps where
+constexpr std::chrono::seconds MEMORY_REPORT_INTERVAL(10);
+
+static void usage() {
+  fprintf(stderr, "usage: ./shardkv [-l <LOG FILE> " \
+                  "[-p <SNAPSHOT FILE> [-i <SNAPSHOT INTERVAL SECONDS>]] | " \
+                  "-d <DATA DIR>] [-s per-write|batched|async] " \
+                  "[-m <MEMORY BUDGET MB> [-f <SPILL FILE>]] " \
+                  "<PORT> " \
+                  "<SHARDMASTER HOSTNAME[,...]> <SHARDMASTER PORT[,...]> " \
+                  "[<COMPLETION QUEUES> [<POLLERS PER QUEUE>]]\n");
+}
+
 int main(int argc, char** argv) {
-  if (argc != 4) {
-    fprintf(stderr, "usage: ./shardkv <PORT> <SHARDMASTER HOSTNAME> " \
-                    "<SHARDMASTER PORT>\n");
+  // with a log file, our data survives a restart. each write is acknowledged
+  // once it's synced the way -s says (batched by default)
+  // with a snapshot file too, we restart from the last snapshot plus the
+  // log written since, and snapshot every -i seconds
+  // with a data directory instead, keys are kept on disk in an LsmStore (which
+  // logs its own writes, synced the way -s says), so they needn't fit in
+  // memory
+  // with a memory budget, the keys read or written longest ago are spilled
+  // to a file once the budget is used up (not with -d, which is on disk
+  // already)
+  std::string log_path;
+  std::string data_dir;
+  SyncMode sync_mode = SyncMode::BATCHED;
+  std::string snapshot_path;
+  std::chrono::seconds snapshot_interval = SNAPSHOT_INTERVAL;
+  size_t memory_budget = 0;
+  std::string spill_path;
+  int opt;
+  while ((opt = getopt(argc, argv, "l:s:p:i:d:m:f:")) != -1) {
+    if (opt == 'm' && atoll(optarg) > 0) {
+      memory_budget = (size_t)atoll(optarg) << 20;
+    } else if (opt == 'f') {
+      spill_path = optarg;
+    } else if (opt == 'l') {
+      log_path = optarg;
+    } else if (opt == 'd') {
+      data_dir = optarg;
+    } else if (opt == 'p') {
+      snapshot_path = optarg;
+    } else if (opt == 'i' && atoi(optarg) > 0) {
+      snapshot_interval = std::chrono::seconds(atoi(optarg));
+    } else if (opt != 's' || !ParseSyncMode(optarg, &sync_mode)) {
+      usage();
+      return 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc < 4 || argc > 6 || (snapshot_path != "" && log_path == "") ||
+      (data_dir != "" && (log_path != "" || memory_budget != 0))) {
+    usage();
     return 1;
   }
+  // with a number of completion queues we serve requests asynchronously,
+  // otherwise with the sync API
+  int num_cqs = argc > 4 ? atoi(argv[4]) : 0;
+  int pollers_per_cq = argc > 5 ? atoi(argv[5]) : 1;
   // get our hostname so we can construct address for shardkv. we need this
   // because the shardmaster will know us by our hostname and port, so we should
   // track that.
@@ -21,13 +82,99 @@ int main(int argc, char** argv) {
   std::string addr = hostname + ":" + port;
 
   fprintf(stdout, "Listening on: %s\n", addr.c_str());
-  std::string shardmaster_addr =
-      std::string(argv[2]) + ":" + std::string(argv[3]);
+  // a replicated shardmaster is given as a list of hosts and/or ports
+  std::string shardmaster_addr = ShardmasterAddrs(argv[2], argv[3]);
+  if (shardmaster_addr == "") {
+    usage();
+    return 1;
+  }
   fprintf(stdout, "Shardmaster on: %s\n", shardmaster_addr.c_str());
 
+  // the store is recovered here, before the server is started
+  std::unique_ptr<StorageEngine> store;
+  std::unique_ptr<WriteAheadLog> log;
+  // the store, unless it's an LsmStore. it lives as long as the server, i.e.
+  // until we exit, so the threads below can keep a pointer to it
+  KvStore* kv_store = nullptr;
+  if (data_dir != "") {
+    auto lsm = std::make_unique<LsmStore>(data_dir, sync_mode);
+    if (!lsm->Open()) {
+      perror(data_dir.c_str());
+      return 1;
+    }
+    fprintf(stdout, "Storing on disk in: %s\n", data_dir.c_str());
+    store = std::move(lsm);
+  } else {
+    auto kv = std::make_unique<KvStore>();
+    kv_store = kv.get();
+    store = std::move(kv);
+  }
+  if (memory_budget != 0) {
+    if (spill_path == "") {
+      spill_path = "./shardkv_" + port + ".spill";
+    }
+    if (!kv_store->SetMemoryBudget(memory_budget, spill_path)) {
+      perror(spill_path.c_str());
+      return 1;
+    }
+    fprintf(stdout, "Memory budget: %zu MB, spilling to %s\n",
+            memory_budget >> 20, spill_path.c_str());
+    std::thread reporter([kv_store]() {
+      while (true) {
+        std::this_thread::sleep_for(MEMORY_REPORT_INTERVAL);
+        KvMemoryStats m = kv_store->MemoryStats();
+        fprintf(stdout,
+                "Memory: %zu bytes resident, %zu bytes in %zu stripes "
+                "spilled; %llu faults (avg %.1f us, max %llu us)\n",
+                m.resident_bytes, m.spilled_bytes, m.spilled_stripes,
+                (unsigned long long)m.faults,
+                m.faults > 0 ? (double)m.fault_micros_total / m.faults : 0.0,
+                (unsigned long long)m.fault_micros_max);
+        fflush(stdout);
+      }
+    });
+    reporter.detach();
+  }
+  if (log_path != "") {
+    log = std::make_unique<WriteAheadLog>(log_path, sync_mode);
+    if (!log->Open()) {
+      perror(log_path.c_str());
+      return 1;
+    }
+    fprintf(stdout, "Logging to: %s\n", log_path.c_str());
+    size_t records = kv_store->Recover(log.get(), snapshot_path);
+    fprintf(stdout, "Replayed %s%zu log records\n",
+            snapshot_path != "" ? "the snapshot and " : "", records);
+    if (snapshot_path != "") {
+      fprintf(stdout, "Snapshots to: %s every %llds\n", snapshot_path.c_str(),
+              (long long)snapshot_interval.count());
+      // reads are served from the mapped snapshot meanwhile
+      std::thread hydrator([kv_store]() { kv_store->Hydrate(); });
+      hydrator.detach();
+      std::thread checkpointer([kv_store, snapshot_path, snapshot_interval]() {
+        while (true) {
+          std::this_thread::sleep_for(snapshot_interval);
+          if (!kv_store->Checkpoint(snapshot_path)) {
+            perror(snapshot_path.c_str());
+          }
+        }
+      });
+      checkpointer.detach();
+    }
+  }
+
   ::grpc::ServerBuilder builder;
   builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
-  ShardkvServer shardkv(addr, shardmaster_addr);
+  ShardkvServer shardkv(addr, shardmaster_addr, true, std::move(store));
+  if (num_cqs > 0) {
+    fprintf(stdout, "Serving async: %d completion queues, %d pollers each\n",
+            num_cqs, pollers_per_cq);
+    AsyncShardkvServer async(&shardkv, &builder, num_cqs, pollers_per_cq);
+    std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
+    async.Start();
+    async.Wait();
+    return 0;
+  }
   builder.RegisterService(&shardkv);
   std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
 
@@ -0,0 +1,97 @@
+#include "postlist.h"
+
+#include "../common/common.h"
+#include "../common/records.h"
+
+PostList::PostList(const std::string& joined) {
+  for (const std::string& post : parse_value(joined, ",")) {
+    Append(post);
+  }
+}
+
+bool PostList::Append(const std::string& post) {
+  auto [it, inserted] = seqs.try_emplace(post, next_seq);
+  if (!inserted) {
+    return false;
+  }
+  order.emplace_hint(order.end(), next_seq++, &it->first);
+  chars += post.size();
+  return true;
+}
+
+bool PostList::Remove(const std::string& post) {
+  auto it = seqs.find(post);
+  if (it == seqs.end()) {
+    return false;
+  }
+  order.erase(it->second);
+  chars -= post.size();
+  seqs.erase(it);
+  return true;
+}
+
+std::string PostList::Joined() const {
+  std::string joined;
+  for (auto& [seq, post] : order) {
+    joined += *post;
+    joined += ',';
+  }
+  return joined;
+}
+
+// next_seq and the number of posts, then each post's sequence number, length
+// and characters, in order
+std::string PostList::Encode() const {
+  std::string data;
+  data.reserve(2 * sizeof(uint64_t) + chars +
+               order.size() * (sizeof(uint64_t) + sizeof(uint32_t)));
+  PutRaw<uint64_t>(&data, next_seq);
+  PutRaw<uint64_t>(&data, order.size());
+  for (auto& [seq, post] : order) {
+    PutRaw<uint64_t>(&data, seq);
+    PutRaw<uint32_t>(&data, post->size());
+    data.append(*post);
+  }
+  return data;
+}
+
+bool PostList::Decode(std::string_view data, PostList* list) {
+  constexpr size_t POST_HEADER = sizeof(uint64_t) + sizeof(uint32_t);
+  if (data.size() < 2 * sizeof(uint64_t)) {
+    return false;
+  }
+  uint64_t next_seq = GetRaw<uint64_t>(data.data());
+  uint64_t count = GetRaw<uint64_t>(data.data() + sizeof(uint64_t));
+  size_t pos = 2 * sizeof(uint64_t);
+  for (uint64_t i = 0; i < count; i++) {
+    if (data.size() - pos < POST_HEADER) {
+      return false;
+    }
+    uint64_t seq = GetRaw<uint64_t>(data.data() + pos);
+    uint32_t len = GetRaw<uint32_t>(data.data() + pos + sizeof(uint64_t));
+    pos += POST_HEADER;
+    // sequence numbers only go up, and are all below next_seq
+    if (data.size() - pos < len || seq >= next_seq ||
+        (!list->order.empty() && seq <= list->order.rbegin()->first)) {
+      return false;
+    }
+    list->next_seq = seq;
+    if (!list->Append(std::string(data.substr(pos, len)))) {
+      return false;
+    }
+    pos += len;
+  }
+  list->next_seq = next_seq;
+  return pos == data.size();
+}
+
+void PostList::Range(uint64_t cursor, size_t limit,
+                     std::vector<std::string>* posts, uint64_t* next,
+                     bool* more) const {
+  auto it = order.lower_bound(cursor);
+  for (; it != order.end() && limit > 0; it++, limit--) {
+    posts->push_back(*it->second);
+  }
+  *next = it == order.end() ? next_seq : it->first;
+  *more = it != order.end();
+}
@@ -0,0 +1,78 @@
+#ifndef SHARDING_POSTLIST_H
+#define SHARDING_POSTLIST_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// bytes a post costs in a PostList besides its own characters: a hash node
+// holding it and a tree node pointing at it
+constexpr size_t POST_OVERHEAD = 96;
+
+// The posts of one user (the value of user_<id>_posts), as a list instead of
+// a comma-joined string.
+//
+// Every post gets the next sequence number when it's appended, and the list
+// is ordered by it, so appending is amortized O(1) and removing a post is
+// O(log n) without touching the others. Sequence numbers are never reused,
+// which makes them stable cursors for reading the list a page at a time even
+// while posts are removed. A post is on the list at most once.
+//
+// Joined() loses the sequence numbers (a list parsed back from it numbers its
+// posts from 0), so a list is stored and handed off as Encode() instead,
+// which keeps them.
+class PostList {
+ public:
+  PostList() = default;
+
+  // parses a comma-joined list like "post_1,post_2,"
+  explicit PostList(const std::string& joined);
+
+  // points into seqs, which moves along with its nodes but can't be copied
+  PostList(const PostList&) = delete;
+  PostList& operator=(const PostList&) = delete;
+  PostList(PostList&&) = default;
+  PostList& operator=(PostList&&) = default;
+
+  // appends post unless it's already on the list. returns whether it was
+  // added
+  bool Append(const std::string& post);
+
+  // removes post. returns whether it was on the list
+  bool Remove(const std::string& post);
+
+  size_t Size() const { return seqs.size(); }
+
+  // roughly the bytes the list takes in memory
+  size_t Bytes() const { return chars + seqs.size() * POST_OVERHEAD; }
+
+  // every post followed by a comma, the legacy user_<id>_posts value
+  std::string Joined() const;
+
+  // the list with its sequence numbers, for Decode
+  std::string Encode() const;
+
+  // makes *list (which must be empty) the list data holds, as Encode left
+  // it. returns false if data isn't one
+  static bool Decode(std::string_view data, PostList* list);
+
+  // copies up to limit posts to posts, starting from the first one at or past
+  // cursor. *next is set to the cursor to continue from and *more to whether
+  // there are posts past it
+  void Range(uint64_t cursor, size_t limit, std::vector<std::string>* posts,
+             uint64_t* next, bool* more) const;
+
+ private:
+  // post -> sequence number
+  std::unordered_map<std::string, uint64_t> seqs;
+  // sequence number -> post (the key in seqs)
+  std::map<uint64_t, const std::string*> order;
+  uint64_t next_seq = 0;
+  // characters in all posts together
+  size_t chars = 0;
+};
+
+#endif  // SHARDING_POSTLIST_H
@@ -1,7 +1,21 @@
 #include <grpcpp/grpcpp.h>
+#include <algorithm>
+#include <atomic>
+#include <set>
 
 #include "shardkv.h"
 
+// most entries one ListUsers or ListPosts page holds, so a client can't make
+// us build an arbitrarily large response
+constexpr uint32_t MAX_PAGE = 1000;
+
+// what a request gets for a key that's still on its way to us after
+// HANDOFF_WAIT
+static ::grpc::Status stillArriving() {
+  return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE,
+                        "ERR: key is still being handed off to this server");
+}
+
 /**
  * This method is analogous to a hashmap lookup. A key is supplied in the
  * request and if its value can be found, we should either set the appropriate
@@ -19,38 +33,36 @@
                                   const ::GetRequest *request,
                                   ::GetResponse *response) {
 
-  std::string key = request->key();
+  const std::string &key = request->key();
   if (key == "") {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: GET request key null");
   }
 
-  std::lock_guard<std::mutex> lock(kv_mutex);
-  std::map<std::string, std::string>::iterator it;
-  if (key == "all_users") {
-    it = kv_store.find("all_users");
-    std::string all_users = it->second;
-    response->set_data(all_users);
+  ParsedKey parsed = ParseKey(key);
+  if (parsed.type == KeyType::ALL_USERS) {
+    response->set_data(user_directory.Joined());
     return ::grpc::Status::OK;
   }
-  // for key of type user_id, post_id, and user_id_posts
-  int id = extractID(key);
 
-  // if current server not responsible for key
-  if (CheckInShard(id, local_shard) == false) {
+  // for key of type user_id, post_id, and user_id_posts
+  std::shared_lock<std::shared_mutex> lock(shard_mutex);
+  if (!awaitHandoff(lock, parsed.id)) {
+    return stillArriving();
+  }
+  // if current server not responsible for key (keys without an ID belong to
+  // nobody)
+  if (shard_index.Local(parsed.id) == false) {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: server not responsible for key");
   }
 
-  it = kv_store.find(key);
-  if (it == kv_store.end()) {
+  // on success, the data goes straight into rsp
+  if (!kv_store->Get(key, response->mutable_data())) {
     // if not found
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "GET request key not found");
   }
-  // on success, set data for rsp
-  std::string value = it->second;
-  response->set_data(value);
   return ::grpc::Status::OK;
 }
 
@@ -71,9 +83,42 @@
 ::grpc::Status ShardkvServer::Put(::grpc::ServerContext *context,
                                   const ::PutRequest *request,
                                   Empty *response) {
-  std::string key = request->key();
-  std::string data = request->data();
-  std::string user = request->user();
+  Forwards<AppendRequest> appends;
+  ::grpc::Status status = PutLocal(request, &appends);
+  sendAppends(appends);
+  return status;
+}
+
+void ShardkvServer::sendAppends(const Forwards<AppendRequest> &appends) {
+  // APPEND request call in another server to append post_id to user_id_posts
+  for (auto &[server, req] : appends) {
+    auto stub = peers.Get(server);
+    ::grpc::ClientContext cc;
+    Empty res;
+    auto status = stub->Append(&cc, req, &res);
+    while (!status.ok()) { // sleep & retry till success
+      std::chrono::milliseconds timespan(50);
+      std::this_thread::sleep_for(timespan);
+      ::grpc::ClientContext new_cc;
+      status = stub->Append(&new_cc, req, &res);
+    }
+  }
+}
+
+::grpc::Status ShardkvServer::PutLocal(const ::PutRequest *request,
+                                       Forwards<AppendRequest> *appends) {
+  std::shared_lock<std::shared_mutex> lock(shard_mutex);
+  return putLocked(lock, request, appends,
+                   std::chrono::steady_clock::now() + HANDOFF_WAIT);
+}
+
+::grpc::Status ShardkvServer::putLocked(
+    std::shared_lock<std::shared_mutex> &lock, const ::PutRequest *request,
+    Forwards<AppendRequest> *appends,
+    std::chrono::steady_clock::time_point deadline) {
+  const std::string &key = request->key();
+  const std::string &data = request->data();
+  const std::string &user = request->user();
   if (key == "") {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: PUT request key null");
@@ -83,60 +128,41 @@
   // then check if key already in map, if so, update value to data
   // if not, insert the kvpair, find the all_users in map, append user_id; also
   // append for the all_users list
-  if (key == "all_users") {
+  ParsedKey parsed = ParseKey(key);
+  if (parsed.type == KeyType::ALL_USERS) {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: PUT request all users invalid");
   }
 
   // case of key == user_id, post_id, or user_id_posts
-  std::vector<std::string> parsed = parse_value(key, "_");
-
-  std::lock_guard<std::mutex> lock(kv_mutex);
-  std::map<std::string, std::string>::iterator it;
-
-  int uid = extractID(key);
+  if (!awaitHandoff(lock, parsed.id, deadline)) {
+    return stillArriving();
+  }
   // if key not in local shard range (for user_id, post_id, and user_id_posts)
-  if (CheckInShard(uid, local_shard) == false) {
+  if (shard_index.Local(parsed.id) == false) {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: PUT request server not responsible for key");
   }
 
   // special case: internal PUT where user field is "" & it's transfering a
   // "post"
-  if (parsed[0] == "post" && parsed.size() == 2 && user == "") {
-    it = kv_store.find(key);
-    if (it == kv_store.end()) {
-      kv_store.insert(std::pair<std::string, std::string>(key, data));
-    } else {
-      it->second = data;
-    }
+  if (parsed.type == KeyType::POST && user == "") {
+    kv_store->Put(key, data);
     return ::grpc::Status::OK;
   }
 
   // internal transfer for "user_id_posts": user field is ""
-  if (parsed.size() == 3 && (parsed[0] == "user" && parsed[2] == "posts") &&
-      user == "") {
-    it = kv_store.find(key);
-    if (it == kv_store.end()) {
-      kv_store.insert(std::pair<std::string, std::string>(key, data));
-    } else {
-      it->second = data;
-    }
+  if (parsed.type == KeyType::USER_POSTS && user == "") {
+    kv_store->Put(key, data);
     return ::grpc::Status::OK;
   }
 
-  if (parsed[0] == "user" && parsed.size() == 2) { // key is of type "user_id"
-    // if key not in kvstore
-    it = kv_store.find(key);
-    if (it == kv_store.end()) {
-      // if not found, set user_id -> name (str)
-      kv_store.insert(std::pair<std::string, std::string>(key, data));
-      // add to all_users both in map & in list
-      it = kv_store.find("all_users");
-      it->second = it->second + key + ","; // cat new "user_id,"
-    } else { // otherwise, this user already exist in local kvstore, just change
-             // the value
-      it->second = data;
+  if (parsed.type == KeyType::USER) { // key is of type "user_id"
+    // set user_id -> name (str); if the user is new, add it to all_users,
+    // otherwise this user already exist in local kvstore and we just changed
+    // the value
+    if (kv_store->Put(key, data)) {
+      user_directory.Add(key);
     }
     return ::grpc::Status::OK;
   }
@@ -145,63 +171,49 @@
   // if not, insert the kvpair, check if user_id is in local shard range,
   // if so, check if user is new, if so, insert into
   // all_users, also update user_id_posts with post_id
-  else if (parsed[0] == "post" && parsed.size() == 2 &&
+  else if (parsed.type == KeyType::POST &&
            user != "") { // key is of type "post_id" & non empty user_id
+    ParsedKey parsed_user = ParseKey(user);
+    if (parsed_user.type != KeyType::USER) {
+      return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                            "ERR: PUT request user invalid");
+    }
+    // the post goes on the user's list, which mustn't be on its way to us
+    if (!awaitHandoff(lock, parsed_user.id, deadline)) {
+      return stillArriving();
+    }
+    // a config may have come in while we waited
+    if (shard_index.Local(parsed.id) == false) {
+      return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                            "ERR: PUT request server not responsible for key");
+    }
 
-    it = kv_store.find(key);
-    if (it == kv_store.end()) { // if post_id not found
-      // set post_id -> text (str)
-      kv_store.insert(std::pair<std::string, std::string>(key, data));
-      // check if user_id_posts/user_id is in local shard range
-      int uuid = extractID(user);
-      if (CheckInShard(uuid, local_shard) == false) {
-        // APPEND request call in another server to append post_id to
-        // user_id_posts
-        for (auto &server : server_shard_map) {
-          if (CheckInShard(uuid, server.second)) {
-            auto channel = grpc::CreateChannel(
-                server.first, grpc::InsecureChannelCredentials());
-            auto stub = Shardkv::NewStub(channel);
-
-            ::grpc::ClientContext cc;
-            AppendRequest req;
-            Empty res;
-            req.set_key(user + "_posts");
-            req.set_data(key + ",");
-
-            auto status = stub->Append(&cc, req, &res);
-            while (!status.ok()) { // sleep & retry till success
-              std::chrono::milliseconds timespan(50);
-              std::this_thread::sleep_for(timespan);
-              ::grpc::ClientContext new_cc;
-              status = stub->Append(&new_cc, req, &res);
-            }
-          }
-        }
-      } else {
-        it = kv_store.find(user);
-        if (it == kv_store.end()) {
-          // if user is new (here we are sure user_id is also in shard range of
-          // this
-          // server), add to map with value "" --> in tests we shouldn't reach
-          // this state
-          kv_store.insert(std::pair<std::string, std::string>(user, ""));
-          it = kv_store.find("all_users");
-          it->second = it->second + user + ","; // cat new "user_id,"
-        }
-        // otherwise, user_id already exists
-        // if user_id_post not already in local kv_store, create a mapping & add
-        // the post, otherwise append new post to the user_id_posts
-        it = kv_store.find(user + "_posts");
-        if (it == kv_store.end()) {
-          kv_store.insert(
-              std::pair<std::string, std::string>(user + "_posts", key + ","));
-        } else {
-          it->second = it->second + key + ",";
-        }
+    // set post_id -> text (str). if post_id was already there we're done
+    if (!kv_store->Put(key, data)) {
+      return ::grpc::Status::OK;
+    }
+    // check if user_id_posts/user_id is in local shard range
+    int uuid = parsed_user.id;
+    if (shard_index.Local(uuid) == false) {
+      // the post goes on user_id_posts in another server. the caller sends the
+      // APPEND, so we don't hold the shard lock across the RPC
+      std::string server = serverFor(uuid);
+      if (server != "") {
+        AppendRequest req;
+        req.set_key(user + "_posts");
+        req.set_data(key + ",");
+        appends->emplace_back(server, std::move(req));
+      }
+    } else {
+      // if user is new (here we are sure user_id is also in shard range of
+      // this server), add to map with value "" --> in tests we shouldn't
+      // reach this state
+      if (kv_store->Append(user, "")) {
+        user_directory.Add(user);
       }
-    } else { // if post_id found, just update the data
-      it->second = data;
+      // if user_id_post not already in local kv_store, create a mapping & add
+      // the post, otherwise append new post to the user_id_posts
+      kv_store->ListAppend(user + "_posts", {key});
     }
   }
   return ::grpc::Status::OK;
@@ -226,53 +238,49 @@
   // what can't we append to: all_users (should be illegal behavior),
   // user_id_posts (we don't have user field), otherwise for user_id and post_id
   // we can just append to data if appropriate
-  std::string key = request->key();
-  std::string data = request->data();
+  const std::string &key = request->key();
+  const std::string &data = request->data();
   if (key == "") {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: APPEND request key null");
   }
-  if (key == "all_users") {
+  ParsedKey parsed = ParseKey(key);
+  if (parsed.type == KeyType::ALL_USERS) {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: APPEND request all users illegal behavior");
   }
-  std::vector<std::string> parsed = parse_value(key, "_");
-  std::lock_guard<std::mutex> lock(kv_mutex);
-  std::map<std::string, std::string>::iterator it;
+  std::shared_lock<std::shared_mutex> lock(shard_mutex);
+  if (!awaitHandoff(lock, parsed.id)) {
+    return stillArriving();
+  }
 
-  int id = extractID(key);
   // check if id is in local scope for user_id and post_id
-  if (CheckInShard(id, local_shard) == false) {
+  if (shard_index.Local(parsed.id) == false) {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: APPEND request server not responsible for id");
   }
 
-  if (parsed.size() == 3 && (parsed[0] == "user" && parsed[2] == "posts")) {
-    it = kv_store.find(key);
-    if (it == kv_store.end()) {
-      kv_store.insert(std::pair<std::string, std::string>(key, data));
-    } else {
-      it->second += data;
-    }
+  if (parsed.type == KeyType::USER_POSTS) {
+    kv_store->ListAppend(key, parse_value(data, ","));
     return ::grpc::Status::OK;
   }
 
-  it = kv_store.find(key);
-  if (it == kv_store.end()) {
-    // if not found, we can only handle user_id here, cuz for post, we can't
-    // create a post for a user we don't know
-    if (parsed.size() == 2 && parsed[0] == "post") {
-      return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
-                            "ERR: APPEND request cannot handle post_id without "
-                            "user_id specified");
-    } else if (parsed.size() == 2 && parsed[0] == "user") {
-      kv_store.insert(std::pair<std::string, std::string>(key, data));
-      // add to all_users both in map & in list
-      it = kv_store.find("all_users");
-      it->second = it->second + key + ","; // cat new "user_id,"
+  // if user_id/post_id exists, just append data
+  if (kv_store->AppendIfPresent(key, data)) {
+    return ::grpc::Status::OK;
+  }
+  // if not found, we can only handle user_id here, cuz for post, we can't
+  // create a post for a user we don't know
+  if (parsed.type == KeyType::POST) {
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                          "ERR: APPEND request cannot handle post_id without "
+                          "user_id specified");
+  } else if (parsed.type == KeyType::USER) {
+    // add to all_users both in map & in list (unless a racing append beat us
+    // to creating the user)
+    if (kv_store->Append(key, data)) {
+      user_directory.Add(key);
     }
-  } else { // if user_id/post_id exists, just append data
-    it->second = it->second + data;
   }
   return ::grpc::Status::OK;
 }
@@ -280,7 +288,8 @@
 /**
  * Deletes the key-value pair associated with this key from the server.
  * If this server does not contain the requested key, do nothing and return
- * the error specified
+ * the error specified. If the key is a post and the request names its user,
+ * the post is also taken off the user's post list, wherever that lives
  *
  * @param context - you can ignore this
  * @param request A message containing the key to be removed
@@ -292,123 +301,452 @@
 ::grpc::Status ShardkvServer::Delete(::grpc::ServerContext *context,
                                      const ::DeleteRequest *request,
                                      Empty *response) {
+  Forwards<DeleteRequest> deletes;
+  ::grpc::Status status = DeleteLocal(request, &deletes);
+  // RPC delete the user's posts on the servers responsible
+  for (auto &[server, req] : deletes) {
+    auto stub = peers.Get(server);
+    ::grpc::ClientContext cc;
+    Empty res;
+    auto delete_status = stub->Delete(&cc, req, &res);
+    while (!delete_status.ok()) { // sleep & retry till success
+      std::chrono::milliseconds timespan(50);
+      std::this_thread::sleep_for(timespan);
+      ::grpc::ClientContext new_cc;
+      delete_status = stub->Delete(&new_cc, req, &res);
+    }
+  }
+  return status;
+}
+
+::grpc::Status ShardkvServer::DeleteLocal(const ::DeleteRequest *request,
+                                          Forwards<DeleteRequest> *deletes) {
   // what the client isn't authorized to delete:
   // all_users, user_id_posts
-  // deleting a post would need to modify user_id_posts, but now we don't know
-  // which user this post belongs to unless adding external ds to monitor it, so
-  // skip for now deleting a user_id would (potentially) need to delete all
-  // posts of the user
-  std::string key = request->key();
+  // deleting a post only takes it off user_id_posts if the request says which
+  // user it belongs to. deleting a user_id would (potentially) need to delete
+  // all posts of the user
+  const std::string &key = request->key();
   if (key == "") {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: DELETE request key null");
   }
-  if (key == "all_users") {
+  ParsedKey parsed = ParseKey(key);
+  if (parsed.type == KeyType::ALL_USERS) {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: DELETE request all users illegal behavior");
   }
-  std::vector<std::string> parsed = parse_value(key, "_");
+  bool is_post = parsed.type == KeyType::POST;
+  std::string user = is_post ? request->user() : "";
+  ParsedKey parsed_user = ParseKey(user);
+  if (user != "" && parsed_user.type != KeyType::USER) {
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                          "ERR: DELETE request user invalid");
+  }
 
-  int id = extractID(key);
+  std::shared_lock<std::shared_mutex> lock(shard_mutex);
+  auto deadline = std::chrono::steady_clock::now() + HANDOFF_WAIT;
+  if (!awaitHandoff(lock, parsed.id, deadline) ||
+      (user != "" && !awaitHandoff(lock, parsed_user.id, deadline))) {
+    return stillArriving();
+  }
+  // if we have the user's post list, take the post off it. the post's server
+  // passes the request on to us if the list is elsewhere, so the post itself
+  // doesn't have to be ours
+  bool has_list = user != "" && shard_index.Local(parsed_user.id);
+  if (has_list) {
+    kv_store->ListRemove(user + "_posts", key);
+  }
   // check if id is in local scope for user_id and post_id
-  if (CheckInShard(id, local_shard) == false) {
+  if (shard_index.Local(parsed.id) == false) {
+    if (has_list) {
+      return ::grpc::Status::OK;
+    }
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: DELETE request server not responsible for id");
   }
 
-  std::lock_guard<std::mutex> lock(kv_mutex);
-  std::map<std::string, std::string>::iterator it;
-
   // if the key is a post_id
-  if (parsed[0] == "post" && parsed.size() == 2) {
-    it = kv_store.find(key);
-    if (it == kv_store.end()) {
-      // first check if contained in the "deleted" list, if so, return OK
-      for (auto & del : deleted) {
+  if (is_post) {
+    std::lock_guard<std::mutex> deleted_lock(deleted_mutex);
+    if (!kv_store->Erase(key)) {
+      // first check if contained in the "deleted" list, if so, return OK.
+      // same if all that was left to do was taking it off the post list
+      for (auto &del : deleted) {
         if (key == del) {
           return ::grpc::Status::OK;
         }
       }
-      return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+      if (has_list) {
+        return ::grpc::Status::OK;
+      }
+      return ::grpc::Status(::grpc::StatusCode::NOT_FOUND,
                             "ERR: DELETE request post_id not found on server");
-    } else { // if post found in local kv_store, delete from map & add to "deleted" list
-      kv_store.erase(it);
-      deleted.push_back(key);
+    }
+    // post found in local kv_store and deleted, add to "deleted" list
+    deleted.push_back(key);
+    // the caller passes the request on to the server with the post list
+    if (user != "" && !has_list) {
+      std::string server = serverFor(parsed_user.id);
+      if (server != "" && server != address) {
+        deletes->emplace_back(server, *request);
+      }
     }
     return ::grpc::Status::OK;
   }
 
   // if the key is a user_id
-  if (parsed[0] == "user" && parsed.size() == 2) { // if user_id
-  it = kv_store.find(key);
-  if (it == kv_store.end()) { // key not found on this server
+  if (parsed.type == KeyType::USER) { // if user_id
+    if (!kv_store->Erase(key)) { // key not found on this server
+      return ::grpc::Status(::grpc::StatusCode::NOT_FOUND,
+                            "ERR: DELETE request user_id not found on server");
+    }
+    // deleting all posts associated with a user if deleting a user_id
+    std::string user_posts;
+    kv_store->Erase(key + "_posts", &user_posts); // delete user_id_posts too
+    user_directory.Remove(key); // erase user from all_users list
+
+    // delete all posts associated with this user, if post not found in local
+    // kv, then the caller RPC deletes it on the server responsible (so we
+    // don't hold the shard lock across the RPCs)
+    for (auto &post : parse_value(user_posts, ",")) {
+      // a post still on its way to us is waited for, so that its handoff
+      // doesn't bring it back
+      awaitHandoff(lock, ParseKey(post).id, deadline);
+      if (kv_store->Erase(post)) { // if post found in local kv_store
+        std::lock_guard<std::mutex> deleted_lock(deleted_mutex);
+        deleted.push_back(post);
+        continue;
+      }
+      std::string server = serverFor(ParseKey(post).id);
+      if (server != "" && server != address) {
+        DeleteRequest req;
+        req.set_key(post);
+        deletes->emplace_back(server, std::move(req));
+      }
+    }
+  }
+  return ::grpc::Status::OK;
+}
+
+/**
+ * Looks up a batch of keys under one acquisition of the shard lock, fetching
+ * each stripe of the store once. Every key gets its own result, with the data
+ * or the error a Get of that key would return, so one missing key doesn't
+ * fail the others.
+ *
+ * @param context - you can ignore this
+ * @param request a message containing the keys
+ * @param response one KeyStatus per key, in request order
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvServer::MultiGet(::grpc::ServerContext *context,
+                                       const ::MultiGetRequest *request,
+                                       ::MultiResponse *response) {
+  std::vector<std::string> keys;
+  std::vector<KeyStatus *> pending;
+
+  std::shared_lock<std::shared_mutex> lock(shard_mutex);
+  auto deadline = std::chrono::steady_clock::now() + HANDOFF_WAIT;
+  for (const std::string &key : request->keys()) {
+    KeyStatus *result = response->add_results();
+    result->set_key(key);
+    if (key == "") {
+      result->set_code(::grpc::StatusCode::INVALID_ARGUMENT);
+      result->set_error("ERR: GET request key null");
+      continue;
+    }
+    ParsedKey parsed = ParseKey(key);
+    if (parsed.type == KeyType::ALL_USERS) {
+      result->set_data(user_directory.Joined());
+      continue;
+    }
+    if (!awaitHandoff(lock, parsed.id, deadline)) {
+      result->set_code(::grpc::StatusCode::UNAVAILABLE);
+      result->set_error(stillArriving().error_message());
+      continue;
+    }
+    if (shard_index.Local(parsed.id) == false) {
+      result->set_code(::grpc::StatusCode::INVALID_ARGUMENT);
+      result->set_error("ERR: server not responsible for key");
+      continue;
+    }
+    keys.push_back(key);
+    pending.push_back(result);
+  }
+
+  std::vector<std::string> values;
+  std::vector<bool> found;
+  kv_store->GetBatch(keys, &values, &found);
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (found[i]) {
+      pending[i]->set_data(std::move(values[i]));
+    } else {
+      pending[i]->set_code(::grpc::StatusCode::INVALID_ARGUMENT);
+      pending[i]->set_error("GET request key not found");
+    }
+  }
+  return ::grpc::Status::OK;
+}
+
+/**
+ * Puts a batch of key-value pairs under one acquisition of the shard lock.
+ * Each pair is applied like a Put of it would be (including appending new
+ * posts to their user's post list, on another server if need be) and gets
+ * its own result.
+ *
+ * @param context - you can ignore this
+ * @param request a message containing the puts
+ * @param response one KeyStatus per put, in request order
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvServer::MultiPut(::grpc::ServerContext *context,
+                                       const ::MultiPutRequest *request,
+                                       ::MultiResponse *response) {
+  Forwards<AppendRequest> appends;
+  ::grpc::Status status = MultiPutLocal(request, response, &appends);
+  sendAppends(appends);
+  return status;
+}
+
+::grpc::Status ShardkvServer::MultiPutLocal(const ::MultiPutRequest *request,
+                                            ::MultiResponse *response,
+                                            Forwards<AppendRequest> *appends) {
+  std::shared_lock<std::shared_mutex> lock(shard_mutex);
+  auto deadline = std::chrono::steady_clock::now() + HANDOFF_WAIT;
+  for (const PutRequest &put : request->puts()) {
+    ::grpc::Status status = putLocked(lock, &put, appends, deadline);
+    KeyStatus *result = response->add_results();
+    result->set_key(put.key());
+    result->set_code(status.error_code());
+    result->set_error(status.error_message());
+  }
+  return ::grpc::Status::OK;
+}
+
+/**
+ * Returns a page of the users this server stores, in the same order as
+ * all_users. Clients page through all of them by passing the last user of
+ * each page as the next request's after, which works even if that user has
+ * been deleted or moved away since.
+ *
+ * @param context - you can ignore this
+ * @param request where the page starts and how many users it holds at most
+ * @param response the users, and whether there are more
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvServer::ListUsers(::grpc::ServerContext *context,
+                                        const ::ListUsersRequest *request,
+                                        ::ListUsersResponse *response) {
+  uint32_t limit = request->limit();
+  if (limit == 0 || limit > MAX_PAGE) {
+    limit = MAX_PAGE;
+  }
+  bool more;
+  for (std::string &user :
+       user_directory.Page(request->after(), limit, &more)) {
+    response->add_users(std::move(user));
+  }
+  response->set_more(more);
+  return ::grpc::Status::OK;
+}
+
+/**
+ * Returns a page of a user's posts, the items of user_<id>_posts in the order
+ * they were posted. Clients page through all of them by passing the next
+ * cursor of each page to the following request.
+ *
+ * @param context - you can ignore this
+ * @param request the user, and where the page starts and how many posts it
+ * holds at most
+ * @param response the posts, the cursor after them, and whether there are more
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvServer::ListPosts(::grpc::ServerContext *context,
+                                        const ::ListPostsRequest *request,
+                                        ::ListPostsResponse *response) {
+  const std::string &user = request->user();
+  ParsedKey parsed = ParseKey(user);
+  if (parsed.type != KeyType::USER) {
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                          "ERR: LIST POSTS request user invalid");
+  }
+  uint32_t limit = request->limit();
+  if (limit == 0 || limit > MAX_PAGE) {
+    limit = MAX_PAGE;
+  }
+
+  std::shared_lock<std::shared_mutex> lock(shard_mutex);
+  if (!awaitHandoff(lock, parsed.id)) {
+    return stillArriving();
+  }
+  if (shard_index.Local(parsed.id) == false) {
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                          "ERR: server not responsible for key");
+  }
+  std::vector<std::string> posts;
+  uint64_t next;
+  bool more;
+  if (!kv_store->ListRange(user + "_posts", request->cursor(), limit, &posts,
+                          &next, &more)) {
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                          "LIST POSTS request key not found");
+  }
+  for (std::string &post : posts) {
+    response->add_posts(std::move(post));
+  }
+  response->set_next(next);
+  response->set_more(more);
+  return ::grpc::Status::OK;
+}
+
+/**
+ * Receives keys handed off by another server, in batches, acknowledging each
+ * one once it's applied. Each batch is checked against our shards and then
+ * applied atomically, as the internal
+ * Put with an empty user would apply each key (new user_<id> keys are added
+ * to all_users). If any key in a batch isn't ours (e.g. the sender got the new
+ * config before we did), the batch is rejected and the transfer fails, and
+ * the sender retries it.
+ *
+ * @param context - you can ignore this
+ * @param stream the batches, and an acknowledgement for each: the number of
+ * batches and keys we applied so far
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvServer::TransferShard(
+    ::grpc::ServerContext *context,
+    ::grpc::ServerReaderWriter<::TransferResponse, ::TransferBatch> *stream) {
+  TransferBatch batch;
+  TransferResponse response;
+  while (stream->Read(&batch)) {
+    ::grpc::Status status = ApplyBatch(&batch, &response);
+    if (!status.ok()) {
+      return status;
+    }
+    if (!stream->Write(response)) {
+      break;
+    }
+  }
+  return ::grpc::Status::OK;
+}
+
+::grpc::Status ShardkvServer::ApplyBatch(::TransferBatch *batch,
+                                         ::TransferResponse *response) {
+  KeyValues pairs;
+  std::vector<bool> created;
+  for (auto &kv : *batch->mutable_pairs()) {
+    pairs.emplace_back(std::move(*kv.mutable_key()),
+                       std::move(*kv.mutable_data()));
+  }
+  std::vector<std::pair<std::string, PostList>> lists;
+  for (auto &kv : *batch->mutable_lists()) {
+    PostList list;
+    if (!PostList::Decode(kv.data(), &list)) {
+      return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                            "ERR: TRANSFER request invalid post list");
+    }
+    lists.emplace_back(std::move(*kv.mutable_key()), std::move(list));
+  }
+
+  std::vector<int> ids;
+  std::vector<KeyType> types;
+  std::shared_lock<std::shared_mutex> lock(shard_mutex);
+  for (auto &kv : pairs) {
+    ParsedKey parsed = ParseKey(kv.first);
+    if (!parsed.HasID()) {
+      return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                            "ERR: TRANSFER request invalid key");
+    }
+    if (shard_index.Local(parsed.id) == false) {
       return ::grpc::Status(
           ::grpc::StatusCode::INVALID_ARGUMENT,
-          "ERR: DELETE request user_id not found on server");
-    }
-    kv_store.erase(key);                           // delete the user
-    it = kv_store.find(key + "_posts"); // deleting all posts associated with a
-    // user if deleting a user_id
-
-    std::vector<std::string> this_user_posts = parse_value(it->second, ",");
-    for (auto &post :
-         this_user_posts) { // delete all posts associated with this user, if
-                            // post not found in local kv, then RPC delete on
-                            // the server responsible
-      it = kv_store.find(post);
-      if (it == kv_store.end()) {
-
-        int post_id = extractID(post);
-        for (auto &server_shard : server_shard_map) {
-          if (CheckInShard(post_id, server_shard.second) &&
-              address != server_shard.first) {
-            auto channel = grpc::CreateChannel(
-                server_shard.first, grpc::InsecureChannelCredentials());
-            auto stub = Shardkv::NewStub(channel);
-
-            ::grpc::ClientContext cc;
-            DeleteRequest req;
-            Empty res;
-            req.set_key(post);
-
-            auto status = stub->Delete(&cc, req, &res);
-            while (!status.ok()) { // sleep & retry till success
-              std::chrono::milliseconds timespan(50);
-              std::this_thread::sleep_for(timespan);
-              ::grpc::ClientContext new_cc;
-              status = stub->Delete(&new_cc, req, &res);
-            }
-          }
-        }
-      } else { // if post found in local kv_store, delete from map
-        kv_store.erase(it);
-        deleted.push_back(key);
-      }
+          "ERR: TRANSFER request server not responsible for key");
     }
-    it = kv_store.find("all_users");
-    std::vector<std::string> all_users = parse_value(it->second, ",");
-    int m = 0;
-    for (m; m < all_users.size(); m++) {
-      if (key == all_users.at(m)) {
-        break;
+    ids.push_back(parsed.id);
+    types.push_back(parsed.type);
+  }
+  for (auto &kv : lists) {
+    ParsedKey parsed = ParseKey(kv.first);
+    if (!parsed.HasID() || shard_index.Local(parsed.id) == false) {
+      return ::grpc::Status(
+          ::grpc::StatusCode::INVALID_ARGUMENT,
+          "ERR: TRANSFER request server not responsible for key");
+    }
+    ids.push_back(parsed.id);
+  }
+  std::vector<shard_t> done;
+  for (const KeyRange &range : batch->done()) {
+    done.push_back(shard_t{range.lower(), range.upper()});
+  }
+  if (!shard_difference(done, local_shard).empty()) {
+    return ::grpc::Status(
+        ::grpc::StatusCode::INVALID_ARGUMENT,
+        "ERR: TRANSFER request server not responsible for range");
+  }
+  // nobody has been served a key of a range we're still waiting for, so what
+  // the old owner sends for it is the latest value. anywhere else (a resent
+  // batch of a range that's done, a key nobody owned) we may have written to
+  // the key since, and keep what we have
+  KeyValues overwrite;
+  std::vector<KeyType> overwrite_types;
+  for (size_t i = 0; i < pairs.size(); i++) {
+    if (batch->if_absent() || !CheckInShard(ids[i], incoming)) {
+      bool added = kv_store->PutIfAbsent(pairs[i].first, pairs[i].second);
+      if (added && types[i] == KeyType::USER) {
+        user_directory.Add(pairs[i].first);
       }
+    } else {
+      overwrite.push_back(std::move(pairs[i]));
+      overwrite_types.push_back(types[i]);
     }
-    all_users.erase(all_users.begin() + m); // erase user from all_users list
-    std::string new_all_users = "";
-    // join the string back together
-    for (auto &c : all_users) {
-      new_all_users = new_all_users + c + ",";
+  }
+  if (!overwrite.empty()) {
+    kv_store->PutBatch(overwrite, &created);
+  }
+  for (size_t i = 0; i < overwrite.size(); i++) {
+    if (created[i] && overwrite_types[i] == KeyType::USER) {
+      user_directory.Add(overwrite[i].first);
     }
-    it->second = new_all_users;
-
-    kv_store.erase(key + "_posts"); // delete user_id_posts too
   }
-   return ::grpc::Status::OK;
+  for (size_t i = 0; i < lists.size(); i++) {
+    int id = ids[pairs.size() + i];
+    kv_store->PutList(lists[i].first, std::move(lists[i].second),
+                      batch->if_absent() || !CheckInShard(id, incoming));
+  }
+  response->set_batches(response->batches() + 1);
+  response->set_keys(response->keys() + pairs.size() + lists.size());
+  if (!done.empty()) {
+    lock.unlock();
+    std::unique_lock<std::shared_mutex> done_lock(shard_mutex);
+    incoming = shard_difference(incoming, done);
+    handoff_cv.notify_all();
+  }
+  return ::grpc::Status::OK;
+}
+
+bool ShardkvServer::awaitHandoff(std::shared_lock<std::shared_mutex> &lock,
+                                 int id,
+                                 std::chrono::steady_clock::time_point deadline) {
+  return handoff_cv.wait_until(lock, deadline, [this, id]() {
+    return !CheckInShard(id, incoming);
+  });
+}
+
+bool ShardkvServer::awaitHandoff(std::shared_lock<std::shared_mutex> &lock,
+                                 int id) {
+  return awaitHandoff(lock, id,
+                      std::chrono::steady_clock::now() + HANDOFF_WAIT);
 }
 
 /**
- * This method is called in a separate thread on periodic intervals (see the
- * constructor in shardkv.h for how this is done). It should query the
+ * This method is called in a separate thread on periodic intervals whenever
+ * the shardmaster's Watch stream is unavailable (see the constructor in
+ * shardkv.h for how this is done). It should query the
  * shardmaster for an updated configuration of how shards are distributed. You
  * should then find this server in that configuration and look at the shards
  * associated with it. These are the shards that the shardmaster deems this
@@ -425,114 +763,407 @@
  * method!
  */
 void ShardkvServer::QueryShardmaster(Shardmaster::Stub *stub) {
-  Empty query;
+  QueryIfNewerRequest query;
   QueryResponse response;
   ::grpc::ClientContext cc;
 
-  auto status = stub->Query(&cc, query, &response);
-  // now we have the server addr, the shards this server is responsible for (in
-  // config from response)
+  // only ask for the config if it changed since the one we have
+  query.set_config_num(config_num);
+  auto status = stub->QueryIfNewer(&cc, query, &response);
+  if (status.ok() && response.config_num() == config_num) {
+    // nothing changed, so there's nothing to do (and nothing to lock)
+    return;
+  }
   if (status.ok()) {
-    int server_num = response.config_size();
-
-    kv_mutex.lock();
-    server_shard_map.clear();
-
-    for (int i = 0; i < server_num; i++) {
-      ConfigEntry *config = response.mutable_config(i);
-      std::string server_addr = config->server();
-      std::vector<shard> server_shards;
-      int shards_num = config->shards_size();
-      for (int j = 0; j < shards_num; j++) {
-        Shard *shard = config->mutable_shards(j);
-        shard_t s = shard_t();
-        s.lower = shard->lower();
-        s.upper = shard->upper();
-        server_shards.push_back(s);
-      }
-      server_shard_map.insert(std::pair<std::string, std::vector<shard>>(
-          server_addr, server_shards));
+    applyConfig(response);
+  } else {
+    printf("BAD STATUS :(");
+  }
+}
+
+/**
+ * Subscribes to the shardmaster's Watch stream and installs every config it
+ * pushes, so we pick up a Join, Leave or Move as soon as it happens. Blocks
+ * until the stream breaks (e.g. the shardmaster is down); the query thread
+ * then falls back to QueryShardmaster until it can watch again.
+ *
+ * @param stub a grpc stub for the shardmaster, which we use to invoke the Watch
+ * method!
+ */
+void ShardkvServer::WatchShardmaster(Shardmaster::Stub *stub) {
+  QueryIfNewerRequest request;
+  QueryResponse response;
+  ::grpc::ClientContext cc;
+
+  request.set_config_num(config_num);
+  auto reader = stub->Watch(&cc, request);
+  while (reader->Read(&response)) {
+    applyConfig(response);
+  }
+  reader->Finish();
+}
+
+void ShardkvServer::applyConfig(const QueryResponse &response) {
+  config_num = response.config_num();
+  int server_num = response.config_size();
+
+  // requests on this server wait until the new config is installed and the
+  // keys we lost are handed off
+  std::unique_lock<std::shared_mutex> lock(shard_mutex);
+  // the IDs nobody owned in the config we had (all of them before the first
+  // one). keys of theirs that we hold, e.g. recovered from disk, are handed
+  // off as soon as someone else owns them
+  std::vector<shard_t> owned;
+  for (auto &server : server_shard_map) {
+    owned.insert(owned.end(), server.second.begin(), server.second.end());
+  }
+  std::vector<shard_t> unowned =
+      shard_difference({shard_t{MIN_KEY, MAX_KEY}}, owned);
+  server_shard_map.clear();
+
+  for (int i = 0; i < server_num; i++) {
+    const ConfigEntry &config = response.config(i);
+    std::string server_addr = config.server();
+    std::vector<shard> server_shards;
+    int shards_num = config.shards_size();
+    for (int j = 0; j < shards_num; j++) {
+      const Shard &shard = config.shards(j);
+      shard_t s = shard_t();
+      s.lower = shard.lower();
+      s.upper = shard.upper();
+      server_shards.push_back(s);
     }
-    std::map<std::string, std::vector<shard>>::iterator it;
-    it = server_shard_map.find(address);
-    // update current server's shard range
+    server_shard_map.insert(std::pair<std::string, std::vector<shard>>(
+        server_addr, server_shards));
+  }
+  // we only ever talk to servers in the config, so stop caching channels to
+  // the ones that left
+  std::set<std::string> servers;
+  for (auto &server : server_shard_map) {
+    servers.insert(server.first);
+  }
+  peers.Retain(servers);
+
+  std::map<std::string, std::vector<shard>>::iterator it;
+  it = server_shard_map.find(address);
+  // update current server's shard range (we have none if we haven't joined
+  // yet or have left)
+  std::vector<shard> old_local_shard = local_shard;
+  if (it != server_shard_map.end()) {
     local_shard = it->second;
-    // unlock upon finish modifying the server: shards map
-    // shard_mutex.unlock();
-
-    // extra data structure that stores the new kv_mappings
-    std::map<std::string, std::string> updated_kv_store;
-    // kv_mutex.lock();
-    for (auto &kv : kv_store) {
-      printf("kv.first is: %s\n", kv.first.c_str());
-      if (kv.first == "all_users") {
+  } else {
+    local_shard.clear();
+  }
+  shard_index = ShardIndex(server_shard_map, address);
+
+  // only the ranges we just lost have to be handed off. kv_store keeps keys
+  // grouped by ID, so reading a range doesn't touch any other data, and an
+  // unchanged config costs nothing here. the copies we read are what the
+  // migrator sends, so the transfers don't hold up requests; the keys stay
+  // in kv_store (unserved) until their new owner has them
+  std::vector<shard_t> lost = shard_difference(old_local_shard, local_shard);
+  std::vector<shard_t> gained = shard_difference(local_shard, old_local_shard);
+  // a range still on its way to us is finished by whoever is sending it, so
+  // we only tell the new owner we're done with the ranges we had all of
+  Handoff moving{{}, {}, shard_difference(lost, incoming), false};
+  Handoff held{{}, {}, {}, true};
+  auto read = [this](const std::vector<shard_t> &ranges, Handoff *handoff) {
+    for (const shard_t &lost : ranges) {
+      for (auto &kv : kv_store->ReadRange(lost, &handoff->lists)) {
+        // modify the all_users for local server (for the user_ids removed)
+        if (ParseKey(kv.first).type == KeyType::USER) {
+          user_directory.Remove(kv.first);
+        }
+        handoff->pairs.push_back(std::move(kv));
+      }
+    }
+  };
+  read(lost, &moving);
+  // their new owner may have written to them since, so it keeps its values
+  read(shard_difference(unowned, local_shard), &held);
+  // requests for the ranges we took over from another server wait until it
+  // has sent us all of their keys. nobody had the ones nobody owned
+  incoming = shard_difference(incoming, lost);
+  for (const shard_t &range : shard_difference(gained, unowned)) {
+    incoming.push_back(range);
+  }
+  handoff_cv.notify_all();
+  for (Handoff *handoff : {&moving, &held}) {
+    if (handoff->pairs.empty() && handoff->lists.empty() &&
+        handoff->ranges.empty()) {
+      continue;
+    }
+    if (!background_migration) {
+      migrate(std::move(*handoff), true);
+      continue;
+    }
+    std::lock_guard<std::mutex> migration_lock(migration_mutex);
+    migrations.push_back(std::move(*handoff));
+    migration_cv.notify_one();
+  }
+}
+
+/**
+ * Hands off the keys of the ranges this server has lost. applyConfig pulls
+ * them out of kv_store while it installs the new config and queues them up
+ * here; this thread then streams them to their new owners without holding
+ * shard_mutex, so requests for every key that isn't moving keep being served
+ * during the transfer. Their new owner holds back requests for the ranges that
+ * move until our last batch for them says they're done (see awaitHandoff), so
+ * nobody serves a moving key, or writes to it, before it arrives.
+ */
+void ShardkvServer::MigrateKeys() {
+  while (true) {
+    Handoff handoff;
+    {
+      std::unique_lock<std::mutex> lock(migration_mutex);
+      migration_cv.wait(lock, [this]() { return !migrations.empty(); });
+      handoff = std::move(migrations.front());
+      migrations.pop_front();
+    }
+    migrate(std::move(handoff), false);
+  }
+}
+
+void ShardkvServer::migrate(Handoff handoff, bool locked) {
+  KeyValues &pairs = handoff.pairs;
+  KeyValues &lists = handoff.lists;
+  while (true) {
+    std::map<std::string, KeyValues> outgoing;
+    std::map<std::string, KeyValues> outgoing_lists;
+    std::map<std::string, std::vector<shard_t>> outgoing_ranges;
+    if (locked) {
+      outgoing = routeKeys(pairs);
+      outgoing_lists = routeKeys(lists);
+      outgoing_ranges = routeRanges(handoff.ranges);
+    } else {
+      std::unique_lock<std::shared_mutex> lock(shard_mutex);
+      outgoing = routeKeys(pairs);
+      outgoing_lists = routeKeys(lists);
+      outgoing_ranges = routeRanges(handoff.ranges);
+    }
+    std::set<std::string> servers;
+    for (auto *route : {&outgoing, &outgoing_lists}) {
+      for (auto &server : *route) {
+        servers.insert(server.first);
+      }
+    }
+    for (auto &server : outgoing_ranges) {
+      servers.insert(server.first);
+    }
+    std::vector<std::string> handed_off;
+    for (const std::string &server : servers) {
+      KeyValues &group = outgoing[server];
+      KeyValues &list_group = outgoing_lists[server];
+      std::vector<shard_t> &ranges = outgoing_ranges[server];
+      size_t acked = 0;
+      bool done = transferKeys(server, group, list_group, ranges,
+                               handoff.if_absent, &acked);
+      size_t acked_pairs = std::min(acked, group.size());
+      size_t acked_lists = acked - acked_pairs;
+      for (size_t i = 0; i < acked_pairs; i++) {
+        handed_off.push_back(std::move(group[i].first));
+      }
+      for (size_t i = 0; i < acked_lists; i++) {
+        handed_off.push_back(std::move(list_group[i].first));
+      }
+      if (done) {
         continue;
       }
-      int id = extractID(kv.first); // for user_id, post_id, and user_id_posts
-      if (CheckInShard(id, local_shard) ==
-          false) { // after updating local shards, if the key in map is no
-                   // longer in scope, issue put request
-        for (auto &server : server_shard_map) {
-          if (CheckInShard(id, server.second)) {
-            auto channel = grpc::CreateChannel(
-                server.first, grpc::InsecureChannelCredentials());
-            auto stub = Shardkv::NewStub(channel);
-
-            ::grpc::ClientContext cc;
-            PutRequest req;
-            Empty res;
-            req.set_key(kv.first);
-            req.set_data(kv.second);
-            req.set_user("");
-
-            auto status = stub->Put(&cc, req, &res);
-            while (!status.ok()) { // sleep & retry till success
-              std::chrono::milliseconds timespan(50);
-              std::this_thread::sleep_for(timespan);
-              ::grpc::ClientContext new_cc;
-              status = stub->Put(&new_cc, req, &res);
-            }
-          }
-        }
-        // modify the all_users for local server (if the key to be removed is a
-        // user_id)
-        std::vector<std::string> parsed = parse_value(kv.first, "_");
-        if (parsed.size() == 2 && parsed[0] == "user") {
-          std::map<std::string, std::string>::iterator kv_it;
-          kv_it = kv_store.find("all_users");
-          std::vector<std::string> all_users = parse_value(kv_it->second, ",");
-          int m = 0;
-          for (m; m < all_users.size(); m++) {
-            if (kv.first == all_users.at(m)) {
-              break;
-            }
-          }
-          all_users.erase(all_users.begin() +
-                          m); // erase user from all_users list
-          std::string new_all_users = "";
-          // join the string back together
-          for (auto &c : all_users) {
-            new_all_users = new_all_users + c + ",";
-          }
-          kv_it->second = new_all_users;
+      // the receiver rejected a batch (or went away), e.g. because it hasn't
+      // seen the new config yet. look up the owners of the rest again and
+      // resend them
+      pairs.insert(pairs.end(),
+                   std::make_move_iterator(group.begin() + acked_pairs),
+                   std::make_move_iterator(group.end()));
+      lists.insert(lists.end(),
+                   std::make_move_iterator(list_group.begin() + acked_lists),
+                   std::make_move_iterator(list_group.end()));
+      handoff.ranges.insert(handoff.ranges.end(), ranges.begin(), ranges.end());
+    }
+    // only now that their new owners have them do the keys go from kv_store
+    // and its log, so a crash before this hands them off again on restart
+    if (locked) {
+      eraseHandedOff(handed_off);
+    } else {
+      std::shared_lock<std::shared_mutex> lock(shard_mutex);
+      eraseHandedOff(handed_off);
+    }
+    // a batch that wasn't acknowledged may have been applied anyway. that's
+    // fine to resend: the receiver only overwrites a key while its range is
+    // still on its way, and nobody could have written to it then
+    if (pairs.empty() && lists.empty() && handoff.ranges.empty()) {
+      return;
+    }
+    std::chrono::milliseconds timespan(50);
+    std::this_thread::sleep_for(timespan);
+  }
+}
+
+std::map<std::string, KeyValues> ShardkvServer::routeKeys(KeyValues &pairs) {
+  std::map<std::string, KeyValues> outgoing;
+  size_t unowned = 0;
+  for (auto &kv : pairs) {
+    ParsedKey parsed = ParseKey(kv.first);
+    if (shard_index.Local(parsed.id)) {
+      // the range came back to us before it was handed off. kv_store still
+      // has the key (or whatever was written to it since), so it just has to
+      // be listed again
+      std::string value;
+      if (parsed.type == KeyType::USER && kv_store->Get(kv.first, &value)) {
+        user_directory.Add(kv.first);
+      }
+      continue;
+    }
+    std::string server = serverFor(parsed.id);
+    if (server != "") {
+      outgoing[server].push_back(std::move(kv));
+    } else {
+      unowned++;
+    }
+  }
+  if (unowned > 0) {
+    // they stay in kv_store, and are handed off once a config gives them
+    // an owner
+    fprintf(stdout, "Keeping %zu keys nobody owns\n", unowned);
+  }
+  pairs.clear();
+  return outgoing;
+}
+
+std::map<std::string, std::vector<shard_t>> ShardkvServer::routeRanges(
+    std::vector<shard_t> &ranges) {
+  std::map<std::string, std::vector<shard_t>> outgoing;
+  std::vector<shard_t> ours;
+  for (const shard_t &range : ranges) {
+    std::vector<shard_t> left = {range};
+    for (auto &[server, shards] : server_shard_map) {
+      std::vector<shard_t> theirs =
+          shard_difference(left, shard_difference(left, shards));
+      if (theirs.empty()) {
+        continue;
+      }
+      if (server == address) {
+        ours.insert(ours.end(), theirs.begin(), theirs.end());
+      } else {
+        outgoing[server].insert(outgoing[server].end(), theirs.begin(),
+                                theirs.end());
+      }
+      left = shard_difference(left, theirs);
+    }
+  }
+  if (!ours.empty()) {
+    // the range came back to us, and we still have all of its keys
+    incoming = shard_difference(incoming, ours);
+    handoff_cv.notify_all();
+  }
+  ranges.clear();
+  return outgoing;
+}
+
+void ShardkvServer::eraseHandedOff(std::vector<std::string> &keys) {
+  // a key whose range came back to us since is ours again, and what the new
+  // owner sends back is newer than what we handed off
+  keys.erase(std::remove_if(keys.begin(), keys.end(),
+                            [this](const std::string &key) {
+                              return shard_index.Local(ParseKey(key).id);
+                            }),
+             keys.end());
+  if (!keys.empty()) {
+    kv_store->EraseBatch(keys);
+  }
+}
+
+bool ShardkvServer::transferKeys(const std::string &server,
+                                 const KeyValues &pairs,
+                                 const KeyValues &lists,
+                                 const std::vector<shard_t> &done,
+                                 bool if_absent, size_t *acked) {
+  auto stub = peers.Get(server);
+
+  ::grpc::ClientContext cc;
+  auto stream = stub->TransferShard(&cc);
+  // the acknowledgements are read as they come, so the receiver never waits
+  // on us to take one before it reads the next batch
+  std::atomic<size_t> acked_keys{0};
+  std::atomic<int> acked_batches{0};
+  std::thread reader([&stream, &acked_keys, &acked_batches]() {
+    TransferResponse res;
+    while (stream->Read(&res)) {
+      acked_keys = res.keys();
+      acked_batches = res.batches();
+    }
+  });
+  TransferBatch batch;
+  size_t batch_bytes = 0;
+  int batches = 0;
+  bool written = true;
+  size_t total = pairs.size() + lists.size();
+  // with no keys, done still goes out, in a batch of its own
+  for (size_t i = 0; i < total || batches == 0; i++) {
+    if (i < total) {
+      bool is_list = i >= pairs.size();
+      auto &pair = is_list ? lists[i - pairs.size()] : pairs[i];
+      KeyValue *kv = is_list ? batch.add_lists() : batch.add_pairs();
+      kv->set_key(pair.first);
+      kv->set_data(pair.second);
+      batch_bytes += pair.first.size() + pair.second.size();
+    }
+    bool last = i + 1 >= total;
+    if (batch.pairs_size() + batch.lists_size() == TRANSFER_BATCH_KEYS ||
+        batch_bytes >= TRANSFER_BATCH_BYTES || last) {
+      batch.set_if_absent(if_absent);
+      if (last) {
+        for (const shard_t &range : done) {
+          KeyRange *r = batch.add_done();
+          r->set_lower(range.lower);
+          r->set_upper(range.upper);
         }
-      } else { // if the kv is in scope, we add it to the updated mapping
-        updated_kv_store.insert(
-            std::pair<std::string, std::string>(kv.first, kv.second));
       }
+      // blocks while the receiver's flow-control window is full
+      if (!stream->Write(batch)) {
+        written = false;
+        break;
+      }
+      batches++;
+      batch.Clear();
+      batch_bytes = 0;
     }
-    // find the original all_users mapping in kv_store, add to the
-    // updated_mapping
-    std::map<std::string, std::string>::iterator s_it;
-    s_it = kv_store.find("all_users");
-    updated_kv_store.insert(
-        std::pair<std::string, std::string>(s_it->first, s_it->second));
-    // clear the original map & assign it to the new mapping
-    kv_store.clear();
-    kv_store = updated_kv_store;
-
-    kv_mutex.unlock();
-  } else {
-    printf("BAD STATUS :(");
   }
+  stream->WritesDone();
+  reader.join();
+  stream->Finish();
+  *acked = acked_keys;
+  return written && acked_batches == batches;
+}
+
+/**
+ * Picks up the keys kv_store already holds when we start, e.g. after its
+ * creator recovered it from disk (KvStore::Recover, LsmStore::Open). They
+ * include keys that arrived in transfers, and those of ranges we were
+ * handing off whose new owner hadn't acknowledged them yet: a key only goes
+ * from kv_store (and its log) once it has been handed off.
+ *
+ * We don't know which shards were ours until the shardmaster tells us. Until
+ * then no ID has an owner, so the first config we install hands off whatever
+ * we hold that isn't ours, as it does for any key nobody owned before (see
+ * applyConfig). Its owner may have newer values by now, so those handoffs
+ * only add keys the receiver doesn't have.
+ */
+void ShardkvServer::recover() {
+  size_t keys = 0;
+  // only the keys are read, so values on disk stay there
+  kv_store->ForEachKey([this, &keys](std::string_view key) {
+    if (ParseKey(key).type == KeyType::USER) {
+      user_directory.Add(std::string(key));
+    }
+    keys++;
+  });
+  if (keys > 0) {
+    fprintf(stdout, "Recovered %zu keys\n", keys);
+  }
+}
+
+std::string ShardkvServer::serverFor(int id) {
+  return shard_index.Owner(id);
 }
@@ -2,32 +2,90 @@
 #define SHARDING_SHARDKV_H
 
 #include <grpcpp/grpcpp.h>
+#include <condition_variable>
+#include <deque>
+#include <shared_mutex>
 #include <thread>
 #include "../common/common.h"
+#include "../common/keys.h"
+#include "../common/peerpool.h"
+#include "../common/shardindex.h"
+#include "../common/shardmasters.h"
+#include "kvstore.h"
+#include "storage.h"
+#include "userdirectory.h"
 
 #include "../build/shardkv.grpc.pb.h"
 #include "../build/shardmaster.grpc.pb.h"
 
+// a shard handoff is streamed in batches of at most this many keys or (about)
+// this many bytes, whichever fills up first
+constexpr int TRANSFER_BATCH_KEYS = 1024;
+constexpr size_t TRANSFER_BATCH_BYTES = 1 << 20;
+// how long a request for a key whose range is still being handed to us waits
+// for it before failing with UNAVAILABLE
+constexpr std::chrono::milliseconds HANDOFF_WAIT(5000);
+
+using KeyValues = std::vector<std::pair<std::string, std::string>>;
+
+// keys to hand off (post lists apart, encoded, see TransferBatch.lists), the
+// ranges they're all the keys of (which their new owners wait for, see
+// TransferBatch.done), and whether their new owner keeps the values it
+// already has (see TransferBatch.if_absent)
+struct Handoff {
+  KeyValues pairs;
+  KeyValues lists;
+  std::vector<shard_t> ranges;
+  bool if_absent;
+};
+
+// remote writes a request leaves behind, as (server, request) pairs. whoever
+// handles the request sends them, retrying each until it succeeds
+template <typename Request>
+using Forwards = std::vector<std::pair<std::string, Request>>;
+
 class ShardkvServer : public Shardkv::Service {
   using Empty = google::protobuf::Empty;
 
  public:
-  explicit ShardkvServer(std::string addr, const std::string& shardmaster_addr)
-      : address(std::move(addr)) {
-    // This thread will query the shardmaster every 100 milliseconds for updates
+  // background_migration = false hands keys off inline, holding shard_mutex
+  // until every key is acknowledged (how servers used to do it -- only kept
+  // around to benchmark against). keys are kept in store (an in-memory
+  // KvStore if null); whatever it holds already, e.g. after its creator
+  // recovered it from disk, is served as soon as the shardmaster agrees.
+  // shardmaster_addr is the shardmaster's address, or its replicas'
+  // (comma-separated)
+  explicit ShardkvServer(std::string addr, const std::string& shardmaster_addr,
+                         bool background_migration = true,
+                         std::unique_ptr<StorageEngine> store = nullptr)
+      : address(std::move(addr)),
+        kv_store(store != nullptr ? std::move(store)
+                                  : std::make_unique<KvStore>()),
+        background_migration(background_migration) {
+    recover();
+    // This thread watches the shardmaster for config updates. Whenever the
+    // stream breaks it moves on to the next replica (if there are several),
+    // falls back to one query, then waits 100 milliseconds before watching
+    // again
     std::thread query(
         [this](const std::string sm_addr) {
           std::chrono::milliseconds timespan(100);
-          auto stub = Shardmaster::NewStub(
-              grpc::CreateChannel(sm_addr, grpc::InsecureChannelCredentials()));
+          ShardmasterList shardmasters(sm_addr);
           while (true) {
-            this->QueryShardmaster(stub.get());
+            Shardmaster::Stub* stub = shardmasters.Current();
+            this->WatchShardmaster(stub);
+            shardmasters.Rotate(stub);
+            this->QueryShardmaster(shardmasters.Current());
             std::this_thread::sleep_for(timespan);
           }
         },
         shardmaster_addr);
     // we detach the thread so we don't have to wait for it to terminate later
     query.detach();
+    // This thread hands off the keys of the ranges we lose, so requests for
+    // everything else don't wait on the transfers
+    std::thread migrator([this]() { this->MigrateKeys(); });
+    migrator.detach();
   };
 
   // TODO implement these three methods, should be fairly similar to your
@@ -43,23 +101,141 @@ class ShardkvServer : public Shardkv::Service {
   ::grpc::Status Delete(::grpc::ServerContext* context,
                         const ::DeleteRequest* request,
                         Empty* response) override;
+  ::grpc::Status MultiGet(::grpc::ServerContext* context,
+                          const ::MultiGetRequest* request,
+                          ::MultiResponse* response) override;
+  ::grpc::Status MultiPut(::grpc::ServerContext* context,
+                          const ::MultiPutRequest* request,
+                          ::MultiResponse* response) override;
+  ::grpc::Status ListUsers(::grpc::ServerContext* context,
+                           const ::ListUsersRequest* request,
+                           ::ListUsersResponse* response) override;
+  ::grpc::Status ListPosts(::grpc::ServerContext* context,
+                           const ::ListPostsRequest* request,
+                           ::ListPostsResponse* response) override;
+  ::grpc::Status TransferShard(
+      ::grpc::ServerContext* context,
+      ::grpc::ServerReaderWriter<::TransferResponse, ::TransferBatch>* stream)
+      override;
+
+  // the parts of Put, MultiPut, Delete and TransferShard that only touch this
+  // server. Put, MultiPut and Delete leave the RPCs to other servers in
+  // appends/deletes, so the sync handlers above and AsyncShardkvServer can
+  // each send them their way
+  ::grpc::Status PutLocal(const ::PutRequest* request,
+                          Forwards<AppendRequest>* appends);
+  ::grpc::Status MultiPutLocal(const ::MultiPutRequest* request,
+                               ::MultiResponse* response,
+                               Forwards<AppendRequest>* appends);
+  ::grpc::Status DeleteLocal(const ::DeleteRequest* request,
+                             Forwards<DeleteRequest>* deletes);
+  ::grpc::Status ApplyBatch(::TransferBatch* batch,
+                            ::TransferResponse* response);
+
+  PeerPool& Peers() { return peers; }
 
   // TODO this will be called in a separate thread, here is where you want to
   // query the shardmaster for configuration updates and respond to changes
   // appropriately (i.e. transferring keys, no longer serving keys, etc.)
   void QueryShardmaster(Shardmaster::Stub* stub);
 
+  // installs each config the shardmaster pushes until the stream breaks
+  void WatchShardmaster(Shardmaster::Stub* stub);
+
+  // runs in a separate thread: hands off the keys queued in migrations, one
+  // config change at a time
+  void MigrateKeys();
+
  private:
+  // returns the address of the server responsible for id, or "" if there is
+  // none. caller must hold shard_mutex
+  std::string serverFor(int id);
+
+  // rebuilds user_directory from the keys kv_store starts out with. called
+  // before any request or config can reach us
+  void recover();
+
+  // PutLocal without taking shard_mutex. caller must hold it, as lock
+  ::grpc::Status putLocked(std::shared_lock<std::shared_mutex>& lock,
+                           const ::PutRequest* request,
+                           Forwards<AppendRequest>* appends,
+                           std::chrono::steady_clock::time_point deadline);
+
+  // waits, letting go of lock (on shard_mutex) meanwhile, until id isn't in a
+  // range that's still being handed to us. returns false if it still is at
+  // deadline (or after HANDOFF_WAIT)
+  bool awaitHandoff(std::shared_lock<std::shared_mutex>& lock, int id,
+                    std::chrono::steady_clock::time_point deadline);
+  bool awaitHandoff(std::shared_lock<std::shared_mutex>& lock, int id);
+
+  // sends appends, retrying each until it succeeds
+  void sendAppends(const Forwards<AppendRequest>& appends);
+
+  // installs a config from the shardmaster and hands off the keys we lost
+  void applyConfig(const QueryResponse& response);
+
+  // sends every pair to the server that owns it now, retrying until all of
+  // them are acknowledged, and erases each key from kv_store once it is.
+  // keys that are ours again, or nobody's, stay. each new owner is then told
+  // that the handoff's ranges it owns are done. caller must hold shard_mutex
+  // (exclusively) iff locked
+  void migrate(Handoff handoff, bool locked);
+
+  // groups pairs by the server that owns them, leaving out keys nobody owns
+  // (which we keep, and report) and keys we own again. caller must hold
+  // shard_mutex
+  std::map<std::string, KeyValues> routeKeys(KeyValues& pairs);
+
+  // splits ranges among the servers that own them, clearing it. the parts
+  // that are ours again are no longer waited for (we still have their keys);
+  // those nobody owns are dropped. caller must hold shard_mutex exclusively
+  std::map<std::string, std::vector<shard_t>> routeRanges(
+      std::vector<shard_t>& ranges);
+
+  // erases from kv_store the keys a new owner acknowledged, except those
+  // whose range is ours again. caller must hold shard_mutex
+  void eraseHandedOff(std::vector<std::string>& keys);
+
+  // streams pairs and then lists to server with TransferShard, as if_absent
+  // batches if set, the last batch saying done is. sets *acked to how many of
+  // them (from the first pair) it acknowledged, and returns whether it
+  // acknowledged them all and done
+  bool transferKeys(const std::string& server, const KeyValues& pairs,
+                    const KeyValues& lists, const std::vector<shard_t>& done,
+                    bool if_absent, size_t* acked);
+
   // address we're running on (hostname:port)
   const std::string address;
-  std::vector<shard> local_shard; // TODO: ?lock?
+  // local_shard and server_shard_map are read (shared) by every request and
+  // rewritten (exclusive) when the shardmaster hands us a new config
+  std::vector<shard> local_shard;
   std::map<std::string, std::vector<shard>> server_shard_map;
-  std::mutex shard_mutex;
-  // TODO add any fields you want here!
-  std::map<std::string, std::string> kv_store = {{"all_users", ""}};
+  // server_shard_map indexed for lookups, rebuilt with each config
+  ShardIndex shard_index;
+  std::shared_mutex shard_mutex;
+  // number of the config in local_shard/server_shard_map. only touched by the
+  // query thread, so it needs no lock
+  uint64_t config_num = 0;
+  // the ranges we took over from another server that hasn't told us it has
+  // sent all of their keys. requests for them wait (awaitHandoff) on
+  // handoff_cv, which is notified when this shrinks. guarded by shard_mutex
+  std::vector<shard_t> incoming;
+  std::condition_variable_any handoff_cv;
+  // a KvStore (striped hash table, so requests on unrelated keys don't
+  // serialize) unless we were handed another engine
+  std::unique_ptr<StorageEngine> kv_store;
+  // the users in kv_store, served as all_users and by ListUsers
+  UserDirectory user_directory;
+  // channels to the other servers, shared by every request and the migrator
+  PeerPool peers;
+  // whether keys are handed off by the migrator thread (see the constructor)
+  const bool background_migration;
+  // copies of the keys of the ranges we lost, waiting for the migrator thread
+  std::deque<Handoff> migrations;
+  std::mutex migration_mutex;
+  std::condition_variable migration_cv;
   std::vector<std::string> deleted;
-  std::mutex kv_mutex;
-  
+  std::mutex deleted_mutex;
 };
 
 #endif  // SHARDING_SHARDKV_H
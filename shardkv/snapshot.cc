@@ -0,0 +1,249 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+
+#include "../common/records.h"
+
+constexpr char MAGIC[8] = {'S', 'K', 'V', 'S', 'N', 'A', 'P', '2'};
+
+// snapshots are written out in chunks of about this many bytes
+constexpr size_t WRITE_CHUNK = 1 << 20;
+
+struct Header {
+  char magic[8];
+  uint32_t min_id;
+  uint32_t max_id;
+  uint64_t stripes;
+};
+
+// key length, value length and the list flag
+constexpr size_t ENTRY_HEADER = 2 * sizeof(uint32_t) + 1;
+
+std::unique_ptr<MappedSnapshot> MappedSnapshot::Open(const std::string& path,
+                                                     unsigned int min_id,
+                                                     unsigned int max_id,
+                                                     size_t num_stripes) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  size_t index_end = sizeof(Header) + num_stripes * sizeof(IndexEntry);
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < index_end) {
+    close(fd);
+    return nullptr;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the file is closed
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+  std::unique_ptr<MappedSnapshot> snapshot(
+      new MappedSnapshot((const char*)addr, st.st_size));
+
+  Header header;
+  memcpy(&header, addr, sizeof(header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.min_id != min_id || header.max_id != max_id ||
+      header.stripes != num_stripes) {
+    return nullptr;
+  }
+  // only the index is checked here. the file is renamed into place once it's
+  // complete, so the entries it points to are whole
+  for (size_t i = 0; i < num_stripes; i++) {
+    const IndexEntry& entry = snapshot->index(i);
+    if (entry.offset < index_end || entry.offset > snapshot->size ||
+        entry.bytes > snapshot->size - entry.offset ||
+        (uint64_t)entry.count * ENTRY_HEADER > entry.bytes ||
+        entry.slots < entry.count || (entry.slots & (entry.slots - 1)) != 0 ||
+        entry.table > snapshot->size ||
+        (uint64_t)entry.slots * sizeof(uint64_t) >
+            snapshot->size - entry.table) {
+      return nullptr;
+    }
+  }
+  return snapshot;
+}
+
+MappedSnapshot::~MappedSnapshot() { munmap((void*)data, size); }
+
+const MappedSnapshot::IndexEntry& MappedSnapshot::index(size_t stripe) const {
+  return ((const IndexEntry*)(data + sizeof(Header)))[stripe];
+}
+
+uint64_t MappedSnapshot::Lsn(size_t stripe) const {
+  return index(stripe).lsn;
+}
+
+size_t MappedSnapshot::Count(size_t stripe) const {
+  return index(stripe).count;
+}
+
+MappedSnapshot::Entry MappedSnapshot::next(const char** p) {
+  uint32_t key_len, value_len;
+  memcpy(&key_len, *p, sizeof(key_len));
+  memcpy(&value_len, *p + sizeof(key_len), sizeof(value_len));
+  Entry entry;
+  entry.is_list = (*p)[2 * sizeof(uint32_t)] != 0;
+  entry.key = std::string_view(*p + ENTRY_HEADER, key_len);
+  entry.value = std::string_view(*p + ENTRY_HEADER + key_len, value_len);
+  *p += ENTRY_HEADER + key_len + value_len;
+  return entry;
+}
+
+bool MappedSnapshot::Find(size_t stripe, std::string_view key,
+                          Entry* entry) const {
+  const IndexEntry& stripe_index = index(stripe);
+  if (stripe_index.count == 0) {
+    return false;
+  }
+  const char* table = data + stripe_index.table;
+  size_t mask = stripe_index.slots - 1;
+  // linear probing. the table is at most half full, so an empty slot ends
+  // the search soon
+  for (size_t i = Fnv1a64(key) & mask;; i = (i + 1) & mask) {
+    uint64_t slot;
+    memcpy(&slot, table + i * sizeof(slot), sizeof(slot));
+    if (slot == 0 || slot > stripe_index.bytes) {
+      return false;
+    }
+    const char* p = data + stripe_index.offset + slot - 1;
+    *entry = next(&p);
+    if (entry->key == key) {
+      return true;
+    }
+  }
+}
+
+SnapshotWriter::SnapshotWriter(std::string path, unsigned int min_id,
+                               unsigned int max_id, size_t num_stripes)
+    : path(path),
+      tmp_path(path + ".tmp"),
+      min_id(min_id),
+      max_id(max_id),
+      num_stripes(num_stripes) {
+  stripes.reserve(num_stripes);
+  // the header and index are written last, over this space
+  buffer.assign(
+      sizeof(Header) + num_stripes * sizeof(MappedSnapshot::IndexEntry), '\0');
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (fd >= 0) {
+    close(fd);
+    unlink(tmp_path.c_str());
+  }
+}
+
+bool SnapshotWriter::Open() {
+  fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  return fd >= 0;
+}
+
+void SnapshotWriter::BeginStripe(uint64_t lsn) {
+  endStripe();
+  MappedSnapshot::IndexEntry entry = {};
+  entry.offset = offset + buffer.size();
+  entry.lsn = lsn;
+  stripes.push_back(entry);
+}
+
+void SnapshotWriter::Add(std::string_view key, std::string_view value,
+                         bool is_list) {
+  uint32_t key_len = key.size();
+  uint32_t value_len = value.size();
+  entries.emplace_back(Fnv1a64(key), stripes.back().bytes);
+  buffer.append((const char*)&key_len, sizeof(key_len));
+  buffer.append((const char*)&value_len, sizeof(value_len));
+  buffer.push_back(is_list ? 1 : 0);
+  buffer.append(key);
+  buffer.append(value);
+  stripes.back().bytes += ENTRY_HEADER + key_len + value_len;
+  stripes.back().count++;
+  if (buffer.size() >= WRITE_CHUNK) {
+    flush();
+  }
+}
+
+void SnapshotWriter::endStripe() {
+  if (stripes.empty()) {
+    return;
+  }
+  MappedSnapshot::IndexEntry& stripe = stripes.back();
+  // a power of two at least twice the entries, to keep probes short
+  uint32_t slots = entries.empty() ? 0 : 2;
+  while (slots < 2 * entries.size()) {
+    slots *= 2;
+  }
+  std::vector<uint64_t> table(slots, 0);
+  for (auto& [hash, position] : entries) {
+    size_t i = hash & (slots - 1);
+    while (table[i] != 0) {
+      i = (i + 1) & (slots - 1);
+    }
+    table[i] = position + 1;
+  }
+  // the slots are 8 byte aligned in the file
+  buffer.append((8 - (offset + buffer.size()) % 8) % 8, '\0');
+  stripe.table = offset + buffer.size();
+  stripe.slots = slots;
+  buffer.append((const char*)table.data(), slots * sizeof(uint64_t));
+  entries.clear();
+}
+
+bool SnapshotWriter::flush() {
+  size_t done = 0;
+  while (ok && done < buffer.size()) {
+    ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+    if (n < 0) {
+      ok = false;
+    } else {
+      done += n;
+    }
+  }
+  offset += buffer.size();
+  buffer.clear();
+  return ok;
+}
+
+bool SnapshotWriter::Finish() {
+  endStripe();
+  if (!flush() || stripes.size() != num_stripes) {
+    return false;
+  }
+  Header header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.min_id = min_id;
+  header.max_id = max_id;
+  header.stripes = stripes.size();
+  size_t index_bytes = stripes.size() * sizeof(MappedSnapshot::IndexEntry);
+  if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      pwrite(fd, stripes.data(), index_bytes, sizeof(header)) !=
+          (ssize_t)index_bytes ||
+      fsync(fd) != 0) {
+    return false;
+  }
+  close(fd);
+  fd = -1;
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  // make the rename itself durable
+  std::string dir = ".";
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos) {
+    dir = path.substr(0, slash + 1);
+  }
+  int dir_fd = open(dir.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+}
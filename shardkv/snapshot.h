@@ -0,0 +1,132 @@
+#ifndef SHARDING_SNAPSHOT_H
+#define SHARDING_SNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A point-in-time copy of a KvStore on disk, laid out so it can be mapped
+// into memory and read in place:
+//
+//   header   "SKVSNAP1", min_id, max_id, number of stripes
+//   index    per stripe: where its entries and hash table are, how many
+//            entries and slots there are, and the LSN of the last change it
+//            holds
+//   stripes  per stripe: its entries -- key length, value length, whether
+//            the value is a post list (stored comma-joined), the key and the
+//            value -- then an open-addressing hash table of where each entry
+//            starts, so a key is found without reading the others
+//
+// The stripes are KvStore's: one per ID in [min_id, max_id], then the
+// overflow stripes. A shard's keys are the stripes of its ID range, so they
+// can be found (or skipped) through the index without reading anything else.
+
+// the snapshot file at path, mapped read-only
+class MappedSnapshot {
+ public:
+  struct Entry {
+    std::string_view key;
+    std::string_view value;
+    bool is_list;
+  };
+
+  // maps the snapshot at path. returns nullptr if there is none or it isn't
+  // a snapshot of num_stripes stripes for IDs [min_id, max_id]
+  static std::unique_ptr<MappedSnapshot> Open(const std::string& path,
+                                              unsigned int min_id,
+                                              unsigned int max_id,
+                                              size_t num_stripes);
+
+  ~MappedSnapshot();
+
+  // the LSN of the last change stripe holds
+  uint64_t Lsn(size_t stripe) const;
+
+  size_t Count(size_t stripe) const;
+
+  // the entry for key in stripe. returns false if it has none
+  bool Find(size_t stripe, std::string_view key, Entry* entry) const;
+
+  // calls fn(entry) on every entry of stripe, in the order they were written
+  template <typename Fn>
+  void ForEach(size_t stripe, Fn fn) const {
+    const char* p = data + index(stripe).offset;
+    for (size_t i = 0; i < Count(stripe); i++) {
+      fn(next(&p));
+    }
+  }
+
+ private:
+  struct IndexEntry {
+    // the entries, and the hash table (slots 8 byte positions of an entry
+    // in the stripe plus one, or 0 for an empty slot)
+    uint64_t offset;
+    uint64_t bytes;
+    uint64_t table;
+    uint64_t lsn;
+    uint32_t count;
+    uint32_t slots;
+  };
+
+  MappedSnapshot(const char* data, size_t size) : data(data), size(size) {}
+
+  const IndexEntry& index(size_t stripe) const;
+
+  // decodes the entry at *p and moves *p past it
+  static Entry next(const char** p);
+
+  const char* data;
+  size_t size;
+
+  friend class SnapshotWriter;
+};
+
+// Writes a snapshot one stripe at a time, in stripe order, to a temporary
+// file that replaces the one at path only once it's complete and on disk, so
+// a crash while writing leaves the previous snapshot in place.
+class SnapshotWriter {
+ public:
+  SnapshotWriter(std::string path, unsigned int min_id, unsigned int max_id,
+                 size_t num_stripes);
+
+  // removes the temporary file unless Finish succeeded
+  ~SnapshotWriter();
+
+  // returns false (with errno set) if the temporary file can't be created
+  bool Open();
+
+  // starts the next stripe, which holds every change up to lsn
+  void BeginStripe(uint64_t lsn);
+
+  // adds an entry to the current stripe. keys within a stripe must be unique
+  void Add(std::string_view key, std::string_view value, bool is_list);
+
+  // writes out the index, syncs the file and moves it to path. returns false
+  // (with errno set) if any of it failed
+  bool Finish();
+
+ private:
+  // writes out buffer. returns false if the write failed
+  bool flush();
+
+  // appends the current stripe's hash table, if there is a current stripe
+  void endStripe();
+
+  const std::string path;
+  const std::string tmp_path;
+  const unsigned int min_id;
+  const unsigned int max_id;
+  const size_t num_stripes;
+  int fd = -1;
+  bool ok = true;
+  std::vector<MappedSnapshot::IndexEntry> stripes;
+  // the current stripe's entries: their key hashes and positions
+  std::vector<std::pair<uint64_t, uint64_t>> entries;
+  // bytes written so far, and the ones not written yet
+  uint64_t offset = 0;
+  std::string buffer;
+};
+
+#endif  // SHARDING_SNAPSHOT_H
@@ -0,0 +1,320 @@
+#include "sortedrun.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "../common/records.h"
+
+constexpr char MAGIC[8] = {'S', 'K', 'V', 'R', 'U', 'N', '0', '2'};
+
+// runs are written out in chunks of about this many bytes
+constexpr size_t WRITE_CHUNK = 1 << 20;
+
+struct Footer {
+  uint64_t index_offset;
+  uint64_t index_bytes;
+  uint64_t bloom_offset;
+  uint64_t bloom_bytes;
+  uint64_t entries;
+  uint32_t blocks;
+  uint32_t probes;
+  char magic[8];
+};
+
+// key length, value length and kind
+constexpr size_t ENTRY_HEADER = 2 * sizeof(uint32_t) + 1;
+
+// calls fn(bit) for each of the filter bits of a key with hash. bits is the
+// size of the filter
+template <typename Fn>
+static void bloomBits(uint64_t hash, uint64_t bits, Fn fn) {
+  // double hashing: probe i is h1 + i * h2
+  uint64_t h1 = hash;
+  uint64_t h2 = (hash >> 33) | 1;
+  for (uint32_t i = 0; i < LSM_BLOOM_PROBES; i++) {
+    fn((h1 + i * h2) % bits);
+  }
+}
+
+static bool readAll(int fd, char* data, size_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = pread(fd, data, len, offset);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+// decodes the entry at data[*pos], moving *pos past it. returns false if
+// it runs past the end
+static bool decode(const std::string& data, size_t* pos, std::string* key,
+                   LsmEntry* entry) {
+  if (data.size() - *pos < ENTRY_HEADER) {
+    return false;
+  }
+  const char* p = data.data() + *pos;
+  uint32_t key_len = GetRaw<uint32_t>(p);
+  uint32_t value_len = GetRaw<uint32_t>(p + sizeof(uint32_t));
+  if (data.size() - *pos - ENTRY_HEADER < (uint64_t)key_len + value_len) {
+    return false;
+  }
+  entry->kind = (LsmEntry::Kind)p[2 * sizeof(uint32_t)];
+  key->assign(p + ENTRY_HEADER, key_len);
+  entry->value.assign(p + ENTRY_HEADER + key_len, value_len);
+  *pos += ENTRY_HEADER + key_len + value_len;
+  return true;
+}
+
+std::shared_ptr<SortedRun> SortedRun::Open(const std::string& path,
+                                           uint64_t number) {
+  std::shared_ptr<SortedRun> run(new SortedRun(path, number));
+  run->fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (run->fd < 0 || fstat(run->fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(Footer)) {
+    return nullptr;
+  }
+  run->bytes = st.st_size;
+  Footer footer;
+  if (!readAll(run->fd, (char*)&footer, sizeof(footer),
+               st.st_size - sizeof(footer)) ||
+      memcmp(footer.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      footer.index_offset > run->bytes ||
+      footer.index_bytes > run->bytes - footer.index_offset ||
+      footer.bloom_offset > run->bytes ||
+      footer.bloom_bytes > run->bytes - footer.bloom_offset ||
+      footer.probes != LSM_BLOOM_PROBES) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  run->entries = footer.entries;
+
+  std::string index(footer.index_bytes, '\0');
+  run->bloom.assign(footer.bloom_bytes, '\0');
+  if (!readAll(run->fd, &index[0], index.size(), footer.index_offset) ||
+      !readAll(run->fd, &run->bloom[0], run->bloom.size(),
+               footer.bloom_offset)) {
+    return nullptr;
+  }
+  size_t pos = 0;
+  for (uint32_t b = 0; b < footer.blocks; b++) {
+    if (index.size() - pos < sizeof(uint32_t)) {
+      errno = EINVAL;
+      return nullptr;
+    }
+    uint32_t key_len = GetRaw<uint32_t>(index.data() + pos);
+    pos += sizeof(uint32_t);
+    if (index.size() - pos < key_len + sizeof(uint64_t) + sizeof(uint32_t)) {
+      errno = EINVAL;
+      return nullptr;
+    }
+    BlockHandle handle;
+    handle.first_key.assign(index.data() + pos, key_len);
+    pos += key_len;
+    memcpy(&handle.offset, index.data() + pos, sizeof(handle.offset));
+    pos += sizeof(handle.offset);
+    handle.size = GetRaw<uint32_t>(index.data() + pos);
+    pos += sizeof(uint32_t);
+    run->index.push_back(std::move(handle));
+  }
+  return run;
+}
+
+SortedRun::~SortedRun() {
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (obsolete) {
+    unlink(path.c_str());
+  }
+}
+
+long SortedRun::findBlock(std::string_view key) const {
+  auto it = std::upper_bound(
+      index.begin(), index.end(), key,
+      [](std::string_view k, const BlockHandle& b) { return k < b.first_key; });
+  return (it - index.begin()) - 1;
+}
+
+bool SortedRun::readBlock(size_t b, std::string* data) const {
+  data->resize(index[b].size);
+  return readAll(fd, &(*data)[0], data->size(), index[b].offset);
+}
+
+bool SortedRun::mayContain(std::string_view key) const {
+  if (bloom.empty()) {
+    return true;
+  }
+  bool found = true;
+  bloomBits(Fnv1a64(key), bloom.size() * 8, [this, &found](uint64_t bit) {
+    if (((uint8_t)bloom[bit / 8] & (1 << (bit % 8))) == 0) {
+      found = false;
+    }
+  });
+  return found;
+}
+
+bool SortedRun::Get(std::string_view key, LsmEntry* entry,
+                    uint64_t* blocks_read) const {
+  if (!mayContain(key)) {
+    return false;
+  }
+  long b = findBlock(key);
+  if (b < 0) {
+    return false;
+  }
+  std::string data;
+  (*blocks_read)++;
+  if (!readBlock(b, &data)) {
+    return false;
+  }
+  size_t pos = 0;
+  std::string k;
+  while (decode(data, &pos, &k, entry)) {
+    if (k == key) {
+      return true;
+    }
+    if (k > key) {
+      return false;
+    }
+  }
+  return false;
+}
+
+SortedRun::Iterator::Iterator(std::shared_ptr<SortedRun> run)
+    : run(std::move(run)) {}
+
+void SortedRun::Iterator::load(size_t b) {
+  valid = false;
+  block = b;
+  pos = 0;
+  if (b >= run->index.size() || !run->readBlock(b, &data)) {
+    return;
+  }
+  valid = decode(data, &pos, &key, &entry);
+}
+
+void SortedRun::Iterator::Seek(std::string_view target) {
+  load(std::max(run->findBlock(target), 0L));
+  while (valid && key < target) {
+    Next();
+  }
+}
+
+void SortedRun::Iterator::Next() {
+  if (pos < data.size()) {
+    valid = decode(data, &pos, &key, &entry);
+  } else {
+    load(block + 1);
+  }
+}
+
+SortedRunWriter::SortedRunWriter(std::string path)
+    : path(path), tmp_path(path + ".tmp") {}
+
+SortedRunWriter::~SortedRunWriter() {
+  if (fd >= 0) {
+    close(fd);
+    unlink(tmp_path.c_str());
+  }
+}
+
+bool SortedRunWriter::Open() {
+  fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  return fd >= 0;
+}
+
+void SortedRunWriter::Add(std::string_view key, const LsmEntry& entry) {
+  if (!in_block) {
+    block_start = Bytes();
+    block_key.assign(key);
+    in_block = true;
+  }
+  uint32_t key_len = key.size();
+  uint32_t value_len = entry.value.size();
+  buffer.append((const char*)&key_len, sizeof(key_len));
+  buffer.append((const char*)&value_len, sizeof(value_len));
+  buffer.push_back((char)entry.kind);
+  buffer.append(key);
+  buffer.append(entry.value);
+  hashes.push_back(Fnv1a64(key));
+  if (Bytes() - block_start >= LSM_BLOCK_BYTES) {
+    endBlock();
+  }
+  if (buffer.size() >= WRITE_CHUNK) {
+    flush();
+  }
+}
+
+void SortedRunWriter::endBlock() {
+  if (!in_block) {
+    return;
+  }
+  uint32_t key_len = block_key.size();
+  uint64_t block_offset = block_start;
+  uint32_t block_size = Bytes() - block_start;
+  index.append((const char*)&key_len, sizeof(key_len));
+  index.append(block_key);
+  index.append((const char*)&block_offset, sizeof(block_offset));
+  index.append((const char*)&block_size, sizeof(block_size));
+  blocks++;
+  in_block = false;
+}
+
+bool SortedRunWriter::flush() {
+  size_t done = 0;
+  while (ok && done < buffer.size()) {
+    ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+    if (n < 0) {
+      ok = false;
+    } else {
+      done += n;
+    }
+  }
+  offset += buffer.size();
+  buffer.clear();
+  return ok;
+}
+
+bool SortedRunWriter::Finish() {
+  endBlock();
+  Footer footer = {};
+  footer.index_offset = Bytes();
+  footer.index_bytes = index.size();
+  buffer.append(index);
+
+  std::string bloom((hashes.size() * LSM_BLOOM_BITS_PER_KEY + 7) / 8 + 8,
+                    '\0');
+  for (uint64_t hash : hashes) {
+    bloomBits(hash, bloom.size() * 8, [&bloom](uint64_t bit) {
+      bloom[bit / 8] |= (char)(1 << (bit % 8));
+    });
+  }
+  footer.bloom_offset = Bytes();
+  footer.bloom_bytes = bloom.size();
+  buffer.append(bloom);
+
+  footer.entries = hashes.size();
+  footer.blocks = blocks;
+  footer.probes = LSM_BLOOM_PROBES;
+  memcpy(footer.magic, MAGIC, sizeof(MAGIC));
+  buffer.append((const char*)&footer, sizeof(footer));
+  if (!flush() || fsync(fd) != 0) {
+    return false;
+  }
+  close(fd);
+  fd = -1;
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
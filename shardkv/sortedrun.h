@@ -0,0 +1,168 @@
+#ifndef SHARDING_SORTEDRUN_H
+#define SHARDING_SORTEDRUN_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// a run's entries are grouped into blocks of about this many bytes, the unit
+// a lookup reads from disk
+constexpr size_t LSM_BLOCK_BYTES = 4096;
+
+// bits of Bloom filter per key. 10 bits and 7 probes give about 1% false
+// positives
+constexpr size_t LSM_BLOOM_BITS_PER_KEY = 10;
+constexpr uint32_t LSM_BLOOM_PROBES = 7;
+
+// what an LsmStore holds for a key: a value, or a tombstone that hides older
+// values of it
+struct LsmEntry {
+  enum Kind : uint8_t {
+    PLAIN = 0,    // value is a plain string
+    LIST = 1,     // value is a post list (PostList::Encode)
+    DELETED = 2,  // the key was erased
+  };
+  Kind kind = PLAIN;
+  std::string value;
+};
+
+// An immutable file of entries sorted by key, one of the levels of an
+// LsmStore:
+//
+//   blocks  entries -- key length, value length, kind, key, value -- in key
+//           order, cut into blocks of about LSM_BLOCK_BYTES
+//   index   the first key, offset and size of each block
+//   bloom   a Bloom filter of every key
+//   footer  where the index and filter are, and the number of entries
+//
+// The index and filter are loaded when the run is opened, so a lookup reads
+// at most one block, and none at all for most keys that aren't in the run.
+class SortedRun {
+ public:
+  // opens the run at path. returns nullptr (with errno set) if it can't be
+  // read or isn't a run
+  static std::shared_ptr<SortedRun> Open(const std::string& path,
+                                         uint64_t number);
+
+  // closes the file, and removes it if it's obsolete
+  ~SortedRun();
+
+  SortedRun(const SortedRun&) = delete;
+  SortedRun& operator=(const SortedRun&) = delete;
+
+  // looks key up, adding the blocks it read to *blocks_read. returns false
+  // if the run has no entry for key
+  bool Get(std::string_view key, LsmEntry* entry, uint64_t* blocks_read) const;
+
+  // the run's number, which orders runs by age: higher is newer
+  uint64_t Number() const { return number; }
+
+  uint64_t Bytes() const { return bytes; }
+  uint64_t Entries() const { return entries; }
+
+  // the run has been merged into another one. its file is removed once the
+  // last reader lets go of it
+  void MarkObsolete() { obsolete = true; }
+
+  // reads the run's entries in key order, a block at a time
+  class Iterator {
+   public:
+    explicit Iterator(std::shared_ptr<SortedRun> run);
+
+    // moves to the first entry with a key >= target
+    void Seek(std::string_view target);
+    bool Valid() const { return valid; }
+    std::string_view Key() const { return key; }
+    const LsmEntry& Entry() const { return entry; }
+    void Next();
+
+   private:
+    // reads block b and decodes its first entry
+    void load(size_t b);
+
+    std::shared_ptr<SortedRun> run;
+    size_t block = 0;
+    std::string data;
+    size_t pos = 0;
+    bool valid = false;
+    std::string key;
+    LsmEntry entry;
+  };
+
+ private:
+  struct BlockHandle {
+    std::string first_key;
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  SortedRun(std::string path, uint64_t number) : path(path), number(number) {}
+
+  // the block that would hold key, or -1 if key sorts before every block
+  long findBlock(std::string_view key) const;
+
+  // reads block b into data. returns false if the read failed
+  bool readBlock(size_t b, std::string* data) const;
+
+  bool mayContain(std::string_view key) const;
+
+  const std::string path;
+  const uint64_t number;
+  int fd = -1;
+  uint64_t bytes = 0;
+  uint64_t entries = 0;
+  std::vector<BlockHandle> index;
+  std::string bloom;
+  std::atomic<bool> obsolete{false};
+};
+
+// Writes a SortedRun. Entries must be added in increasing key order. The run
+// is written to a temporary file and moved to path by Finish, once it's on
+// disk.
+class SortedRunWriter {
+ public:
+  explicit SortedRunWriter(std::string path);
+
+  // removes the temporary file unless Finish succeeded
+  ~SortedRunWriter();
+
+  // returns false (with errno set) if the temporary file can't be created
+  bool Open();
+
+  void Add(std::string_view key, const LsmEntry& entry);
+
+  // writes the index, filter and footer, syncs the file and moves it to
+  // path (syncing the directory is up to the caller). returns false (with
+  // errno set) if any of it failed
+  bool Finish();
+
+  // bytes written so far
+  uint64_t Bytes() const { return offset + buffer.size(); }
+
+ private:
+  // ends the current block
+  void endBlock();
+
+  // writes out buffer. returns false if the write failed
+  bool flush();
+
+  const std::string path;
+  const std::string tmp_path;
+  int fd = -1;
+  bool ok = true;
+  uint64_t offset = 0;
+  std::string buffer;
+  // start of the current block, and the key it starts with
+  uint64_t block_start = 0;
+  std::string block_key;
+  bool in_block = false;
+  std::string index;
+  uint32_t blocks = 0;
+  // hashes of every key, for the filter
+  std::vector<uint64_t> hashes;
+};
+
+#endif  // SHARDING_SORTEDRUN_H
@@ -0,0 +1,115 @@
+#ifndef SHARDING_STORAGE_H
+#define SHARDING_STORAGE_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../common/common.h"
+#include "postlist.h"
+
+// The store ShardkvServer keeps its keys in. Implementations must be safe to
+// call from any number of threads at once, and each method is atomic with
+// respect to the others on the same key.
+//
+// A value is either a plain string or a post list (user_<id>_posts, written
+// with the List* methods). Everything else reads a list as the legacy
+// comma-joined string, and a plain string is split on commas the first time
+// it's written as a list.
+//
+// There are two engines: KvStore (kvstore.h) keeps everything in memory, and
+// LsmStore (lsmstore.h) keeps it on disk for data that doesn't fit in memory.
+// How an engine persists its data, and recovers it, is set up by whoever
+// creates it.
+class StorageEngine {
+ public:
+  virtual ~StorageEngine() = default;
+
+  // copies the value of key into value. returns false if key is missing
+  virtual bool Get(const std::string& key, std::string* value) = 0;
+
+  // looks up every key. found[i] is set to whether keys[i] is present, and
+  // values[i] to its value if so
+  virtual void GetBatch(const std::vector<std::string>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<bool>* found) = 0;
+
+  // inserts or overwrites key. returns true if the key was newly created
+  virtual bool Put(const std::string& key, const std::string& value) = 0;
+
+  // inserts key only if it doesn't exist yet. returns true if it was inserted
+  virtual bool PutIfAbsent(const std::string& key,
+                           const std::string& value) = 0;
+
+  // appends data to the value of key, creating it if it doesn't exist yet.
+  // if key is a list, data is split on commas and each post appended to it.
+  // returns true if the key was newly created
+  virtual bool Append(const std::string& key, const std::string& data) = 0;
+
+  // appends each post in posts to the list at key (unless it's on it
+  // already), creating the list if key doesn't exist yet. returns true if the
+  // key was newly created
+  virtual bool ListAppend(const std::string& key,
+                          const std::vector<std::string>& posts) = 0;
+
+  // makes list the value of key, unless if_absent is set and key exists.
+  // returns whether it was written
+  virtual bool PutList(const std::string& key, PostList list,
+                       bool if_absent) = 0;
+
+  // removes post from the list at key. returns false if it wasn't on it
+  virtual bool ListRemove(const std::string& key, const std::string& post) = 0;
+
+  // reads up to limit posts of the list at key, starting at cursor (see
+  // PostList::Range). returns false if key is missing
+  virtual bool ListRange(const std::string& key, uint64_t cursor,
+                         size_t limit, std::vector<std::string>* posts,
+                         uint64_t* next, bool* more) = 0;
+
+  // inserts or overwrites every pair, possibly moving the values out of
+  // pairs. readers see either none or all of the batch. created[i] is set to
+  // whether pairs[i] was a new key
+  virtual void PutBatch(std::vector<std::pair<std::string, std::string>>& pairs,
+                        std::vector<bool>* created) = 0;
+
+  // removes key, storing its old value in value (if non-null). returns false
+  // if key was not present
+  virtual bool Erase(const std::string& key, std::string* value = nullptr) = 0;
+
+  // runs fn on the value of key, so a read-modify-write can't interleave
+  // with other writers. returns false (without calling fn) if key is missing
+  // or a list
+  virtual bool Update(const std::string& key,
+                      const std::function<void(std::string&)>& fn) = 0;
+
+  // appends data to the value of key only if it exists. returns false
+  // (changing nothing) if key is missing or a list
+  virtual bool AppendIfPresent(const std::string& key,
+                               const std::string& data) = 0;
+
+  // removes every key in keys that is present, logging them together.
+  // returns the number of keys removed
+  virtual size_t EraseBatch(const std::vector<std::string>& keys) = 0;
+
+  // returns a copy of every pair whose key ID is in [s.lower, s.upper]. a
+  // range being handed off is read with this and only erased (EraseBatch)
+  // once its new owner has it, so a crash in between can't lose it. if lists
+  // is set, the post lists go there instead, as PostList::Encode, so they
+  // keep their sequence numbers (see PutList)
+  virtual std::vector<std::pair<std::string, std::string>> ReadRange(
+      const shard_t& s,
+      std::vector<std::pair<std::string, std::string>>* lists = nullptr) = 0;
+
+  // returns a copy of every key-value pair. not necessarily an atomic
+  // snapshot of the whole store
+  virtual std::vector<std::pair<std::string, std::string>> Snapshot() = 0;
+
+  virtual size_t Size() = 0;
+
+  // calls fn on every key, e.g. to rebuild an index without copying values
+  virtual void ForEachKey(const std::function<void(std::string_view)>& fn) = 0;
+};
+
+#endif  // SHARDING_STORAGE_H
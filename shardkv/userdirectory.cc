@@ -0,0 +1,128 @@
+#include "userdirectory.h"
+
+static const std::string USER_PREFIX = "user_";
+
+UserDirectory::UserDirectory(unsigned int min_id, unsigned int max_id)
+    : min_id(min_id),
+      max_id(max_id),
+      bits((max_id - min_id) / 64 + 1, 0) {}
+
+long UserDirectory::slot(const std::string& user) const {
+  if (user.compare(0, USER_PREFIX.size(), USER_PREFIX) != 0 ||
+      user.size() == USER_PREFIX.size()) {
+    return -1;
+  }
+  // only the canonical spelling of an ID (no sign, no leading zeros) gets a
+  // bit, so a user comes out of the bitmap exactly as it went in
+  size_t digits = user.size() - USER_PREFIX.size();
+  if (digits > 10 || (digits > 1 && user[USER_PREFIX.size()] == '0')) {
+    return -1;
+  }
+  unsigned long id = 0;
+  for (size_t i = USER_PREFIX.size(); i < user.size(); i++) {
+    if (user[i] < '0' || user[i] > '9') {
+      return -1;
+    }
+    id = id * 10 + (user[i] - '0');
+  }
+  if (id < min_id || id > max_id) {
+    return -1;
+  }
+  return id;
+}
+
+bool UserDirectory::Add(const std::string& user) {
+  long id = slot(user);
+  std::unique_lock<std::shared_mutex> lock(mtx);
+  if (id < 0) {
+    return others.insert(user).second;
+  }
+  uint64_t& word = bits[(id - min_id) / 64];
+  uint64_t bit = 1ULL << ((id - min_id) % 64);
+  if (word & bit) {
+    return false;
+  }
+  word |= bit;
+  bit_count++;
+  return true;
+}
+
+bool UserDirectory::Remove(const std::string& user) {
+  long id = slot(user);
+  std::unique_lock<std::shared_mutex> lock(mtx);
+  if (id < 0) {
+    return others.erase(user) > 0;
+  }
+  uint64_t& word = bits[(id - min_id) / 64];
+  uint64_t bit = 1ULL << ((id - min_id) % 64);
+  if (!(word & bit)) {
+    return false;
+  }
+  word &= ~bit;
+  bit_count--;
+  return true;
+}
+
+bool UserDirectory::Contains(const std::string& user) {
+  long id = slot(user);
+  std::shared_lock<std::shared_mutex> lock(mtx);
+  if (id < 0) {
+    return others.count(user) > 0;
+  }
+  return bits[(id - min_id) / 64] & (1ULL << ((id - min_id) % 64));
+}
+
+size_t UserDirectory::Size() {
+  std::shared_lock<std::shared_mutex> lock(mtx);
+  return bit_count + others.size();
+}
+
+std::string UserDirectory::Joined() {
+  bool more;
+  std::string joined;
+  for (const std::string& user : Page("", SIZE_MAX, &more)) {
+    joined += user;
+    joined += ',';
+  }
+  return joined;
+}
+
+std::vector<std::string> UserDirectory::Page(const std::string& after,
+                                             size_t limit, bool* more) {
+  std::vector<std::string> page;
+  *more = false;
+  std::shared_lock<std::shared_mutex> lock(mtx);
+
+  // users in others sort after every user in the bitmap, so unless after is
+  // one of them we go through the bitmap first, starting past after's bit
+  long after_id = slot(after);
+  bool in_bitmap = after == "" || after_id != -1;
+  if (in_bitmap) {
+    unsigned long start = after == "" ? 0 : after_id + 1 - min_id;
+    for (size_t w = start / 64; w < bits.size(); w++) {
+      uint64_t word = bits[w];
+      if (w == start / 64) {
+        // skip the IDs up to and including after
+        word &= ~0ULL << (start % 64);
+      }
+      while (word != 0) {
+        if (page.size() == limit) {
+          *more = true;
+          return page;
+        }
+        int b = __builtin_ctzll(word);
+        page.push_back(USER_PREFIX + std::to_string(min_id + w * 64 + b));
+        word &= word - 1;
+      }
+    }
+  }
+  auto it = in_bitmap ? others.begin() : others.upper_bound(after);
+  for (; it != others.end(); it++) {
+    if (page.size() == limit) {
+      *more = true;
+      return page;
+    }
+    page.push_back(*it);
+  }
+  return page;
+}
@@ -0,0 +1,61 @@
+#ifndef SHARDING_USERDIRECTORY_H
+#define SHARDING_USERDIRECTORY_H
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "../common/common.h"
+
+// The set of user_<id> keys a ShardkvServer stores, i.e. what a Get of
+// all_users returns.
+//
+// Users with an ID in [min_id, max_id] (every user the shardmaster can assign)
+// are one bit each in a bitmap indexed by ID, so adding or removing one is
+// O(1) and no string is rebuilt. Any other user key goes in a small ordered
+// set. The directory's order is the bitmap in ID order, then that set. The
+// comma-joined all_users string is only built when someone asks for it.
+class UserDirectory {
+ public:
+  explicit UserDirectory(unsigned int min_id = MIN_KEY,
+                         unsigned int max_id = MAX_KEY);
+
+  // adds user. returns true if it wasn't in the directory yet
+  bool Add(const std::string& user);
+
+  // removes user. returns true if it was in the directory
+  bool Remove(const std::string& user);
+
+  bool Contains(const std::string& user);
+
+  size_t Size();
+
+  // every user followed by a comma, the legacy all_users value
+  std::string Joined();
+
+  // returns up to limit users that come after the user after ("" starts from
+  // the beginning), in directory order. after doesn't have to be in the
+  // directory anymore, so a page can be resumed from the last user of the
+  // previous one even if that user was removed since. *more is set to whether
+  // there are users past the page
+  std::vector<std::string> Page(const std::string& after, size_t limit,
+                                bool* more);
+
+ private:
+  // returns the ID of user if it is exactly user_<id> with an ID in
+  // [min_id, max_id], or -1
+  long slot(const std::string& user) const;
+
+  const unsigned int min_id;
+  const unsigned int max_id;
+  std::shared_mutex mtx;
+  // bit (id - min_id) is set iff user_<id> is in the directory
+  std::vector<uint64_t> bits;
+  size_t bit_count = 0;
+  std::set<std::string> others;
+};
+
+#endif  // SHARDING_USERDIRECTORY_H
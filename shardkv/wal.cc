@@ -0,0 +1,270 @@
+#include "wal.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../common/records.h"
+
+// a record's payload (see common/records.h) is the op, the LSN, the key
+// length, the key and the data
+constexpr size_t PAYLOAD_HEADER = 1 + sizeof(uint64_t) + sizeof(uint32_t);
+
+// appends the encoded record to out
+static void encode(std::string* out, WriteAheadLog::Op op, uint64_t lsn,
+                   std::string_view key, std::string_view data) {
+  size_t start = StartRecord(out);
+  out->push_back((char)op);
+  PutRaw<uint64_t>(out, lsn);
+  PutRaw<uint32_t>(out, key.size());
+  out->append(key);
+  out->append(data);
+  FinishRecord(out, start);
+}
+
+// fsyncs the directory path is in, so a file created or renamed there
+// survives a crash
+static void syncDir(const std::string& path) {
+  std::string dir = ".";
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos) {
+    dir = path.substr(0, slash + 1);
+  }
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+bool ParseSyncMode(const std::string& name, SyncMode* mode) {
+  if (name == "per-write") {
+    *mode = SyncMode::PER_WRITE;
+  } else if (name == "batched") {
+    *mode = SyncMode::BATCHED;
+  } else if (name == "async") {
+    *mode = SyncMode::ASYNC;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+WriteAheadLog::WriteAheadLog(std::string path, SyncMode mode)
+    : path(std::move(path)), mode(mode) {}
+
+WriteAheadLog::~WriteAheadLog() {
+  if (fd < 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mtx);
+  closing = true;
+  cv.notify_all();
+  if (flusher.joinable()) {
+    lock.unlock();
+    flusher.join();
+    lock.lock();
+  }
+  cv.wait(lock, [this]() { return !flushing; });
+  flush(lock);
+  close(fd);
+}
+
+bool WriteAheadLog::Open() {
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  syncDir(path);
+  if (mode == SyncMode::ASYNC) {
+    flusher = std::thread([this]() { this->flushLoop(); });
+  }
+  return true;
+}
+
+// calls apply on every complete record in the file fd, in order. returns how
+// many records there were, and sets *end to how many bytes they take up
+static size_t readRecords(
+    int fd, const std::function<void(const WriteAheadLog::Record&)>& apply,
+    size_t* end) {
+  std::string contents = ReadFile(fd);
+
+  size_t records = 0;
+  size_t pos = 0;
+  size_t next = 0;
+  std::string_view payload;
+  while (NextRecord(contents, &next, &payload)) {
+    if (payload.size() < PAYLOAD_HEADER) {
+      break;
+    }
+    uint32_t key_len = GetRaw<uint32_t>(payload.data() + 1 + sizeof(uint64_t));
+    if (key_len > payload.size() - PAYLOAD_HEADER) {
+      break;
+    }
+    WriteAheadLog::Record record;
+    record.op = (WriteAheadLog::Op)payload[0];
+    record.lsn = GetRaw<uint64_t>(payload.data() + 1);
+    record.key = payload.substr(PAYLOAD_HEADER, key_len);
+    record.data = payload.substr(PAYLOAD_HEADER + key_len);
+    apply(record);
+    records++;
+    pos = next;
+  }
+  *end = pos;
+  return records;
+}
+
+size_t WriteAheadLog::Replay(
+    const std::function<void(const Record&)>& apply) {
+  auto replay = [this, &apply](const Record& record) {
+    apply(record);
+    last_lsn = std::max(last_lsn, record.lsn);
+  };
+  size_t records = 0;
+  size_t end;
+  // a segment left by a Rotate whose checkpoint never finished comes first.
+  // it was complete when it was rotated out
+  int old_fd = open(oldPath().c_str(), O_RDONLY);
+  if (old_fd >= 0) {
+    records += readRecords(old_fd, replay, &end);
+    close(old_fd);
+  }
+  records += readRecords(fd, replay, &end);
+  // whatever follows the last complete record was being written when we
+  // went down, and was never acknowledged
+  struct stat st;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size > end &&
+      ftruncate(fd, end) != 0) {
+    perror("wal: truncating torn record");
+    abort();
+  }
+  synced_lsn = last_lsn;
+  return records;
+}
+
+uint64_t WriteAheadLog::Add(Op op, std::string_view key,
+                            std::string_view data) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (mode == SyncMode::PER_WRITE) {
+    std::string record;
+    encode(&record, op, ++last_lsn, key, data);
+    writeOut(record);
+    fsyncs++;
+    synced_lsn = last_lsn;
+    return last_lsn;
+  }
+  encode(&buffer, op, ++last_lsn, key, data);
+  return last_lsn;
+}
+
+void WriteAheadLog::Sync(uint64_t lsn) {
+  if (mode != SyncMode::BATCHED) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mtx);
+  while (synced_lsn < lsn) {
+    if (flushing) {
+      // someone else is writing a batch. ours may be in it, otherwise we
+      // lead the next one
+      cv.wait(lock);
+    } else {
+      flush(lock);
+    }
+  }
+}
+
+uint64_t WriteAheadLog::LastLsn() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return last_lsn;
+}
+
+void WriteAheadLog::AdvanceTo(uint64_t lsn) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (lsn > last_lsn) {
+    last_lsn = synced_lsn = lsn;
+  }
+}
+
+bool WriteAheadLog::Rotate() {
+  std::unique_lock<std::mutex> lock(mtx);
+  // the records of the last rotated segment may not be in a snapshot yet
+  if (access(oldPath().c_str(), F_OK) == 0) {
+    return false;
+  }
+  cv.wait(lock, [this]() { return !flushing; });
+  // writers wait on mtx until the new segment is in place, so every record
+  // up to last_lsn ends up in the old one and every later one in the new one
+  if (!buffer.empty()) {
+    writeOut(buffer);
+    buffer.clear();
+    fsyncs++;
+  }
+  synced_lsn = last_lsn;
+  int new_fd = -1;
+  if (rename(path.c_str(), oldPath().c_str()) != 0 ||
+      (new_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644)) < 0) {
+    perror("wal: rotating");
+    abort();
+  }
+  syncDir(path);
+  close(fd);
+  fd = new_fd;
+  cv.notify_all();
+  return true;
+}
+
+void WriteAheadLog::DropRotated() { unlink(oldPath().c_str()); }
+
+uint64_t WriteAheadLog::Fsyncs() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return fsyncs;
+}
+
+void WriteAheadLog::writeOut(const std::string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0) {
+      perror("wal: write");
+      abort();
+    }
+    done += n;
+  }
+  if (fdatasync(fd) != 0) {
+    perror("wal: fdatasync");
+    abort();
+  }
+}
+
+void WriteAheadLog::flush(std::unique_lock<std::mutex>& lock) {
+  if (buffer.empty()) {
+    synced_lsn = last_lsn;
+    return;
+  }
+  flushing = true;
+  std::string batch;
+  batch.swap(buffer);
+  uint64_t upto = last_lsn;
+  // writers keep adding to the (new) buffer while we write this batch
+  lock.unlock();
+  writeOut(batch);
+  lock.lock();
+  fsyncs++;
+  synced_lsn = upto;
+  flushing = false;
+  cv.notify_all();
+}
+
+void WriteAheadLog::flushLoop() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (!closing) {
+    cv.wait_for(lock, ASYNC_SYNC_INTERVAL, [this]() { return closing; });
+    if (!flushing) {
+      flush(lock);
+    }
+  }
+}
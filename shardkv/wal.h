@@ -0,0 +1,144 @@
+#ifndef SHARDING_WAL_H
+#define SHARDING_WAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// how the log makes a write durable before the write is acknowledged
+enum class SyncMode {
+  PER_WRITE,  // each write is written and fsynced on its own
+  BATCHED,    // writers waiting at the same time share one fsync
+  ASYNC       // writes are acknowledged at once and fsynced in the background
+};
+
+// parses "per-write", "batched" or "async". returns false for anything else
+bool ParseSyncMode(const std::string& name, SyncMode* mode);
+
+// how often an ASYNC log fsyncs, i.e. how much it may lose in a crash
+constexpr std::chrono::milliseconds ASYNC_SYNC_INTERVAL(10);
+
+// An append-only write-ahead log of the changes made to a KvStore, so a
+// shardkv process can rebuild its data when it restarts.
+//
+// Each change is appended as one record: its length, a checksum, the op, its
+// log sequence number, the key and the data. Add buffers a record and returns
+// its LSN; Sync(lsn) blocks until the record is on disk. In BATCHED mode the
+// first writer to call Sync writes and fsyncs everything buffered so far on
+// behalf of every writer waiting behind it (group commit), so N concurrent
+// writes cost one fsync instead of N. A record cut short by a crash is
+// detected by its length or checksum and dropped when the log is replayed.
+//
+// A checkpoint (KvStore::Checkpoint) keeps the log short: it Rotates the log,
+// so new records go to a fresh file while the old one is kept at
+// <path>.old, and calls DropRotated once its snapshot holds everything the
+// old segment did. LSNs keep counting across segments, so a snapshot can
+// tell which records it already holds.
+//
+// usage:
+//   WriteAheadLog log(path, SyncMode::BATCHED);
+//   if (!log.Open()) ...
+//   log.Replay([](const WriteAheadLog::Record& r) { ... });
+//   uint64_t lsn = log.Add(WriteAheadLog::PUT, key, value);
+//   log.Sync(lsn);
+class WriteAheadLog {
+ public:
+  enum Op : uint8_t {
+    PUT = 1,          // key now holds the plain value data
+    APPEND,           // data was appended to key (KvStore::Append)
+    LIST_APPEND,      // the comma-separated posts in data were listed at key
+    LIST_REMOVE,      // the post data was taken off the list at key
+    ERASE,            // key was removed
+    PUT_LIST          // key now holds the post list data (PostList::Encode)
+  };
+
+  struct Record {
+    Op op;
+    uint64_t lsn;
+    std::string key;
+    std::string data;
+  };
+
+  WriteAheadLog(std::string path, SyncMode mode);
+
+  // flushes whatever is still buffered and closes the file
+  ~WriteAheadLog();
+
+  // opens the log file, creating it if it doesn't exist. returns false (with
+  // errno set) if it can't be opened
+  bool Open();
+
+  // calls apply on every record in the log (the rotated segment first, if
+  // there is one), in order, and cuts off a torn record at the end so new
+  // records follow the last complete one. call once, after Open and before
+  // the first Add. returns the number of records
+  size_t Replay(const std::function<void(const Record&)>& apply);
+
+  // appends a record. in PER_WRITE mode it is on disk when this returns,
+  // otherwise it is buffered until Sync (or the background flush) writes it
+  uint64_t Add(Op op, std::string_view key, std::string_view data);
+
+  // blocks until the record with LSN lsn (and every one before it) is on
+  // disk. returns at once in ASYNC mode
+  void Sync(uint64_t lsn);
+
+  SyncMode Mode() const { return mode; }
+
+  // the LSN of the last record added
+  uint64_t LastLsn();
+
+  // makes the next record's LSN greater than lsn, e.g. the LSN a snapshot
+  // holds changes up to, once the records up to it have been dropped
+  void AdvanceTo(uint64_t lsn);
+
+  // writes out what's buffered and moves the log to <path>.old, so records
+  // up to LastLsn() are there and later ones in a new file at path. returns
+  // false (and leaves the log alone) if there is a rotated segment already,
+  // i.e. its checkpoint never finished
+  bool Rotate();
+
+  // removes the rotated segment, once a snapshot holds all of its changes
+  void DropRotated();
+
+  // number of fsyncs so far, to see how well writes are batched
+  uint64_t Fsyncs();
+
+ private:
+  // writes data to the file and fsyncs it. aborts if that fails, since a
+  // write we can't log must not be acknowledged
+  void writeOut(const std::string& data);
+
+  // takes the buffer and writes it out (as the only flusher). lock must hold
+  // mtx; it is released during the write
+  void flush(std::unique_lock<std::mutex>& lock);
+
+  std::string oldPath() const { return path + ".old"; }
+
+  // runs in a separate thread in ASYNC mode: flushes every
+  // ASYNC_SYNC_INTERVAL until the log is closed
+  void flushLoop();
+
+  const std::string path;
+  const SyncMode mode;
+  int fd = -1;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  // records added but not written yet, and the LSNs that are assigned and on
+  // disk
+  std::string buffer;
+  uint64_t last_lsn = 0;
+  uint64_t synced_lsn = 0;
+  // whether some thread is writing out a batch
+  bool flushing = false;
+  uint64_t fsyncs = 0;
+  bool closing = false;
+  std::thread flusher;
+};
+
+#endif  // SHARDING_WAL_H
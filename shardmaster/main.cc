@@ -1,14 +1,58 @@
 #include <unistd.h>
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include "replicated_shardmaster.h"
 #include "shardmaster.h"
 
+static void usage() {
+  fprintf(stderr, "usage: ./shardmaster [-p partition|balanced|ring " \
+                  "[-v <VIRTUAL NODES>]] [-r <REPLICA,REPLICA,...> " \
+                  "[-s <STATE FILE>]] <PORT>\n");
+}
+
 int main(int argc, char** argv) {
+  // with -p balanced, a Join or Leave only moves IDs off the servers that
+  // hold more than their share
+  // with -p ring, servers are placed on a hash ring with -v virtual nodes
+  // each (RING_VNODES by default)
+  // with -r, this is one replica of a shardmaster replicated with Raft over
+  // the addresses listed (this one's included), keeping its Raft state in
+  // the -s file (./shardmaster_<PORT>.raft by default)
+  Placement placement = Placement::PARTITION;
+  unsigned int vnodes = RING_VNODES;
+  std::vector<std::string> replicas;
+  std::string state_path;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:v:r:s:")) != -1) {
+    if (opt == 'p' && std::string(optarg) == "partition") {
+      placement = Placement::PARTITION;
+    } else if (opt == 'p' && std::string(optarg) == "balanced") {
+      placement = Placement::BALANCED;
+    } else if (opt == 'p' && std::string(optarg) == "ring") {
+      placement = Placement::RING;
+    } else if (opt == 'v' && atoi(optarg) > 0) {
+      vnodes = atoi(optarg);
+    } else if (opt == 'r') {
+      std::stringstream list(optarg);
+      std::string replica;
+      while (std::getline(list, replica, ',')) {
+        replicas.push_back(replica);
+      }
+    } else if (opt == 's') {
+      state_path = optarg;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
   if (argc != 2) {
-    fprintf(stderr, "usage: ./shardmaster <PORT>\n");
+    usage();
     return 1;
   }
-  // shardmaster service
-  StaticShardmaster shardmaster;
   // construct address
   char hostnamebuf[256];
   gethostname(hostnamebuf, 256);
@@ -17,7 +61,33 @@ int main(int argc, char** argv) {
   std::string addr = hostname + ":" + std::string(argv[1]);
   ::grpc::ServerBuilder builder;
   builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
-  builder.RegisterService(&shardmaster);
+  // shardmaster service
+  std::unique_ptr<StaticShardmaster> shardmaster;
+  std::unique_ptr<ReplicatedShardmaster> replicated;
+  if (replicas.empty()) {
+    shardmaster = std::make_unique<StaticShardmaster>(placement, vnodes);
+    builder.RegisterService(shardmaster.get());
+  } else {
+    auto self = std::find(replicas.begin(), replicas.end(), addr);
+    if (self == replicas.end()) {
+      fprintf(stderr, "%s isn't one of the replicas\n", addr.c_str());
+      return 1;
+    }
+    // a replica that forgot its votes and log could undo committed changes,
+    // so its state is always kept on disk
+    if (state_path == "") {
+      state_path = "./shardmaster_" + std::string(argv[1]) + ".raft";
+    }
+    replicated = std::make_unique<ReplicatedShardmaster>(
+        replicas, self - replicas.begin(), state_path, placement, vnodes);
+    if (!replicated->Start()) {
+      perror(state_path.c_str());
+      return 1;
+    }
+    builder.RegisterService(replicated.get());
+    builder.RegisterService(replicated->Node());
+    fprintf(stdout, "Raft state in: %s\n", state_path.c_str());
+  }
   std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
   fprintf(stdout, "Listening on: %s\n", addr.c_str());
   server->Wait();
@@ -0,0 +1,571 @@
+#include "raft.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../common/records.h"
+
+// a state file record's payload (see common/records.h) is its type, then for
+// TERM the term and vote, for ENTRY the entry's index and the serialized
+// LogEntry, and for TRUNCATE the index the log is cut back to
+enum RecordType : uint8_t { TERM = 1, ENTRY, TRUNCATE };
+
+// appends a record of type with the payload body to out
+static void encode(std::string* out, RecordType type, const std::string& body) {
+  size_t start = StartRecord(out);
+  out->push_back((char)type);
+  out->append(body);
+  FinishRecord(out, start);
+}
+
+std::shared_ptr<::grpc::Channel> PeerChannel(const std::string& addr) {
+  ::grpc::ChannelArguments args;
+  args.SetInt(GRPC_ARG_INITIAL_RECONNECT_BACKOFF_MS, RAFT_HEARTBEAT.count());
+  args.SetInt(GRPC_ARG_MIN_RECONNECT_BACKOFF_MS, RAFT_HEARTBEAT.count());
+  args.SetInt(GRPC_ARG_MAX_RECONNECT_BACKOFF_MS, RAFT_HEARTBEAT.count());
+  std::shared_ptr<::grpc::Channel> channel = ::grpc::CreateCustomChannel(
+      addr, ::grpc::InsecureChannelCredentials(), args);
+  channel->GetState(true);
+  return channel;
+}
+
+RaftNode::RaftNode(std::vector<std::string> peers, size_t self,
+                   std::string state_path, Apply apply)
+    : peers(std::move(peers)),
+      self(self),
+      state_path(std::move(state_path)),
+      apply(std::move(apply)),
+      rng(std::random_device()() + self),
+      followers(this->peers.size()) {
+  for (size_t p = 0; p < this->peers.size(); p++) {
+    if (p != self) {
+      followers[p].stub = Raft::NewStub(PeerChannel(this->peers[p]));
+    }
+  }
+}
+
+RaftNode::~RaftNode() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+    replicate_cv.notify_all();
+    commit_cv.notify_all();
+    applied_cv.notify_all();
+  }
+  if (ticker.joinable()) {
+    ticker.join();
+  }
+  if (applier.joinable()) {
+    applier.join();
+  }
+  for (Follower& f : followers) {
+    if (f.thread.joinable()) {
+      f.thread.join();
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool RaftNode::Start() {
+  if (state_path != "") {
+    fd = open(state_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    load();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    resetElectionTimer();
+  }
+  ticker = std::thread([this]() { this->tickLoop(); });
+  applier = std::thread([this]() { this->applyLoop(); });
+  for (size_t p = 0; p < peers.size(); p++) {
+    if (p != self) {
+      followers[p].thread = std::thread([this, p]() { this->replicate(p); });
+    }
+  }
+  return true;
+}
+
+bool RaftNode::Propose(LogEntry entry, uint64_t* index, uint64_t* term) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (role != Role::LEADER) {
+    return false;
+  }
+  entry.set_term(current_term);
+  log.push_back(std::move(entry));
+  saveEntries(lastIndex());
+  *index = lastIndex();
+  *term = current_term;
+  advanceCommit();
+  replicate_cv.notify_all();
+  return true;
+}
+
+bool RaftNode::WaitApplied(uint64_t index, uint64_t term,
+                           std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mtx);
+  applied_cv.wait_for(lock, timeout, [this, index]() {
+    return last_applied >= index || stopping;
+  });
+  return last_applied >= index && log[index].term() == term;
+}
+
+bool RaftNode::ReadBarrier(std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::unique_lock<std::mutex> lock(mtx);
+  uint64_t term = current_term;
+  auto deposed = [this, term]() {
+    return role != Role::LEADER || current_term != term || stopping;
+  };
+  if (deposed()) {
+    return false;
+  }
+  // a new leader only knows what's committed once an entry of its own term
+  // is (the no-op it appends on taking the lead)
+  if (!applied_cv.wait_until(lock, deadline, [&]() {
+        return deposed() || log[commit_index].term() == term;
+      }) ||
+      deposed()) {
+    return false;
+  }
+  uint64_t read_index = commit_index;
+  uint64_t round = ++read_round;
+  replicate_cv.notify_all();
+  if (!applied_cv.wait_until(lock, deadline, [&]() {
+        if (deposed()) {
+          return true;
+        }
+        size_t acks = 1;
+        for (size_t p = 0; p < peers.size(); p++) {
+          acks += p != self && followers[p].acked_round >= round;
+        }
+        return acks >= majority();
+      }) ||
+      deposed()) {
+    return false;
+  }
+  return applied_cv.wait_until(lock, deadline, [&]() {
+    return last_applied >= read_index || stopping;
+  }) && last_applied >= read_index;
+}
+
+std::string RaftNode::Leader() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return leader >= 0 ? peers[leader] : "";
+}
+
+::grpc::Status RaftNode::RequestVote(::grpc::ServerContext* context,
+                                     const RequestVoteRequest* request,
+                                     RequestVoteResponse* response) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (request->term() > current_term) {
+    stepDown(request->term());
+  }
+  response->set_term(current_term);
+  response->set_granted(false);
+  if (request->term() < current_term) {
+    return ::grpc::Status::OK;
+  }
+  // only vote for a candidate whose log holds everything ours does, so the
+  // winner has every committed entry
+  bool up_to_date =
+      request->last_log_term() > lastTerm() ||
+      (request->last_log_term() == lastTerm() &&
+       request->last_log_index() >= lastIndex());
+  if (up_to_date &&
+      (voted_for < 0 || voted_for == (int)request->candidate())) {
+    voted_for = request->candidate();
+    saveTerm();
+    resetElectionTimer();
+    response->set_granted(true);
+  }
+  return ::grpc::Status::OK;
+}
+
+::grpc::Status RaftNode::AppendEntries(::grpc::ServerContext* context,
+                                       const AppendEntriesRequest* request,
+                                       AppendEntriesResponse* response) {
+  std::lock_guard<std::mutex> lock(mtx);
+  response->set_success(false);
+  if (request->term() < current_term) {
+    response->set_term(current_term);
+    return ::grpc::Status::OK;
+  }
+  if (request->term() > current_term || role != Role::FOLLOWER) {
+    stepDown(request->term());
+  }
+  response->set_term(current_term);
+  leader = request->leader();
+  resetElectionTimer();
+
+  uint64_t prev = request->prev_log_index();
+  if (prev > lastIndex()) {
+    response->set_next_index(lastIndex() + 1);
+    return ::grpc::Status::OK;
+  }
+  if (log[prev].term() != request->prev_log_term()) {
+    // skip back over the whole conflicting term at once
+    uint64_t conflict = log[prev].term();
+    uint64_t first = prev;
+    while (first > 1 && log[first - 1].term() == conflict) {
+      first--;
+    }
+    response->set_next_index(first);
+    return ::grpc::Status::OK;
+  }
+
+  // entries we already have are skipped, so a late or repeated request
+  // doesn't cut off anything newer. a conflicting one, and everything after
+  // it, is replaced
+  int i = 0;
+  for (; i < request->entries_size(); i++) {
+    uint64_t index = prev + 1 + i;
+    if (index > lastIndex()) {
+      break;
+    }
+    if (log[index].term() != request->entries(i).term()) {
+      log.resize(index);
+      saveTruncate(index);
+      break;
+    }
+  }
+  uint64_t from = lastIndex() + 1;
+  for (; i < request->entries_size(); i++) {
+    log.push_back(request->entries(i));
+  }
+  if (lastIndex() >= from) {
+    saveEntries(from);
+  }
+
+  uint64_t match = prev + request->entries_size();
+  if (request->leader_commit() > commit_index) {
+    commit_index =
+        std::max(commit_index, std::min(request->leader_commit(), match));
+    commit_cv.notify_all();
+  }
+  response->set_success(true);
+  response->set_next_index(match);
+  return ::grpc::Status::OK;
+}
+
+::grpc::Status RaftNode::Status(::grpc::ServerContext* context,
+                                const Empty* request, RaftStatus* response) {
+  std::lock_guard<std::mutex> lock(mtx);
+  response->set_term(current_term);
+  response->set_leader(leader >= 0 ? peers[leader] : "");
+  response->set_is_leader(role == Role::LEADER);
+  response->set_commit_index(commit_index);
+  response->set_applied_index(last_applied);
+  return ::grpc::Status::OK;
+}
+
+void RaftNode::resetElectionTimer() {
+  std::uniform_int_distribution<int> timeout(RAFT_ELECTION_MIN.count(),
+                                             RAFT_ELECTION_MAX.count() - 1);
+  election_deadline = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(timeout(rng));
+}
+
+void RaftNode::stepDown(uint64_t term) {
+  if (term > current_term) {
+    current_term = term;
+    voted_for = -1;
+    leader = -1;
+    saveTerm();
+  }
+  if (role == Role::LEADER) {
+    leader = -1;
+    // a deposed leader's timer ran out long ago
+    resetElectionTimer();
+  }
+  role = Role::FOLLOWER;
+  replicate_cv.notify_all();
+  applied_cv.notify_all();
+}
+
+void RaftNode::runElection(std::unique_lock<std::mutex>& lock) {
+  current_term++;
+  voted_for = self;
+  role = Role::CANDIDATE;
+  leader = -1;
+  saveTerm();
+  resetElectionTimer();
+  if (majority() == 1) {
+    becomeLeader();
+    return;
+  }
+
+  RequestVoteRequest request;
+  request.set_term(current_term);
+  request.set_candidate(self);
+  request.set_last_log_index(lastIndex());
+  request.set_last_log_term(lastTerm());
+  uint64_t term = current_term;
+  size_t votes = 1;
+  lock.unlock();
+  // ask everyone at once, and lead as soon as a majority says yes rather
+  // than waiting on a replica that's down
+  std::vector<std::thread> askers;
+  for (size_t p = 0; p < peers.size(); p++) {
+    if (p == self) {
+      continue;
+    }
+    askers.emplace_back([this, p, term, &request, &votes]() {
+      ::grpc::ClientContext context;
+      context.set_deadline(std::chrono::system_clock::now() +
+                           RAFT_RPC_TIMEOUT);
+      RequestVoteResponse response;
+      ::grpc::Status status =
+          followers[p].stub->RequestVote(&context, request, &response);
+      std::lock_guard<std::mutex> lock(mtx);
+      if (!status.ok()) {
+        return;
+      }
+      if (response.term() > current_term) {
+        stepDown(response.term());
+      } else if (response.granted() && role == Role::CANDIDATE &&
+                 current_term == term && ++votes >= majority()) {
+        becomeLeader();
+      }
+    });
+  }
+  for (std::thread& asker : askers) {
+    asker.join();
+  }
+  lock.lock();
+}
+
+void RaftNode::becomeLeader() {
+  role = Role::LEADER;
+  leader = self;
+  auto now = std::chrono::steady_clock::now();
+  for (Follower& f : followers) {
+    f.next_index = lastIndex() + 1;
+    f.match_index = 0;
+    f.next_heartbeat = now;
+    f.retry_at = now;
+  }
+  // entries of earlier terms only commit along with one of ours
+  LogEntry noop;
+  noop.set_term(current_term);
+  log.push_back(std::move(noop));
+  saveEntries(lastIndex());
+  advanceCommit();
+  replicate_cv.notify_all();
+}
+
+void RaftNode::advanceCommit() {
+  // only an entry of the current term is committed by counting replicas
+  for (uint64_t n = lastIndex();
+       n > commit_index && log[n].term() == current_term; n--) {
+    size_t holders = 1;
+    for (size_t p = 0; p < peers.size(); p++) {
+      holders += p != self && followers[p].match_index >= n;
+    }
+    if (holders >= majority()) {
+      commit_index = n;
+      commit_cv.notify_all();
+      applied_cv.notify_all();
+      return;
+    }
+  }
+}
+
+void RaftNode::replicate(size_t peer) {
+  Follower& f = followers[peer];
+  std::unique_lock<std::mutex> lock(mtx);
+  while (!stopping) {
+    auto now = std::chrono::steady_clock::now();
+    if (role != Role::LEADER) {
+      replicate_cv.wait(lock);
+      continue;
+    }
+    if (now < f.retry_at) {
+      replicate_cv.wait_until(lock, f.retry_at);
+      continue;
+    }
+    bool due = now >= f.next_heartbeat || f.next_index <= lastIndex() ||
+               f.acked_round < read_round;
+    if (!due) {
+      replicate_cv.wait_until(lock, f.next_heartbeat);
+      continue;
+    }
+
+    AppendEntriesRequest request;
+    uint64_t term = current_term;
+    uint64_t round = read_round;
+    uint64_t prev = f.next_index - 1;
+    request.set_term(term);
+    request.set_leader(self);
+    request.set_prev_log_index(prev);
+    request.set_prev_log_term(log[prev].term());
+    uint64_t last = std::min(lastIndex(), prev + RAFT_MAX_BATCH);
+    for (uint64_t i = prev + 1; i <= last; i++) {
+      *request.add_entries() = log[i];
+    }
+    request.set_leader_commit(commit_index);
+    f.next_heartbeat = now + RAFT_HEARTBEAT;
+    lock.unlock();
+
+    ::grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + RAFT_RPC_TIMEOUT);
+    AppendEntriesResponse response;
+    ::grpc::Status status = f.stub->AppendEntries(&context, request, &response);
+    lock.lock();
+    if (!status.ok()) {
+      // down or slow: don't spin on it
+      f.retry_at = std::chrono::steady_clock::now() + RAFT_HEARTBEAT;
+      continue;
+    }
+    if (response.term() > current_term) {
+      stepDown(response.term());
+      continue;
+    }
+    if (role != Role::LEADER || current_term != term) {
+      continue;
+    }
+    // even a rejected AppendEntries means it still takes us for leader
+    f.acked_round = std::max(f.acked_round, round);
+    if (response.success()) {
+      f.match_index = std::max(f.match_index, response.next_index());
+      f.next_index = f.match_index + 1;
+      advanceCommit();
+    } else {
+      f.next_index = std::max<uint64_t>(1, std::min(response.next_index(), prev));
+    }
+    applied_cv.notify_all();
+  }
+}
+
+void RaftNode::applyLoop() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (true) {
+    commit_cv.wait(lock, [this]() {
+      return stopping || last_applied < commit_index;
+    });
+    if (stopping) {
+      return;
+    }
+    uint64_t first = last_applied + 1;
+    std::vector<LogEntry> batch(log.begin() + first,
+                                log.begin() + commit_index + 1);
+    lock.unlock();
+    for (size_t i = 0; i < batch.size(); i++) {
+      apply(first + i, batch[i]);
+    }
+    lock.lock();
+    last_applied = first + batch.size() - 1;
+    applied_cv.notify_all();
+  }
+}
+
+void RaftNode::tickLoop() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (!stopping) {
+    auto now = std::chrono::steady_clock::now();
+    if (role != Role::LEADER && now >= election_deadline) {
+      runElection(lock);
+      continue;
+    }
+    replicate_cv.wait_until(lock, role == Role::LEADER
+                                      ? now + RAFT_ELECTION_MIN
+                                      : election_deadline);
+  }
+}
+
+void RaftNode::saveTerm() {
+  if (fd < 0) {
+    return;
+  }
+  std::string body, record;
+  PutRaw<uint64_t>(&body, current_term);
+  PutRaw<int32_t>(&body, voted_for);
+  encode(&record, TERM, body);
+  writeOut(record);
+}
+
+void RaftNode::saveEntries(uint64_t from) {
+  if (fd < 0) {
+    return;
+  }
+  std::string records;
+  for (uint64_t i = from; i <= lastIndex(); i++) {
+    std::string body;
+    PutRaw<uint64_t>(&body, i);
+    log[i].AppendToString(&body);
+    encode(&records, ENTRY, body);
+  }
+  writeOut(records);
+}
+
+void RaftNode::saveTruncate(uint64_t from) {
+  if (fd < 0) {
+    return;
+  }
+  std::string body, record;
+  PutRaw<uint64_t>(&body, from);
+  encode(&record, TRUNCATE, body);
+  writeOut(record);
+}
+
+void RaftNode::writeOut(const std::string& data) {
+  // a vote or entry we can't keep must not be promised to anyone
+  if (write(fd, data.data(), data.size()) != (ssize_t)data.size() ||
+      fdatasync(fd) != 0) {
+    perror("raft state");
+    abort();
+  }
+}
+
+void RaftNode::load() {
+  std::string contents = ReadFile(fd);
+
+  std::lock_guard<std::mutex> lock(mtx);
+  size_t pos = 0;
+  size_t next = 0;
+  std::string_view payload;
+  while (NextRecord(contents, &next, &payload)) {
+    if (payload.empty()) {
+      break;
+    }
+    const char* body = payload.data() + 1;
+    size_t body_len = payload.size() - 1;
+    RecordType type = (RecordType)payload[0];
+    if (type == TERM && body_len == sizeof(uint64_t) + sizeof(int32_t)) {
+      current_term = GetRaw<uint64_t>(body);
+      voted_for = GetRaw<int32_t>(body + sizeof(uint64_t));
+    } else if (type == ENTRY && body_len >= sizeof(uint64_t)) {
+      uint64_t index = GetRaw<uint64_t>(body);
+      LogEntry entry;
+      if (index == 0 || index > log.size() ||
+          !entry.ParseFromArray(body + sizeof(uint64_t),
+                                body_len - sizeof(uint64_t))) {
+        break;
+      }
+      log.resize(index);
+      log.push_back(std::move(entry));
+    } else if (type == TRUNCATE && body_len == sizeof(uint64_t)) {
+      uint64_t index = GetRaw<uint64_t>(body);
+      if (index == 0 || index > log.size()) {
+        break;
+      }
+      log.resize(index);
+    } else {
+      break;
+    }
+    pos = next;
+  }
+  // cut off a torn record, so new ones follow the last complete one
+  if (pos < contents.size() && ftruncate(fd, pos) != 0) {
+    perror("raft state");
+    abort();
+  }
+}
@@ -0,0 +1,202 @@
+#ifndef SHARDING_RAFT_H
+#define SHARDING_RAFT_H
+
+#include <grpcpp/grpcpp.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../build/raft.grpc.pb.h"
+
+// how often a leader sends AppendEntries to a replica it has nothing new for
+constexpr std::chrono::milliseconds RAFT_HEARTBEAT(50);
+// a replica that hears from no leader for a random time in
+// [RAFT_ELECTION_MIN, RAFT_ELECTION_MAX) stands for election
+constexpr std::chrono::milliseconds RAFT_ELECTION_MIN(150);
+constexpr std::chrono::milliseconds RAFT_ELECTION_MAX(300);
+// how long a replica waits on another's answer to an RPC
+constexpr std::chrono::milliseconds RAFT_RPC_TIMEOUT(100);
+// the most entries sent in one AppendEntries
+constexpr size_t RAFT_MAX_BATCH = 256;
+
+// a channel to another replica, connecting right away. it tries to
+// reconnect every RAFT_HEARTBEAT once the connection is lost, instead of
+// backing off for seconds as gRPC does by default, so a replica that
+// restarts is back in the cluster as soon as it listens
+std::shared_ptr<::grpc::Channel> PeerChannel(const std::string& addr);
+
+// One replica of a log kept consistent over several processes with Raft
+// (Ongaro and Ousterhout, "In Search of an Understandable Consensus
+// Algorithm"). The replicas are the addresses in peers, this one being
+// peers[self]; each serves the Raft service on its address.
+//
+// The leader appends what it's given (Propose) and sends it on to the others;
+// once a majority holds an entry it is committed, and every replica calls
+// apply on its committed entries one at a time, in log order, from its own
+// thread. A leader that dies is replaced by whichever replica wins an
+// election, which can only be one holding every committed entry.
+//
+// Term, vote and log are appended to the file at state_path (if there is
+// one), and fsynced before the replica answers for them, so a replica that
+// restarts rejoins with everything it promised. Records are checksummed (see
+// common/records.h), and a torn one at the end is dropped. The log is never
+// compacted: a restarted replica replays it from the start.
+//
+// usage:
+//   RaftNode node(peers, self, path, [](uint64_t index, const LogEntry& e) {
+//     ...
+//   });
+//   if (!node.Start()) ...
+//   builder.RegisterService(&node);
+//   uint64_t index, term;
+//   if (node.Propose(entry, &index, &term) &&
+//       node.WaitApplied(index, term, timeout)) ...
+class RaftNode final : public Raft::Service {
+  using Empty = google::protobuf::Empty;
+
+ public:
+  using Apply = std::function<void(uint64_t index, const LogEntry& entry)>;
+
+  RaftNode(std::vector<std::string> peers, size_t self, std::string state_path,
+           Apply apply);
+
+  // stops the threads and closes the state file
+  ~RaftNode();
+
+  // reads back the state file (creating it if it doesn't exist) and starts
+  // the election timer, replication and the applier. returns false (with
+  // errno set) if the file can't be opened
+  bool Start();
+
+  // appends entry to the log if this replica is the leader, setting *index
+  // and *term to where it went. returns false if it isn't
+  bool Propose(LogEntry entry, uint64_t* index, uint64_t* term);
+
+  // blocks until the entry at index is applied, or timeout passes. returns
+  // true if it was applied and is still the entry proposed in term, false if
+  // another leader's entry replaced it or it timed out
+  bool WaitApplied(uint64_t index, uint64_t term,
+                   std::chrono::milliseconds timeout);
+
+  // blocks until this replica has applied every entry committed before the
+  // call, and a majority has answered a round of heartbeats sent after it,
+  // so it was still the leader then: state read next is at least as new as
+  // any change acknowledged before the call (Raft's ReadIndex). returns false
+  // if this replica isn't the leader, or timeout passes first
+  bool ReadBarrier(std::chrono::milliseconds timeout);
+
+  // the address of the leader this replica last heard from (its own if it
+  // leads), or "" if it doesn't know of one
+  std::string Leader();
+
+  ::grpc::Status RequestVote(::grpc::ServerContext* context,
+                             const RequestVoteRequest* request,
+                             RequestVoteResponse* response) override;
+  ::grpc::Status AppendEntries(::grpc::ServerContext* context,
+                               const AppendEntriesRequest* request,
+                               AppendEntriesResponse* response) override;
+  ::grpc::Status Status(::grpc::ServerContext* context, const Empty* request,
+                        RaftStatus* response) override;
+
+ private:
+  enum class Role { FOLLOWER, CANDIDATE, LEADER };
+
+  // what a leader knows about one of the other replicas
+  struct Follower {
+    std::unique_ptr<Raft::Stub> stub;
+    // the next entry to send it, and the last one known to match ours
+    uint64_t next_index = 1;
+    uint64_t match_index = 0;
+    // when to send the next heartbeat, and not to retry before, after a
+    // failed RPC
+    std::chrono::steady_clock::time_point next_heartbeat;
+    std::chrono::steady_clock::time_point retry_at;
+    // the last read round (see ReadBarrier) it answered
+    uint64_t acked_round = 0;
+    std::thread thread;
+  };
+
+  uint64_t lastIndex() const { return log.size() - 1; }
+  uint64_t lastTerm() const { return log.back().term(); }
+  size_t majority() const { return peers.size() / 2 + 1; }
+
+  // picks a new random election deadline
+  void resetElectionTimer();
+
+  // moves to term (if it's newer) as a follower. caller must hold mtx
+  void stepDown(uint64_t term);
+
+  // votes for itself and asks the others to, taking the lead if a majority
+  // agrees. caller must hold lock; it is released while votes are gathered
+  void runElection(std::unique_lock<std::mutex>& lock);
+
+  // takes the lead in the current term. caller must hold mtx
+  void becomeLeader();
+
+  // commits the newest entry of the current term a majority holds, if any
+  // newer than commit_index. caller must hold mtx
+  void advanceCommit();
+
+  // runs in a thread per other replica while this one leads: sends it new
+  // entries, heartbeats and read rounds
+  void replicate(size_t peer);
+
+  // runs in its own thread: calls apply on newly committed entries
+  void applyLoop();
+
+  // runs in its own thread: starts an election when the timer runs out
+  void tickLoop();
+
+  // state file records, written and fsynced before returning. caller must
+  // hold mtx
+  void saveTerm();
+  void saveEntries(uint64_t from);
+  void saveTruncate(uint64_t from);
+  void writeOut(const std::string& data);
+
+  // rebuilds term, vote and log from the state file
+  void load();
+
+  const std::vector<std::string> peers;
+  const size_t self;
+  const std::string state_path;
+  const Apply apply;
+  int fd = -1;
+
+  std::mutex mtx;
+  // signalled when the role, term, log or read round changes (replication),
+  // when entries are committed (applyLoop) and when they're applied
+  std::condition_variable replicate_cv;
+  std::condition_variable commit_cv;
+  std::condition_variable applied_cv;
+
+  uint64_t current_term = 0;
+  // who this replica voted for in current_term, or -1
+  int voted_for = -1;
+  // log[0] is a placeholder of term 0, so entry i is log[i]
+  std::vector<LogEntry> log = std::vector<LogEntry>(1);
+  uint64_t commit_index = 0;
+  uint64_t last_applied = 0;
+
+  Role role = Role::FOLLOWER;
+  // the replica this one last heard from as leader, or -1
+  int leader = -1;
+  std::chrono::steady_clock::time_point election_deadline;
+  std::mt19937 rng;
+
+  // read rounds asked for so far (see ReadBarrier)
+  uint64_t read_round = 0;
+  std::vector<Follower> followers;
+
+  bool stopping = false;
+  std::thread ticker;
+  std::thread applier;
+};
+
+#endif  // SHARDING_RAFT_H
@@ -0,0 +1,292 @@
+#include "replicated_shardmaster.h"
+
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+// set on a call one replica forwards to another, which must not forward it
+// again
+static const char* FORWARDED = "x-shardmaster-forwarded";
+// the client and request IDs a forwarded call is proposed under, as
+// "<client>:<request>"
+static const char* REQUEST_ID = "x-shardmaster-request";
+// how many applied entries' statuses are kept for their callers
+constexpr uint64_t KEPT_RESULTS = 1024;
+
+// a random, nonzero ID for this replica's proposals, so a restarted replica
+// doesn't reuse its old one
+static uint64_t newClientId() {
+  std::random_device random;
+  uint64_t id = 0;
+  while (id == 0) {
+    id = (uint64_t(random()) << 32) | random();
+  }
+  return id;
+}
+
+ReplicatedShardmaster::ReplicatedShardmaster(std::vector<std::string> replicas,
+                                             size_t self,
+                                             std::string state_path,
+                                             Placement placement,
+                                             unsigned int vnodes)
+    : addr(replicas[self]),
+      state(placement, vnodes),
+      client_id(newClientId()),
+      raft(replicas, self, std::move(state_path),
+           [this](uint64_t index, const LogEntry& entry) {
+             this->apply(index, entry);
+           }) {
+  // connect to every replica now, rather than when it's first the leader
+  for (const std::string& replica : replicas) {
+    if (replica != addr) {
+      stub(replica);
+    }
+  }
+}
+
+::grpc::Status ReplicatedShardmaster::Join(::grpc::ServerContext* context,
+                                           const JoinRequest* request,
+                                           Empty* response) {
+  LogEntry entry;
+  *entry.mutable_join() = *request;
+  tag(context, &entry);
+  return route(context, replicate(entry),
+               [&](Shardmaster::Stub* stub, ::grpc::ClientContext* forwarded) {
+                 return stub->Join(forwarded, *request, response);
+               },
+               &entry);
+}
+
+::grpc::Status ReplicatedShardmaster::Leave(::grpc::ServerContext* context,
+                                            const LeaveRequest* request,
+                                            Empty* response) {
+  LogEntry entry;
+  *entry.mutable_leave() = *request;
+  tag(context, &entry);
+  return route(context, replicate(entry),
+               [&](Shardmaster::Stub* stub, ::grpc::ClientContext* forwarded) {
+                 return stub->Leave(forwarded, *request, response);
+               },
+               &entry);
+}
+
+::grpc::Status ReplicatedShardmaster::Move(::grpc::ServerContext* context,
+                                           const MoveRequest* request,
+                                           Empty* response) {
+  LogEntry entry;
+  *entry.mutable_move() = *request;
+  tag(context, &entry);
+  return route(context, replicate(entry),
+               [&](Shardmaster::Stub* stub, ::grpc::ClientContext* forwarded) {
+                 return stub->Move(forwarded, *request, response);
+               },
+               &entry);
+}
+
+::grpc::Status ReplicatedShardmaster::Query(::grpc::ServerContext* context,
+                                            const Empty* request,
+                                            QueryResponse* response) {
+  return route(
+      context,
+      [&](std::chrono::milliseconds timeout, ::grpc::Status* status) {
+        if (!raft.ReadBarrier(timeout)) {
+          return false;
+        }
+        *status = state.Query(context, request, response);
+        return true;
+      },
+      [&](Shardmaster::Stub* stub, ::grpc::ClientContext* forwarded) {
+        return stub->Query(forwarded, *request, response);
+      });
+}
+
+::grpc::Status ReplicatedShardmaster::QueryIfNewer(
+    ::grpc::ServerContext* context, const QueryIfNewerRequest* request,
+    QueryResponse* response) {
+  return route(
+      context,
+      [&](std::chrono::milliseconds timeout, ::grpc::Status* status) {
+        if (!raft.ReadBarrier(timeout)) {
+          return false;
+        }
+        *status = state.QueryIfNewer(context, request, response);
+        return true;
+      },
+      [&](Shardmaster::Stub* stub, ::grpc::ClientContext* forwarded) {
+        return stub->QueryIfNewer(forwarded, *request, response);
+      });
+}
+
+::grpc::Status ReplicatedShardmaster::Watch(
+    ::grpc::ServerContext* context, const QueryIfNewerRequest* request,
+    ::grpc::ServerWriter<QueryResponse>* writer) {
+  return state.Watch(context, request, writer);
+}
+
+::grpc::Status ReplicatedShardmaster::GDPRDelete(
+    ::grpc::ServerContext* context, const GDPRDeleteRequest* request,
+    Empty* response) {
+  // the entry only orders the delete among the config changes; the leader
+  // sends it to the ID's owner once it's applied. a retry of a delete that
+  // was applied before isn't sent again
+  LogEntry entry;
+  *entry.mutable_gdpr_delete() = *request;
+  tag(context, &entry);
+  bool repeat = false;
+  Local logged = replicate(entry, &repeat);
+  return route(
+      context,
+      [&](std::chrono::milliseconds timeout, ::grpc::Status* status) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        if (!logged(timeout, status)) {
+          return false;
+        }
+        if (status->ok() && !repeat) {
+          *status = state.DeleteFromOwner(request, deadline);
+        }
+        return true;
+      },
+      [&](Shardmaster::Stub* stub, ::grpc::ClientContext* forwarded) {
+        return stub->GDPRDelete(forwarded, *request, response);
+      },
+      &entry);
+}
+
+::grpc::Status ReplicatedShardmaster::route(::grpc::ServerContext* context,
+                                            const Local& local,
+                                            const Forward& forward,
+                                            const LogEntry* entry) {
+  bool forwarded =
+      context && context->client_metadata().count(FORWARDED) > 0;
+  auto deadline = std::chrono::steady_clock::now() + REPLICATED_TIMEOUT;
+  while (true) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) {
+      break;
+    }
+    ::grpc::Status status;
+    if (local(left, &status)) {
+      return status;
+    }
+    std::string leader = raft.Leader();
+    if (forwarded && leader != addr) {
+      // let the replica that forwarded it find the new leader
+      break;
+    }
+    if (leader != "" && leader != addr) {
+      ::grpc::ClientContext client;
+      client.AddMetadata(FORWARDED, "1");
+      if (entry) {
+        client.AddMetadata(REQUEST_ID,
+                           std::to_string(entry->client_id()) + ":" +
+                               std::to_string(entry->request_id()));
+      }
+      client.set_deadline(std::chrono::system_clock::now() + left);
+      status = forward(stub(leader), &client);
+      if (status.error_code() != ::grpc::StatusCode::UNAVAILABLE) {
+        return status;
+      }
+    }
+    // no leader yet, or it just went away
+    std::this_thread::sleep_for(RAFT_HEARTBEAT / 2);
+  }
+  return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE,
+                        "ERR: no shardmaster leader");
+}
+
+void ReplicatedShardmaster::tag(::grpc::ServerContext* context,
+                                LogEntry* entry) {
+  if (context) {
+    auto it = context->client_metadata().find(REQUEST_ID);
+    if (it != context->client_metadata().end()) {
+      std::string id(it->second.data(), it->second.size());
+      size_t colon = id.find(':');
+      uint64_t client = strtoull(id.c_str(), nullptr, 10);
+      if (colon != std::string::npos && client != 0) {
+        entry->set_client_id(client);
+        entry->set_request_id(strtoull(id.c_str() + colon + 1, nullptr, 10));
+        return;
+      }
+    }
+  }
+  entry->set_client_id(client_id);
+  entry->set_request_id(next_request++);
+}
+
+ReplicatedShardmaster::Local ReplicatedShardmaster::replicate(
+    const LogEntry& entry, bool* repeat) {
+  return [this, entry, repeat](std::chrono::milliseconds timeout,
+                               ::grpc::Status* status) {
+    uint64_t index, term;
+    // if another leader's entry replaced ours, it was never applied. if it
+    // was committed after all (say the leader went away before answering),
+    // apply skips this second copy, as it has the same IDs
+    if (!raft.Propose(entry, &index, &term) ||
+        !raft.WaitApplied(index, term, timeout)) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(results_mtx);
+    auto it = results.find(index);
+    if (it != results.end()) {
+      *status = it->second.first;
+      if (repeat) {
+        *repeat = it->second.second;
+      }
+      results.erase(it);
+    }
+    return true;
+  };
+}
+
+void ReplicatedShardmaster::apply(uint64_t index, const LogEntry& entry) {
+  std::pair<uint64_t, uint64_t> id(entry.client_id(), entry.request_id());
+  {
+    std::lock_guard<std::mutex> lock(results_mtx);
+    auto it = applied.find(id);
+    if (it != applied.end()) {
+      // a retry of a command that's already applied
+      results[index] = {it->second.second, true};
+      return;
+    }
+  }
+  Empty empty;
+  ::grpc::Status status;
+  switch (entry.command_case()) {
+    case LogEntry::kJoin:
+      status = state.Join(nullptr, &entry.join(), &empty);
+      break;
+    case LogEntry::kLeave:
+      status = state.Leave(nullptr, &entry.leave(), &empty);
+      break;
+    case LogEntry::kMove:
+      status = state.Move(nullptr, &entry.move(), &empty);
+      break;
+    default:
+      // a leader's no-op, or a GDPRDelete (the leader does the deleting)
+      break;
+  }
+  uint64_t oldest = index > KEPT_RESULTS ? index - KEPT_RESULTS : 0;
+  std::lock_guard<std::mutex> lock(results_mtx);
+  results[index] = {status, false};
+  results.erase(results.begin(), results.lower_bound(oldest));
+  if (id.first != 0) {
+    applied[id] = {index, status};
+  }
+  for (auto it = applied.begin(); it != applied.end();) {
+    if (it->second.first < oldest) {
+      it = applied.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+Shardmaster::Stub* ReplicatedShardmaster::stub(const std::string& leader) {
+  std::lock_guard<std::mutex> lock(stubs_mtx);
+  std::unique_ptr<Shardmaster::Stub>& stub = stubs[leader];
+  if (!stub) {
+    stub = Shardmaster::NewStub(PeerChannel(leader));
+  }
+  return stub.get();
+}
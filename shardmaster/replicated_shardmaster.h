@@ -0,0 +1,129 @@
+#ifndef SHARDING_REPLICATED_SHARDMASTER_H
+#define SHARDING_REPLICATED_SHARDMASTER_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include "raft.h"
+#include "shardmaster.h"
+
+// how long a replica keeps trying to reach a leader before it fails a call
+// with UNAVAILABLE
+constexpr std::chrono::milliseconds REPLICATED_TIMEOUT(5000);
+
+// A shardmaster run on several processes, so it survives losing a minority
+// of them. Join, Leave, Move and GDPRDelete are appended to a Raft log
+// (RaftNode) and applied in log order to a StaticShardmaster on every
+// replica, so whichever replica is elected next already holds the config.
+// A call is answered once its entry is applied on the leader, with the
+// status the StaticShardmaster gave it.
+//
+// Any replica takes every call: one that isn't the leader forwards it there
+// (only once, so a call can't bounce between two replicas that each think
+// the other leads) and retries while an election is going on. Query and
+// QueryIfNewer are linearizable: the leader answers them only after a round
+// of heartbeats shows it still leads (RaftNode::ReadBarrier), so they see
+// every change acknowledged before they started. Watch streams the config of
+// the replica it's called on, which may be a heartbeat behind the leader's.
+//
+// usage:
+//   ReplicatedShardmaster shardmaster(replicas, self, state_path);
+//   if (!shardmaster.Start()) ...
+//   builder.RegisterService(&shardmaster);
+//   builder.RegisterService(shardmaster.Node());
+class ReplicatedShardmaster : public Shardmaster::Service {
+  using Empty = google::protobuf::Empty;
+
+ public:
+  // replicas are every replica's address, this one being replicas[self].
+  // state_path is where its Raft state is kept ("" to keep it in memory)
+  ReplicatedShardmaster(std::vector<std::string> replicas, size_t self,
+                        std::string state_path,
+                        Placement placement = Placement::PARTITION,
+                        unsigned int vnodes = RING_VNODES);
+
+  // see RaftNode::Start
+  bool Start() { return raft.Start(); }
+
+  // the Raft service, to register alongside this one
+  RaftNode* Node() { return &raft; }
+
+  ::grpc::Status Join(::grpc::ServerContext* context,
+                      const JoinRequest* request, Empty* response) override;
+  ::grpc::Status Leave(::grpc::ServerContext* context,
+                       const LeaveRequest* request, Empty* response) override;
+  ::grpc::Status Move(::grpc::ServerContext* context,
+                      const MoveRequest* request, Empty* response) override;
+  ::grpc::Status Query(::grpc::ServerContext* context, const Empty* request,
+                       QueryResponse* response) override;
+  ::grpc::Status QueryIfNewer(::grpc::ServerContext* context,
+                              const QueryIfNewerRequest* request,
+                              QueryResponse* response) override;
+  ::grpc::Status Watch(::grpc::ServerContext* context,
+                       const QueryIfNewerRequest* request,
+                       ::grpc::ServerWriter<QueryResponse>* writer) override;
+  ::grpc::Status GDPRDelete(::grpc::ServerContext* context,
+                            const GDPRDeleteRequest* request,
+                            Empty* response) override;
+
+ private:
+  // serves a call here, if it can, within the time it's given, setting
+  // *status. returns false if this replica can't (it isn't the leader)
+  using Local =
+      std::function<bool(std::chrono::milliseconds, ::grpc::Status*)>;
+  // makes the call on the leader's stub
+  using Forward = std::function<::grpc::Status(Shardmaster::Stub*,
+                                               ::grpc::ClientContext*)>;
+
+  // tries local, then forward to the leader, until one of them answers or
+  // REPLICATED_TIMEOUT passes. entry, if given, is what local proposes: its
+  // IDs go along with the call, so the leader proposes it under the same ones
+  ::grpc::Status route(::grpc::ServerContext* context, const Local& local,
+                       const Forward& forward,
+                       const LogEntry* entry = nullptr);
+
+  // sets entry's client and request IDs: the ones the replica that forwarded
+  // the call sent with it, or new ones
+  void tag(::grpc::ServerContext* context, LogEntry* entry);
+
+  // a Local that appends entry to the log and waits for it to be applied,
+  // setting the status the state machine gave it. sets *repeat, if given, to
+  // whether apply skipped it as a retry of a command applied before
+  Local replicate(const LogEntry& entry, bool* repeat = nullptr);
+
+  // called by the RaftNode on every committed entry, in order
+  void apply(uint64_t index, const LogEntry& entry);
+
+  Shardmaster::Stub* stub(const std::string& addr);
+
+  const std::string addr;
+  // the state machine
+  StaticShardmaster state;
+
+  // proposes calls given to this replica under this ID, numbering them from
+  // next_request
+  const uint64_t client_id;
+  std::atomic<uint64_t> next_request{1};
+
+  // the status each entry got when applied, and whether it was a repeat, by
+  // index, until its caller takes it. only the latest few are kept, for
+  // entries nobody waits on
+  std::mutex results_mtx;
+  std::map<uint64_t, std::pair<::grpc::Status, bool>> results;
+  // the status of each of the latest few commands applied, by client and
+  // request ID, and the index each was applied at, so a retried proposal
+  // gets its first status rather than being applied again. a command's
+  // retry is proposed well within KEPT_RESULTS entries of it. the same on
+  // every replica, since they apply the same log
+  std::map<std::pair<uint64_t, uint64_t>, std::pair<uint64_t, ::grpc::Status>>
+      applied;
+
+  // to forward calls to whichever replica leads
+  std::mutex stubs_mtx;
+  std::map<std::string, std::unique_ptr<Shardmaster::Stub>> stubs;
+
+  // last, so its threads stop before the rest goes away
+  RaftNode raft;
+};
+
+#endif  // SHARDING_REPLICATED_SHARDMASTER_H
@@ -1,6 +1,10 @@
 #include "shardmaster.h"
 // #include "../shardkv/shardkv.h"
 
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
 
 /**
  * Based on the server specified in JoinRequest, you should update the
@@ -28,36 +32,14 @@ StaticShardmaster::Join(::grpc::ServerContext *context,
                           "ERR: JOIN request null server");
   }
   std::lock_guard<std::mutex> lock(shard_mtx);
-  std::map<std::string, std::vector<shard>>::iterator it;
-  it = server_shard_map.find(server);
-  if (it != server_shard_map.end()) { // if server already exists in config
+  if (std::find(server_order.begin(), server_order.end(), server) !=
+      server_order.end()) { // if server already exists in config
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: JOIN request server already in cluster");
   }
-  int partition_num = server_shard_map.size() + 1;
-  if (partition_num == 1) { // if the first server to join
-    shard s = shard_t();
-    s.lower = MIN_KEY;
-    s.upper = MAX_KEY;
-    server_order.push_back(server);
-    std::vector<shard> sh;
-    sh.push_back(s);
-    server_shard_map.insert(
-        std::pair<std::string, std::vector<shard>>(server, sh));
-  } else {
-    std::vector<shard> shards = partition(partition_num, MIN_KEY, MAX_KEY);
-    for (int i = 0; i < server_order.size(); i++) {
-      it = server_shard_map.find(server_order.at(i));
-      std::vector<shard> sh;
-      sh.push_back(shards.at(i));
-      it->second = sh; // reassign interval according to order
-    }
-    server_order.push_back(server);
-    std::vector<shard> sh;
-    sh.push_back(shards.back());
-    server_shard_map.insert(
-        std::pair<std::string, std::vector<shard>>(server, sh));
-  }
+  server_order.push_back(server);
+  place();
+  bumpConfig();
   return ::grpc::Status::OK;
 }
 
@@ -88,35 +70,22 @@ StaticShardmaster::Join(::grpc::ServerContext *context,
   }
   LeaveRequest req = *request;
   std::lock_guard<std::mutex> lock(shard_mtx);
-  std::map<std::string, std::vector<shard>>::iterator it;
+  // check every server before removing any, so a failed leave leaves the
+  // config untouched
   for (int i = 0; i < size; i++) {
-    std::string *server = req.mutable_servers(i);
-    it = server_shard_map.find(*server);
-    if (it == server_shard_map.end()) { // if server not in config
+    if (std::find(server_order.begin(), server_order.end(), req.servers(i)) ==
+        server_order.end()) { // if server not in config
       return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                             "ERR: LEAVE request server not found in config");
     }
-    for (int i = 0; i < server_order.size(); i++) {
-      if (server_order.at(i) ==
-          *server) { // if exist, delete from map & vector,
-                     // repartition & assign intervals
-        server_shard_map.erase(*server);
-        server_order.erase(server_order.begin() + i);
-        break;
-      }
-    }
-  }
-  if (server_order.empty()) {
-    return ::grpc::Status::OK;
   }
-  std::vector<shard> new_shards =
-      partition(server_order.size(), MIN_KEY, MAX_KEY);
-  for (int i = 0; i < server_order.size(); i++) {
-    it = server_shard_map.find(server_order.at(i));
-    std::vector<shard> sh;
-    sh.push_back(new_shards.at(i));
-    it->second = sh; // reassign interval according to order
+  for (int i = 0; i < size; i++) {
+    // delete from the join order, then reassign intervals
+    server_order.erase(
+        std::find(server_order.begin(), server_order.end(), req.servers(i)));
   }
+  place();
+  bumpConfig();
   return ::grpc::Status::OK;
 }
 
@@ -138,8 +107,6 @@ StaticShardmaster::Join(::grpc::ServerContext *context,
 ::grpc::Status StaticShardmaster::Move(::grpc::ServerContext *context,
                                        const ::MoveRequest *request,
                                        Empty *response) {
-  // Hint: Take a look at get_overlap in common.{h, cc}
-  // Using the function will save you lots of time and effort!
   std::string server = request->server();
   Shard m_shard = request->shard();
   shard move_shard = shard_t();
@@ -149,72 +116,23 @@ StaticShardmaster::Join(::grpc::ServerContext *context,
   if (server == "") {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: MOVE request null server");
-  } // error handling for empty shard >>>...<<<
+  }
+  if (move_shard.lower > move_shard.upper || move_shard.upper > MAX_KEY) {
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                          "ERR: MOVE request invalid shard");
+  }
 
   std::lock_guard<std::mutex> lock(shard_mtx);
-  std::map<std::string, std::vector<shard>>::iterator it;
-
-  it = server_shard_map.find(server);
-  if (it == server_shard_map.end()) {
+  if (std::find(server_order.begin(), server_order.end(), server) ==
+      server_order.end()) {
     // if server doesn't exist
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: MOVE request server not found");
   }
-
-  for (int i = 0; i < server_order.size(); i++) {
-    it = server_shard_map.find(server_order.at(i));
-    std::vector<shard> shards = it->second;
-
-    std::vector<shard> new_intervals;
-
-    for (auto &sd : shards) {
-      OverlapStatus status = get_overlap(move_shard, sd);
-      switch (status) {
-      case OverlapStatus::NO_OVERLAP: {
-        new_intervals.push_back(sd);
-      } break;
-      case OverlapStatus::OVERLAP_START: {
-        shard new_shard = shard_t();
-        new_shard.lower = sd.lower;
-        new_shard.upper = move_shard.lower - 1;
-        new_intervals.push_back(new_shard);
-      } break;
-      case OverlapStatus::OVERLAP_END: {
-        shard new_shard = shard_t();
-        new_shard.lower = move_shard.upper + 1;
-        new_shard.upper = sd.upper;
-        new_intervals.push_back(new_shard);
-      } break;
-      case OverlapStatus::COMPLETELY_CONTAINS:
-        break;
-      case OverlapStatus::COMPLETELY_CONTAINED: {
-        unsigned int upper = sd.upper;
-
-        if (sd.lower != move_shard.lower) {
-          shard lower_half = shard_t();
-          lower_half.lower = sd.lower;
-          lower_half.upper = move_shard.lower - 1;
-          new_intervals.push_back(lower_half);
-        }
-        if (move_shard.upper < sd.upper) {
-          shard upper_half = shard_t();
-          upper_half.lower = move_shard.upper + 1;
-          upper_half.upper = upper;
-          new_intervals.push_back(upper_half);
-        }
-      } break;
-      }
-    }
-
-    it->second = new_intervals;
-  }
-
-  // move shard into designated server
-  it = server_shard_map.find(server);
-  it->second.push_back(move_shard);
-
-  // TODO: consider merging interval if interval range == shards.end().upper -
-  // shards.begin().lower ...
+  // takes the shard off whoever had it, and merges it with the server's
+  // ranges on either side
+  shards.Assign(move_shard, server);
+  bumpConfig();
   return ::grpc::Status::OK;
 }
 
@@ -232,38 +150,61 @@ StaticShardmaster::Join(::grpc::ServerContext *context,
 ::grpc::Status StaticShardmaster::GDPRDelete(::grpc::ServerContext *context,
                                              const ::GDPRDeleteRequest *request,
                                              Empty *response) {
+  return DeleteFromOwner(request, std::chrono::steady_clock::time_point::max());
+}
+
+::grpc::Status StaticShardmaster::DeleteFromOwner(
+    const ::GDPRDeleteRequest *request,
+    std::chrono::steady_clock::time_point deadline) {
   // will check the key to delete, find the server responsible for it & issue
   // RPC delete call on that server
   std::string to_delete = request->key();
-  if (to_delete == "all_users") {
+  ParsedKey parsed = ParseKey(to_delete);
+  if (parsed.type == KeyType::ALL_USERS) {
     return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
                           "ERR: DELETE request illegal for all_users");
   }
+  if (!parsed.HasID()) {
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT,
+                          "ERR: DELETE request key invalid");
+  }
   // the test doesn't cover deleting user_id_posts case, so we'll just not handle it here for now
-  int id = extractID(to_delete);
-  std::lock_guard<std::mutex> lock(shard_mtx);
-  std::map<std::string, std::vector<shard>>::iterator it;
+  int id = parsed.id;
+  std::string owner;
+  {
+    std::lock_guard<std::mutex> lock(shard_mtx);
+    owner = shards.Owner(id);
+  }
+  if (owner != "") {
+    // issue delete RPC on the server responsible for the id, providing the
+    // key to delete
+    auto channel =
+        grpc::CreateChannel(owner, grpc::InsecureChannelCredentials());
+    auto stub = Shardkv::NewStub(channel);
 
-  for (auto &kv : server_shard_map) {
-    if (CheckInShard(id, kv.second)) {
-      // if id in a specific server, issue delete RPC on that server providing
-      // the key to delete
-      auto channel =
-          grpc::CreateChannel(kv.first, grpc::InsecureChannelCredentials());
-      auto stub = Shardkv::NewStub(channel);
+    DeleteRequest req;
+    Empty res;
+    req.set_key(to_delete);
 
+    while (true) {
       ::grpc::ClientContext cc;
-      DeleteRequest req;
-      Empty res;
-      req.set_key(to_delete);
-
+      if (deadline != std::chrono::steady_clock::time_point::max()) {
+        cc.set_deadline(std::chrono::system_clock::now() +
+                        (deadline - std::chrono::steady_clock::now()));
+      }
       auto status = stub->Delete(&cc, req, &res);
-      while (!status.ok()) { // sleep & retry till success
-        std::chrono::milliseconds timespan(50);
-        std::this_thread::sleep_for(timespan);
-        ::grpc::ClientContext new_cc;
-        status = stub->Delete(&new_cc, req, &res);
+      // the key may be gone already, e.g. deleted by an earlier try
+      if (status.ok() ||
+          status.error_code() == ::grpc::StatusCode::NOT_FOUND) {
+        break;
       }
+      // sleep & retry till success
+      std::chrono::milliseconds timespan(50);
+      if (std::chrono::steady_clock::now() + timespan >= deadline) {
+        return ::grpc::Status(::grpc::StatusCode::DEADLINE_EXCEEDED,
+                              "ERR: DELETE not done by its owner in time");
+      }
+      std::this_thread::sleep_for(timespan);
     }
   }
 
@@ -287,23 +228,116 @@ StaticShardmaster::Join(::grpc::ServerContext *context,
 ::grpc::Status StaticShardmaster::Query(::grpc::ServerContext *context,
                                         const StaticShardmaster::Empty *request,
                                         ::QueryResponse *response) {
-  std::lock_guard<std::mutex> lock(shard_mtx);
-  std::map<std::string, std::vector<shard>>::iterator it;
-  if (server_order.empty()) {
-    return ::grpc::Status::OK; // ?? for empty state, not set response/set as
-                               // empty (how)
+  // the config built by the last change, without waiting on shard_mtx
+  response->CopyFrom(*std::atomic_load(&current));
+  return ::grpc::Status::OK;
+}
+
+/**
+ * Like Query, but only sends the config if it differs from the one the caller
+ * already has (request->config_num()). Otherwise the response carries just
+ * the current config_num, so an up-to-date poller costs one tiny RPC. A
+ * caller whose number is ahead of ours (the shardmaster restarted) gets the
+ * full config too.
+ *
+ * @param context - you can ignore this
+ * @param request A message containing the caller's config_num
+ * @param response A message that specifies which shards are on which servers
+ * (empty if the caller is up to date) and the config_num it describes
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status
+StaticShardmaster::QueryIfNewer(::grpc::ServerContext *context,
+                                const ::QueryIfNewerRequest *request,
+                                ::QueryResponse *response) {
+  std::shared_ptr<const QueryResponse> config = std::atomic_load(&current);
+  if (request->config_num() == config->config_num()) {
+    response->set_config_num(config->config_num());
+    return ::grpc::Status::OK;
+  }
+  response->CopyFrom(*config);
+  return ::grpc::Status::OK;
+}
+
+/**
+ * Streams the config to the caller every time it changes, so subscribers learn
+ * about a Join, Leave or Move as soon as it happens instead of on their next
+ * poll. The current config is sent first unless the caller already has it
+ * (request->config_num()). If several changes happen while a message is being
+ * written, only the latest config is sent. The stream ends when the caller
+ * cancels it or goes away.
+ *
+ * @param context used to notice when the caller cancels the stream
+ * @param request A message containing the caller's config_num
+ * @param writer stream of messages that specify which shards are on which
+ * servers, each with the config_num it describes
+ * @return ::grpc::Status::OK once the caller is gone
+ */
+::grpc::Status
+StaticShardmaster::Watch(::grpc::ServerContext *context,
+                         const ::QueryIfNewerRequest *request,
+                         ::grpc::ServerWriter<::QueryResponse> *writer) {
+  uint64_t known = request->config_num();
+  std::unique_lock<std::mutex> lock(shard_mtx);
+  while (!context->IsCancelled()) {
+    if (config_num.load() == known) {
+      // wake up now and then to notice a caller that went away
+      config_cv.wait_for(lock, std::chrono::milliseconds(500));
+      continue;
+    }
+    // don't hold up Join/Leave/Move while we write to a slow caller
+    lock.unlock();
+    std::shared_ptr<const QueryResponse> config = std::atomic_load(&current);
+    known = config->config_num();
+    if (!writer->Write(*config)) {
+      return ::grpc::Status::OK;
+    }
+    lock.lock();
   }
-  for (int i = 0; i < server_order.size(); i++) {
-    std::string server = server_order.at(i);
+  return ::grpc::Status::OK;
+}
+
+void StaticShardmaster::fillConfig(::QueryResponse *response) {
+  response->set_config_num(config_num.load());
+  // an entry for every server, in join order, even if it has no shards
+  std::unordered_map<std::string, ConfigEntry *> entries;
+  for (const std::string &server : server_order) {
     ConfigEntry *entry = response->add_config();
     entry->set_server(server);
-    it = server_shard_map.find(server);
-    std::vector<shard> shards = it->second;
-    for (int i = 0; i < shards.size(); i++) {
-      Shard *shard = entry->add_shards();
-      shard->set_lower(shards.at(i).lower);
-      shard->set_upper(shards.at(i).upper);
+    entries[server] = entry;
+  }
+  shards.ForEach([&entries](const shard_t &s, const std::string &server) {
+    Shard *shard = entries[server]->add_shards();
+    shard->set_lower(s.lower);
+    shard->set_upper(s.upper);
+  });
+}
+
+void StaticShardmaster::place() {
+  if (server_order.empty()) {
+    shards.Reset({});
+  } else if (placement == Placement::BALANCED) {
+    shards.Reset(
+        rebalance(shards.ByServer(), server_order, MIN_KEY, MAX_KEY));
+  } else if (placement == Placement::RING) {
+    shards.Reset(hash_ring(server_order, vnodes, MIN_KEY, MAX_KEY));
+  } else {
+    // one interval per server, in join order
+    std::vector<shard> intervals =
+        partition(server_order.size(), MIN_KEY, MAX_KEY);
+    std::map<std::string, std::vector<shard>> config;
+    for (size_t i = 0; i < server_order.size(); i++) {
+      config[server_order.at(i)].push_back(intervals.at(i));
     }
+    shards.Reset(config);
   }
-  return ::grpc::Status::OK;
+}
+
+void StaticShardmaster::bumpConfig() {
+  config_num++;
+  auto config = std::make_shared<QueryResponse>();
+  fillConfig(config.get());
+  std::atomic_store(&current,
+                    std::shared_ptr<const QueryResponse>(std::move(config)));
+  config_cv.notify_all();
 }
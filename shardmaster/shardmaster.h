@@ -2,16 +2,41 @@
 #define SHARDING_SHARDMASTER_H
 
 #include "../common/common.h"
+#include "../common/keys.h"
+#include "../common/shardtable.h"
 #include "../shardkv/shardkv.h"
 
 #include <grpcpp/grpcpp.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include "../build/shardmaster.grpc.pb.h"
 #include "../build/shardkv.grpc.pb.h"
 
+// how Join and Leave reassign the key space
+enum class Placement {
+  // one even interval per server, recomputed from scratch in join order
+  PARTITION,
+  // the same even shares, but servers keep what they already hold and only
+  // the excess of the over-loaded ones moves (see rebalance in common.h)
+  BALANCED,
+  // each server holds the arcs of a hash ring before its virtual nodes (see
+  // hash_ring in common.h): shares are only roughly even, but a config
+  // depends on nothing but who's in it
+  RING
+};
+
+// virtual nodes per server on the hash ring, unless told otherwise
+constexpr unsigned int RING_VNODES = 64;
+
 class StaticShardmaster : public Shardmaster::Service {
   using Empty = google::protobuf::Empty;
 
  public:
+  explicit StaticShardmaster(Placement placement = Placement::PARTITION,
+                             unsigned int vnodes = RING_VNODES)
+      : placement(placement), vnodes(vnodes) {}
+
   // TODO implement these four methods!
   ::grpc::Status Join(::grpc::ServerContext* context,
                       const ::JoinRequest* request, Empty* response) override;
@@ -21,18 +46,57 @@ class StaticShardmaster : public Shardmaster::Service {
                       const ::MoveRequest* request, Empty* response) override;
   ::grpc::Status Query(::grpc::ServerContext* context, const Empty* request,
                        ::QueryResponse* response) override;
+  ::grpc::Status QueryIfNewer(::grpc::ServerContext* context,
+                              const ::QueryIfNewerRequest* request,
+                              ::QueryResponse* response) override;
+  ::grpc::Status Watch(::grpc::ServerContext* context,
+                       const ::QueryIfNewerRequest* request,
+                       ::grpc::ServerWriter<::QueryResponse>* writer) override;
   ::grpc::Status GDPRDelete(::grpc::ServerContext* context,
                         const ::GDPRDeleteRequest* request,
                         Empty* response) override;
 
+  // GDPRDelete, but giving up with DEADLINE_EXCEEDED if the key's owner
+  // hasn't deleted it by deadline. a key its owner doesn't have counts as
+  // deleted
+  ::grpc::Status DeleteFromOwner(
+      const ::GDPRDeleteRequest* request,
+      std::chrono::steady_clock::time_point deadline);
+
  private:
+  // writes the current config into response. caller must hold shard_mtx
+  void fillConfig(::QueryResponse* response);
+
+  // bumps config_num, publishes the new config to current and wakes up
+  // every Watch stream. caller must hold shard_mtx, and call it after every
+  // change
+  void bumpConfig();
+
+  // reassigns the key space among server_order the way placement says.
+  // caller must hold shard_mtx
+  void place();
+
+  const Placement placement;
+  // virtual nodes per server, with Placement::RING
+  const unsigned int vnodes;
+
   // TODO add any fields you want here!
   // Hint: think about what sort of data structures make sense for keeping track
   // of which servers have which shards, as well as what kind of locking you
   // will need to ensure thread safety.
   std::vector<std::string> server_order; // maintain server join order
-  std::map<std::string, std::vector<shard>> server_shard_map; // map to shards
+  // which server owns each range of IDs
+  ShardTable shards;
   std::mutex shard_mtx;
+  // bumped (under shard_mtx) by every change to the config
+  std::atomic<uint64_t> config_num{0};
+  // signalled (with shard_mtx) whenever config_num changes
+  std::condition_variable config_cv;
+  // the config as of config_num. replaced as a whole (under shard_mtx) by
+  // every change, and never modified, so Query and friends copy it out
+  // through std::atomic_load without taking shard_mtx
+  std::shared_ptr<const QueryResponse> current =
+      std::make_shared<const QueryResponse>();
 };
 
 #endif  // SHARDING_SHARDMASTER_H
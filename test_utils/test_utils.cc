@@ -3,6 +3,7 @@
 #include <sstream>
 #include <cstdio>
 
+#include "../shardkv/async_server.h"
 #include "../shardkv/shardkv.h"
 #include "../shardmaster/shardmaster.h"
 #include "../simple_shardkv/simpleshardkv.h"
@@ -44,6 +45,24 @@ void start_shardkv(const std::string& addr,
                           const std::string&>(addr, addr, shardmaster_addr);
 }
 
+void start_async_shardkv(const std::string& addr,
+                         const std::string& shardmaster_addr, int num_cqs,
+                         int pollers_per_cq) {
+  std::thread thr([=]() {
+    ::grpc::ServerBuilder builder;
+    builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
+    ShardkvServer shardkv(addr, shardmaster_addr);
+    AsyncShardkvServer async(&shardkv, &builder, num_cqs, pollers_per_cq);
+    std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
+    async.Start();
+    async.Wait();
+  });
+  thr.detach();
+  // sleep to allow service to start
+  std::chrono::milliseconds timespan(100);
+  std::this_thread::sleep_for(timespan);
+}
+
 std::vector<pid_t> start_shardkvs_proc(const Addrs& addrs,
                                        const std::string& shardmaster_addr) {
   std::vector<pid_t> pids;
@@ -141,6 +160,106 @@ bool test_put(const std::string& addr, std::string key,
   return status.ok() == success;
 }
 
+bool test_multi_get(const std::string& addr,
+                    const std::vector<std::string>& keys,
+                    const std::vector<std::optional<std::string>>& values) {
+  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardkv::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  MultiGetRequest req;
+  MultiResponse res;
+  for (const std::string& key : keys) {
+    req.add_keys(key);
+  }
+
+  auto status = stub->MultiGet(&cc, req, &res);
+  if (!status.ok() || res.results_size() != (int)keys.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    const KeyStatus& result = res.results(i);
+    bool ok = result.code() == ::grpc::StatusCode::OK;
+    if (result.key() != keys[i] || ok != values[i].has_value() ||
+        (ok && result.data() != values[i].value())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool test_multi_put(
+    const std::string& addr,
+    const std::vector<std::tuple<std::string, std::string, std::string>>& puts,
+    const std::vector<bool>& successes) {
+  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardkv::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  MultiPutRequest req;
+  MultiResponse res;
+  for (auto& [key, value, user] : puts) {
+    PutRequest* put = req.add_puts();
+    put->set_key(key);
+    put->set_data(value);
+    put->set_user(user);
+  }
+
+  auto status = stub->MultiPut(&cc, req, &res);
+  if (!status.ok() || res.results_size() != (int)puts.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < puts.size(); i++) {
+    bool ok = res.results(i).code() == ::grpc::StatusCode::OK;
+    if (res.results(i).key() != std::get<0>(puts[i]) || ok != successes[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool test_list_posts(const std::string& addr, const std::string& user,
+                     uint64_t cursor, uint32_t limit,
+                     const std::vector<std::string>& posts, uint64_t next,
+                     bool more) {
+  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardkv::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  ListPostsRequest req;
+  ListPostsResponse res;
+  req.set_user(user);
+  req.set_cursor(cursor);
+  req.set_limit(limit);
+
+  auto status = stub->ListPosts(&cc, req, &res);
+  if (!status.ok() || res.next() != next || res.more() != more) {
+    return false;
+  }
+  return std::vector<std::string>(res.posts().begin(), res.posts().end()) ==
+         posts;
+}
+
+bool test_list_users(const std::string& addr, const std::string& after,
+                     uint32_t limit, const std::vector<std::string>& users,
+                     bool more) {
+  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardkv::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  ListUsersRequest req;
+  ListUsersResponse res;
+  req.set_after(after);
+  req.set_limit(limit);
+
+  auto status = stub->ListUsers(&cc, req, &res);
+  if (!status.ok() || res.more() != more) {
+    return false;
+  }
+  return std::vector<std::string>(res.users().begin(), res.users().end()) ==
+         users;
+}
+
 bool test_append(const std::string& addr, std::string key,
                  const std::string& value, bool success) {
   auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
@@ -170,6 +289,21 @@ bool test_delete(const std::string& addr, std::string key,
   return status.ok() == success;
 }
 
+bool test_delete_post(const std::string& addr, const std::string& post,
+                      const std::string& user, bool success) {
+  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardkv::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  DeleteRequest req;
+  Empty res;
+  req.set_key(post);
+  req.set_user(user);
+
+  auto status = stub->Delete(&cc, req, &res);
+  return status.ok() == success;
+}
+
 // testing functions for shardmaster - for join/leave/move we will have to call
 // query anyway so maybe bundle them?
 bool test_join(const std::string& shardmaster_addr, const std::string& addr,
@@ -223,21 +357,10 @@ bool test_move(const std::string& shardmaster_addr, const std::string& addr,
   return status.ok() == success;
 }
 
-bool test_query(const std::string& shardmaster_addr,
-                const std::map<std::string, std::vector<shard_t>>& m) {
-  auto channel =
-      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardmaster::NewStub(channel);
-
-  ::grpc::ClientContext cc;
-  Empty req;
-  QueryResponse response;
-
-  auto status = stub->Query(&cc, req, &response);
-  if (!status.ok()) {
-    return false;
-  }
-
+// checks whether the config in response is the one described by m
+static bool config_equals(
+    const QueryResponse& response,
+    const std::map<std::string, std::vector<shard_t>>& m) {
   // read response into a map then check if it's equal to what we expect (m)
   std::map<std::string, std::vector<shard_t>> res_map;
 
@@ -281,6 +404,71 @@ bool test_query(const std::string& shardmaster_addr,
   return true;
 }
 
+bool test_query(const std::string& shardmaster_addr,
+                const std::map<std::string, std::vector<shard_t>>& m) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  Empty req;
+  QueryResponse response;
+
+  auto status = stub->Query(&cc, req, &response);
+  if (!status.ok()) {
+    return false;
+  }
+  return config_equals(response, m);
+}
+
+bool test_query_if_newer(const std::string& shardmaster_addr,
+                         uint64_t known_num, uint64_t expected_num,
+                         bool has_config) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  QueryIfNewerRequest req;
+  QueryResponse response;
+  req.set_config_num(known_num);
+
+  auto status = stub->QueryIfNewer(&cc, req, &response);
+  return status.ok() && response.config_num() == expected_num &&
+         (response.config_size() > 0) == has_config;
+}
+
+bool test_watch(const std::string& shardmaster_addr, uint64_t known_num,
+                const std::map<std::string, std::vector<shard_t>>& m) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  QueryIfNewerRequest req;
+  QueryResponse response;
+  req.set_config_num(known_num);
+  // give up if the config we expect never gets pushed
+  cc.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(5));
+
+  bool found = false;
+  auto reader = stub->Watch(&cc, req);
+  while (reader->Read(&response)) {
+    // every pushed config must be newer than the one we told it we have
+    if (response.config_num() <= known_num) {
+      break;
+    }
+    known_num = response.config_num();
+    if (config_equals(response, m)) {
+      found = true;
+      break;
+    }
+  }
+  cc.TryCancel();
+  reader->Finish();
+  return found;
+}
+
 bool test_gdpr_delete(const std::string& shardmaster_addr, std::string user, bool success){
     auto channel =
       grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
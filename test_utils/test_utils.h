@@ -8,6 +8,7 @@
 #include <optional>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <vector>
 #include "../common/common.h"
 
@@ -69,6 +70,11 @@ std::vector<pid_t> start_shardkvs_proc(const Addrs& addrs,
 void start_shardkv(const std::string& addr,
                    const std::string& shardmaster_addr);
 
+// runs a shardkv served by AsyncShardkvServer in a detached thread
+void start_async_shardkv(const std::string& addr,
+                         const std::string& shardmaster_addr, int num_cqs,
+                         int pollers_per_cq);
+
 pid_t start_shardkv_proc(const std::string& addr,
                          const std::string& shardmaster_addr);
 
@@ -81,12 +87,42 @@ bool test_get(const std::string& addr, std::string key,
 bool test_put(const std::string& addr, std::string key,
               const std::string& value, std::string user, bool success);
 
+// sends keys in one MultiGet. values[i] is the data expected for keys[i], or
+// nullopt if that key should fail
+bool test_multi_get(const std::string& addr,
+                    const std::vector<std::string>& keys,
+                    const std::vector<std::optional<std::string>>& values);
+
+// sends one MultiPut of (key, value, user) puts. successes[i] is whether
+// puts[i] should succeed
+bool test_multi_put(
+    const std::string& addr,
+    const std::vector<std::tuple<std::string, std::string, std::string>>& puts,
+    const std::vector<bool>& successes);
+
+// sends one ListPosts for user starting at cursor. posts is the page expected
+// back, next the cursor after it and more whether there are posts past it
+bool test_list_posts(const std::string& addr, const std::string& user,
+                     uint64_t cursor, uint32_t limit,
+                     const std::vector<std::string>& posts, uint64_t next,
+                     bool more);
+
+// sends one ListUsers starting after after. users is the page expected back
+// and more whether the server should say there are users past it
+bool test_list_users(const std::string& addr, const std::string& after,
+                     uint32_t limit, const std::vector<std::string>& users,
+                     bool more);
+
 bool test_append(const std::string& addr, std::string key,
                  const std::string& value, bool success);
 
 bool test_delete(const std::string& addr, std::string key,
                  bool success);
 
+// deletes post, naming user so it is taken off user's post list too
+bool test_delete_post(const std::string& addr, const std::string& post,
+                      const std::string& user, bool success);
+
 // testing functions for shardmaster
 bool test_join(const std::string& shardmaster_addr, const std::string& addr,
                bool success);
@@ -100,6 +136,17 @@ bool test_move(const std::string& shardmaster_addr, const std::string& addr,
 bool test_query(const std::string& shardmaster_addr,
                 const std::map<std::string, std::vector<shard_t>>& m);
 
+// calls QueryIfNewer with known_num, expecting the shardmaster to report
+// config number expected_num and to send a config iff has_config
+bool test_query_if_newer(const std::string& shardmaster_addr,
+                         uint64_t known_num, uint64_t expected_num,
+                         bool has_config);
+
+// watches the shardmaster starting from known_num, expecting it to push a
+// config equal to m within a few seconds
+bool test_watch(const std::string& shardmaster_addr, uint64_t known_num,
+                const std::map<std::string, std::vector<shard_t>>& m);
+
 bool test_gdpr_delete(const std::string& shardmaster_addr, std::string user,
                bool success);
 
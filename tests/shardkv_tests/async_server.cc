@@ -0,0 +1,77 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  const string skv_1 = hostname + ":8081";
+  const string skv_2 = hostname + ":8082";
+  const string skv_3 = hostname + ":8083";
+
+  // a single poller, so a request that blocked it would stall every other one
+  start_async_shardkv(skv_1, shardmaster_addr, 1, 1);
+
+  map<string, vector<shard_t>> m;
+
+  // skv_2 joins before it's running, so Appends forwarded to it fail at first
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  // the Put keeps retrying its Append to skv_2 in the background, while skv_1
+  // goes on serving other requests
+  std::thread put([&]() {
+    assert(test_put(skv_1, "post_1", "hi", "user_900", true));
+  });
+  std::this_thread::sleep_for(timespan);
+  assert(test_get(skv_1, "post_1", "hi"));
+  assert(test_put(skv_1, "user_2", "Bob", "user_2", true));
+  assert(test_get(skv_1, "user_2", "Bob"));
+
+  start_async_shardkv(skv_2, shardmaster_addr, 2, 2);
+  put.join();
+  assert(test_get(skv_2, "user_900_posts", "post_1,"));
+
+  // deleting the user deletes its post on skv_1 too
+  assert(test_put(skv_2, "user_900", "Alice", "user_900", true));
+  assert(test_delete(skv_2, "user_900", true));
+  assert(test_get(skv_1, "post_1", nullopt));
+
+  // keys are handed off to a joining server over TransferShard
+  assert(test_put(skv_2, "user_950", "Carol", "user_950", true));
+  start_async_shardkv(skv_3, shardmaster_addr, 2, 2);
+  assert(test_join(shardmaster_addr, skv_3, true));
+  m[skv_1].push_back({0, 333});
+  m[skv_2].push_back({334, 667});
+  m[skv_3].push_back({668, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  std::this_thread::sleep_for(timespan);
+  assert(test_get(skv_2, "user_950", nullopt));
+  assert(test_get(skv_3, "user_950", "Carol"));
+  assert(test_get(skv_3, "all_users", "user_950,"));
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <cassert>
+#include <string>
+
+#include "../../common/keys.h"
+#include "../../shardkv/flattable.h"
+
+using namespace std;
+
+static PackedKey post(int id) { return PackKey("post_" + to_string(id)); }
+
+int main() {
+  Arena arena;
+  {
+    FlatTable table;
+    table.SetArena(&arena);
+    string_view value;
+    assert(!table.Find(post(1), &value));
+
+    // short values stay in the slot, longer ones go to the arena
+    assert(table.Set(post(1), "bob"));
+    assert(!table.Set(post(1), string(FLAT_INLINE, 'a')));
+    assert(table.Find(post(1), &value) && value == string(FLAT_INLINE, 'a'));
+    assert(table.Append(post(2), "x"));
+    string built = "x";
+    for (int i = 0; i < 200; i++) {
+      string more(i % 7 + 1, 'a' + i % 26);
+      assert(!table.Append(post(2), more));
+      built += more;
+    }
+    assert(table.Find(post(2), &value) && value == built);
+    // and back into the slot
+    assert(!table.Set(post(2), "short"));
+    assert(table.Find(post(2), &value) && value == "short");
+    assert(!table.Set(post(1), string(5000, 'b')));
+    assert(table.Find(post(1), &value) && value == string(5000, 'b'));
+
+    // two or three keys fill a small table, which still finds and erases
+    assert(table.Set(PackKey("user_1"), "u"));
+    assert(table.Set(PackKey("user_1_posts"), "post_1,"));
+    assert(table.Size() == 4);
+    string old;
+    assert(table.Erase(post(1), &old) && old == string(5000, 'b'));
+    assert(!table.Erase(post(1)));
+    assert(!table.Find(post(1), &value));
+    assert(table.Find(PackKey("user_1_posts"), &value) && value == "post_1,");
+
+    for (int i = 10; i < 1000; i++) {
+      table.Set(post(i), string(i % 300, 'c'));
+    }
+    assert(table.Size() == 3 + 990);
+    size_t erased = 0;
+    table.EraseIf([](PackedKey key) { return PackedID(key) >= 500; },
+                  [&erased](PackedKey key, string_view value) {
+                    assert(value == string(PackedID(key) % 300, 'c'));
+                    erased++;
+                  });
+    assert(erased == 500 && table.Size() == 493);
+    assert(table.Find(post(499), &value) && value.size() == 499 % 300);
+    assert(!table.Find(post(500), &value));
+    assert(arena.Bytes() > 0);
+    table.Clear();
+    assert(table.Size() == 0);
+  }
+  // every block came back, so the arena let go of its chunks
+  assert(arena.Bytes() == 0);
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <unistd.h>
+#include <cassert>
+#include <string>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  const string skv_1 = hostname + ":8081";
+  const string skv_2 = hostname + ":8082";
+
+  start_shardkvs({skv_1, skv_2}, shardmaster_addr);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  // users come back in ID order, whatever order they were added in
+  for (int id : {700, 3, 42, 999, 500, 1}) {
+    string user = "user_" + to_string(id);
+    assert(test_put(skv_1, user, "name", user, true));
+  }
+  assert(test_get(skv_1, "all_users",
+                  "user_1,user_3,user_42,user_500,user_700,user_999,"));
+  assert(test_list_users(skv_1, "", 0,
+                         {"user_1", "user_3", "user_42", "user_500",
+                          "user_700", "user_999"},
+                         false));
+
+  // pages pick up after the last user of the previous one
+  assert(test_list_users(skv_1, "", 2, {"user_1", "user_3"}, true));
+  assert(test_list_users(skv_1, "user_3", 2, {"user_42", "user_500"}, true));
+  assert(test_list_users(skv_1, "user_500", 2, {"user_700", "user_999"},
+                         false));
+
+  // ... even if that user is gone by now
+  assert(test_delete(skv_1, "user_42", true));
+  assert(test_list_users(skv_1, "user_42", 2, {"user_500", "user_700"}, true));
+  assert(test_get(skv_1, "all_users", "user_1,user_3,user_500,user_700,"
+                                      "user_999,"));
+
+  // users that move to another server leave the directory of the old one and
+  // show up in the new one's
+  assert(test_join(shardmaster_addr, skv_2, true));
+  std::this_thread::sleep_for(timespan);
+  assert(test_list_users(skv_1, "", 10, {"user_1", "user_3", "user_500"},
+                         false));
+  assert(test_list_users(skv_2, "", 10, {"user_700", "user_999"}, false));
+  assert(test_get(skv_2, "all_users", "user_700,user_999,"));
+
+  assert(test_list_users(skv_2, "user_999", 10, {}, false));
+
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include <cassert>
+#include <string>
+
+#include "../../shardkv/lsmstore.h"
+
+using namespace std;
+
+const string DIR = "/tmp/shardkv_lsm_store_test";
+
+int main() {
+  system(("rm -rf " + DIR).c_str());
+
+  {
+    // a tiny memtable, so a few hundred writes make several runs
+    LsmStore store(DIR, SyncMode::BATCHED, 4096);
+    assert(store.Open());
+    for (int i = 0; i < 500; i++) {
+      assert(store.Put("post_" + to_string(i), "value " + to_string(i)));
+    }
+    assert(!store.Put("post_3", "new"));
+    assert(!store.PutIfAbsent("post_4", "other"));
+    store.Flush();
+    LsmStats stats = store.Stats();
+    assert(stats.flushes > 0 && stats.compactions > 0);
+    assert(stats.runs <= LSM_MAX_RUNS);
+
+    string value;
+    assert(store.Get("post_3", &value) && value == "new");
+    assert(store.Get("post_499", &value) && value == "value 499");
+    // the Bloom filters keep misses off the disk
+    uint64_t blocks = store.Stats().blocks_read;
+    for (int i = 0; i < 100; i++) {
+      assert(!store.Get("post_" + to_string(1000 + i), &value));
+    }
+    assert(store.Stats().blocks_read - blocks < 10);
+
+    // erased keys stay gone once their tombstone is flushed and compacted
+    assert(store.Erase("post_5", &value) && value == "value 5");
+    assert(!store.Erase("post_5"));
+    store.Flush();
+    assert(!store.Get("post_5", &value));
+    assert(store.Size() == 499);
+
+    assert(store.Append("user_1", "Bob"));
+    assert(!store.Append("user_1", "by"));
+    assert(store.Update("user_1", [](string& v) { v += "!"; }));
+    assert(store.ListAppend("user_1_posts", {"post_1", "post_2"}));
+    assert(!store.Append("user_1_posts", "post_3,post_1,"));
+    assert(store.ListRemove("user_1_posts", "post_2"));
+    assert(!store.ListRemove("user_1_posts", "post_2"));
+    assert(!store.Update("user_1_posts", [](string&) {}));
+    vector<string> posts;
+    uint64_t next;
+    bool more;
+    assert(store.ListRange("user_1_posts", 0, 10, &posts, &next, &more));
+    assert(posts.size() == 2 && posts[0] == "post_1" && !more);
+    // post_3 keeps its place past the removed post_2, in runs too
+    store.Flush();
+    posts.clear();
+    assert(store.ListRange("user_1_posts", 2, 10, &posts, &next, &more));
+    assert(posts.size() == 1 && posts[0] == "post_3" && next == 3);
+    assert(store.Get("user_1_posts", &value) && value == "post_1,post_3,");
+
+    vector<pair<string, string>> batch = {{"post_900", "a"}, {"all_users", "b"}};
+    vector<bool> created;
+    store.PutBatch(batch, &created);
+    assert(created[0] && created[1]);
+
+    // only the IDs in the range, whether in the memtable or in runs
+    auto extracted = store.ReadRange({0, 99});
+    assert(extracted.size() == 99 + 2);
+    assert(store.Get("post_42", &value));
+    vector<string> keys;
+    for (auto& kv : extracted) {
+      keys.push_back(kv.first);
+    }
+    assert(store.EraseBatch(keys) == 99 + 2);
+    assert(!store.Get("post_42", &value) && !store.Get("user_1", &value));
+    assert(store.Get("post_100", &value) && store.Get("all_users", &value));
+  }
+
+  {
+    // whatever wasn't flushed comes back from the log
+    LsmStore store(DIR, SyncMode::BATCHED, 4096);
+    assert(store.Open());
+    string value;
+    assert(store.Size() == 499 - 99 + 2);
+    assert(store.Get("post_3", &value) == false);
+    assert(store.Get("post_100", &value) && value == "value 100");
+    assert(store.Get("post_900", &value) && value == "a");
+    assert(!store.Get("user_1_posts", &value));
+    store.Put("user_1_posts", "post_7,");
+    assert(store.ListAppend("user_1_posts", {"post_8"}) == false);
+    assert(store.ListRemove("user_1_posts", "post_7"));
+  }
+
+  {
+    LsmStore store(DIR, SyncMode::PER_WRITE, 4096);
+    assert(store.Open());
+    string value;
+    assert(store.Get("user_1_posts", &value) && value == "post_8,");
+    // the list's sequence numbers come back from the log
+    vector<string> posts;
+    uint64_t next;
+    bool more;
+    assert(store.ListRange("user_1_posts", 1, 10, &posts, &next, &more));
+    assert(posts.size() == 1 && posts[0] == "post_8" && next == 2 && !more);
+  }
+
+  system(("rm -rf " + DIR).c_str());
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include <unistd.h>
+#include <cassert>
+#include <string>
+
+#include "../../shardkv/kvstore.h"
+#include "../../shardkv/wal.h"
+
+using namespace std;
+
+const string SPILL_PATH = "/tmp/shardkv_memory_budget_test.spill";
+const string LOG_PATH = "/tmp/shardkv_memory_budget_test.log";
+const string SNAPSHOT_PATH = "/tmp/shardkv_memory_budget_test.snap";
+
+// about 1 KB per ID
+static void fill(KvStore& store, int from, int to) {
+  for (int id = from; id < to; id++) {
+    store.Put("user_" + to_string(id), "name " + to_string(id));
+    store.Put("post_" + to_string(id), string(900, 'a' + id % 26));
+    store.ListAppend("user_" + to_string(id) + "_posts",
+                     {"post_" + to_string(id)});
+  }
+}
+
+int main() {
+  unlink(LOG_PATH.c_str());
+  unlink((LOG_PATH + ".old").c_str());
+  unlink(SNAPSHOT_PATH.c_str());
+
+  {
+    KvStore store;
+    const size_t budget = 100 << 10;
+    assert(store.SetMemoryBudget(budget, SPILL_PATH));
+    // the file is only kept open
+    assert(access(SPILL_PATH.c_str(), F_OK) != 0);
+
+    fill(store, 0, 1000);
+    KvMemoryStats m = store.MemoryStats();
+    assert(m.resident_bytes <= budget);
+    assert(m.spilled_stripes > 800 && m.spills >= m.spilled_stripes);
+    assert(m.faults == 0);
+
+    // the IDs written first went first
+    size_t resident, spilled;
+    store.RangeBytes({0, 99}, &resident, &spilled);
+    assert(resident == 0 && spilled > 0);
+    store.RangeBytes({950, 999}, &resident, &spilled);
+    assert(resident > 0);
+
+    // and come back when they're read
+    string value;
+    assert(store.Get("post_3", &value) && value == string(900, 'd'));
+    assert(store.Get("user_3", &value) && value == "name 3");
+    vector<string> posts;
+    uint64_t next;
+    bool more;
+    assert(store.ListRange("user_3_posts", 0, 10, &posts, &next, &more));
+    assert(posts.size() == 1 && posts[0] == "post_3");
+    m = store.MemoryStats();
+    assert(m.faults == 1 && m.resident_bytes <= budget);
+    store.RangeBytes({3, 3}, &resident, &spilled);
+    assert(resident > 0 && spilled == 0);
+
+    // or written
+    assert(!store.Append("user_4", "!"));
+    assert(store.Get("user_4", &value) && value == "name 4!");
+    assert(store.MemoryStats().faults == 2);
+
+    // whole-store reads leave spilled stripes where they are
+    assert(store.Size() == 3000);
+    assert(store.Snapshot().size() == 3000);
+    size_t keys = 0;
+    store.ForEachKey([&keys](string_view) { keys++; });
+    assert(keys == 3000);
+    assert(store.MemoryStats().faults == 2);
+
+    // handing a range off empties it, spilled or not
+    auto moving = store.ReadRange({0, 499});
+    assert(moving.size() == 1500);
+    assert(store.MemoryStats().faults == 2);
+    vector<string> moving_keys;
+    for (auto& kv : moving) {
+      moving_keys.push_back(kv.first);
+    }
+    assert(store.EraseBatch(moving_keys) == 1500);
+    assert(store.Size() == 1500);
+    store.RangeBytes({0, 499}, &resident, &spilled);
+    assert(resident == 0 && spilled == 0);
+    assert(store.MemoryStats().resident_bytes <= budget);
+  }
+
+  {
+    // a checkpoint holds the spilled stripes too
+    WriteAheadLog log(LOG_PATH, SyncMode::BATCHED);
+    assert(log.Open());
+    KvStore store;
+    assert(store.SetMemoryBudget(64 << 10, SPILL_PATH));
+    store.Recover(&log, SNAPSHOT_PATH);
+    fill(store, 0, 200);
+    assert(store.MemoryStats().spilled_stripes > 0);
+    assert(store.Checkpoint(SNAPSHOT_PATH));
+  }
+
+  {
+    WriteAheadLog log(LOG_PATH, SyncMode::BATCHED);
+    assert(log.Open());
+    KvStore store;
+    store.Recover(&log, SNAPSHOT_PATH);
+    string value;
+    assert(store.Size() == 600);
+    assert(store.Get("post_0", &value) && value == string(900, 'a'));
+    assert(store.Get("user_199", &value) && value == "name 199");
+  }
+
+  unlink(LOG_PATH.c_str());
+  unlink(SNAPSHOT_PATH.c_str());
+  return 0;
+}
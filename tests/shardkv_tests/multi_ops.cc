@@ -0,0 +1,57 @@
+#include <unistd.h>
+#include <cassert>
+#include <optional>
+#include <string>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  const string skv_1 = hostname + ":8081";
+  const string skv_2 = hostname + ":8082";
+
+  start_shardkvs({skv_1, skv_2}, shardmaster_addr);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  // keys skv_1 doesn't own fail on their own, without failing the rest
+  assert(test_multi_put(skv_1,
+                        {{"user_1", "Bob", "user_1"},
+                         {"post_2", "hi", "user_1"},
+                         {"post_3", "hello", "user_900"},
+                         {"user_600", "Alice", "user_600"},
+                         {"", "nothing", ""}},
+                        {true, true, true, false, false}));
+  assert(test_multi_put(skv_2, {{"user_900", "Carol", "user_900"}}, {true}));
+
+  assert(test_multi_get(skv_1,
+                        {"user_1", "post_2", "post_3", "user_1_posts",
+                         "post_4", "user_900", "all_users"},
+                        {"Bob", "hi", "hello", "post_2,", nullopt, nullopt,
+                         "user_1,"}));
+  // post_3's user lives on skv_2, so it was appended to the post list there
+  assert(test_multi_get(skv_2, {"user_900", "user_900_posts", "user_1"},
+                        {"Carol", "post_3,", nullopt}));
+
+  // a batch sees the single-key writes before it
+  assert(test_put(skv_1, "user_1", "Robert", "user_1", true));
+  assert(test_append(skv_1, "user_1_posts", "post_5,", true));
+  assert(test_multi_get(skv_1, {"user_1", "user_1_posts"},
+                        {"Robert", "post_2,post_5,"}));
+  assert(test_multi_get(skv_1, {}, {}));
+
+  return 0;
+}
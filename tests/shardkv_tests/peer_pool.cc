@@ -0,0 +1,32 @@
+#include <cassert>
+#include <string>
+
+#include "../../common/peerpool.h"
+
+using namespace std;
+
+int main() {
+  // channels connect lazily, so no servers are needed to exercise the pool
+  PeerPool pool;
+  const string skv_1 = "127.0.0.1:8081";
+  const string skv_2 = "127.0.0.1:8082";
+
+  auto stub_1 = pool.Get(skv_1);
+  assert(pool.Get(skv_1) == stub_1);
+  assert(pool.Created() == 1);
+  assert(pool.Reused() == 1);
+
+  auto stub_2 = pool.Get(skv_2);
+  assert(stub_2 != stub_1);
+  assert(pool.Created() == 2);
+
+  // once skv_1 leaves the config its channel is dropped, and the next Get
+  // opens a new one
+  pool.Retain({skv_2});
+  assert(pool.Get(skv_2) == stub_2);
+  assert(pool.Get(skv_1) != stub_1);
+  assert(pool.Created() == 3);
+  assert(pool.Reused() == 2);
+
+  return 0;
+}
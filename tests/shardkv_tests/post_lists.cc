@@ -0,0 +1,88 @@
+#include <unistd.h>
+#include <cassert>
+#include <optional>
+#include <string>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  const string skv_1 = hostname + ":8081";
+  const string skv_2 = hostname + ":8082";
+
+  start_shardkvs({skv_1, skv_2}, shardmaster_addr);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_put(skv_1, "user_1", "Bob", "user_1", true));
+  for (int id = 10; id < 15; id++) {
+    assert(test_put(skv_1, "post_" + to_string(id), "hi", "user_1", true));
+  }
+  // a post is only listed once
+  assert(test_append(skv_1, "user_1_posts", "post_12,", true));
+  assert(test_get(skv_1, "user_1_posts",
+                  "post_10,post_11,post_12,post_13,post_14,"));
+
+  // pages continue at the cursor the previous page returned
+  assert(test_list_posts(skv_1, "user_1", 0, 2, {"post_10", "post_11"}, 2,
+                         true));
+  assert(test_list_posts(skv_1, "user_1", 2, 2, {"post_12", "post_13"}, 4,
+                         true));
+  assert(test_list_posts(skv_1, "user_1", 4, 2, {"post_14"}, 5, false));
+
+  // deleting a post along with its user takes it off the list, and cursors
+  // handed out before stay valid
+  assert(test_delete_post(skv_1, "post_13", "user_1", true));
+  assert(test_get(skv_1, "post_13", nullopt));
+  assert(test_list_posts(skv_1, "user_1", 2, 2, {"post_12", "post_14"}, 5,
+                         false));
+  assert(test_get(skv_1, "user_1_posts", "post_10,post_11,post_12,post_14,"));
+
+  // user_700's list moves to skv_2 when it joins, and cursors into it stay
+  // valid
+  assert(test_put(skv_1, "user_700", "Alice", "user_700", true));
+  assert(test_put(skv_1, "post_701", "a", "user_700", true));
+  assert(test_put(skv_1, "post_702", "b", "user_700", true));
+  assert(test_put(skv_1, "post_703", "c", "user_700", true));
+  assert(test_delete_post(skv_1, "post_701", "user_700", true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  // the handoff takes as long as it takes, so wait (up to 30s) until skv_2
+  // serves the list rather than for a fixed time
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (!test_list_posts(skv_2, "user_700", 0, 0, {"post_702", "post_703"},
+                          3, false)) {
+    assert(std::chrono::steady_clock::now() < deadline);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  assert(test_list_posts(skv_2, "user_700", 2, 0, {"post_703"}, 3, false));
+  assert(!test_list_posts(skv_1, "user_700", 0, 0, {}, 0, false));
+  assert(test_delete_post(skv_2, "post_702", "user_700", true));
+  assert(test_get(skv_2, "user_700_posts", "post_703,"));
+
+  // the post's server passes the delete on to the server with the list
+  assert(test_put(skv_1, "post_20", "c", "user_700", true));
+  assert(test_get(skv_2, "user_700_posts", "post_703,post_20,"));
+  assert(test_delete_post(skv_1, "post_20", "user_700", true));
+  assert(test_get(skv_1, "post_20", nullopt));
+  assert(test_get(skv_2, "user_700_posts", "post_703,"));
+
+  // deleting the user drops the list with it
+  assert(test_delete(skv_1, "user_1", true));
+  assert(!test_list_posts(skv_1, "user_1", 0, 0, {}, 0, false));
+  assert(test_get(skv_1, "post_10", nullopt));
+
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <unistd.h>
+#include <cassert>
+#include <string>
+
+#include "../../shardkv/kvstore.h"
+#include "../../shardkv/wal.h"
+
+using namespace std;
+
+const string LOG_PATH = "/tmp/shardkv_snapshot_test.log";
+const string SNAPSHOT_PATH = "/tmp/shardkv_snapshot_test.snap";
+
+static bool exists(const string& path) {
+  return access(path.c_str(), F_OK) == 0;
+}
+
+int main() {
+  unlink(LOG_PATH.c_str());
+  unlink((LOG_PATH + ".old").c_str());
+  unlink(SNAPSHOT_PATH.c_str());
+
+  {
+    WriteAheadLog log(LOG_PATH, SyncMode::BATCHED);
+    assert(log.Open());
+    KvStore store;
+    assert(store.Recover(&log, SNAPSHOT_PATH) == 0);
+    store.Put("user_1", "Bob");
+    store.Put("post_2", "hi");
+    store.ListAppend("user_1_posts", {"post_2", "post_3"});
+    store.Put("user_700", "Alice");
+    store.Put("all_users", "user_1,");
+    assert(store.Checkpoint(SNAPSHOT_PATH));
+    // the snapshot holds everything logged before it
+    assert(exists(SNAPSHOT_PATH) && !exists(LOG_PATH + ".old"));
+
+    // and the log what came after
+    store.Append("user_1", "by");
+    store.Put("post_4", "there");
+    assert(store.ReadRange({700, 800}).size() == 1);
+    assert(store.EraseBatch({"user_700"}) == 1);
+  }
+
+  {
+    WriteAheadLog log(LOG_PATH, SyncMode::BATCHED);
+    assert(log.Open());
+    KvStore store;
+    assert(store.Recover(&log, SNAPSHOT_PATH) == 3);
+    string value;
+    // applied once, not on top of the snapshot's "Bobby"
+    assert(store.Get("user_1", &value) && value == "Bobby");
+    // still served from the snapshot
+    assert(store.Get("post_2", &value) && value == "hi");
+    assert(store.Get("all_users", &value) && value == "user_1,");
+    vector<string> posts;
+    uint64_t next;
+    bool more;
+    assert(store.ListRange("user_1_posts", 0, 10, &posts, &next, &more));
+    assert(posts.size() == 2 && posts[0] == "post_2" && !more);
+    assert(store.Get("post_4", &value) && value == "there");
+    assert(!store.Contains("user_700") && !store.Contains("post_5"));
+    assert(store.Size() == 5);
+
+    // a cold stripe is copied into memory when it's written to
+    assert(store.ListRemove("user_1_posts", "post_2"));
+    assert(store.Get("user_1_posts", &value) && value == "post_3,");
+    assert(store.Get("user_1", &value) && value == "Bobby");
+
+    // a snapshot taken with stripes still cold copies them from the old one
+    assert(store.Checkpoint(SNAPSHOT_PATH));
+    store.Put("post_6", "new");
+  }
+
+  {
+    WriteAheadLog log(LOG_PATH, SyncMode::PER_WRITE);
+    assert(log.Open());
+    KvStore store;
+    // the log was emptied by the checkpoint, so post_6 only comes back if
+    // its LSN followed the snapshot's
+    assert(store.Recover(&log, SNAPSHOT_PATH) == 1);
+    string value;
+    assert(store.Get("post_6", &value) && value == "new");
+    assert(store.Get("post_2", &value) && value == "hi");
+    // post_3 keeps its place past the removed post_2, cold or not
+    vector<string> posts;
+    uint64_t next;
+    bool more;
+    assert(store.ListRange("user_1_posts", 1, 10, &posts, &next, &more));
+    assert(posts.size() == 1 && posts[0] == "post_3" && next == 2);
+    store.Hydrate();
+    posts.clear();
+    assert(store.ListRange("user_1_posts", 1, 10, &posts, &next, &more));
+    assert(posts.size() == 1 && posts[0] == "post_3" && next == 2);
+    assert(store.Size() == 6);
+    assert(store.Get("user_1_posts", &value) && value == "post_3,");
+
+    // a checkpoint that never finished leaves its rotated segment behind,
+    // and the next recovery replays both segments
+    assert(log.Rotate());
+    store.Put("post_7", "rotated");
+    // the rotated segment isn't dropped before a snapshot holds it
+    assert(!log.Rotate());
+  }
+  assert(exists(LOG_PATH + ".old"));
+  {
+    WriteAheadLog log(LOG_PATH, SyncMode::BATCHED);
+    assert(log.Open());
+    KvStore store;
+    assert(store.Recover(&log, SNAPSHOT_PATH) == 2);
+    string value;
+    assert(store.Get("post_6", &value) && value == "new");
+    assert(store.Get("post_7", &value) && value == "rotated");
+    assert(store.Checkpoint(SNAPSHOT_PATH));
+    assert(!exists(LOG_PATH + ".old"));
+  }
+
+  // a file that isn't a snapshot of this store is never mistaken for one
+  assert(MappedSnapshot::Open(SNAPSHOT_PATH, MIN_KEY, MAX_KEY,
+                              MAX_KEY - MIN_KEY + 1 + KV_STRIPES) != nullptr);
+  assert(MappedSnapshot::Open(SNAPSHOT_PATH, MIN_KEY, MAX_KEY / 2,
+                              MAX_KEY / 2 - MIN_KEY + 1 + KV_STRIPES) ==
+         nullptr);
+  assert(MappedSnapshot::Open(LOG_PATH, MIN_KEY, MAX_KEY,
+                              MAX_KEY - MIN_KEY + 1 + KV_STRIPES) == nullptr);
+
+  unlink(LOG_PATH.c_str());
+  unlink(SNAPSHOT_PATH.c_str());
+  return 0;
+}
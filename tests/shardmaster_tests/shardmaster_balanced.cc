@@ -0,0 +1,65 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  spawn_service_in_thread<StaticShardmaster>(shardmaster_addr,
+                                             Placement::BALANCED);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string skv_3 = hostname + ":8083";
+  string skv_4 = hostname + ":8084";
+  map<string, vector<shard_t>> m;
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  m[skv_1] = {{0, 1000}};
+  assert(test_query(shardmaster_addr, m));
+
+  assert(test_join(shardmaster_addr, skv_2, true));
+  m[skv_1] = {{0, 500}};
+  m[skv_2] = {{501, 1000}};
+  assert(test_query(shardmaster_addr, m));
+
+  // each server keeps the bottom of what it had, and the new one gets the
+  // rest
+  assert(test_join(shardmaster_addr, skv_3, true));
+  m[skv_1] = {{0, 333}};
+  m[skv_2] = {{501, 834}};
+  m[skv_3] = {{334, 500}, {835, 1000}};
+  assert(test_query(shardmaster_addr, m));
+
+  assert(test_join(shardmaster_addr, skv_4, true));
+  m[skv_1] = {{0, 250}};
+  m[skv_2] = {{501, 750}};
+  m[skv_3] = {{334, 500}, {835, 917}};
+  m[skv_4] = {{251, 333}, {751, 834}, {918, 1000}};
+  assert(test_query(shardmaster_addr, m));
+
+  // what skv_2 held is split among the others, and nothing else moves
+  assert(test_leave(shardmaster_addr, {skv_2}, true));
+  m.erase(skv_2);
+  m[skv_1] = {{0, 250}, {501, 583}};
+  m[skv_3] = {{334, 500}, {584, 667}, {835, 917}};
+  m[skv_4] = {{251, 333}, {668, 834}, {918, 1000}};
+  assert(test_query(shardmaster_addr, m));
+
+  assert(test_leave(shardmaster_addr, {skv_1, skv_3}, true));
+  m.clear();
+  m[skv_4] = {{0, 1000}};
+  assert(test_query(shardmaster_addr, m));
+
+  return 0;
+}
@@ -0,0 +1,54 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+
+  // nothing has happened yet, so a caller with config 0 is up to date
+  assert(test_query_if_newer(shardmaster_addr, 0, 0, false));
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_query_if_newer(shardmaster_addr, 0, 1, true));
+  assert(test_query_if_newer(shardmaster_addr, 1, 1, false));
+
+  // failed requests don't change the config, so they don't bump the number
+  assert(test_join(shardmaster_addr, skv_1, false));
+  assert(test_leave(shardmaster_addr, {skv_1, skv_2}, false));
+  assert(test_move(shardmaster_addr, skv_2, {0, 100}, false));
+  assert(test_query_if_newer(shardmaster_addr, 1, 1, false));
+
+  assert(test_join(shardmaster_addr, skv_2, true));
+  assert(test_move(shardmaster_addr, skv_2, {0, 100}, true));
+  assert(test_query_if_newer(shardmaster_addr, 1, 3, true));
+  assert(test_query_if_newer(shardmaster_addr, 3, 3, false));
+
+  assert(test_leave(shardmaster_addr, {skv_1}, true));
+  assert(test_query_if_newer(shardmaster_addr, 3, 4, true));
+
+  // a failed leave must not remove any of the servers it lists
+  map<string, vector<shard_t>> m;
+  m[skv_2].push_back({0, 1000});
+  assert(test_leave(shardmaster_addr, {skv_2, skv_1}, false));
+  assert(test_query(shardmaster_addr, m));
+  assert(test_query_if_newer(shardmaster_addr, 4, 4, false));
+
+  // a caller that is ahead of us (we restarted) gets the whole config
+  assert(test_query_if_newer(shardmaster_addr, 10, 4, true));
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string skv_3 = hostname + ":8083";
+  map<string, vector<shard_t>> m;
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  assert(test_join(shardmaster_addr, skv_3, true));
+
+  // a moved shard merges with the ones next to it on the same server
+  assert(test_move(shardmaster_addr, skv_1, {334, 400}, true));
+  m[skv_1].push_back({0, 400});
+  m[skv_2].push_back({401, 667});
+  m[skv_3].push_back({668, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  assert(test_move(shardmaster_addr, skv_1, {401, 667}, true));
+  m[skv_1].push_back({0, 667});
+  m[skv_3].push_back({668, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // splitting a server's shard and giving the piece back leaves one shard
+  assert(test_move(shardmaster_addr, skv_3, {100, 200}, true));
+  m[skv_1].push_back({0, 99});
+  m[skv_1].push_back({201, 667});
+  m[skv_3].push_back({100, 200});
+  m[skv_3].push_back({668, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  assert(test_move(shardmaster_addr, skv_1, {100, 200}, true));
+  m[skv_1].push_back({0, 667});
+  m[skv_3].push_back({668, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // a shard starting where another does, and one covering several
+  assert(test_move(shardmaster_addr, skv_2, {668, 700}, true));
+  assert(test_move(shardmaster_addr, skv_2, {0, 0}, true));
+  assert(test_move(shardmaster_addr, skv_3, {500, 1000}, true));
+  m[skv_1].push_back({1, 499});
+  m[skv_2].push_back({0, 0});
+  m[skv_3].push_back({500, 1000});
+  assert(test_query(shardmaster_addr, m));
+
+  // shards that are empty or past the key space
+  assert(test_move(shardmaster_addr, skv_2, {20, 10}, false));
+  assert(test_move(shardmaster_addr, skv_2, {900, 1001}, false));
+  assert(test_query(shardmaster_addr, m));
+
+  return 0;
+}
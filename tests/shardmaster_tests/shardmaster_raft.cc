@@ -0,0 +1,130 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../shardmaster/replicated_shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// runs the replicas of a replicated shardmaster, each in its own process,
+// keeping their Raft state in memory
+static vector<pid_t> start_replicas(const Addrs& replicas) {
+  vector<pid_t> pids;
+  for (size_t i = 0; i < replicas.size(); i++) {
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (!pid) {
+      ReplicatedShardmaster shardmaster(replicas, i, "");
+      assert(shardmaster.Start());
+      ::grpc::ServerBuilder builder;
+      builder.AddListeningPort(replicas[i],
+                               ::grpc::InsecureServerCredentials());
+      builder.RegisterService(&shardmaster);
+      builder.RegisterService(shardmaster.Node());
+      builder.BuildAndStart()->Wait();
+      exit(0);
+    }
+    pids.push_back(pid);
+  }
+  return pids;
+}
+
+// waits for one of replicas other than old to lead, and returns it
+static string wait_for_leader(const Addrs& replicas, const string& old) {
+  for (int tries = 0; tries < 100; tries++) {
+    for (const string& replica : replicas) {
+      auto stub = Raft::NewStub(
+          grpc::CreateChannel(replica, grpc::InsecureChannelCredentials()));
+      ::grpc::ClientContext cc;
+      google::protobuf::Empty req;
+      RaftStatus status;
+      if (stub->Status(&cc, req, &status).ok() && status.is_leader() &&
+          replica != old) {
+        return replica;
+      }
+    }
+    this_thread::sleep_for(chrono::milliseconds(50));
+  }
+  assert(false);
+  return "";
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  Addrs replicas = {hostname + ":8090", hostname + ":8091",
+                    hostname + ":8092"};
+  vector<pid_t> pids = start_replicas(replicas);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string skv_3 = hostname + ":8083";
+  map<string, vector<shard_t>> m;
+
+  string leader = wait_for_leader(replicas, "");
+  string follower = replicas[0] == leader ? replicas[1] : replicas[0];
+
+  // a follower passes changes on to the leader, and every replica's Query
+  // sees them at once
+  assert(test_join(follower, skv_1, true));
+  m[skv_1].push_back({0, 1000});
+  for (const string& replica : replicas) {
+    assert(test_query(replica, m));
+  }
+  m.clear();
+
+  assert(test_join(leader, skv_2, true));
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  for (const string& replica : replicas) {
+    assert(test_query(replica, m));
+  }
+  m.clear();
+
+  // so do the state machine's errors
+  assert(test_join(follower, skv_2, false));
+  assert(test_move(follower, skv_1, {501, 600}, true));
+  m[skv_1].push_back({0, 600});
+  m[skv_2].push_back({601, 1000});
+  for (const string& replica : replicas) {
+    assert(test_query(replica, m));
+  }
+  m.clear();
+
+  // the others elect a new leader, which has every change so far
+  size_t dead = find(replicas.begin(), replicas.end(), leader) -
+                replicas.begin();
+  kill(pids[dead], SIGKILL);
+  waitpid(pids[dead], nullptr, 0);
+  pids.erase(pids.begin() + dead);
+  Addrs survivors = replicas;
+  survivors.erase(survivors.begin() + dead);
+  wait_for_leader(survivors, leader);
+
+  m[skv_1].push_back({0, 600});
+  m[skv_2].push_back({601, 1000});
+  for (const string& replica : survivors) {
+    assert(test_query(replica, m));
+  }
+  m.clear();
+
+  assert(test_join(survivors[0], skv_3, true));
+  m[skv_1].push_back({0, 333});
+  m[skv_2].push_back({334, 667});
+  m[skv_3].push_back({668, 1000});
+  for (const string& replica : survivors) {
+    assert(test_query(replica, m));
+  }
+
+  cleanup_children(pids);
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+using Assignment = map<string, vector<shard_t>>;
+
+// the owner of every ID, checking that each has exactly one
+static vector<string> owners(const Assignment& a) {
+  vector<string> owner(MAX_KEY - MIN_KEY + 1);
+  for (const auto& [server, shards] : a) {
+    for (const shard_t& s : shards) {
+      for (unsigned int id = s.lower; id <= s.upper; id++) {
+        assert(owner[id - MIN_KEY] == "");
+        owner[id - MIN_KEY] = server;
+      }
+    }
+  }
+  for (const string& server : owner) {
+    assert(server != "");
+  }
+  return owner;
+}
+
+// test_query leaves out servers without shards
+static Assignment nonEmpty(Assignment a) {
+  for (auto it = a.begin(); it != a.end();) {
+    it = it->second.empty() ? a.erase(it) : next(it);
+  }
+  return a;
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  spawn_service_in_thread<StaticShardmaster>(shardmaster_addr, Placement::RING,
+                                             16u);
+
+  Addrs servers;
+  vector<string> before;
+  for (int i = 1; i <= 4; i++) {
+    string skv = hostname + ":808" + to_string(i);
+    assert(test_join(shardmaster_addr, skv, true));
+    servers.push_back(skv);
+    Assignment expected = hash_ring(servers, 16, MIN_KEY, MAX_KEY);
+    assert(test_query(shardmaster_addr, nonEmpty(expected)));
+    // a joining server only takes IDs, it doesn't shuffle the others
+    vector<string> after = owners(expected);
+    for (size_t id = 0; id < before.size(); id++) {
+      assert(after[id] == before[id] || after[id] == skv);
+    }
+    before = after;
+  }
+
+  // a leaving server's IDs go to the others, and nothing else moves
+  string leaving = servers[1];
+  assert(test_leave(shardmaster_addr, {leaving}, true));
+  servers.erase(servers.begin() + 1);
+  Assignment expected = hash_ring(servers, 16, MIN_KEY, MAX_KEY);
+  assert(test_query(shardmaster_addr, nonEmpty(expected)));
+  vector<string> after = owners(expected);
+  for (size_t id = 0; id < before.size(); id++) {
+    assert(after[id] == before[id] || before[id] == leaving);
+  }
+
+  // the config only depends on who's in the cluster
+  assert(test_join(shardmaster_addr, leaving, true));
+  servers.push_back(leaving);
+  assert(owners(hash_ring(servers, 16, MIN_KEY, MAX_KEY)) == before);
+  assert(test_query(shardmaster_addr,
+                    nonEmpty(hash_ring(servers, 16, MIN_KEY, MAX_KEY))));
+
+  // more virtual nodes, more even shares
+  Addrs many;
+  for (int i = 0; i < 5; i++) {
+    many.push_back("server_" + to_string(i));
+  }
+  for (const auto& [server, shards] : hash_ring(many, 128, MIN_KEY, MAX_KEY)) {
+    size_t load = 0;
+    for (const shard_t& s : shards) {
+      load += size(s);
+    }
+    assert(load > 100 && load < 300);
+  }
+  return 0;
+}
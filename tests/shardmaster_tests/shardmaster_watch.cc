@@ -0,0 +1,64 @@
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  map<string, vector<shard_t>> m;
+
+  // a watcher that is behind gets the current config right away
+  assert(test_join(shardmaster_addr, skv_1, true));
+  m[skv_1].push_back({0, 1000});
+  assert(test_watch(shardmaster_addr, 0, m));
+  m.clear();
+
+  // a watcher that is up to date gets the next change pushed as it happens
+  thread joiner([&]() {
+    this_thread::sleep_for(chrono::milliseconds(200));
+    assert(test_join(shardmaster_addr, skv_2, true));
+  });
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  assert(test_watch(shardmaster_addr, 1, m));
+  joiner.join();
+  m.clear();
+
+  // so are moves...
+  thread mover([&]() {
+    this_thread::sleep_for(chrono::milliseconds(200));
+    assert(test_move(shardmaster_addr, skv_2, {0, 100}, true));
+  });
+  m[skv_1].push_back({101, 500});
+  m[skv_2].push_back({501, 1000});
+  m[skv_2].push_back({0, 100});
+  assert(test_watch(shardmaster_addr, 2, m));
+  mover.join();
+  m.clear();
+
+  // ...and leaves
+  thread leaver([&]() {
+    this_thread::sleep_for(chrono::milliseconds(200));
+    assert(test_leave(shardmaster_addr, {skv_1}, true));
+  });
+  m[skv_2].push_back({0, 1000});
+  assert(test_watch(shardmaster_addr, 3, m));
+  leaver.join();
+
+  return 0;
+}